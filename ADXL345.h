@@ -0,0 +1,67 @@
+/* ADXL345 register map, shared by the kernel driver and the userspace tools */
+#ifndef ADXL345_H
+#define ADXL345_H
+
+#define ADXL345_I2C_ADDR			0x53
+#define ADXL345_I2C_ADDR_ALT		0x1D	// ALT ADDRESS pin high
+#define ADXL345_ID					0xE5
+
+/* Registers */
+#define ADXL345_DEVID				0x00
+#define ADXL345_THRESH_TAP			0x1D
+#define ADXL345_REG_OFSX			0x1E
+#define ADXL345_REG_OFSY			0x1F
+#define ADXL345_REG_OFSZ			0x20
+#define ADXL345_TAP_DUR				0x21
+#define ADXL345_TAP_LAT				0x22
+#define ADXL345_DOUBLE_WIND			0x23
+#define ADXL345_THRESH_ACT			0x24
+#define ADXL345_THRESH_INACT		0x25
+#define ADXL345_TIME_INACT			0x26
+#define ADXL345_ACT_INACT_CTL		0x27
+#define ADXL345_THRESH_FF			0x28
+#define ADXL345_TIME_FF				0x29
+#define ADXL345_TAP_EN				0x2A
+#define ADXL345_ACT_TAP_STATUS		0x2B
+#define ADXL345_BW_RATE				0x2C
+#define ADXL345_POWER_CTL			0x2D
+#define ADXL345_INT_ENABLE			0x2E
+#define ADXL345_INT_MAP				0x2F
+#define ADXL345_INT_SOURCE			0x30
+#define ADXL345_DATA_FORMAT			0x31
+#define ADXL345_DATAX0				0x32
+#define ADXL345_FIFO_CTL			0x38
+#define ADXL345_FIFO_STATUS			0x39
+#define ADXL345_NUM_REGS			0x40
+
+/* INT_ENABLE / INT_SOURCE bits */
+#define ADXL345_DATAREADY			0x80
+#define ADXL345_SINGLE				0x40
+#define ADXL345_DOUBLE				0x20
+#define ADXL345_ACTIVITY			0x10
+#define ADXL345_INACTIVITY			0x08
+#define ADXL345_FREEFALL			0x04
+#define ADXL345_WATERMARK			0x02
+#define ADXL345_OVERRUN				0x01
+
+/* POWER_CTL, DATA_FORMAT */
+#define ADXL345_MEASURE				0x08
+#define ADXL345_FULL_RES			0x08
+#define ADXL345_RANGE				0x03
+
+/* FIFO_CTL, FIFO_STATUS */
+#define ADXL345_FIFO_BYPASS			0x00
+#define ADXL345_FIFO_STREAM			0x80
+#define ADXL345_FIFO_ENTRIES		0x3F
+#define ADXL345_FIFO_DEPTH			32
+
+/* 4-wire SPI, mode 3 up to 5 MHz: a command byte of R/W, MB (address auto
+ * increment) and the register address, then the data. A read of DATAZ1 pops
+ * a FIFO entry when chip select rises; above 1.6 MHz the next data read
+ * must not start within 5 us of that, the command byte included. */
+#define ADXL345_SPI_READ			0x80
+#define ADXL345_SPI_MB				0x40
+#define ADXL345_DATAZ1				0x37
+#define ADXL345_FIFO_POP_NS			5000
+
+#endif
@@ -0,0 +1,793 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include "../address_map_arm.h"
+#include "ADXL345_access.h"
+
+/* ADXL345 logic shared by the userspace tools, and the /dev/mem and
+ * /dev/accel backends. The simulated register file is in ADXL345_sim.c. */
+
+static volatile unsigned int * i2c0_base_ptr, * sysmgr_base_ptr;
+static void * i2c0base_virtual, * sysmgrbase_virtual;
+static int fd_i2c0base = -1, fd_sysmgr = -1;
+
+/* I2C0 register access: the mapped controller, or the timing model of
+ * ADXL345_i2csim.c while i2csim_bus is open */
+static int i2c0_model = 0;
+#define I2C0_RD(offset)			(i2c0_model ? i2csim_read(offset) : *(i2c0_base_ptr + (offset)))
+#define I2C0_WR(offset, value)	(i2c0_model ? i2csim_write(offset, value) : (void) (*(i2c0_base_ptr + (offset)) = (value)))
+
+/* SPIM0 register access by byte offset, likewise with ADXL345_spisim.c while
+ * spisim_bus is open. 8 bit frames in SPI mode 3 at 200 MHz / 40 = 5 MHz. */
+static volatile unsigned int * spim0_base_ptr;
+static void * spim0base_virtual;
+static int fd_spim0 = -1;
+static int spim0_model = 0;
+static uint64_t spim0_ready;		// FIFO pop time of the last data read
+#define SPIM0_RD(offset)		(spim0_model ? spisim_read(offset) : *(spim0_base_ptr + (offset) / 4))
+#define SPIM0_WR(offset, value)	(spim0_model ? spisim_write(offset, value) : (void) (*(spim0_base_ptr + (offset) / 4) = (value)))
+#define SPIM0_NOW()				(spim0_model ? spisim_now() : accel_now_ns())
+#define SPIM0_CTRLR0_MODE3		(0x7 | (1 << 6) | (1 << 7))
+#define SPIM0_SCKDV				40
+#define SPIM0_BYTE_NS			(8 * SPIM0_SCKDV * 5)
+#define SPIM0_TIMEOUT_NS		1000000
+
+/* Interrupt driven I2C0 transfers, the engine of ADXL345_driver.c on the
+ * timing model, see I2C0_Transfer_Irq() */
+#define I2C_XFER_RD(base, offset)			I2C0_RD(offset)
+#define I2C_XFER_WR(base, offset, value)	I2C0_WR(offset, value)
+#include "ADXL345_i2cxfer.h"
+#define I2C0_MAX_CMDS			(ADXL345_FIFO_DEPTH * (ADXL345_RECORD_SIZE + 1))
+#define I2C0_TIMEOUT_NS			100000000
+#define I2CIRQ_STEP_NS			250		// resolution of the wait for the interrupt line
+#define I2CIRQ_LATENCY_NS		5000
+#define I2CIRQ_CPU_NS			2000
+
+static struct {
+	uint16_t cmds[I2C0_MAX_CMDS];
+	struct i2c_xfer x;
+	int done;
+	uint32_t latency_ns, cpu_ns;
+	uint64_t irqs;
+} i2c0_xfer = { .latency_ns = I2CIRQ_LATENCY_NS, .cpu_ns = I2CIRQ_CPU_NS };
+
+static int open_physical(int);
+static void * map_physical (int, unsigned int, unsigned int);
+static void close_physical(int);
+static int unmap_physical(void *, unsigned int);
+static void mux_init();
+static int I2C0_Init();
+static int I2C0_onoff(unsigned int onoff);
+static int devmem_open(struct adxl345_bus * bus);
+static void devmem_close(struct adxl345_bus * bus);
+static int i2csim_open(struct adxl345_bus * bus);
+static void i2csim_close(struct adxl345_bus * bus);
+static int i2cirq_open(struct adxl345_bus * bus);
+static int I2C0_Transfer_Irq(int ncmds, uint8_t rx[], int nrx);
+static void I2C0_irq_handler(void);
+static void i2cirq_REG_READ(struct adxl345_bus * bus, uint8_t address, uint8_t * value);
+static void i2cirq_REG_WRITE(struct adxl345_bus * bus, uint8_t address, uint8_t value);
+static void i2cirq_REG_MULTI_READ(struct adxl345_bus * bus, uint8_t address, uint8_t values[], uint8_t len);
+static void i2cirq_BURST_READ(struct adxl345_bus * bus, uint8_t address, uint8_t values[], uint8_t len, uint8_t count);
+static int spimem_open(struct adxl345_bus * bus);
+static void spimem_close(struct adxl345_bus * bus);
+static int spisim_open(struct adxl345_bus * bus);
+static void spisim_close(struct adxl345_bus * bus);
+static void SPIM0_Init();
+static void SPIM0_Frame(uint8_t tx[], uint8_t rx[], int len);
+static void spim0_REG_READ(struct adxl345_bus * bus, uint8_t address, uint8_t * value);
+static void spim0_REG_WRITE(struct adxl345_bus * bus, uint8_t address, uint8_t value);
+static void spim0_REG_MULTI_READ(struct adxl345_bus * bus, uint8_t address, uint8_t values[], uint8_t len);
+static void devmem_REG_READ(struct adxl345_bus * bus, uint8_t address, uint8_t * value);
+static void devmem_REG_WRITE(struct adxl345_bus * bus, uint8_t address, uint8_t value);
+static void devmem_REG_MULTI_READ(struct adxl345_bus * bus, uint8_t address, uint8_t values[], uint8_t len);
+static int reg_source_open(struct accel_source * src);
+static void reg_source_close(struct accel_source * src);
+static int reg_source_set_rate(struct accel_source * src, unsigned int rate);
+static int reg_source_read(struct accel_source * src, struct accel_sample samples[], int max, uint64_t deadline);
+static int dev_open(struct accel_source * src);
+static void dev_close(struct accel_source * src);
+static int dev_set_rate(struct accel_source * src, unsigned int rate);
+static int dev_read(struct accel_source * src, struct accel_sample samples[], int max, uint64_t deadline);
+static void bus_multi_write(struct adxl345_bus * bus, uint8_t address, uint8_t values[], uint8_t len);
+
+/* Initialization sequence, detection registers, snapshot, scale and period,
+ * shared with the driver */
+#define ADXL345_CORE_DEV								struct adxl345_bus *
+#define ADXL345_CORE_WRITE(bus, address, value)			(bus)->reg_write(bus, address, value)
+#define ADXL345_CORE_MULTI_WRITE(bus, address, values, len)	bus_multi_write(bus, address, values, len)
+#define ADXL345_CORE_MULTI_READ(bus, address, values, len)	(bus)->multi_read(bus, address, values, len)
+#include "ADXL345_core.h"
+
+struct adxl345_bus devmem_bus = {
+	.name = "devmem",
+	.open = devmem_open,
+	.close = devmem_close,
+	.reg_read = devmem_REG_READ,
+	.reg_write = devmem_REG_WRITE,
+	.multi_read = devmem_REG_MULTI_READ
+};
+
+/* The same I2C0 code against the timing model */
+struct adxl345_bus i2csim_bus = {
+	.name = "i2csim",
+	.open = i2csim_open,
+	.close = i2csim_close,
+	.reg_read = devmem_REG_READ,
+	.reg_write = devmem_REG_WRITE,
+	.multi_read = devmem_REG_MULTI_READ
+};
+
+/* The driver's interrupt driven transfers against the timing model, a
+ * whole FIFO drain in one transfer */
+struct adxl345_bus i2cirq_bus = {
+	.name = "i2cirq",
+	.open = i2cirq_open,
+	.close = i2csim_close,
+	.reg_read = i2cirq_REG_READ,
+	.reg_write = i2cirq_REG_WRITE,
+	.multi_read = i2cirq_REG_MULTI_READ,
+	.burst_read = i2cirq_BURST_READ
+};
+
+/* SPIM0 chip select 0 through /dev/mem, and the same code against the
+ * timing model */
+struct adxl345_bus spimem_bus = {
+	.name = "spimem",
+	.open = spimem_open,
+	.close = spimem_close,
+	.reg_read = spim0_REG_READ,
+	.reg_write = spim0_REG_WRITE,
+	.multi_read = spim0_REG_MULTI_READ
+};
+
+struct adxl345_bus spisim_bus = {
+	.name = "spisim",
+	.open = spisim_open,
+	.close = spisim_close,
+	.reg_read = spim0_REG_READ,
+	.reg_write = spim0_REG_WRITE,
+	.multi_read = spim0_REG_MULTI_READ
+};
+
+/* Register sources keep the sequence number and DATA_FORMAT they stamp with */
+struct reg_source_state {
+	uint32_t seq;
+	uint8_t data_format;
+	struct accel_ts ts;			// sample timeline, as the driver keeps it
+};
+
+static struct reg_source_state devmem_state, spimem_state, sim_state;
+static int dev_fd = -1;
+
+static struct accel_source devmem_source = {
+	.name = "devmem",
+	.open = reg_source_open,
+	.close = reg_source_close,
+	.set_rate = reg_source_set_rate,
+	.read = reg_source_read,
+	.bus = &devmem_bus,
+	.priv = &devmem_state
+};
+
+static struct accel_source spimem_source = {
+	.name = "spimem",
+	.open = reg_source_open,
+	.close = reg_source_close,
+	.set_rate = reg_source_set_rate,
+	.read = reg_source_read,
+	.bus = &spimem_bus,
+	.priv = &spimem_state
+};
+
+static struct accel_source sim_source = {
+	.name = "sim",
+	.open = reg_source_open,
+	.close = reg_source_close,
+	.set_rate = reg_source_set_rate,
+	.read = reg_source_read,
+	.bus = &sim_bus,
+	.priv = &sim_state
+};
+
+static struct accel_source dev_source = {
+	.name = "dev",
+	.open = dev_open,
+	.close = dev_close,
+	.set_rate = dev_set_rate,
+	.read = dev_read,
+	.priv = &dev_fd
+};
+
+struct accel_source * accel_sources[] = { &devmem_source, &spimem_source, &dev_source, &sim_source, NULL };
+
+struct accel_source * accel_source_find(const char * name) {
+	int i;
+
+	for (i = 0; accel_sources[i]; i++) {
+		if (!strcmp(accel_sources[i]->name, name))
+			return accel_sources[i];
+	}
+	return NULL;
+}
+
+uint64_t accel_now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Shared ADXL345 logic */
+
+/* +-16 range, 10 bits, 12.5 Hz, the driver's detection defaults, activity
+ * and inactivity on INT1, FIFO bypassed */
+void ADXL345_Init(struct adxl345_bus * bus) {
+	adxl345_init(bus, ADXL345_INIT_FORMAT, ADXL345_INIT_RATE, &adxl345_event_defaults,
+		ADXL345_ACTIVITY | ADXL345_INACTIVITY, ADXL345_FIFO_BYPASS);
+}
+
+void ADXL345_IdRead(struct adxl345_bus * bus, uint8_t * pId) {
+	bus->reg_read(bus, ADXL345_DEVID, pId);
+}
+
+/* BW_RATE code 0 (0.098 Hz) to 15 (3200 Hz) */
+void ADXL345_SetRate(struct adxl345_bus * bus, uint8_t rate) {
+	bus->reg_write(bus, ADXL345_BW_RATE, rate & 0x0F);
+}
+
+/* INT_SOURCE through DATAZ1 in one burst. Returns 1 when DATA_READY was
+ * set. */
+int ADXL345_Snapshot(struct adxl345_bus * bus, uint8_t * source, int16_t szData16[3]) {
+	return adxl345_snapshot(bus, source, szData16);
+}
+
+/* Output data period of a BW_RATE code in ns */
+uint64_t ADXL345_Period(uint8_t bw_rate) {
+	return adxl345_period_ns(bw_rate);
+}
+
+/* ug per LSB of a DATA_FORMAT */
+uint32_t ADXL345_Scale(uint8_t data_format) {
+	return adxl345_scale_ug(data_format);
+}
+
+/* Read up to max entries queued in the ADXL345 FIFO, one 6 byte read at
+ * DATAX0 per entry, into back to back raw records for ADXL345_Unpack(); in
+ * one transfer when the backend has burst_read. Returns the entry count. */
+int ADXL345_FIFO_Drain(struct adxl345_bus * bus, uint8_t records[][ADXL345_RECORD_SIZE], int max) {
+	uint8_t status;
+	int entries, i;
+
+	bus->reg_read(bus, ADXL345_FIFO_STATUS, &status);
+	entries = status & ADXL345_FIFO_ENTRIES;
+	if (entries > max)
+		entries = max;
+
+	if (bus->burst_read) {
+		if (entries)
+			bus->burst_read(bus, ADXL345_DATAX0, records[0], ADXL345_RECORD_SIZE, entries);
+		return entries;
+	}
+	for (i = 0; i < entries; i++)
+		bus->multi_read(bus, ADXL345_DATAX0, records[i], ADXL345_RECORD_SIZE);
+	return entries;
+}
+
+/* The register backends write one byte at a time */
+static void bus_multi_write(struct adxl345_bus * bus, uint8_t address, uint8_t values[], uint8_t len) {
+	int i;
+
+	for (i = 0; i < len; i++)
+		bus->reg_write(bus, address + i, values[i]);
+}
+
+/* Register sources, polling DATA_READY as the userspace driver does */
+
+static int reg_source_open(struct accel_source * src) {
+	struct reg_source_state * state = src->priv;
+	uint8_t devid = 0;
+
+	if (src->bus->open(src->bus) < 0)
+		return -1;
+	ADXL345_IdRead(src->bus, &devid);
+	if (devid != ADXL345_ID) {
+		printf("ERROR: %s: no ADXL345, devid %#x\n", src->name, devid);
+		src->bus->close(src->bus);
+		return -1;
+	}
+	ADXL345_Init(src->bus);
+	state->seq = 0;
+	state->data_format = 0x03;
+	memset(&state->ts, 0, sizeof(state->ts));
+	accel_ts_restart(&state->ts, ADXL345_Period(0x07));
+	return 0;
+}
+
+static void reg_source_close(struct accel_source * src) {
+	src->bus->close(src->bus);
+}
+
+static int reg_source_set_rate(struct accel_source * src, unsigned int rate) {
+	struct reg_source_state * state = src->priv;
+
+	if (rate > 15)
+		return -1;
+	ADXL345_SetRate(src->bus, rate);
+	accel_ts_restart(&state->ts, ADXL345_Period(rate));
+	return 0;
+}
+
+static int reg_source_read(struct accel_source * src, struct accel_sample samples[], int max, uint64_t deadline) {
+	struct reg_source_state * state = src->priv;
+	uint8_t source;
+	int16_t XYZ[3];
+
+	if (max < 1)
+		return 0;
+	do {
+		if (ADXL345_Snapshot(src->bus, &source, XYZ)) {
+			//The sample existed by the end of the snapshot
+			accel_ts_batch(&state->ts, 1, 0, accel_now_ns(), source & ADXL345_OVERRUN);
+			samples[0].timestamp = accel_ts_stamp(&state->ts, 0);
+			samples[0].seq = state->seq++;
+			samples[0].x = XYZ[0];
+			samples[0].y = XYZ[1];
+			samples[0].z = XYZ[2];
+			samples[0].flags = ACCEL_FLAG_NEW;
+			if (state->data_format & ADXL345_FULL_RES)
+				samples[0].flags |= ACCEL_FLAG_FULL_RES;
+			samples[0].scale = ADXL345_Scale(state->data_format);
+			return 1;
+		}
+	} while (accel_now_ns() < deadline);
+	return 0;
+}
+
+/* /dev/accel0 source: binary mode records, configured through ioctl() */
+
+static int dev_open(struct accel_source * src) {
+	int * fd = src->priv;
+	__u32 binary = 1;
+
+	if ((*fd = open("/dev/accel0", O_RDWR)) == -1) {
+		printf("ERROR: could not open \"/dev/accel0\"...\n");
+		return -1;
+	}
+	if (ioctl(*fd, ACCEL_IOC_SET_BINARY, &binary) < 0) {
+		printf("ERROR: ACCEL_IOC_SET_BINARY failed...\n");
+		close(*fd);
+		*fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+static void dev_close(struct accel_source * src) {
+	int * fd = src->priv;
+
+	close(*fd);
+	*fd = -1;
+}
+
+static int dev_set_rate(struct accel_source * src, unsigned int rate) {
+	int * fd = src->priv;
+	__u32 value = rate;
+
+	return ioctl(*fd, ACCEL_IOC_SET_RATE, &value) < 0 ? -1 : 0;
+}
+
+static int dev_read(struct accel_source * src, struct accel_sample samples[], int max, uint64_t deadline) {
+	int * fd = src->priv;
+	struct pollfd pfd = { .fd = *fd, .events = POLLIN };
+	uint64_t now = accel_now_ns();
+	ssize_t n;
+
+	//A deadline already passed only takes what is queued
+	n = poll(&pfd, 1, now >= deadline ? 0 : (deadline - now + 999999) / 1000000);
+	if (n <= 0)
+		return n;
+	n = read(*fd, samples, max * sizeof(struct accel_sample));
+	if (n < 0)
+		return -1;
+	return n / sizeof(struct accel_sample);
+}
+
+/* I2C0 through /dev/mem */
+
+static int devmem_open(struct adxl345_bus * bus) {
+	//Configure MUX to connect I2C0 controller to ADXL345
+	if ((fd_sysmgr = open_physical(fd_sysmgr)) == -1) {
+		return(-1);
+	}
+
+	if ((sysmgrbase_virtual = map_physical(fd_sysmgr, SYSMGR_BASE, SYSMGR_SPAN)) == NULL) {
+		return(-1);
+	}
+
+	sysmgr_base_ptr = (unsigned int *) sysmgrbase_virtual;
+	mux_init();
+
+	if ((fd_i2c0base = open_physical(fd_i2c0base)) == -1) {
+		return(-1);
+	}
+
+	if ((i2c0base_virtual = map_physical(fd_i2c0base, I2C0_BASE, I2C0_SPAN)) == NULL) {
+		return(-1);
+	}
+
+	i2c0_base_ptr = (unsigned int *) i2c0base_virtual;
+	if (!I2C0_Init())
+		return(-1);
+	return 0;
+}
+
+static void devmem_close(struct adxl345_bus * bus) {
+	unmap_physical(i2c0base_virtual, I2C0_SPAN);
+	close_physical(fd_i2c0base);
+	unmap_physical(sysmgrbase_virtual, SYSMGR_SPAN);
+	close_physical(fd_sysmgr);
+	fd_i2c0base = fd_sysmgr = -1;
+}
+
+static int i2csim_open(struct adxl345_bus * bus) {
+	i2csim_reset();
+	i2c0_model = 1;
+	if (!I2C0_Init()) {
+		i2c0_model = 0;
+		return(-1);
+	}
+	return 0;
+}
+
+static void i2csim_close(struct adxl345_bus * bus) {
+	i2c0_model = 0;
+}
+
+/* FIFO thresholds as I2C_irq_init() of the driver sets them */
+static int i2cirq_open(struct adxl345_bus * bus) {
+	if (i2csim_open(bus) < 0)
+		return(-1);
+	i2c_xfer_init(NULL);
+	i2c0_xfer.irqs = 0;
+	return 0;
+}
+
+void i2cirq_set_irq(uint32_t latency_ns, uint32_t cpu_ns) {
+	i2c0_xfer.latency_ns = latency_ns;
+	i2c0_xfer.cpu_ns = cpu_ns;
+}
+
+/* Handler runs since the bus was opened */
+uint64_t i2cirq_irqs(void) {
+	return i2c0_xfer.irqs;
+}
+
+/* SPIM0 through /dev/mem. The sensor is external, SPIM0 pins are left as the
+ * boot loader muxed them. */
+static int spimem_open(struct adxl345_bus * bus) {
+	if ((fd_spim0 = open_physical(fd_spim0)) == -1) {
+		return(-1);
+	}
+
+	if ((spim0base_virtual = map_physical(fd_spim0, SPIM0_BASE, SPIM0_SPAN)) == NULL) {
+		return(-1);
+	}
+
+	spim0_base_ptr = (unsigned int *) spim0base_virtual;
+	SPIM0_Init();
+	return 0;
+}
+
+static void spimem_close(struct adxl345_bus * bus) {
+	unmap_physical(spim0base_virtual, SPIM0_SPAN);
+	close_physical(fd_spim0);
+	fd_spim0 = -1;
+}
+
+static int spisim_open(struct adxl345_bus * bus) {
+	spisim_reset();
+	spim0_model = 1;
+	SPIM0_Init();
+	return 0;
+}
+
+static void spisim_close(struct adxl345_bus * bus) {
+	spim0_model = 0;
+}
+
+static int open_physical(int fd) {
+	if (fd == -1) {
+		if ((fd = open("/dev/mem", (O_RDWR | O_SYNC))) == -1) {
+			printf("ERROR: could not open \"/dev/mem\"...\n");
+			return(-1);
+		}
+	}
+
+	return fd;
+}
+
+static void * map_physical(int fd, unsigned int base, unsigned int span) {
+	void * virtual_base;
+
+	// Get a mapping from physical addresses to virtual addresses
+	virtual_base = mmap(NULL, span, (PROT_READ | PROT_WRITE), MAP_SHARED, fd, base);
+	if (virtual_base == MAP_FAILED) {
+		printf("ERROR: mmap() failed...\n");
+		close(fd);
+		return(NULL);
+	}
+
+	return virtual_base;
+}
+
+static int unmap_physical(void * virtual_base, unsigned int span)
+{
+   if (munmap (virtual_base, span) != 0)
+   {
+      printf ("ERROR: munmap() failed...\n");
+      return (-1);
+   }
+   return 0;
+}
+
+static void close_physical (int fd) {
+	close(fd);
+}
+
+/* Set mux to connect ADXL345 to I2C0 Controller */
+static void mux_init() {
+
+	volatile unsigned int *gpio7_ptr, *gpio8_ptr, *i2c0fpga_ptr; //Mux pointer
+
+	gpio7_ptr = sysmgr_base_ptr + SYSMGR_GENERALIO7;
+	gpio8_ptr = sysmgr_base_ptr + SYSMGR_GENERALIO8;
+	i2c0fpga_ptr =  sysmgr_base_ptr + SYSMGR_I2C0USEFPGA;
+
+	*i2c0fpga_ptr = 0;
+	*gpio7_ptr = 1;
+	*gpio8_ptr = 1;
+}
+
+/* Enabling I2C0 with polling */
+static int I2C0_onoff(unsigned int onoff) {
+	int ti2c_poll = 2500;
+	int MAX_T_POLL_COUNT = 100;
+	int poll_count = 0;
+
+	int good = 0;
+	I2C0_WR(I2C0_ENABLE, onoff);
+
+	while (((I2C0_RD(I2C0_ENABLE_STATUS) & 0x1) == (onoff - 1)) & (poll_count < MAX_T_POLL_COUNT)) {
+		poll_count++;
+		usleep(ti2c_poll);
+		I2C0_WR(I2C0_ENABLE, onoff);
+	}
+	if (poll_count < 10)
+		good = 1;
+
+	return good;
+}
+
+static int I2C0_Init() {
+
+	//Abort tranmission and disable Controller for config
+	I2C0_WR(I2C0_ENABLE, 0x2);
+	//Wait for disable status
+
+	if (!(I2C0_onoff(2))) {
+		printf("Unable to disable\n");
+		return 0;
+	}
+
+	// 7-Bit addressing, FastMode (400kb/s), Master Mode
+	I2C0_WR(I2C0_CON, 0x65);
+
+	//Set target address to be ADXL345 devid 0x53 and 7bit addressing
+	I2C0_WR(I2C0_TAR, ADXL345_I2C_ADDR);
+
+	//Minimum period is to be 2.5us but minimum high period is 0.6us
+	//and minimum low period is 1.3us so 0.3us is added to both.
+	I2C0_WR(I2C0_FS_SCL_HCNT, 60 + 30);
+	I2C0_WR(I2C0_FS_SCL_LCNT, 130 + 30);
+
+	//Enable the controller
+	if (!(I2C0_onoff(1))) {
+		printf("Unable to enable\n");
+		return 0;
+	}
+	return 1;
+}
+
+/* Single Byte Read */
+static void devmem_REG_READ(struct adxl345_bus * bus, uint8_t address, uint8_t * value) {
+
+	//Send address and start signal
+	I2C0_WR(I2C0_DATA_CMD, address + 0x400);
+
+	//send read signal
+	I2C0_WR(I2C0_DATA_CMD, 0x100);
+
+	//wait for response
+
+	while(I2C0_RD(I2C0_RXFLR) == 0) {
+		continue;
+	}
+	*value = I2C0_RD(I2C0_DATA_CMD) & 0xFF;
+}
+
+/* Single byte Write */
+static void devmem_REG_WRITE(struct adxl345_bus * bus, uint8_t address, uint8_t value) {
+
+	I2C0_WR(I2C0_DATA_CMD, address + 0x400);
+	I2C0_WR(I2C0_DATA_CMD, value);
+}
+
+/* Multiple Byte Read */
+static void devmem_REG_MULTI_READ(struct adxl345_bus * bus, uint8_t address, uint8_t values[], uint8_t len) {
+
+	int i = 0;
+	int nth_byte = 0;
+	I2C0_WR(I2C0_DATA_CMD, address + 0x400);
+
+	//send read signal multiple times to prevent overwritten data at
+	//inconsistent times
+
+	for(i = 0; i < len; i++)
+		I2C0_WR(I2C0_DATA_CMD, 0x100);
+
+	while(len) {
+		if (I2C0_RD(I2C0_RXFLR) > 0) {
+			values[nth_byte] = I2C0_RD(I2C0_DATA_CMD) & 0xFF;
+			nth_byte++;
+			len--;
+		}
+	}
+}
+
+/* Single byte read, through the interrupt driven engine */
+static void i2cirq_REG_READ(struct adxl345_bus * bus, uint8_t address, uint8_t * value) {
+	i2cirq_BURST_READ(bus, address, value, 1, 1);
+}
+
+static void i2cirq_REG_WRITE(struct adxl345_bus * bus, uint8_t address, uint8_t value) {
+	i2c0_xfer.cmds[0] = address + 0x400;
+	i2c0_xfer.cmds[1] = value;
+	I2C0_Transfer_Irq(2, NULL, 0);
+}
+
+static void i2cirq_REG_MULTI_READ(struct adxl345_bus * bus, uint8_t address, uint8_t values[], uint8_t len) {
+	i2cirq_BURST_READ(bus, address, values, len, 1);
+}
+
+/* count records of an address write and len reads, as I2C_Read() of the
+ * driver builds them */
+static void i2cirq_BURST_READ(struct adxl345_bus * bus, uint8_t address, uint8_t values[], uint8_t len, uint8_t count) {
+	int i, k, n = 0;
+
+	if (count * (len + 1) > I2C0_MAX_CMDS) {
+		memset(values, 0, count * len);
+		return;
+	}
+	for (k = 0; k < count; k++) {
+		i2c0_xfer.cmds[n++] = address + 0x400;
+		for (i = 0; i < len; i++)
+			i2c0_xfer.cmds[n++] = 0x100;
+	}
+	I2C0_Transfer_Irq(n, values, len * count);
+}
+
+/* I2C_Transfer_Irq() of the driver. The calling thread sleeps while the
+ * handler refills the TX FIFO and drains the RX FIFO, and wakes up once
+ * STOP_DET ends the transfer. Returns 0, or a negative errno on an abort or
+ * timeout with the missing bytes zeroed. */
+static int I2C0_Transfer_Irq(int ncmds, uint8_t rx[], int nrx) {
+	uint64_t timeout = i2csim_now() + I2C0_TIMEOUT_NS;
+
+	i2c0_xfer.done = 0;
+	i2c_xfer_start(&i2c0_xfer.x, NULL, i2c0_xfer.cmds, ncmds, rx, nrx);
+
+	while (!i2c0_xfer.done) {
+		if (i2csim_now() > timeout) {
+			i2c_xfer_abort(&i2c0_xfer.x, NULL);
+			break;
+		}
+		if (!i2csim_irq()) {
+			i2csim_idle_until(i2csim_now() + I2CIRQ_STEP_NS);
+			continue;
+		}
+		i2csim_idle_until(i2csim_now() + i2c0_xfer.latency_ns);
+		i2csim_cpu(i2c0_xfer.cpu_ns);
+		I2C0_irq_handler();
+	}
+
+	//The caller is woken up
+	i2csim_idle_until(i2csim_now() + i2c0_xfer.latency_ns);
+	i2csim_cpu(i2c0_xfer.cpu_ns);
+	if (i2c0_xfer.x.err)
+		memset(rx + i2c0_xfer.x.rx_pos, 0, nrx - i2c0_xfer.x.rx_pos);
+	return i2c0_xfer.x.err;
+}
+
+/* I2C_irq_handler() of the driver */
+static void I2C0_irq_handler(void) {
+	uint32_t stat = I2C0_RD(I2C0_INTR_STAT);
+
+	if (!stat)
+		return;
+	i2c0_xfer.irqs++;
+	if (i2c_xfer_irq(&i2c0_xfer.x, NULL, stat))
+		i2c0_xfer.done = 1;
+}
+
+/* Disabled while configured, no slave selected between frames */
+static void SPIM0_Init() {
+	SPIM0_WR(SPIM0_SSIENR, 0);
+	SPIM0_WR(SPIM0_CTRLR0, SPIM0_CTRLR0_MODE3);
+	SPIM0_WR(SPIM0_BAUDR, SPIM0_SCKDV);
+	SPIM0_WR(SPIM0_SER, 0);
+	SPIM0_WR(SPIM0_IMR, 0);
+	SPIM0_WR(SPIM0_SSIENR, 1);
+	spim0_ready = 0;
+}
+
+/* One frame on chip select 0, len bytes out and as many back. Chip select
+ * rises whenever the TX FIFO runs empty, so the frame is queued before SER
+ * selects the slave. A frame that read DATAZ1 pops a FIFO entry, the next
+ * one waits out the pop time; its command byte counts towards it. */
+static void SPIM0_Frame(uint8_t tx[], uint8_t rx[], int len) {
+	int i, n = 0;
+	uint64_t start;
+
+	while (SPIM0_NOW() < spim0_ready)
+		SPIM0_RD(SPIM0_SR);
+
+	for (i = 0; i < len; i++)
+		SPIM0_WR(SPIM0_DR, tx[i]);
+	SPIM0_WR(SPIM0_SER, 0x1);
+
+	start = SPIM0_NOW();
+	while (n < len) {
+		if (SPIM0_RD(SPIM0_RXFLR) > 0)
+			rx[n++] = SPIM0_RD(SPIM0_DR) & 0xFF;
+		else if (SPIM0_NOW() - start > SPIM0_TIMEOUT_NS) {
+			//No clock, flush both FIFOs
+			SPIM0_WR(SPIM0_SSIENR, 0);
+			SPIM0_WR(SPIM0_SSIENR, 1);
+			memset(rx + n, 0, len - n);
+			break;
+		}
+	}
+	SPIM0_WR(SPIM0_SER, 0);
+
+	if (tx[0] & ADXL345_SPI_READ) {
+		i = tx[0] & 0x3F;
+		if (i <= ADXL345_DATAZ1 && i + len - 1 > ADXL345_DATAZ1)
+			spim0_ready = SPIM0_NOW() + ADXL345_FIFO_POP_NS - SPIM0_BYTE_NS;
+	}
+}
+
+static void spim0_REG_READ(struct adxl345_bus * bus, uint8_t address, uint8_t * value) {
+	spim0_REG_MULTI_READ(bus, address, value, 1);
+}
+
+static void spim0_REG_WRITE(struct adxl345_bus * bus, uint8_t address, uint8_t value) {
+	uint8_t tx[2] = { address, value }, rx[2];
+
+	SPIM0_Frame(tx, rx, 2);
+}
+
+/* Command byte with MB set, then one dummy byte per register */
+static void spim0_REG_MULTI_READ(struct adxl345_bus * bus, uint8_t address, uint8_t values[], uint8_t len) {
+	uint8_t tx[256], rx[256];
+
+	tx[0] = ADXL345_SPI_READ | (len > 1 ? ADXL345_SPI_MB : 0) | address;
+	memset(tx + 1, 0, len);
+	SPIM0_Frame(tx, rx, len + 1);
+	memcpy(values, rx + 1, len);
+}
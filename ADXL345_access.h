@@ -0,0 +1,128 @@
+/* Userspace access to the ADXL345 through interchangeable backends.
+ * A register backend (struct adxl345_bus) runs the shared ADXL345 logic of
+ * ADXL345_access.c; a sample source (struct accel_source) hands out stamped
+ * struct accel_sample records whichever way they are obtained. */
+#ifndef ADXL345_ACCESS_H
+#define ADXL345_ACCESS_H
+
+#include <stdint.h>
+#include "ADXL345.h"
+#include "ADXL345_unpack.h"
+#include "accel.h"
+#include "ADXL345_timestamp.h"
+
+/* Register level backend */
+struct adxl345_bus {
+	const char * name;
+	int (*open)(struct adxl345_bus * bus);
+	void (*close)(struct adxl345_bus * bus);
+	void (*reg_read)(struct adxl345_bus * bus, uint8_t address, uint8_t * value);
+	void (*reg_write)(struct adxl345_bus * bus, uint8_t address, uint8_t value);
+	void (*multi_read)(struct adxl345_bus * bus, uint8_t address, uint8_t values[], uint8_t len);
+	//count len byte reads at address in one transfer, NULL when the backend has none
+	void (*burst_read)(struct adxl345_bus * bus, uint8_t address, uint8_t values[], uint8_t len, uint8_t count);
+	void * priv;
+};
+
+/* I2C0 through /dev/mem and the same I2C0 code against the timing model of
+ * ADXL345_i2csim.c, the driver's interrupt driven I2C0 transfers against the
+ * model, SPIM0 chip select 0 through /dev/mem and against ADXL345_spisim.c
+ * (ADXL345_access.c), and the simulated register file accessed directly
+ * (ADXL345_sim.c) */
+extern struct adxl345_bus devmem_bus;
+extern struct adxl345_bus i2csim_bus;
+extern struct adxl345_bus i2cirq_bus;
+extern struct adxl345_bus spimem_bus;
+extern struct adxl345_bus spisim_bus;
+extern struct adxl345_bus sim_bus;
+
+void ADXL345_Init(struct adxl345_bus * bus);
+void ADXL345_IdRead(struct adxl345_bus * bus, uint8_t * pId);
+void ADXL345_SetRate(struct adxl345_bus * bus, uint8_t rate);
+int ADXL345_Snapshot(struct adxl345_bus * bus, uint8_t * source, int16_t szData16[3]);
+uint32_t ADXL345_Scale(uint8_t data_format);
+uint64_t ADXL345_Period(uint8_t bw_rate);
+int ADXL345_FIFO_Drain(struct adxl345_bus * bus, uint8_t records[][ADXL345_RECORD_SIZE], int max);
+
+/* Simulated ADXL345 (ADXL345_sim.c). A bus model calls read/write once per
+ * byte and end at STOP or when chip select rises; the clock defaults to
+ * CLOCK_MONOTONIC. */
+struct adxl345_sim_stats {
+	uint64_t generated;		// samples produced at the output data rate
+	uint64_t read;			// samples read over the bus
+	uint64_t overruns;		// samples lost, overwritten or dropped from a full FIFO
+};
+
+void ADXL345_sim_reset(void);
+void ADXL345_sim_set_clock(uint64_t (*clock)(void));
+uint8_t ADXL345_sim_read(uint8_t address);
+void ADXL345_sim_write(uint8_t address, uint8_t value);
+void ADXL345_sim_end(void);
+int ADXL345_sim_int1(void);
+uint64_t ADXL345_sim_next(void);
+void ADXL345_sim_get_stats(struct adxl345_sim_stats * stats);
+void ADXL345_sim_set_odr_error(int32_t ppm);
+void ADXL345_sim_set_counter(int on);
+uint64_t ADXL345_sim_sample_ns(uint32_t n);
+
+/* Statistics of the bus timing models */
+struct bussim_stats {
+	uint64_t now_ns;		// virtual time since reset
+	uint64_t bus_busy_ns;	// clock active: START to STOP, or shifting SPI bytes
+	uint64_t cpu_ns;		// CPU time spent in register accesses
+	uint64_t accesses;		// register accesses
+	uint64_t bytes;			// bytes on the bus, address and command bytes included
+	uint64_t transactions;	// STOPs, chip select deassertions
+	uint64_t split_reads;	// data register reads not from DATAX0 through DATAZ1 in one go, I2C0 only
+};
+
+/* DesignWare I2C0 timing model (ADXL345_i2csim.c). Time is virtual: every
+ * register access costs the CPU mmio_ns, the bus runs at the SCL rate set
+ * by FS_SCL_HCNT/LCNT of a 100 MHz ic_clk. */
+
+void i2csim_reset(void);
+void i2csim_set_mmio_ns(uint32_t ns);
+uint32_t i2csim_read(int offset);
+void i2csim_write(int offset, uint32_t value);
+uint64_t i2csim_now(void);
+void i2csim_idle_until(uint64_t ns);
+void i2csim_cpu(uint64_t ns);
+int i2csim_irq(void);
+void i2csim_get_stats(struct bussim_stats * stats);
+
+/* i2cirq_bus: the handler runs latency_ns after the interrupt line rises,
+ * and the caller wakes latency_ns after its transfer completes; each costs
+ * cpu_ns of CPU on top of the register accesses */
+void i2cirq_set_irq(uint32_t latency_ns, uint32_t cpu_ns);
+uint64_t i2cirq_irqs(void);
+
+/* DesignWare SSI SPIM0 timing model (ADXL345_spisim.c), virtual time as
+ * above, SCLK is the 200 MHz spi_m_clk divided by BAUDR. Offsets are the
+ * byte offsets of address_map_arm.h. */
+void spisim_reset(void);
+void spisim_set_mmio_ns(uint32_t ns);
+uint32_t spisim_read(int offset);
+void spisim_write(int offset, uint32_t value);
+uint64_t spisim_now(void);
+void spisim_idle_until(uint64_t ns);
+void spisim_get_stats(struct bussim_stats * stats);
+
+/* Sample level backend. read() waits for at least one sample until deadline
+ * (CLOCK_MONOTONIC ns) and returns the sample count, 0 at the deadline or -1. */
+struct accel_source {
+	const char * name;
+	int (*open)(struct accel_source * src);
+	void (*close)(struct accel_source * src);
+	int (*set_rate)(struct accel_source * src, unsigned int rate);
+	int (*read)(struct accel_source * src, struct accel_sample samples[], int max, uint64_t deadline);
+	struct adxl345_bus * bus;		// register sources only
+	void * priv;
+};
+
+/* "devmem", "spimem", "dev" (/dev/accel0) and "sim" */
+extern struct accel_source * accel_sources[];
+struct accel_source * accel_source_find(const char * name);
+
+uint64_t accel_now_ns(void);
+
+#endif
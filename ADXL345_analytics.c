@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "ADXL345_analytics.h"
+
+/* Everything lives in one allocation made by ADXL345_Analytics_Create():
+ * the per axis history rings, the window function, the FFT plan and the
+ * FFT work arrays. */
+struct adxl345_analytics {
+	int n, mask, hop;
+	double rate_hz;
+	float mg;				// mg per LSB
+	unsigned long pushed;
+	int head;				// oldest sample once the rings are full
+	int since;				// samples since the last window
+	uint32_t windows;
+	float * ring[3];		// last n samples per axis, mg
+	uint64_t * times;
+	float * hann;
+	float * cos_t, * sin_t;	// twiddles e^(-2 pi i k / n), k < n / 2
+	uint16_t * rev;			// bit reversal permutation
+	float * re, * im;
+};
+
+static void fft(struct adxl345_analytics * a);
+static void window_axis(struct adxl345_analytics * a, int axis, struct adxl345_window * window);
+
+struct adxl345_analytics * ADXL345_Analytics_Create(const struct adxl345_analytics_config * cfg) {
+	struct adxl345_analytics * a;
+	size_t n = cfg->fft_size;
+	char * p;
+	int i, bits = 0, axis;
+
+	if (cfg->fft_size < ANALYTICS_FFT_MIN || cfg->fft_size > ANALYTICS_FFT_MAX || (n & (n - 1)) ||
+		cfg->hop < 1 || cfg->hop > cfg->fft_size || cfg->rate_hz <= 0 || !cfg->scale)
+		return NULL;
+
+	a = malloc(sizeof(*a) + n * (sizeof(uint64_t) + 6 * sizeof(float) + sizeof(uint16_t)) + n * sizeof(float));
+	if (a == NULL)
+		return NULL;
+	memset(a, 0, sizeof(*a));
+	a->n = n;
+	a->mask = n - 1;
+	a->hop = cfg->hop;
+	a->rate_hz = cfg->rate_hz;
+	a->mg = cfg->scale / 1000.0f;
+
+	//Carve the arrays out of the tail, widest first to keep them aligned
+	p = (char *) (a + 1);
+	a->times = (uint64_t *) p;
+	p += n * sizeof(uint64_t);
+	for (axis = 0; axis < 3; axis++, p += n * sizeof(float))
+		a->ring[axis] = (float *) p;
+	a->hann = (float *) p;
+	p += n * sizeof(float);
+	a->re = (float *) p;
+	p += n * sizeof(float);
+	a->im = (float *) p;
+	p += n * sizeof(float);
+	a->cos_t = (float *) p;
+	p += n / 2 * sizeof(float);
+	a->sin_t = (float *) p;
+	p += n / 2 * sizeof(float);
+	a->rev = (uint16_t *) p;
+
+	while ((1U << bits) < n)
+		bits++;
+	for (i = 0; i < (int) n; i++) {
+		unsigned int r = 0, b;
+
+		for (b = 0; b < (unsigned int) bits; b++)
+			r |= ((i >> b) & 1) << (bits - 1 - b);
+		a->rev[i] = r;
+		a->hann[i] = 0.5f - 0.5f * cosf(2 * M_PI * i / n);
+	}
+	for (i = 0; i < (int) n / 2; i++) {
+		a->cos_t[i] = cos(2 * M_PI * i / n);
+		a->sin_t[i] = -sin(2 * M_PI * i / n);
+	}
+	return a;
+}
+
+void ADXL345_Analytics_Destroy(struct adxl345_analytics * a) {
+	free(a);
+}
+
+int ADXL345_Analytics_Push(struct adxl345_analytics * a, uint64_t timestamp, const int16_t xyz[3],
+	struct adxl345_window * window) {
+	int axis;
+
+	for (axis = 0; axis < 3; axis++)
+		a->ring[axis][a->head] = xyz[axis] * a->mg;
+	a->times[a->head] = timestamp;
+	a->head = (a->head + 1) & a->mask;
+	a->pushed++;
+
+	//First window once the rings are full, then one every hop
+	if (a->pushed < (unsigned long) a->n)
+		return 0;
+	if (a->pushed > (unsigned long) a->n && ++a->since < a->hop)
+		return 0;
+	a->since = 0;
+
+	window->timestamp = a->times[a->head];
+	window->seq = a->windows++;
+	for (axis = 0; axis < 3; axis++)
+		window_axis(a, axis, window);
+	return 1;
+}
+
+/* Statistics and spectrum of one axis over the last n samples */
+static void window_axis(struct adxl345_analytics * a, int axis, struct adxl345_window * window) {
+	const float * x = a->ring[axis];
+	float mean, d, sum_sq = 0, peak = 0, best = 0, m0, m1, m2, delta = 0;
+	double sum = 0;
+	int i, k, kmax = 1;
+
+	for (i = 0; i < a->n; i++)
+		sum += x[i];
+	mean = sum / a->n;
+
+	//Oldest first into bit reversed order, ready for the butterflies
+	for (i = 0; i < a->n; i++) {
+		d = x[(a->head + i) & a->mask] - mean;
+		sum_sq += d * d;
+		if (fabsf(d) > peak)
+			peak = fabsf(d);
+		a->re[a->rev[i]] = d * a->hann[i];
+		a->im[a->rev[i]] = 0;
+	}
+	fft(a);
+
+	for (k = 1; k < a->n / 2; k++) {
+		m1 = a->re[k] * a->re[k] + a->im[k] * a->im[k];
+		if (m1 > best) {
+			best = m1;
+			kmax = k;
+		}
+	}
+	//Where the Hann main lobe through the three bins around the largest one
+	//peaks, and its height there
+	m1 = sqrtf(best);
+	if (kmax > 1 && kmax < a->n / 2 - 1) {
+		m0 = sqrtf(a->re[kmax - 1] * a->re[kmax - 1] + a->im[kmax - 1] * a->im[kmax - 1]);
+		m2 = sqrtf(a->re[kmax + 1] * a->re[kmax + 1] + a->im[kmax + 1] * a->im[kmax + 1]);
+		delta = 2 * (m2 - m0) / (m0 + 2 * m1 + m2);
+		if (fabsf(delta) > 1e-4f)
+			m1 *= M_PI * delta * (1 - delta * delta) / sinf(M_PI * delta);
+	}
+
+	window->mean[axis] = mean;
+	window->rms[axis] = sqrtf(sum_sq / a->n);
+	window->peak[axis] = peak;
+	window->crest[axis] = window->rms[axis] > 0 ? peak / window->rms[axis] : 0;
+	window->freq_hz[axis] = (kmax + delta) * a->rate_hz / a->n;
+	//Single sided, over the Hann window's coherent gain of 1/2
+	window->amplitude[axis] = best > 0 ? 4 * m1 / a->n : 0;
+}
+
+/* In place radix 2 decimation in time on re/im, input in bit reversed order */
+static void fft(struct adxl345_analytics * a) {
+	float * re = a->re, * im = a->im;
+	float wr, wi, tr, ti;
+	int len, half, step, i, j, u, v;
+
+	for (len = 2; len <= a->n; len <<= 1) {
+		half = len / 2;
+		step = a->n / len;
+		for (i = 0; i < a->n; i += len) {
+			for (j = 0; j < half; j++) {
+				wr = a->cos_t[j * step];
+				wi = a->sin_t[j * step];
+				u = i + j;
+				v = u + half;
+				tr = re[v] * wr - im[v] * wi;
+				ti = re[v] * wi + im[v] * wr;
+				re[v] = re[u] - tr;
+				im[v] = im[u] - ti;
+				re[u] += tr;
+				im[u] += ti;
+			}
+		}
+	}
+}
+
+size_t ADXL345_Analytics_Format(const struct adxl345_window * window, char * text, size_t size) {
+	size_t len;
+	int axis, n;
+
+	n = snprintf(text, size, "%u %.3f", window->seq, window->timestamp / 1e6);
+	len = n > 0 ? (size_t) n : 0;
+	for (axis = 0; axis < 3 && len < size; axis++) {
+		n = snprintf(text + len, size - len, " | %c %.1f %.1f %.2f %.2f %.1f", 'X' + axis, window->rms[axis],
+			window->peak[axis], window->crest[axis], window->freq_hz[axis], window->amplitude[axis]);
+		len += n > 0 ? (size_t) n : 0;
+	}
+	if (len < size)
+		len += snprintf(text + len, size - len, "\n");
+	return len < size ? len : size - 1;
+}
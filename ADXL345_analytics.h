@@ -0,0 +1,50 @@
+/* Streaming vibration analytics of ADXL345 samples. Samples are pushed one
+ * at a time; every hop samples, once fft_size have been seen, the last
+ * fft_size of them make a window, overlapping the previous one by
+ * fft_size - hop. Per axis each window yields the RMS and peak about the
+ * window mean (gravity and offset removed), the crest factor peak / RMS and
+ * the strongest line of a Hann windowed FFT. The FFT plan (twiddles and bit
+ * reversal) and every buffer are allocated once by Create, so a window costs
+ * no allocation. */
+#ifndef ADXL345_ANALYTICS_H
+#define ADXL345_ANALYTICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ANALYTICS_FFT_MIN			16
+#define ANALYTICS_FFT_MAX			8192
+
+struct adxl345_analytics_config {
+	int fft_size;			// power of 2, ANALYTICS_FFT_MIN to ANALYTICS_FFT_MAX
+	int hop;				// 1 to fft_size, fft_size / 2 for 50% overlap
+	double rate_hz;			// output data rate
+	uint32_t scale;			// ug per LSB, see ADXL345_Scale()
+};
+
+/* Summary of one window, accelerations in mg */
+struct adxl345_window {
+	uint64_t timestamp;		// of the first sample of the window
+	uint32_t seq;			// windows completed before this one
+	float mean[3];
+	float rms[3];
+	float peak[3];
+	float crest[3];
+	float freq_hz[3];		// strongest line above DC, interpolated between bins
+	float amplitude[3];		// its amplitude, mg
+};
+
+struct adxl345_analytics;
+
+/* Returns NULL for an invalid configuration or when out of memory */
+struct adxl345_analytics * ADXL345_Analytics_Create(const struct adxl345_analytics_config * cfg);
+void ADXL345_Analytics_Destroy(struct adxl345_analytics * a);
+
+/* Push one sample, returns 1 and fills window when it completes one */
+int ADXL345_Analytics_Push(struct adxl345_analytics * a, uint64_t timestamp, const int16_t xyz[3],
+	struct adxl345_window * window);
+
+/* One line, "seq t_ms | X rms pk cf f a | Y ... | Z ...\n", returns its length */
+size_t ADXL345_Analytics_Format(const struct adxl345_window * window, char * text, size_t size);
+
+#endif
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include "ADXL345_analytics.h"
+
+/* Throughput and accuracy check of the vibration analytics.
+ * Usage: ADXL345_analytics_bench [-n lo-hi] [-r rate_hz] [-t seconds] [-v]
+ *   -n   FFT sizes to sweep, powers of 2, default 64-4096
+ *   -r   output data rate, default 3200 Hz
+ *   -t   seconds of samples per configuration, default 60
+ *   -v   verify instead: sines of known frequency and amplitude, on and
+ *        between bins, for every size swept. Exits 1 when a frequency is
+ *        off by more than half a bin, or an amplitude, RMS or crest factor
+ *        by more than 5%.
+ * The benchmark pushes synthetic samples (1 g on Z, two lines and noise) as
+ * fast as it can at 0%, 50% and 75% overlap and prints ns per sample and
+ * per window, the sample rate one core sustains and its load at -r. */
+
+#define BENCH_SCALE					3900	// full resolution, ug per LSB
+#define VERIFY_TOLERANCE			0.05
+
+static void bench(int n, int hop, double rate_hz, double seconds);
+static int verify(int n, double rate_hz);
+static void synth(int16_t xyz[3], unsigned long i, double rate_hz);
+static uint64_t now_ns(void);
+
+int main(int argc, char * argv[]) {
+
+	int opt, lo = 64, hi = 4096, n, check = 0, failed = 0;
+	double rate_hz = 3200, seconds = 60;
+
+	while ((opt = getopt(argc, argv, "n:r:t:v")) != -1) {
+		switch (opt) {
+		case 'n' :
+			if (sscanf(optarg, "%d-%d", &lo, &hi) == 1)
+				hi = lo;
+			break;
+		case 'r' :
+			rate_hz = atof(optarg);
+			break;
+		case 't' :
+			seconds = atof(optarg);
+			break;
+		case 'v' :
+			check = 1;
+			break;
+		default :
+			printf("Usage: %s [-n lo-hi] [-r rate_hz] [-t seconds] [-v]\n", argv[0]);
+			return(-1);
+		}
+	}
+	if (lo < ANALYTICS_FFT_MIN || hi > ANALYTICS_FFT_MAX || lo > hi || rate_hz <= 0 || seconds <= 0) {
+		printf("ERROR: FFT sizes %d to %d, rate and time > 0\n", ANALYTICS_FFT_MIN, ANALYTICS_FFT_MAX);
+		return(-1);
+	}
+
+	if (!check)
+		printf("%6s %6s %10s %11s %12s %9s\n", "fft", "hop", "ns/sample", "us/window", "samples/s", "cpu%");
+	for (n = lo; n <= hi; n *= 2) {
+		if (n & (n - 1))
+			continue;
+		if (check) {
+			failed |= verify(n, rate_hz);
+			continue;
+		}
+		bench(n, n, rate_hz, seconds);
+		bench(n, n / 2, rate_hz, seconds);
+		bench(n, n / 4, rate_hz, seconds);
+	}
+	if (check)
+		printf("%s\n", failed ? "FAILED" : "passed");
+	return failed;
+}
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* 1 g on Z, 200 mg at 97.3 Hz on X, 50 mg at 411 Hz on Y, and some noise */
+static void synth(int16_t xyz[3], unsigned long i, double rate_hz) {
+	double t = i / rate_hz;
+
+	xyz[0] = lrint(200000 * sin(2 * M_PI * 97.3 * t) / BENCH_SCALE) + rand() % 5 - 2;
+	xyz[1] = lrint(50000 * sin(2 * M_PI * 411 * t) / BENCH_SCALE) + rand() % 5 - 2;
+	xyz[2] = 1000000 / BENCH_SCALE + rand() % 5 - 2;
+}
+
+static void bench(int n, int hop, double rate_hz, double seconds) {
+	struct adxl345_analytics_config cfg = { n, hop, rate_hz, BENCH_SCALE };
+	struct adxl345_analytics * a = ADXL345_Analytics_Create(&cfg);
+	struct adxl345_window window;
+	unsigned long i, count = (unsigned long) (rate_hz * seconds), windows = 0;
+	int16_t (*xyz)[3];
+	uint64_t start, elapsed;
+	double ns;
+
+	xyz = malloc(count * sizeof(*xyz));
+	if (a == NULL || xyz == NULL) {
+		printf("ERROR: out of memory\n");
+		exit(1);
+	}
+	//Synthesize first, only the analytics are timed
+	for (i = 0; i < count; i++)
+		synth(xyz[i], i, rate_hz);
+
+	start = now_ns();
+	for (i = 0; i < count; i++)
+		windows += ADXL345_Analytics_Push(a, i * (uint64_t) (1e9 / rate_hz), xyz[i], &window);
+	elapsed = now_ns() - start;
+
+	ns = (double) elapsed / count;
+	printf("%6d %6d %10.1f %11.1f %12.0f %9.2f\n", n, hop, ns, windows ? elapsed / 1000.0 / windows : 0.0,
+		1e9 / ns, 100 * rate_hz * ns / 1e9);
+	ADXL345_Analytics_Destroy(a);
+	free(xyz);
+}
+
+/* One sine per axis: X on a bin, Y half way between two, Z a quarter off,
+ * each with an offset the statistics must remove */
+static int verify(int n, double rate_hz) {
+	struct adxl345_analytics_config cfg = { n, n / 2, rate_hz, BENCH_SCALE };
+	struct adxl345_analytics * a = ADXL345_Analytics_Create(&cfg);
+	struct adxl345_window window;
+	const double amp_mg[3] = { 500, 300, 800 }, bins[3] = { n / 8.0, n / 5 + 0.5, n / 3 + 0.25 };
+	const double offset_mg[3] = { 0, -1000, 1000 };
+	double bin_hz = rate_hz / n, t;
+	int16_t xyz[3];
+	int i, axis, windows = 0, failed = 0;
+
+	if (a == NULL)
+		return 1;
+	for (i = 0; i < 4 * n; i++) {
+		t = i / rate_hz;
+		for (axis = 0; axis < 3; axis++)
+			xyz[axis] = lrint((offset_mg[axis] + amp_mg[axis] * sin(2 * M_PI * bins[axis] * bin_hz * t)) * 1000 / BENCH_SCALE);
+		if (!ADXL345_Analytics_Push(a, 0, xyz, &window))
+			continue;
+		windows++;
+		for (axis = 0; axis < 3; axis++) {
+			if (fabs(window.freq_hz[axis] - bins[axis] * bin_hz) > bin_hz / 2 ||
+				fabs(window.amplitude[axis] / amp_mg[axis] - 1) > VERIFY_TOLERANCE ||
+				fabs(window.rms[axis] / (amp_mg[axis] / M_SQRT2) - 1) > VERIFY_TOLERANCE ||
+				fabs(window.crest[axis] / M_SQRT2 - 1) > VERIFY_TOLERANCE) {
+				printf("fft %d window %u %c: %.2f Hz %.1f mg rms %.1f crest %.2f, expected %.2f Hz %.1f mg rms %.1f crest 1.41\n",
+					n, window.seq, 'X' + axis, window.freq_hz[axis], window.amplitude[axis], window.rms[axis],
+					window.crest[axis], bins[axis] * bin_hz, amp_mg[axis], amp_mg[axis] / M_SQRT2);
+				failed = 1;
+			}
+		}
+	}
+	printf("fft %d: %d windows %s\n", n, windows, failed ? "FAILED" : "ok");
+	ADXL345_Analytics_Destroy(a);
+	return failed || windows != 7;
+}
@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include "ADXL345_access.h"
+
+/* Throughput benchmark of the ADXL345 access backends.
+ * Usage: ADXL345_bench [-b backend,...|all] [-r lo-hi] [-t ms]
+ *   -b   backends to run: devmem, spimem, dev, sim (default sim, all skips those that fail to open)
+ *   -r   BW_RATE codes to sweep, 0 (0.098 Hz) to 15 (3200 Hz), default 0-15
+ *   -t   measurement time per rate, default 1000 ms
+ * For every backend and rate it prints the samples/s achieved, the latency
+ * from the sample timestamp to its delivery (p50, p99, max) and the CPU time
+ * used as a percentage of the wall time. */
+
+#define BENCH_BATCH					32
+#define BENCH_MAX_LATENCIES			(1 << 20)
+
+static int bench_source(struct accel_source * src, int lo, int hi, unsigned int ms);
+static int compare_u64(const void * a, const void * b);
+static double cpu_seconds(void);
+
+static uint64_t * latencies;
+
+volatile sig_atomic_t stop;
+void catchSIGINT (int signum) {
+	stop = 1;
+}
+
+int main(int argc, char * argv[]) {
+
+	int opt, i, lo = 0, hi = 15;
+	unsigned int ms = 1000;
+	char * backends = "sim", * name;
+	struct accel_source * src;
+
+	while ((opt = getopt(argc, argv, "b:r:t:")) != -1) {
+		switch (opt) {
+		case 'b' :
+			backends = optarg;
+			break;
+		case 'r' :
+			if (sscanf(optarg, "%d-%d", &lo, &hi) == 1)
+				hi = lo;
+			break;
+		case 't' :
+			ms = atoi(optarg);
+			break;
+		default :
+			printf("Usage: %s [-b backend,...|all] [-r lo-hi] [-t ms]\n", argv[0]);
+			return(-1);
+		}
+	}
+	if (lo < 0 || hi > 15 || lo > hi || ms == 0) {
+		printf("ERROR: rates are 0 to 15, time > 0\n");
+		return(-1);
+	}
+
+	if ((latencies = malloc(BENCH_MAX_LATENCIES * sizeof(uint64_t))) == NULL)
+		return(-1);
+
+	stop = 0;
+	signal(SIGINT, catchSIGINT);
+
+	printf("%-7s %4s %9s %9s %11s %10s %10s %10s %6s\n", "backend", "rate", "odr_hz", "samples",
+		"samples/s", "p50_us", "p99_us", "max_us", "cpu%");
+	if (!strcmp(backends, "all")) {
+		for (i = 0; accel_sources[i] && !stop; i++)
+			bench_source(accel_sources[i], lo, hi, ms);
+	}
+	else {
+		for (name = strtok(backends, ","); name && !stop; name = strtok(NULL, ",")) {
+			if ((src = accel_source_find(name)) == NULL) {
+				printf("ERROR: no backend \"%s\"\n", name);
+				continue;
+			}
+			bench_source(src, lo, hi, ms);
+		}
+	}
+
+	free(latencies);
+	return 0;
+}
+
+/* Sweep the rates lo to hi on one backend */
+static int bench_source(struct accel_source * src, int lo, int hi, unsigned int ms) {
+	struct accel_sample samples[BENCH_BATCH];
+	uint64_t start, end, now;
+	unsigned long long count;
+	size_t kept;
+	double cpu, seconds;
+	int rate, n, i;
+
+	if (src->open(src) < 0) {
+		printf("%-7s skipped, unable to open\n", src->name);
+		return -1;
+	}
+
+	for (rate = lo; rate <= hi && !stop; rate++) {
+		if (src->set_rate(src, rate) < 0) {
+			printf("%-7s %4d unable to set the rate\n", src->name, rate);
+			continue;
+		}
+		//Drop whatever was queued at the previous rate
+		while (src->read(src, samples, BENCH_BATCH, accel_now_ns()) > 0)
+			;
+
+		count = 0;
+		kept = 0;
+		cpu = cpu_seconds();
+		start = accel_now_ns();
+		end = start + (uint64_t) ms * 1000000;
+		while (!stop && (now = accel_now_ns()) < end) {
+			if ((n = src->read(src, samples, BENCH_BATCH, end)) < 0)
+				break;
+			now = accel_now_ns();
+			for (i = 0; i < n; i++) {
+				if (!(samples[i].flags & ACCEL_FLAG_NEW))
+					continue;
+				if (kept < BENCH_MAX_LATENCIES)
+					latencies[kept++] = now > samples[i].timestamp ? now - samples[i].timestamp : 0;
+				count++;
+			}
+		}
+		seconds = (accel_now_ns() - start) / 1e9;
+		cpu = cpu_seconds() - cpu;
+
+		qsort(latencies, kept, sizeof(uint64_t), compare_u64);
+		printf("%-7s %4d %9.3f %9llu %11.1f %10.1f %10.1f %10.1f %6.1f\n", src->name, rate,
+			3200.0 / (1 << (15 - rate)), count, count / seconds,
+			kept ? latencies[kept / 2] / 1e3 : 0.0,
+			kept ? latencies[kept * 99 / 100] / 1e3 : 0.0,
+			kept ? latencies[kept - 1] / 1e3 : 0.0,
+			100.0 * cpu / seconds);
+	}
+
+	src->close(src);
+	return 0;
+}
+
+static int compare_u64(const void * a, const void * b) {
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+/* User plus system CPU time of this process */
+static double cpu_seconds(void) {
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+		+ usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
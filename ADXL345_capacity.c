@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "ADXL345_access.h"
+
+/* Capacity planning on the bus timing models: runs the userspace I2C0 or
+ * SPIM0 code against ADXL345_i2csim.c or ADXL345_spisim.c in virtual time
+ * for every configuration and rate.
+ * Usage: ADXL345_capacity [-b bus] [-r lo-hi] [-t ms] [-m mmio_ns] [-l latency_us] [-i irq_us] [-v]
+ *   -b   i2csim (400 kHz I2C0 polled, default), i2cirq (the same bus with the
+ *        driver's interrupt driven transfers) or spisim (5 MHz SPIM0)
+ *   -r   BW_RATE codes to sweep, default 6-15 (6.25 to 3200 Hz)
+ *   -t   virtual time per rate, default 1000 ms
+ *   -m   CPU cost of one controller register access, default 200 ns
+ *   -l   interrupt to thread wakeup latency, default 20 us
+ *   -i   i2cirq: I2C interrupt to handler latency, default 5 us; every
+ *        handler run and every wakeup of the caller costs 2 us of CPU
+ *   -v   instead checks on i2cirq that FIFO drains never split a record
+ *        with the handler up to 2 ms late, exits 1 on a failure
+ * Configurations: "dataready" takes one INT_SOURCE..DATAZ1 snapshot per
+ * DATA_READY interrupt, "fifo N" drains the FIFO in stream mode at a
+ * watermark of N, "+tap" adds an ACT_TAP_STATUS read per interrupt as tap
+ * detection needs. For each it reports bus utilization, CPU time spent in
+ * controller accesses and interrupts, in all and per sample read, lost
+ * samples, and the highest rate sustained without loss together with the
+ * sample rate the bus could carry at 100% utilization. */
+
+#define CAPACITY_BATCH				ADXL345_FIFO_DEPTH
+#define CAPACITY_IRQ_CPU_NS			2000
+
+struct capacity_config {
+	const char * name;
+	unsigned int watermark;		// 0 for DATA_READY, else FIFO stream mode
+	int tap;
+};
+
+/* A register backend and the virtual clock of its timing model */
+struct capacity_model {
+	struct adxl345_bus * bus;
+	void (*set_mmio_ns)(uint32_t ns);
+	uint64_t (*now)(void);
+	void (*idle_until)(uint64_t ns);
+	void (*get_stats)(struct bussim_stats * stats);
+};
+
+static struct capacity_model models[] = {
+	{ &i2csim_bus, i2csim_set_mmio_ns, i2csim_now, i2csim_idle_until, i2csim_get_stats },
+	{ &i2cirq_bus, i2csim_set_mmio_ns, i2csim_now, i2csim_idle_until, i2csim_get_stats },
+	{ &spisim_bus, spisim_set_mmio_ns, spisim_now, spisim_idle_until, spisim_get_stats },
+};
+
+static struct capacity_config configs[] = {
+	{ "dataready", 0, 0 },
+	{ "dataready+tap", 0, 1 },
+	{ "fifo 8", 8, 0 },
+	{ "fifo 16", 16, 0 },
+	{ "fifo 16+tap", 16, 1 },
+	{ "fifo 31", 31, 0 },
+};
+
+static int run_config(struct capacity_model * model, struct capacity_config * config, int lo, int hi,
+	unsigned int ms, uint64_t latency_ns);
+static int wait_int1(struct capacity_model * model, uint64_t end, uint64_t latency_ns);
+static int verify(struct capacity_model * model, unsigned int ms, uint64_t latency_ns);
+
+int main(int argc, char * argv[]) {
+
+	struct capacity_model * model = &models[0];
+	int opt, lo = 6, hi = 15, mmio_ns = 0, check = 0;
+	unsigned int ms = 1000, i;
+	uint64_t latency_ns = 20000, irq_ns = 5000;
+
+	while ((opt = getopt(argc, argv, "b:r:t:m:l:i:v")) != -1) {
+		switch (opt) {
+		case 'b' :
+			for (i = 0; i < sizeof(models) / sizeof(models[0]); i++) {
+				if (!strcmp(optarg, models[i].bus->name))
+					break;
+			}
+			if (i == sizeof(models) / sizeof(models[0])) {
+				printf("ERROR: buses are i2csim, i2cirq and spisim\n");
+				return(-1);
+			}
+			model = &models[i];
+			break;
+		case 'r' :
+			if (sscanf(optarg, "%d-%d", &lo, &hi) == 1)
+				hi = lo;
+			break;
+		case 't' :
+			ms = atoi(optarg);
+			break;
+		case 'm' :
+			mmio_ns = atoi(optarg);
+			break;
+		case 'l' :
+			latency_ns = (uint64_t) atoi(optarg) * 1000;
+			break;
+		case 'i' :
+			irq_ns = (uint64_t) atoi(optarg) * 1000;
+			break;
+		case 'v' :
+			check = 1;
+			break;
+		default :
+			printf("Usage: %s [-b bus] [-r lo-hi] [-t ms] [-m mmio_ns] [-l latency_us] [-i irq_us] [-v]\n",
+				argv[0]);
+			return(-1);
+		}
+	}
+	if (lo < 0 || hi > 15 || lo > hi || ms == 0) {
+		printf("ERROR: rates are 0 to 15, time > 0\n");
+		return(-1);
+	}
+
+	if (mmio_ns > 0)
+		model->set_mmio_ns(mmio_ns);
+	if (check)
+		return verify(&models[1], ms, latency_ns) ? 1 : 0;
+	i2cirq_set_irq(irq_ns, CAPACITY_IRQ_CPU_NS);
+
+	printf("bus %s\n\n", model->bus->name);
+	for (i = 0; i < sizeof(configs) / sizeof(configs[0]); i++)
+		run_config(model, &configs[i], lo, hi, ms, latency_ns);
+	return 0;
+}
+
+/* Sweep the rates of one configuration */
+static int run_config(struct capacity_model * model, struct capacity_config * config, int lo, int hi,
+	unsigned int ms, uint64_t latency_ns) {
+	struct adxl345_bus * bus = model->bus;
+	struct bussim_stats bus0, bus1;
+	struct adxl345_sim_stats sim0, sim1;
+	int16_t xyz[3];
+	uint8_t records[CAPACITY_BATCH][ADXL345_RECORD_SIZE];
+	uint8_t source, status;
+	uint64_t end, elapsed, lost;
+	double odr, bus_pct, bus_limit = 0;
+	int rate, sustained = -1;
+
+	printf("%s\n", config->name);
+	printf("%4s %9s %9s %9s %8s %7s %7s %10s %10s\n", "rate", "odr_hz", "generated", "read", "lost",
+		"bus%", "cpu%", "cpu_us/smp", "bytes/smp");
+
+	for (rate = lo; rate <= hi; rate++) {
+		if (bus->open(bus) < 0)
+			return -1;
+		ADXL345_Init(bus);
+		ADXL345_SetRate(bus, rate);
+		if (config->watermark) {
+			bus->reg_write(bus, ADXL345_FIFO_CTL, ADXL345_FIFO_STREAM | config->watermark);
+			bus->reg_write(bus, ADXL345_INT_ENABLE, ADXL345_WATERMARK | (config->tap ? ADXL345_SINGLE | ADXL345_DOUBLE : 0));
+		}
+		else
+			bus->reg_write(bus, ADXL345_INT_ENABLE, ADXL345_DATAREADY | (config->tap ? ADXL345_SINGLE | ADXL345_DOUBLE : 0));
+		//Writes are posted, a read waits until they are on the bus
+		bus->reg_read(bus, ADXL345_DEVID, &status);
+
+		model->get_stats(&bus0);
+		ADXL345_sim_get_stats(&sim0);
+		end = bus0.now_ns + (uint64_t) ms * 1000000;
+
+		while (wait_int1(model, end, latency_ns)) {
+			if (config->watermark) {
+				bus->reg_read(bus, ADXL345_INT_SOURCE, &source);
+				if (config->tap)
+					bus->reg_read(bus, ADXL345_ACT_TAP_STATUS, &status);
+				ADXL345_FIFO_Drain(bus, records, CAPACITY_BATCH);
+			}
+			else {
+				ADXL345_Snapshot(bus, &source, xyz);
+				if (config->tap)
+					bus->reg_read(bus, ADXL345_ACT_TAP_STATUS, &status);
+			}
+		}
+
+		model->get_stats(&bus1);
+		ADXL345_sim_get_stats(&sim1);
+		bus->close(bus);
+
+		elapsed = bus1.now_ns - bus0.now_ns;
+		lost = sim1.overruns - sim0.overruns;
+		odr = 3200.0 / (1 << (15 - rate));
+		bus_pct = 100.0 * (bus1.bus_busy_ns - bus0.bus_busy_ns) / elapsed;
+		printf("%4d %9.3f %9llu %9llu %8llu %7.1f %7.1f %10.2f %10.1f\n", rate, odr,
+			(unsigned long long) (sim1.generated - sim0.generated),
+			(unsigned long long) (sim1.read - sim0.read), (unsigned long long) lost, bus_pct,
+			100.0 * (bus1.cpu_ns - bus0.cpu_ns) / elapsed,
+			sim1.read > sim0.read ? (bus1.cpu_ns - bus0.cpu_ns) / 1e3 / (sim1.read - sim0.read) : 0.0,
+			sim1.read > sim0.read ? (double) (bus1.bytes - bus0.bytes) / (sim1.read - sim0.read) : 0.0);
+
+		if (!lost && sim1.read > sim0.read)
+			sustained = rate;
+		if (sim1.read > sim0.read && bus1.bus_busy_ns > bus0.bus_busy_ns)
+			bus_limit = (sim1.read - sim0.read) * 1e9 / (bus1.bus_busy_ns - bus0.bus_busy_ns);
+	}
+
+	if (sustained >= 0)
+		printf("max sustainable: rate %d (%.3f Hz), bus limit %.0f samples/s\n\n", sustained,
+			3200.0 / (1 << (15 - sustained)), bus_limit);
+	else
+		printf("max sustainable: none of the rates swept, bus limit %.0f samples/s\n\n", bus_limit);
+	return 0;
+}
+
+/* Sleep until INT1, then pay the wakeup latency. Returns 0 at end. */
+static int wait_int1(struct capacity_model * model, uint64_t end, uint64_t latency_ns) {
+	uint64_t next;
+
+	while (model->now() < end) {
+		if (ADXL345_sim_int1())
+			return 1;
+		next = ADXL345_sim_next();
+		if (next >= end) {
+			model->idle_until(end);
+			break;
+		}
+		model->idle_until(next + latency_ns);
+	}
+	return 0;
+}
+
+/* FIFO drains at 3200 Hz, watermark 16, on the interrupt driven engine with
+ * the handler later and later, so that drains run with the TX FIFO empty
+ * and with the reads in flight at the RX FIFO cap. The model must see no
+ * split data read, and the counter samples must come back whole and in
+ * order, the gaps adding up to the samples the sensor overran. Returns the
+ * failed runs. */
+static int verify(struct capacity_model * model, unsigned int ms, uint64_t latency_ns) {
+	static const uint32_t irq_us[] = { 0, 20, 100, 400, 1000, 2000 };
+	struct adxl345_bus * bus = model->bus;
+	struct bussim_stats stats;
+	struct adxl345_sim_stats sim;
+	uint8_t records[CAPACITY_BATCH][ADXL345_RECORD_SIZE];
+	uint8_t source;
+	uint64_t end, gaps, bad;
+	int64_t last;
+	uint32_t n;
+	int16_t z, lsb_per_g;
+	int i, k, count, failed = 0;
+
+	printf("%7s %9s %9s %8s %8s %7s %7s\n", "irq_us", "read", "overruns", "gaps", "bad", "split", "result");
+	for (k = 0; k < (int) (sizeof(irq_us) / sizeof(irq_us[0])); k++) {
+		i2cirq_set_irq(irq_us[k] * 1000, CAPACITY_IRQ_CPU_NS);
+		if (bus->open(bus) < 0)
+			return -1;
+		ADXL345_sim_set_counter(1);
+		ADXL345_Init(bus);
+		//Stream mode before the first sample at 3200 Hz, every one is queued
+		bus->reg_write(bus, ADXL345_FIFO_CTL, ADXL345_FIFO_STREAM | 16);
+		ADXL345_SetRate(bus, 15);
+		bus->reg_write(bus, ADXL345_INT_ENABLE, ADXL345_WATERMARK);
+		bus->reg_read(bus, ADXL345_DEVID, &source);
+		lsb_per_g = 1000000 / ADXL345_Scale(0x03);
+
+		last = -1;
+		gaps = bad = 0;
+		end = model->now() + (uint64_t) ms * 1000000;
+		while (wait_int1(model, end, latency_ns)) {
+			bus->reg_read(bus, ADXL345_INT_SOURCE, &source);
+			count = ADXL345_FIFO_Drain(bus, records, CAPACITY_BATCH);
+			for (i = 0; i < count; i++) {
+				n = (records[i][0] | records[i][1] << 8) | (uint32_t) (records[i][2] | records[i][3] << 8) << 16;
+				z = records[i][4] | records[i][5] << 8;
+				if (z != lsb_per_g || (int64_t) n <= last) {
+					bad++;
+					continue;
+				}
+				gaps += n - (last + 1);
+				last = n;
+			}
+		}
+		model->get_stats(&stats);
+		ADXL345_sim_get_stats(&sim);
+		bus->close(bus);
+
+		i = !sim.read || bad || stats.split_reads || gaps != sim.overruns;
+		failed += i;
+		printf("%7u %9llu %9llu %8llu %8llu %7llu %7s\n", irq_us[k], (unsigned long long) sim.read,
+			(unsigned long long) sim.overruns, (unsigned long long) gaps, (unsigned long long) bad,
+			(unsigned long long) stats.split_reads, i ? "FAIL" : "ok");
+	}
+	return failed;
+}
@@ -0,0 +1,93 @@
+/* Bus independent ADXL345 logic shared by the driver and the userspace access
+ * layer: the initialization sequence, the detection registers, the data
+ * snapshot and the scale and period of a configuration. The includer
+ * includes ADXL345.h and accel.h, and defines the type of its device handle
+ * as ADXL345_CORE_DEV and the register access on it,
+ * ADXL345_CORE_WRITE(dev, address, value) and ADXL345_CORE_MULTI_WRITE /
+ * ADXL345_CORE_MULTI_READ(dev, address, values, len), the ADXL345
+ * incrementing the address, before including this file. */
+#ifndef ADXL345_CORE_H
+#define ADXL345_CORE_H
+
+#include <linux/types.h>
+
+/* Power-on configuration: +-16 g at 10 bits, 12.5 Hz */
+#define ADXL345_INIT_FORMAT			0x03
+#define ADXL345_INIT_RATE			0x07
+
+#define ADXL345_SNAPSHOT_SIZE		8		// INT_SOURCE through DATAZ1
+
+/* Defaults of the detection registers: 1 g taps of up to 20 ms on Y, double
+ * taps 20 ms to 320 ms apart, activity above 250 mg, inactivity below 125 mg
+ * for 2 s, ac coupled on every axis, free-fall below 562 mg for 100 ms */
+static const struct accel_event_config adxl345_event_defaults = {
+	.thresh_tap = 0x10,
+	.dur = 0x20,
+	.latent = 0x10,
+	.window = 0xF0,
+	.thresh_act = 0x04,
+	.thresh_inact = 0x02,
+	.time_inact = 0x02,
+	.act_inact_ctl = 0xFF,
+	.thresh_ff = 0x09,
+	.time_ff = 0x14,
+	.tap_axes = 0x2,
+};
+
+/* Output data period of a BW_RATE code in ns, 3200 Hz halving per step */
+static inline __u64 adxl345_period_ns(__u8 bw_rate) {
+	return (__u64) 312500 << (15 - (bw_rate & 0x0F));
+}
+
+/* ug per LSB of a DATA_FORMAT: 3.9 mg at full resolution, else doubling
+ * with each range step at 10 bits */
+static inline __u32 adxl345_scale_ug(__u8 data_format) {
+	if (data_format & ADXL345_FULL_RES)
+		return 3900;
+	return 3900 << (data_format & ADXL345_RANGE);
+}
+
+/* DATAX0 to DATAZ1, little endian */
+static inline void adxl345_decode(const __u8 raw[6], __s16 xyz[3]) {
+	xyz[0] = (raw[1] << 8) | raw[0];
+	xyz[1] = (raw[3] << 8) | raw[2];
+	xyz[2] = (raw[5] << 8) | raw[4];
+}
+
+/* THRESH_TAP, then DUR to TAP_EN in one burst */
+static inline void adxl345_write_events(ADXL345_CORE_DEV dev, const struct accel_event_config * cfg) {
+	__u8 values[10] = {cfg->dur, cfg->latent, cfg->window, cfg->thresh_act, cfg->thresh_inact,
+		cfg->time_inact, cfg->act_inact_ctl, cfg->thresh_ff, cfg->time_ff, cfg->tap_axes};
+
+	ADXL345_CORE_WRITE(dev, ADXL345_THRESH_TAP, cfg->thresh_tap);
+	ADXL345_CORE_MULTI_WRITE(dev, ADXL345_TAP_DUR, values, sizeof(values));
+}
+
+/* DATA_FORMAT and BW_RATE, the detection registers, the INT1 sources and
+ * the FIFO mode, then a standby to measurement cycle to restart sampling */
+static inline void adxl345_init(ADXL345_CORE_DEV dev, __u8 data_format, __u8 bw_rate,
+	const struct accel_event_config * events, __u8 int_enable, __u8 fifo_ctl) {
+	ADXL345_CORE_WRITE(dev, ADXL345_DATA_FORMAT, data_format);
+	ADXL345_CORE_WRITE(dev, ADXL345_BW_RATE, bw_rate);
+	adxl345_write_events(dev, events);
+	ADXL345_CORE_WRITE(dev, ADXL345_INT_ENABLE, int_enable);
+	ADXL345_CORE_WRITE(dev, ADXL345_FIFO_CTL, fifo_ctl);
+	ADXL345_CORE_WRITE(dev, ADXL345_POWER_CTL, 0x00);
+	ADXL345_CORE_WRITE(dev, ADXL345_POWER_CTL, ADXL345_MEASURE);
+}
+
+/* INT_SOURCE through DATAZ1 (0x30 to 0x37) in a single burst: INT_SOURCE,
+ * DATA_FORMAT, then the six data bytes. Reading INT_SOURCE clears the tap and
+ * activity bits and reading the data clears DATA_READY, so the caller decodes
+ * everything from this one snapshot. Returns 1 when the sample is new. Not for
+ * FIFO stream mode, where the data read would pop an entry. */
+static inline int adxl345_snapshot(ADXL345_CORE_DEV dev, __u8 * source, __s16 xyz[3]) {
+	__u8 raw[ADXL345_SNAPSHOT_SIZE];
+
+	ADXL345_CORE_MULTI_READ(dev, ADXL345_INT_SOURCE, raw, sizeof(raw));
+	*source = raw[0];
+	adxl345_decode(raw + 2, xyz);
+	return (*source & ADXL345_DATAREADY) ? 1 : 0;
+}
+
+#endif
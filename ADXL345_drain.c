@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include "ADXL345_access.h"
+
+/* FIFO drain benchmark on the simulated ADXL345: the samples/s each BW_RATE
+ * sustains when reading one sample per poll, as accel_read did before FIFO
+ * stream mode, against draining the FIFO.
+ * Usage: ADXL345_drain [-b bus] [-r lo-hi] [-t ms] [-p us]
+ *   -b   sim (the register file, real time, default) or i2csim (the I2C0
+ *        timing model at 400 kHz, virtual time)
+ *   -r   BW_RATE codes to sweep, default 0-15
+ *   -t   time per rate and mode, default 1000 ms
+ *   -p   time between polls, default 1000 us: a reader calling read() once
+ *        per scheduler tick. 0 polls back to back.
+ * "single" polls INT_SOURCE and reads the six data bytes when DATA_READY is
+ * set, "fifo" puts the FIFO in stream mode, reads FIFO_STATUS and drains
+ * every queued entry. For each it reports the samples read, those lost to
+ * overruns and the samples/s read; on i2csim also the bus utilization. */
+
+/* A register backend and the clock its simulated ADXL345 runs on */
+struct drain_model {
+	struct adxl345_bus * bus;
+	uint64_t (*now)(void);
+	void (*idle_until)(uint64_t ns);
+	void (*get_stats)(struct bussim_stats * stats);
+};
+
+struct drain_result {
+	uint64_t read, lost;
+	double rate, bus_pct;
+};
+
+static void sleep_until(uint64_t ns);
+
+static struct drain_model models[] = {
+	{ &sim_bus, accel_now_ns, sleep_until, NULL },
+	{ &i2csim_bus, i2csim_now, i2csim_idle_until, i2csim_get_stats },
+};
+
+static int run(struct drain_model * model, int rate, int fifo, unsigned int ms, uint64_t gap_ns,
+	struct drain_result * result);
+
+volatile sig_atomic_t stop;
+void catchSIGINT (int signum) {
+	stop = 1;
+}
+
+int main(int argc, char * argv[]) {
+
+	struct drain_model * model = &models[0];
+	struct drain_result single, fifo;
+	int opt, lo = 0, hi = 15, rate;
+	unsigned int ms = 1000, i;
+	uint64_t gap_ns = 1000000;
+
+	while ((opt = getopt(argc, argv, "b:r:t:p:")) != -1) {
+		switch (opt) {
+		case 'b' :
+			for (i = 0; i < sizeof(models) / sizeof(models[0]); i++) {
+				if (!strcmp(optarg, models[i].bus->name))
+					break;
+			}
+			if (i == sizeof(models) / sizeof(models[0])) {
+				printf("ERROR: buses are sim and i2csim\n");
+				return(-1);
+			}
+			model = &models[i];
+			break;
+		case 'r' :
+			if (sscanf(optarg, "%d-%d", &lo, &hi) == 1)
+				hi = lo;
+			break;
+		case 't' :
+			ms = atoi(optarg);
+			break;
+		case 'p' :
+			gap_ns = (uint64_t) atoi(optarg) * 1000;
+			break;
+		default :
+			printf("Usage: %s [-b bus] [-r lo-hi] [-t ms] [-p us]\n", argv[0]);
+			return(-1);
+		}
+	}
+	if (lo < 0 || hi > 15 || lo > hi || ms == 0) {
+		printf("ERROR: rates are 0 to 15, time > 0\n");
+		return(-1);
+	}
+
+	stop = 0;
+	signal(SIGINT, catchSIGINT);
+
+	printf("bus %s, %llu us between polls\n", model->bus->name, (unsigned long long) gap_ns / 1000);
+	printf("%4s %9s | %-37s | %-37s\n", "", "", "single", "fifo");
+	printf("%4s %9s | %8s %7s %11s %7s | %8s %7s %11s %7s\n", "rate", "odr_hz", "read", "lost", "samples/s",
+		"bus%", "read", "lost", "samples/s", "bus%");
+	for (rate = lo; rate <= hi && !stop; rate++) {
+		if (run(model, rate, 0, ms, gap_ns, &single) < 0 || run(model, rate, 1, ms, gap_ns, &fifo) < 0)
+			return(-1);
+		printf("%4d %9.3f | %8llu %7llu %11.1f %7.1f | %8llu %7llu %11.1f %7.1f\n", rate,
+			3200.0 / (1 << (15 - rate)), (unsigned long long) single.read, (unsigned long long) single.lost,
+			single.rate, single.bus_pct, (unsigned long long) fifo.read, (unsigned long long) fifo.lost,
+			fifo.rate, fifo.bus_pct);
+	}
+	return 0;
+}
+
+/* One rate in one mode, from a freshly reset sensor */
+static int run(struct drain_model * model, int rate, int fifo, unsigned int ms, uint64_t gap_ns,
+	struct drain_result * result) {
+	struct adxl345_bus * bus = model->bus;
+	struct adxl345_sim_stats sim0, sim1;
+	struct bussim_stats bus0, bus1;
+	uint8_t records[ADXL345_FIFO_DEPTH][ADXL345_RECORD_SIZE];
+	uint8_t source, status;
+	uint64_t start, end;
+
+	memset(&bus0, 0, sizeof(bus0));
+	memset(&bus1, 0, sizeof(bus1));
+	if (bus->open(bus) < 0) {
+		printf("ERROR: unable to open %s\n", bus->name);
+		return -1;
+	}
+	ADXL345_Init(bus);
+	bus->reg_write(bus, ADXL345_INT_ENABLE, 0);
+	if (fifo)
+		bus->reg_write(bus, ADXL345_FIFO_CTL, ADXL345_FIFO_STREAM);
+	ADXL345_SetRate(bus, rate);
+	//Writes are posted, a read waits until they are on the bus
+	bus->reg_read(bus, ADXL345_DEVID, &status);
+
+	if (model->get_stats)
+		model->get_stats(&bus0);
+	ADXL345_sim_get_stats(&sim0);
+	start = model->now();
+	end = start + (uint64_t) ms * 1000000;
+	while (!stop && model->now() < end) {
+		if (fifo)
+			ADXL345_FIFO_Drain(bus, records, ADXL345_FIFO_DEPTH);
+		else {
+			bus->reg_read(bus, ADXL345_INT_SOURCE, &source);
+			if (source & ADXL345_DATAREADY)
+				bus->multi_read(bus, ADXL345_DATAX0, records[0], ADXL345_RECORD_SIZE);
+		}
+		if (gap_ns)
+			model->idle_until(model->now() + gap_ns);
+	}
+	end = model->now();
+	ADXL345_sim_get_stats(&sim1);
+	if (model->get_stats)
+		model->get_stats(&bus1);
+	bus->close(bus);
+
+	result->read = sim1.read - sim0.read;
+	result->lost = sim1.overruns - sim0.overruns;
+	result->rate = result->read * 1e9 / (end - start);
+	result->bus_pct = 100.0 * (bus1.bus_busy_ns - bus0.bus_busy_ns) / (end - start);
+	return 0;
+}
+
+static void sleep_until(uint64_t ns) {
+	struct timespec until;
+
+	until.tv_sec = ns / 1000000000;
+	until.tv_nsec = ns % 1000000000;
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL);
+}
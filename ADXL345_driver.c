@@ -5,9 +5,38 @@
 #include <linux/device.h>
 #include <linux/types.h>
 #include <linux/delay.h>
+#include <linux/interrupt.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/kfifo.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/log2.h>
 #include <asm/io.h>
 #include <asm/uaccess.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/sort.h>
 #include "../address_map_arm.h"
+#include "../ADXL345.h"
+#include "../accel.h"
+#include "../ADXL345_timestamp.h"
+
+#define I2C_XFER_RD(base, offset)			(*((base) + (offset)))
+#define I2C_XFER_WR(base, offset, value)	(*((base) + (offset)) = (value))
+#include "../ADXL345_i2cxfer.h"
+
+#define CREATE_TRACE_POINTS
+#include "../ADXL345_trace.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Dang Nguyen");
@@ -17,31 +46,308 @@ MODULE_VERSION("0.01");
 #define SUCCESS 0
 #define DEVICE_NAME "accel"
 #define ROUNDED_DIVISION(n, d) (((n<0) ^ (d < 0)) ? ((n- d/2)/d) : ((n+d/2)/d))
+#define NUM_COMMANDS 13
+
+#define ACCEL_BATCH					64		// samples returned by one read
+#define ACCEL_LINE_MAX				40		// "1 -1022361 -1022361 -1022361 31\n"
+#define ACCEL_EVENT_DEPTH			64		// events queued per reader, a power of 2
+#define ACCEL_EVENT_BATCH			16		// events returned by one read
+
+/* Up to two sensors, at 0x53 and 0x1D, on each of the four HPS I2C controllers,
+ * and up to four on the SPIM0 chip selects */
+#define ACCEL_MAX_DEVICES			8
+#define I2C_NUM_BUSES				4
+
+/* INT1 of the on-board ADXL345 (I2C0, 0x53) is wired to HPS GPIO61, bit 3 of
+ * the GPIO2 controller */
+#define HPS_GPIO2_IRQ				198
+#define GSENSOR_INT					(1 << 3)
+
+/* DesignWare I2C TX/RX FIFO depth (ADXL345_i2cxfer.h), each FIFO entry needs
+ * 1 address + 6 read commands. The I2C0_* register offsets apply to all four
+ * controllers. */
+#define FIFO_BURST_ENTRIES			(I2C0_FIFO_DEPTH / 7)
+/* Interrupt driven I2C transfers, a whole ADXL345 FIFO drain in one go.
+ * I2C1 to I2C3 interrupts follow I2C0's. */
+#define HPS_I2C0_IRQ				190
+#define I2C0_MAX_CMDS				(ADXL345_FIFO_DEPTH * 7)
+#define I2C0_TIMEOUT_MS				100
+
+/* SPIM0 (DesignWare SSI) for output data rates above what 400 kHz I2C
+ * carries, accel_buses[SPI_BUS]. The SPIM0_* offsets are byte offsets.
+ * 8 bit frames in SPI mode 3, 200 MHz spi_m_clk / 40 = 5 MHz, the ADXL345
+ * maximum. */
+#define SPI_BUS						I2C_NUM_BUSES
+#define SPI_NUM_CS					4
+#define SPIM0_FIFO_DEPTH			256
+#define SPIM0_CTRLR0_MODE3			(0x7 | (1 << 6) | (1 << 7))	// DFS 8 bit, SCPH, SCPOL, TMOD TX and RX
+#define SPIM0_SCKDV					40
+#define SPIM0_BYTE_NS				(8 * SPIM0_SCKDV * 5)		// 1.6 us
+#define SPIM0_TIMEOUT_NS			1000000
+#define SPIM0_REG(offset)			((offset) / 4)
+
+/* Background calibration, see accel_calStart(). 800 Hz through the FIFO,
+ * the first samples at the new rate are dropped while the filter settles. */
+#define CAL_RATE					0x0D
+#define CAL_WATERMARK				16
+#define CAL_SKIP					8
+#define CAL_SAMPLES					128
+#define CAL_1G_UG					(256 * 3900)	// 1 g, 256 LSB at full resolution
+#define CAL_OFS_UG					15600			// offset register LSB
+
+/* Per reader output rates, see accel_publish(). Each stage halves the rate,
+ * so 15 take 3200 Hz down to 0.098 Hz. */
+#define ACCEL_DECIM_STAGES			15
+#define ACCEL_DECIM_TAPS			5
+
+/* One decimate by 2 stage, shared by every reader at or below its output
+ * rate: a 4th order CIC at R = 2, M = 1, which is the FIR 1 4 6 4 1 / 16 */
+struct accel_decim {
+	struct accel_sample hist[ACCEL_DECIM_TAPS - 1];	// last inputs, oldest first
+	int filled;					// inputs in hist
+	int phase;					// an output is due at every other input
+	u16 flags;					// of the inputs since the last output
+};
+
+/* log2 latency histogram, bucket i counts durations of 2^i to 2^(i+1) - 1 ns */
+#define ACCEL_HIST_BUCKETS			28
+struct accel_hist {
+	const char * name;
+	u64 count, total_ns, max_ns;
+	u64 bucket[ACCEL_HIST_BUCKETS];
+};
+
+/* One HPS I2C controller or SPIM0, shared by the sensors on its bus.
+ * Transfers on one bus take turns under lock, different buses run in
+ * parallel. */
+struct accel_bus {
+	int id;
+	int spi;					// SPIM0, see SPI_Frame()
+	char label[8];				// "i2cN" or "spim0"
+	char name[16];
+	volatile int * base;
+	int users;					// sensors on this bus
+	int irq;
+	int use_irq;				// transfers are interrupt driven, see I2C_Transfer_Irq()
+	struct mutex lock;			// one transfer at a time
+	u8 tar;						// sensor currently addressed, see I2C_SetTarget()
+	u16 cmds[I2C0_MAX_CMDS];	// I2C commands, built under lock
+	u8 spi_tx[SPIM0_FIFO_DEPTH], spi_rx[SPIM0_FIFO_DEPTH];
+	u64 spi_ready_ns;			// FIFO pop time of the last data read, see SPI_Read()
+	struct completion done;
+	struct i2c_xfer xfer;		// interrupt driven transfer, see ADXL345_i2cxfer.h
+	struct {
+		u64 rxflr_spins;		// RXFLR polls that found the RX FIFO empty
+		u64 rxflr_ns;			// time spent in those polls
+		u64 irqs;				// controller interrupts
+		u64 errors;				// aborted or timed out transfers
+	} stats;
+};
 
-/* Kernel Character Device Driver /dev/accel */
+/* One sensor, /dev/accelN. Register access and configuration are serialized
+ * by lock, which the acquisition thread holds while it samples. */
+struct accel_dev {
+	int minor;
+	struct accel_bus * bus;
+	u8 address;
+	struct mutex lock;
+	u8 devid;
+	u8 data_format, bw_rate, int_mask, fifo_ctl;
+	s16 XYZ[3];
+	struct accel_sample acq_samples[ADXL345_FIFO_DEPTH], last_sample;
+	u32 sample_seq;
+	int use_irq;				// INT1 wired and requested, else polled at the output data rate
+
+	/* Acquisition thread, the only place the sensor is sampled from. It
+	 * sleeps until INT1, or one output data period when there is none. */
+	struct task_struct * acq_task;
+	wait_queue_head_t acq_wait;
+	int acq_irq;				// interrupt disabled until the thread has read the sensor
+	u64 irq_ns;					// time of that interrupt
+	struct accel_ts ts;			// sample timeline, see ADXL345_timestamp.h
+	int sampling;
+	u64 acq_start, acq_samples_count;	// achieved rate since the last start or rate change
+
+	/* Tap, activity and free-fall detection, see ADXL345_setEvents() */
+	struct accel_event_config events;
+
+	/* Open files receiving samples from accel_publish() */
+	struct list_head readers;
+	spinlock_t readers_lock;
+	wait_queue_head_t wait;
+	struct accel_decim decim[ACCEL_DECIM_STAGES];
+	int decim_stages;			// stages run on the last batch, the others start over when needed
+	struct accel_sample decim_buf[ADXL345_FIFO_DEPTH];
+
+	/* mmap() ring, see struct accel_mmap_ctl. The driver keeps its own head
+	 * and mask since userspace can write the control page. */
+	void * ring;
+	struct accel_mmap_ctl * ring_ctl;
+	struct accel_sample * ring_samples;
+	size_t ring_size;
+	u32 ring_head, ring_mask;
+	struct accel_file * ring_owner;	// the one file mapping the ring, under readers_lock
+
+	/* Calibration state, owned by the acquisition thread while running and
+	 * read by the status interfaces, all under lock */
+	wait_queue_head_t cal_wait;
+	struct accel_calibration cal;
+	s32 cal_ug[3][CAL_SAMPLES];		// collected samples, per axis
+	s32 cal_sorted[CAL_SAMPLES];
+	u8 cal_bw_rate, cal_fifo_ctl;	// restored when the calibration ends
+	u32 cal_scale;
+	int cal_skip;
+
+	/* debugfs statistics, /sys/kernel/debug/accel/accelN/ */
+	struct dentry * debugfs;
+	struct accel_hist hist_reg_read, hist_multi_read, hist_read;
+	struct {
+		u64 samples;			// published to readers
+		u64 empty_polls;		// INT_SOURCE checks that found no new sample
+		u64 stale_reads;		// reads answered with the last sample, R = 0
+		u64 single_taps, double_taps;
+		u64 irqs;
+		u64 events;				// queued to event readers, see accel_events()
+	} stats;
+};
+
+/* Per open file state. Every reader has its own sample ring which the
+ * single producer fills once per sample, see accel_publish() */
+struct accel_file {
+	struct list_head list;
+	struct accel_dev * dev;
+	DECLARE_KFIFO_PTR(fifo, struct accel_sample);
+	struct mutex lock;			// serializes reads, and text with the replies of accel_write
+	u32 overruns;				// samples dropped because the ring was full
+	int overrun;				// flag the next sample read with ACCEL_FLAG_OVERRUN
+	int binary;
+	int mapped;					// mappings of the mmap ring, samples skip fifo while any
+	int events;					// receives event_fifo instead of samples
+	DECLARE_KFIFO(event_fifo, struct accel_event, ACCEL_EVENT_DEPTH);
+	u8 output;					// BW_RATE code of the output rate, ACCEL_OUTPUT_FULL
+	u8 lowpass;					// low-pass shift, 0 for none
+	int lp_primed;
+	s32 lp[3];					// low-pass state, 8 fractional bits
+	struct accel_sample samples[ACCEL_BATCH];
+	char text[ACCEL_BATCH * ACCEL_LINE_MAX];
+	size_t text_len;			// 0 when the next read must collect new samples
+	u64 read_start;				// start of the current read, after any wait for data
+};
+
+/* Kernel Character Device Driver /dev/accelN */
 static int device_open (struct inode * inode, struct file * file);
 static int device_release (struct inode * inode, struct file * filp);
 static ssize_t accel_read (struct file * filp, char * buffer, size_t length, loff_t *offset);
 static ssize_t accel_write (struct file * filp, const char * buffer, size_t length, loff_t *offset);
+static long accel_ioctl (struct file * filp, unsigned int cmd, unsigned long arg);
 static int __init init_accel(void);
 static void __exit stop_accel(void);
 
 /* Module Functions Prototype */
 static void mux_init(void);
-static int I2C0_Init(void);
-static void ADXL345_Init(void);
-static int I2C0_OnOff(unsigned int onoff);
-static void ADXL345_IdRead(u8 *pId);
-static void ADXL345_REG_READ(u8 address, u8 * value);
-static void ADXL345_REG_WRITE(u8 address, u8 value);
-static void ADXL345_REG_MULTI_READ(u8 address, u8 values[], u8 len);
-static int ADXL345_IsDataReady(void);
-static void ADXL345_XYZ_Read(s16 szData16[3]);
-static void ADXL345_Calibrate(void);
-static void ADXL345_updateFormat(char command[], int len);
-static void ADXL345_updateRate(char command[], int len);
+static int accel_probe(int minor, const char * spec);
+static void accel_remove(struct accel_dev * dev);
+static void accel_teardown(void);
+static struct accel_bus * I2C_Get(unsigned int id);
+static struct accel_bus * SPI_Get(void);
+static void accel_bus_put(struct accel_bus * bus);
+static int I2C_Init(struct accel_bus * bus);
+static void SPI_Init(struct accel_bus * bus);
+static void ADXL345_Init(struct accel_dev * dev);
+static int I2C_OnOff(struct accel_bus * bus, unsigned int onoff);
+static void I2C_SetTarget(struct accel_bus * bus, u8 target);
+static void ADXL345_IdRead(struct accel_dev * dev, u8 *pId);
+static void ADXL345_REG_READ(struct accel_dev * dev, u8 address, u8 * value);
+static void ADXL345_REG_WRITE(struct accel_dev * dev, u8 address, u8 value);
+static void ADXL345_REG_MULTI_READ(struct accel_dev * dev, u8 address, u8 values[], u8 len);
+static void ADXL345_REG_MULTI_WRITE(struct accel_dev * dev, u8 address, u8 values[], u8 len);
+static void ADXL345_REG_BURST_READ(struct accel_dev * dev, u8 address, u8 values[], u8 len, u8 count);
+static int ADXL345_FIFO_Drain(struct accel_dev * dev, struct accel_sample samples[], int max, u64 * status_ns);
+static void ADXL345_updateFifo(struct accel_dev * dev, char command[], int len);
+static int ADXL345_Snapshot(struct accel_dev * dev, u8 * source, s16 szData16[3]);
+static int ADXL345_updateFormat(struct accel_dev * dev, char * arg);
+static int ADXL345_updateRate(struct accel_dev * dev, char * arg);
 static int get_command(char * arr);
-static void ADXL345_Calibrate(void);
+static u8 ADXL345_IntEnable(struct accel_dev * dev);
+static size_t accel_format(struct accel_dev * dev, char * text, struct accel_sample samples[], int count);
+static size_t accel_format_line(char * text, int fresh, struct accel_sample * sample);
+static int accel_collect(struct file * filp, struct accel_sample samples[], int max);
+static ssize_t accel_read_binary(struct file * filp, char * buffer, size_t length);
+static ssize_t accel_read_events(struct file * filp, char * buffer, size_t length);
+static void accel_events(struct accel_dev * dev, u8 source, struct accel_sample samples[], int count);
+static void accel_setEventMode(struct accel_file * af, int on);
+static void accel_updateThreshold(struct file * filp, char * arg);
+static int ADXL345_setEvents(struct accel_dev * dev, struct accel_event_config * cfg);
+static void accel_stamp(struct accel_dev * dev, struct accel_sample samples[], int count, u8 source, int obs, u64 obs_ns);
+static u32 ADXL345_Scale(struct accel_dev * dev);
+static void accel_updateMode(struct file * filp, char * arg);
+static int accel_updateDepth(struct file * filp, char * arg);
+static int accel_setDepth(struct accel_file * af, unsigned int n);
+static void accel_updateOutput(struct file * filp, char * arg);
+static int accel_setOutput(struct accel_file * af, unsigned int rate);
+static void accel_updateLowpass(struct file * filp, char * arg);
+static int accel_setLowpass(struct accel_file * af, unsigned int shift);
+static int ADXL345_setRate(struct accel_dev * dev, unsigned int rate);
+static int ADXL345_setFormat(struct accel_dev * dev, u8 format);
+static int ADXL345_rangeCode(unsigned int g);
+static int ADXL345_setFifo(struct accel_dev * dev, unsigned int watermark);
+static int ADXL345_setIntMask(struct accel_dev * dev, unsigned int mask);
+static void ADXL345_setOffsets(struct accel_dev * dev, struct accel_offsets * ofs);
+static void ADXL345_getOffsets(struct accel_dev * dev, struct accel_offsets * ofs);
+static int ADXL345_setConfig(struct accel_dev * dev, struct accel_config * cfg);
+static void ADXL345_getConfig(struct accel_dev * dev, struct accel_config * cfg);
+static int accel_updateCalibrate(struct file * filp, char * arg);
+static int accel_calStart(struct accel_dev * dev);
+static void accel_calFeed(struct accel_dev * dev, struct accel_sample samples[], int count);
+static void accel_calFinish(struct accel_dev * dev);
+static void accel_calEnd(struct accel_dev * dev, u32 state);
+static void accel_calMode(struct accel_dev * dev, u8 rate, u8 fifo);
+static int accel_calCompare(const void * a, const void * b);
+static s32 accel_calMedian(s32 values[], s32 sorted[], int n);
+static void accel_publish(struct accel_dev * dev, struct accel_sample samples[], int count);
+static void accel_deliver(struct accel_file * af, struct accel_sample samples[], int count);
+static int accel_decimate(struct accel_decim * st, struct accel_sample samples[], int count);
+static void accel_lowpass(struct accel_file * af, struct accel_sample * sample);
+static void accel_acquire(struct accel_dev * dev);
+static int accel_acq_thread(void * data);
+static void accel_updateSampling(struct file * filp, char * arg);
+static u64 ADXL345_Period(struct accel_dev * dev);
+static u64 accel_achieved(struct accel_dev * dev);
+static void accel_stats_reset(struct accel_dev * dev);
+static void accel_hist_add(struct accel_hist * hist, u64 ns);
+static int accel_debugfs_init(struct accel_dev * dev);
+static int accel_debugfs_show(struct seq_file * m, void * v);
+static int accel_debugfs_open(struct inode * inode, struct file * file);
+static ssize_t accel_debugfs_reset(struct file * filp, const char __user * buffer, size_t length, loff_t * offset);
+static int accel_throughput_show(struct seq_file * m, void * v);
+static int accel_throughput_open(struct inode * inode, struct file * file);
+static unsigned int accel_poll (struct file * filp, poll_table * wait);
+static int accel_mmap (struct file * filp, struct vm_area_struct * vma);
+static int accel_ring_init(struct accel_dev * dev);
+static void accel_ring_push(struct accel_dev * dev, struct accel_sample samples[], int count);
+static irqreturn_t accel_irq_handler(int irq, void * dev_id);
+static int accel_irq_init(struct accel_dev * dev);
+static void accel_irq_exit(struct accel_dev * dev);
+static int accel_bus_read(struct accel_dev * dev, u8 address, u8 values[], u8 len, u8 count);
+static int accel_bus_write(struct accel_dev * dev, u8 address, u8 values[], u8 len);
+static int I2C_Read(struct accel_bus * bus, u8 target, u8 address, u8 values[], u8 len, u8 count);
+static int I2C_Write(struct accel_bus * bus, u8 target, u8 address, u8 values[], u8 len);
+static int SPI_Read(struct accel_bus * bus, u8 cs, u8 address, u8 values[], u8 len, u8 count);
+static int SPI_Write(struct accel_bus * bus, u8 cs, u8 address, u8 values[], u8 len);
+static int SPI_Frame(struct accel_bus * bus, u8 cs, int len);
+static int I2C_Transfer(struct accel_bus * bus, u8 target, u16 cmds[], int ncmds, u8 rx[], int nrx);
+static int I2C_Transfer_Poll(struct accel_bus * bus, u16 cmds[], int ncmds, u8 rx[], int nrx);
+static int I2C_Transfer_Irq(struct accel_bus * bus, u16 cmds[], int ncmds, u8 rx[], int nrx);
+static irqreturn_t I2C_irq_handler(int irq, void * dev_id);
+static int I2C_irq_init(struct accel_bus * bus);
+static void I2C_irq_exit(struct accel_bus * bus);
+
+/* Initialization sequence, detection registers, snapshot, scale and period */
+#define ADXL345_CORE_DEV								struct accel_dev *
+#define ADXL345_CORE_WRITE(dev, address, value)			ADXL345_REG_WRITE(dev, address, value)
+#define ADXL345_CORE_MULTI_WRITE(dev, address, values, len)	ADXL345_REG_MULTI_WRITE(dev, address, values, len)
+#define ADXL345_CORE_MULTI_READ(dev, address, values, len)	ADXL345_REG_MULTI_READ(dev, address, values, len)
+#include "../ADXL345_core.h"
 
 /* Character Kernel Variables */
 static dev_t accel_no = 0;
@@ -53,25 +359,73 @@ static struct file_operations accel_fops = {
 	.open = device_open,
 	.release = device_release,
 	.read = accel_read,
-	.write = accel_write
+	.write = accel_write,
+	.unlocked_ioctl = accel_ioctl,
+	.poll = accel_poll,
+	.mmap = accel_mmap
 };
 
 /* Module Variables */
-static volatile int * I2C0_ptr, * SYSMGR_ptr, *LEDR_ptr, * LW_virtual;
-static u8 devid;
-static u8 mg_per_lsb = 3;
-static u16 XYZ[3];
-static char reg_read[256], reg_write[256];
-static s16 new_data, xmg, ymg, zmg;
-static unsigned int ind_read = 0, ind_write = 0;
-static unsigned int write_Empty = 0, calibrate = 0;
-static char * commands[5] = {"device", "init", "calibrate", "format", "rate"};
+static volatile int * SYSMGR_ptr, *LEDR_ptr, * LW_virtual, * GPIO2_ptr;
+static struct accel_bus accel_buses[I2C_NUM_BUSES + 1];	// I2C0 to I2C3, SPIM0
+static struct accel_dev * accel_devs[ACCEL_MAX_DEVICES];	// by minor, NULL where no sensor answered
+static char * sensors[ACCEL_MAX_DEVICES] = { "0:0x53" };
+static int num_sensors = 1;
+module_param_array(sensors, charp, &num_sensors, S_IRUGO);
+MODULE_PARM_DESC(sensors, "Sensors as bus:address, bus 0 to 3 for I2C0 to I2C3, address 0x53 or 0x1D, "
+	"or as spi:cs for SPIM0 chip select 0 to 3. The Nth entry is /dev/accelN");
+static int irq = HPS_GPIO2_IRQ;
+module_param(irq, int, S_IRUGO);
+MODULE_PARM_DESC(irq, "INT1 interrupt of the on-board ADXL345 (I2C0, 0x53), 0 polls it at the output data rate");
+static int i2c_irq[I2C_NUM_BUSES] = { HPS_I2C0_IRQ, HPS_I2C0_IRQ + 1, HPS_I2C0_IRQ + 2, HPS_I2C0_IRQ + 3 };
+module_param_array(i2c_irq, int, NULL, S_IRUGO);
+MODULE_PARM_DESC(i2c_irq, "I2C0 to I2C3 controller interrupts, 0 polls the RX FIFO during that controller's transfers");
+static unsigned int depth = 256;
+module_param(depth, uint, S_IRUGO);
+MODULE_PARM_DESC(depth, "Default samples buffered per reader, rounded up to a power of 2");
+
+static unsigned int mmap_records = 4096;
+module_param(mmap_records, uint, S_IRUGO);
+MODULE_PARM_DESC(mmap_records, "Records in each sensor's mmap() ring, rounded up to a power of 2, at least 64");
+
+/* debugfs statistics, /sys/kernel/debug/accel/ */
+static struct dentry * accel_debugfs = NULL;
+static DEFINE_SPINLOCK(stats_lock);
+
+static const struct file_operations accel_debugfs_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = accel_debugfs_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release
+};
+
+static const struct file_operations accel_debugfs_reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = accel_debugfs_reset
+};
+
+static const struct file_operations accel_debugfs_throughput_fops = {
+	.owner = THIS_MODULE,
+	.open = accel_throughput_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release
+};
+
+static char * commands[NUM_COMMANDS] = {"device", "init", "calibrate", "format", "rate", "fifo", "mode",
+	"depth", "overruns", "sampling", "output", "lowpass", "threshold"};
+
+/* "threshold NAME VALUE" names, in struct accel_event_config order */
+static const char * threshold_names[] = {"tap", "dur", "latent", "window", "act", "inact", "time_inact",
+	"act_inact_ctl", "ff", "time_ff", "tap_axes"};
 
 static int __init init_accel(void) {
 
-	int err = 0;
-	//Register char device in a range of no
-	if ((err = alloc_chrdev_region (&accel_no, 0, 1, DEVICE_NAME)) < 0) {
+	int err = 0, i, found = 0;
+	//Register char device in a range of no, one minor per possible sensor
+	if ((err = alloc_chrdev_region (&accel_no, 0, ACCEL_MAX_DEVICES, DEVICE_NAME)) < 0) {
 		printk(KERN_ERR "chardev: alloc_chrdev_region() error %d\n", err);
 		return err;
 	}
@@ -81,83 +435,981 @@ static int __init init_accel(void) {
 	accel_cdev->ops = &accel_fops;
 	accel_cdev->owner = THIS_MODULE;
 
-	if ((err = cdev_add(accel_cdev, accel_no, 1)) < 0) {
+	if ((err = cdev_add(accel_cdev, accel_no, ACCEL_MAX_DEVICES)) < 0) {
 		printk(KERN_ERR "chardev: cdev_add() error %d\n", err);
 		return err;
 	}
 
-	device_create(accel_class, NULL, accel_no, NULL, DEVICE_NAME);
-
 	//Accelerometer Initialization
-	printk("Initializing Accelerometer\n");
-	I2C0_ptr = ioremap_nocache(I2C0_BASE, I2C0_SPAN);
+	printk("Initializing Accelerometers\n");
 	SYSMGR_ptr = ioremap_nocache(SYSMGR_BASE, SYSMGR_SPAN);
 	LW_virtual = ioremap_nocache(LW_BRIDGE_BASE, LW_BRIDGE_SPAN);
 
 	LEDR_ptr = LW_virtual + LEDR_BASE;
 	*LEDR_ptr = 0;
 
-	if ((I2C0_ptr == 0) || (SYSMGR_ptr == NULL)) 
+	if (SYSMGR_ptr == NULL)
 		printk (KERN_ERR "Error: ioremap_nocache returned NULL\n");
 
 	mux_init();
-	I2C0_Init();
-	ADXL345_Init();
 
-	ADXL345_IdRead(&devid);
-	if (devid == 0xE5)
-		printk("Found ADXL345\n");
-	
+	accel_debugfs = debugfs_create_dir(DEVICE_NAME, NULL);
+	if (IS_ERR_OR_NULL(accel_debugfs)) {
+		printk("No debugfs statistics\n");
+		accel_debugfs = NULL;
+	}
+	else
+		debugfs_create_file("throughput", S_IRUGO, accel_debugfs, NULL, &accel_debugfs_throughput_fops);
+
+	for (i = 0; i < num_sensors; i++) {
+		if ((err = accel_probe(i, sensors[i])) < 0)
+			printk("No /dev/accel%d for \"%s\" (%d)\n", i, sensors[i], err);
+		else
+			found++;
+	}
+	if (!found) {
+		accel_teardown();
+		return -ENODEV;
+	}
 	return 0;
 }
 
 static void __exit stop_accel(void) {
+	accel_teardown();
+}
+
+static void accel_teardown(void) {
+	int i;
+
+	for (i = 0; i < ACCEL_MAX_DEVICES; i++) {
+		if (accel_devs[i])
+			accel_remove(accel_devs[i]);
+	}
+	debugfs_remove_recursive(accel_debugfs);
 	*LEDR_ptr = 0;
 	iounmap(LW_virtual);
-	iounmap(I2C0_ptr);
 	iounmap (SYSMGR_ptr);
-	device_destroy(accel_class, accel_no);
 	cdev_del(accel_cdev);
 	class_destroy(accel_class);
-	unregister_chrdev_region(accel_no, 1);
+	unregister_chrdev_region(accel_no, ACCEL_MAX_DEVICES);
+}
+
+/* Bring up sensor minor from a "bus:address" or "spi:cs" spec: map the
+ * controller on its first use, check DEVID, configure the sensor and start
+ * its acquisition thread, then create /dev/accel<minor>. Only the on-board
+ * sensor has INT1 wired, every other one is polled. */
+static int accel_probe(int minor, const char * spec) {
+	struct accel_dev * dev;
+	struct accel_bus * bus;
+	unsigned int id;
+	int address, err;
+
+	if (sscanf(spec, "spi:%i", &address) == 1) {
+		if (address < 0 || address >= SPI_NUM_CS)
+			return -EINVAL;
+		bus = SPI_Get();
+	}
+	else {
+		if (sscanf(spec, "%u:%i", &id, &address) != 2 || id >= I2C_NUM_BUSES ||
+			(address != ADXL345_I2C_ADDR && address != ADXL345_I2C_ADDR_ALT))
+			return -EINVAL;
+		bus = I2C_Get(id);
+	}
+	if (bus == NULL)
+		return -ENOMEM;
+	dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+	if (dev == NULL) {
+		accel_bus_put(bus);
+		return -ENOMEM;
+	}
+
+	dev->minor = minor;
+	dev->bus = bus;
+	dev->address = address;
+	mutex_init(&dev->lock);
+	dev->data_format = 0x03;
+	dev->bw_rate = 0x07;
+	dev->int_mask = 0x78;
+	dev->events = adxl345_event_defaults;
+	dev->fifo_ctl = ADXL345_FIFO_BYPASS;
+	dev->sampling = 1;
+	init_waitqueue_head(&dev->acq_wait);
+	init_waitqueue_head(&dev->wait);
+	init_waitqueue_head(&dev->cal_wait);
+	INIT_LIST_HEAD(&dev->readers);
+	spin_lock_init(&dev->readers_lock);
+	dev->hist_reg_read.name = "reg_read";
+	dev->hist_multi_read.name = "multi_read";
+	dev->hist_read.name = "accel_read";
+
+	mutex_lock(&dev->lock);
+	ADXL345_IdRead(dev, &dev->devid);
+	mutex_unlock(&dev->lock);
+	if (dev->devid != ADXL345_ID) {
+		printk("No ADXL345 on %s at %#x, DEVID %#x\n", bus->label, address, dev->devid);
+		kfree(dev);
+		accel_bus_put(bus);
+		return -ENODEV;
+	}
+	printk("Found ADXL345 on %s at %#x\n", bus->label, address);
+
+	if ((err = accel_ring_init(dev)) < 0)
+		printk(KERN_ERR "Unable to allocate the mmap ring %d\n", err);
+
+	if (bus->id == 0 && address == ADXL345_I2C_ADDR) {
+		if ((err = accel_irq_init(dev)) < 0)
+			printk("No ADXL345 interrupt (%d), polling at the output data rate\n", err);
+		else
+			dev->use_irq = 1;
+	}
 
+	mutex_lock(&dev->lock);
+	ADXL345_Init(dev);
+	mutex_unlock(&dev->lock);
+
+	if ((err = accel_debugfs_init(dev)) < 0)
+		printk("No debugfs statistics %d\n", err);
+
+	accel_stats_reset(dev);
+	dev->acq_task = kthread_run(accel_acq_thread, dev, "accel_acq/%d", minor);
+	if (IS_ERR(dev->acq_task)) {
+		printk(KERN_ERR "Unable to start the acquisition thread %ld\n", PTR_ERR(dev->acq_task));
+		dev->acq_task = NULL;
+	}
+
+	accel_devs[minor] = dev;
+	device_create(accel_class, NULL, MKDEV(MAJOR(accel_no), minor), NULL, DEVICE_NAME "%d", minor);
+	return 0;
+}
+
+/* No file can be open, the module is referenced while one is */
+static void accel_remove(struct accel_dev * dev) {
+	device_destroy(accel_class, MKDEV(MAJOR(accel_no), dev->minor));
+	accel_devs[dev->minor] = NULL;
+	if (dev->acq_task)
+		kthread_stop(dev->acq_task);
+	accel_irq_exit(dev);
+	debugfs_remove_recursive(dev->debugfs);
+	vfree(dev->ring);
+	accel_bus_put(dev->bus);
+	kfree(dev);
 }
 
 
 static int device_open(struct inode * inode, struct file * file) {
+	struct accel_file * af;
+	struct accel_dev * dev;
+
+	if (iminor(inode) >= ACCEL_MAX_DEVICES || (dev = accel_devs[iminor(inode)]) == NULL)
+		return -ENODEV;
+
+	af = kzalloc(sizeof(*af), GFP_KERNEL);
+	if (af == NULL)
+		return -ENOMEM;
+	if (kfifo_alloc(&af->fifo, max(depth, 2U), GFP_KERNEL)) {
+		kfree(af);
+		return -ENOMEM;
+	}
+	mutex_init(&af->lock);
+	af->dev = dev;
+	af->output = ACCEL_OUTPUT_FULL;
+	INIT_KFIFO(af->event_fifo);
+	file->private_data = af;
+
+	spin_lock(&dev->readers_lock);
+	list_add_tail(&af->list, &dev->readers);
+	spin_unlock(&dev->readers_lock);
 	return SUCCESS;
 }
 
 static int device_release(struct inode * inode, struct file * file) {
+	struct accel_file * af = file->private_data;
+	struct accel_dev * dev = af->dev;
+
+	spin_lock(&dev->readers_lock);
+	list_del(&af->list);
+	spin_unlock(&dev->readers_lock);
+
+	kfifo_free(&af->fifo);
+	kfree(af);
 	return 0;
 }
 
-//Returns New XX YY ZZ SS, SS = Scaling Factor
-static ssize_t accel_read (struct file * filp, char * buffer, size_t length, loff_t *offset) {
-	
-	if (!ind_write && write_Empty) {
-		if(ADXL345_IsDataReady()) {
-			ADXL345_XYZ_Read(XYZ);
-			xmg = XYZ[0]*mg_per_lsb;
-			ymg = XYZ[1]*mg_per_lsb; 
-			zmg = XYZ[2]*mg_per_lsb;
-			new_data = 1;
+/* Hand count new samples to every reader. Readers below the sensor rate
+ * take the output of the decimation stage of their rate; each stage runs
+ * once per batch for all of them, and only as far as the slowest reader
+ * needs, so a low rate reader costs a few adds per sample. */
+static void accel_publish(struct accel_dev * dev, struct accel_sample samples[], int count) {
+	struct accel_file * af;
+	int rate = dev->bw_rate & 0x0F;
+	int stage, stages = 0;
+
+	if (!count)
+		return;
+
+	accel_ring_push(dev, samples, count);
+
+	spin_lock(&dev->readers_lock);
+	list_for_each_entry(af, &dev->readers, list) {
+		if (af->mapped || af->events)
+			continue;
+		if (af->output >= rate)
+			accel_deliver(af, samples, count);
+		else
+			stages = max(stages, rate - af->output);
+	}
+
+	if (stages)
+		memcpy(dev->decim_buf, samples, count * sizeof(samples[0]));
+	for (stage = 1; stage <= stages; stage++) {
+		if (stage > dev->decim_stages)
+			memset(&dev->decim[stage - 1], 0, sizeof(dev->decim[0]));
+		count = accel_decimate(&dev->decim[stage - 1], dev->decim_buf, count);
+		if (!count)
+			continue;
+		list_for_each_entry(af, &dev->readers, list) {
+			if (!af->mapped && !af->events && af->output < rate && rate - af->output == stage)
+				accel_deliver(af, dev->decim_buf, count);
+		}
+	}
+	//A stage skipped for a batch has a gap in its history
+	dev->decim_stages = stages;
+	spin_unlock(&dev->readers_lock);
+	wake_up_interruptible(&dev->wait);
+}
+
+/* Queue count samples on one reader's ring. A full ring loses its oldest
+ * samples and has them added to its overrun count. Called with
+ * readers_lock held. */
+static void accel_deliver(struct accel_file * af, struct accel_sample samples[], int count) {
+	struct accel_sample sample;
+	int skip, dropped, i;
+
+	//Samples beyond the ring size can never be kept
+	skip = max_t(int, count - (int) kfifo_size(&af->fifo), 0);
+	dropped = skip;
+	while ((int) kfifo_avail(&af->fifo) < count - skip) {
+		kfifo_skip(&af->fifo);
+		dropped++;
+	}
+	if (dropped) {
+		af->overruns += dropped;
+		af->overrun = 1;
+	}
+
+	if (!af->lowpass) {
+		kfifo_in(&af->fifo, samples + skip, count - skip);
+		return;
+	}
+	//The filter sees every sample, kept or not
+	for (i = 0; i < count; i++) {
+		sample = samples[i];
+		accel_lowpass(af, &sample);
+		if (i >= skip)
+			kfifo_put(&af->fifo, sample);
+	}
+}
+
+#define ACCEL_FIR(st, in, c)		((s16) (((st)->hist[0].c + 4 * (st)->hist[1].c + 6 * (st)->hist[2].c + \
+	4 * (st)->hist[3].c + (in).c + 8) >> 4))
+
+/* Run count samples through one stage in place, returning how many outputs
+ * it left at the front of samples. An output has the time and sequence
+ * number of the input at the middle tap, which is where the filter puts it,
+ * and the flags of every input since the previous output. */
+static int accel_decimate(struct accel_decim * st, struct accel_sample samples[], int count) {
+	struct accel_sample in, out;
+	int i, outputs = 0;
+
+	for (i = 0; i < count; i++) {
+		in = samples[i];
+		st->flags |= in.flags;
+		if (st->filled < ACCEL_DECIM_TAPS - 1) {
+			st->hist[st->filled++] = in;
+			continue;
+		}
+		if ((st->phase ^= 1)) {
+			out = st->hist[ACCEL_DECIM_TAPS / 2];
+			out.x = ACCEL_FIR(st, in, x);
+			out.y = ACCEL_FIR(st, in, y);
+			out.z = ACCEL_FIR(st, in, z);
+			out.flags = st->flags | ACCEL_FLAG_FILTERED;
+			st->flags = 0;
+			samples[outputs++] = out;
+		}
+		memmove(st->hist, st->hist + 1, sizeof(st->hist[0]) * (ACCEL_DECIM_TAPS - 2));
+		st->hist[ACCEL_DECIM_TAPS - 2] = in;
+	}
+	return outputs;
+}
+
+/* Single pole low-pass of one reader, y += (x - y) / 2^lowpass */
+static void accel_lowpass(struct accel_file * af, struct accel_sample * sample) {
+	s16 * axes[3] = { &sample->x, &sample->y, &sample->z };
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		if (!af->lp_primed)
+			af->lp[i] = *axes[i] * 256;
+		else
+			af->lp[i] += (*axes[i] * 256 - af->lp[i]) >> af->lowpass;
+		*axes[i] = (s16) ((af->lp[i] + 128) >> 8);
+	}
+	af->lp_primed = 1;
+	sample->flags |= ACCEL_FLAG_FILTERED;
+}
+
+/* Format count samples into text, one line each, returning the length.
+ * With no new samples the last values are repeated with R = 0 */
+static size_t accel_format(struct accel_dev * dev, char * text, struct accel_sample samples[], int count) {
+	int i;
+	size_t pos = 0;
+
+	if (!count)
+		return accel_format_line(text, 0, &dev->last_sample);
+
+	for (i = 0; i < count; i++)
+		pos += accel_format_line(text + pos, 1, &samples[i]);
+	return pos;
+}
+
+/* "R X Y Z SS" in mg from the exact ug per LSB scale, so 3.9 mg per LSB is
+ * no longer truncated to 3. SS is the scale rounded to whole mg. */
+static size_t accel_format_line(char * text, int fresh, struct accel_sample * sample) {
+	s32 scale = sample->scale;
+
+	return sprintf(text, "%d %d %d %d %d\n", fresh, sample->x * scale / 1000,
+		sample->y * scale / 1000, sample->z * scale / 1000, DIV_ROUND_CLOSEST(scale, 1000));
+}
+
+/* Fill in time, sequence, scale and INT_SOURCE flags of freshly read samples.
+ * Sample obs of them existed by obs_ns, which places the batch on the sample
+ * timeline; each sample then gets its own time from the estimated period. */
+static void accel_stamp(struct accel_dev * dev, struct accel_sample samples[], int count, u8 source, int obs, u64 obs_ns) {
+	int i;
+	u16 flags = ACCEL_FLAG_NEW;
+
+	if (dev->data_format & 0x08)
+		flags |= ACCEL_FLAG_FULL_RES;
+	if (dev->cal.state == ACCEL_CAL_RUNNING)
+		flags |= ACCEL_FLAG_CALIBRATING;
+	if (source & ADXL345_SINGLE)
+		flags |= ACCEL_FLAG_SINGLE_TAP;
+	if (source & ADXL345_DOUBLE)
+		flags |= ACCEL_FLAG_DOUBLE_TAP;
+	if (source & ADXL345_ACTIVITY)
+		flags |= ACCEL_FLAG_ACTIVITY;
+	if (source & ADXL345_INACTIVITY)
+		flags |= ACCEL_FLAG_INACTIVITY;
+	if (source & ADXL345_FREEFALL)
+		flags |= ACCEL_FLAG_FREE_FALL;
+
+	accel_ts_batch(&dev->ts, count, obs, obs_ns, source & ADXL345_OVERRUN);
+	for (i = 0; i < count; i++) {
+		samples[i].timestamp = accel_ts_stamp(&dev->ts, i);
+		samples[i].seq = dev->sample_seq++;
+		samples[i].flags = flags;
+		samples[i].scale = ADXL345_Scale(dev);
+		trace_accel_sample(dev->minor, samples[i].seq, samples[i].x, samples[i].y, samples[i].z, flags);
+	}
+	if (count)
+		dev->last_sample = samples[count - 1];
+}
+
+/* Control page followed by the page aligned records. A batch is at most
+ * ACCEL_MMAP_BATCH records, and the ring holds at least two. */
+static int accel_ring_init(struct accel_dev * dev) {
+	u32 records = roundup_pow_of_two(max(mmap_records, 2U * ACCEL_MMAP_BATCH));
+
+	BUILD_BUG_ON(ADXL345_FIFO_DEPTH > ACCEL_MMAP_BATCH);
+
+	dev->ring_size = PAGE_SIZE + PAGE_ALIGN(records * sizeof(struct accel_sample));
+	dev->ring = vmalloc_user(dev->ring_size);
+	if (dev->ring == NULL)
+		return -ENOMEM;
+
+	dev->ring_ctl = dev->ring;
+	dev->ring_samples = dev->ring + PAGE_SIZE;
+	dev->ring_mask = records - 1;
+	dev->ring_ctl->records = records;
+	dev->ring_ctl->record_size = sizeof(struct accel_sample);
+	dev->ring_ctl->offset = PAGE_SIZE;
+	return 0;
+}
+
+/* Single producer, called with the device lock held. Records are written
+ * before head is released so a consumer never sees head ahead of the data. */
+static void accel_ring_push(struct accel_dev * dev, struct accel_sample samples[], int count) {
+	int i;
+
+	if (dev->ring == NULL)
+		return;
+	for (i = 0; i < count; i++)
+		dev->ring_samples[(dev->ring_head + i) & dev->ring_mask] = samples[i];
+	dev->ring_head += count;
+	smp_store_release(&dev->ring_ctl->head, dev->ring_head);
+}
+
+/* The ring has a single tail, so one file maps it at a time and a second
+ * one gets EBUSY. That file may map it more than once, and fork() and
+ * partial munmap() copy or split its mappings; each is counted in
+ * af->mapped, and the file gets its samples through read() again once the
+ * last one is gone. */
+static void accel_vma_open(struct vm_area_struct * vma) {
+	struct accel_file * af = vma->vm_private_data;
+
+	spin_lock(&af->dev->readers_lock);
+	af->mapped++;
+	spin_unlock(&af->dev->readers_lock);
+}
+
+static void accel_vma_close(struct vm_area_struct * vma) {
+	struct accel_file * af = vma->vm_private_data;
+	struct accel_dev * dev = af->dev;
+
+	spin_lock(&dev->readers_lock);
+	if (--af->mapped == 0)
+		dev->ring_owner = NULL;
+	spin_unlock(&dev->readers_lock);
+}
+
+static const struct vm_operations_struct accel_vm_ops = {
+	.open = accel_vma_open,
+	.close = accel_vma_close,
+};
+
+static int accel_mmap (struct file * filp, struct vm_area_struct * vma) {
+	struct accel_file * af = filp->private_data;
+	struct accel_dev * dev = af->dev;
+	int err;
+
+	if (dev->ring == NULL)
+		return -ENODEV;
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start > dev->ring_size)
+		return -EINVAL;
+
+	//Samples now reach this file through the ring only
+	spin_lock(&dev->readers_lock);
+	if (dev->ring_owner != NULL && dev->ring_owner != af) {
+		spin_unlock(&dev->readers_lock);
+		return -EBUSY;
+	}
+	dev->ring_owner = af;
+	af->mapped++;
+	spin_unlock(&dev->readers_lock);
+
+	vma->vm_private_data = af;
+	vma->vm_ops = &accel_vm_ops;
+	if ((err = remap_vmalloc_range(vma, dev->ring, 0)) < 0)
+		accel_vma_close(vma);
+	return err;
+}
+
+/* Read INT_SOURCE and whatever samples are new, then publish them to every
+ * reader. Outside FIFO stream mode both come from one ADXL345_Snapshot()
+ * burst. The interrupt dates the sample that raised it, the watermark entry
+ * or the data ready one, unless an event shares INT1 or samples were lost
+ * since; otherwise the newest sample existed by the time it was found.
+ * Called from the device's acquisition thread only. */
+static void accel_acquire(struct accel_dev * dev) {
+	u8 source;
+	int count = 0, obs = 0;
+	u64 obs_ns = 0;
+	int watermark = dev->fifo_ctl & ADXL345_FIFO_ENTRIES;
+	u8 irq_sources = dev->int_mask | ADXL345_OVERRUN;
+
+	mutex_lock(&dev->lock);
+	if (dev->fifo_ctl & ADXL345_FIFO_STREAM) {
+		ADXL345_REG_READ(dev, ADXL345_INT_SOURCE, &source);
+		if (!dev->use_irq || (source & ADXL345_WATERMARK))
+			count = ADXL345_FIFO_Drain(dev, dev->acq_samples, ADXL345_FIFO_DEPTH, &obs_ns);
+		obs = count - 1;
+		if (dev->use_irq && !(source & irq_sources) && watermark && count >= watermark) {
+			obs = watermark - 1;
+			obs_ns = dev->irq_ns;
+		}
+	}
+	else if (ADXL345_Snapshot(dev, &source, dev->XYZ)) {
+		dev->acq_samples[0].x = dev->XYZ[0];
+		dev->acq_samples[0].y = dev->XYZ[1];
+		dev->acq_samples[0].z = dev->XYZ[2];
+		count = 1;
+		obs_ns = (dev->use_irq && !(source & irq_sources)) ? dev->irq_ns : ktime_get_ns();
+	}
+
+	if (source & ADXL345_DOUBLE) {
+		trace_accel_tap(dev->minor, source);
+		dev->stats.double_taps++;
+		*LEDR_ptr ^= 0x2;
+	}
+	else if (source & ADXL345_SINGLE) {
+		trace_accel_tap(dev->minor, source);
+		dev->stats.single_taps++;
+		*LEDR_ptr ^= 0x1;
+	}
+	trace_accel_data_ready(dev->minor, source, count);
+	accel_stamp(dev, dev->acq_samples, count, source, obs, obs_ns);
+	if (source & ACCEL_INT_MASK)
+		accel_events(dev, source, dev->acq_samples, count);
+	if (dev->cal.state == ACCEL_CAL_RUNNING)
+		accel_calFeed(dev, dev->acq_samples, count);
+	accel_publish(dev, dev->acq_samples, count);
+	dev->acq_samples_count += count;
+	dev->stats.samples += count;
+	if (!count)
+		dev->stats.empty_polls++;
+	mutex_unlock(&dev->lock);
+}
+
+/* One thread per sensor, so sensors on different controllers are sampled in
+ * parallel; sensors sharing a controller take turns per transfer */
+static int accel_acq_thread(void * data) {
+	struct accel_dev * dev = data;
+	u64 period, next = 0, now;
+	ktime_t until;
+
+	while (!kthread_should_stop()) {
+		if (!dev->sampling) {
+			wait_event_interruptible(dev->acq_wait, dev->sampling || kthread_should_stop());
+			continue;
+		}
+
+		if (dev->use_irq) {
+			wait_event_interruptible(dev->acq_wait, dev->acq_irq || !dev->sampling || kthread_should_stop());
+			if (!dev->acq_irq)
+				continue;
 		}
 		else {
-			new_data = 0;
+			//Poll twice per sample, or once per watermark worth of samples, on
+			//deadlines a period apart so a late wakeup does not delay the next.
+			//In bypass mode every sample then meets a poll as long as wakeups
+			//are less than half a period late.
+			period = ADXL345_Period(dev);
+			if (dev->fifo_ctl & ADXL345_FIFO_STREAM)
+				period *= dev->fifo_ctl & ADXL345_FIFO_ENTRIES;
+			else
+				period /= 2;
+			now = ktime_get_ns();
+			next += period;
+			if (next + period < now)
+				next = now;
+			else if (next > now + period)
+				next = now + period;
+			if (next > now && period < 20 * NSEC_PER_MSEC) {
+				until = ns_to_ktime(next);
+				set_current_state(TASK_INTERRUPTIBLE);
+				schedule_hrtimeout_range(&until, period / 8, HRTIMER_MODE_ABS);
+			}
+			else if (next > now)
+				wait_event_interruptible_timeout(dev->acq_wait, !dev->sampling || kthread_should_stop(),
+					nsecs_to_jiffies(next - now));
+			if (!dev->sampling || kthread_should_stop())
+				continue;
 		}
-		sprintf(reg_write, "%d %d %d %d %d\n", new_data, xmg, ymg, zmg, mg_per_lsb);
+
+		accel_acquire(dev);
+
+		if (dev->use_irq) {
+			dev->acq_irq = 0;
+			enable_irq(irq);
+		}
+	}
+	if (dev->acq_irq)
+		enable_irq(irq);
+	return 0;
+}
+
+static void accel_hist_add(struct accel_hist * hist, u64 ns) {
+	int bucket = ns ? min_t(int, ilog2(ns), ACCEL_HIST_BUCKETS - 1) : 0;
+	unsigned long flags;
+
+	spin_lock_irqsave(&stats_lock, flags);
+	hist->count++;
+	hist->total_ns += ns;
+	if (ns > hist->max_ns)
+		hist->max_ns = ns;
+	hist->bucket[bucket]++;
+	spin_unlock_irqrestore(&stats_lock, flags);
+}
+
+static void accel_hist_show(struct seq_file * m, struct accel_hist * hist) {
+	int i;
+
+	seq_printf(m, "%s: count %llu avg_ns %llu max_ns %llu\n", hist->name, hist->count,
+		hist->count ? div64_u64(hist->total_ns, hist->count) : 0, hist->max_ns);
+	for (i = 0; i < ACCEL_HIST_BUCKETS; i++) {
+		if (hist->bucket[i])
+			seq_printf(m, "  >= %10llu ns: %llu\n", 1ULL << i, hist->bucket[i]);
+	}
+}
+
+static void accel_hist_clear(struct accel_hist * hist) {
+	memset(hist->bucket, 0, sizeof(hist->bucket));
+	hist->count = hist->total_ns = hist->max_ns = 0;
+}
+
+/* The rxflr and i2c counters belong to the controller and include the
+ * transfers of every sensor on it */
+static int accel_debugfs_show(struct seq_file * m, void * v) {
+	struct accel_dev * dev = m->private;
+
+	seq_printf(m, "bus: %s\n", dev->bus->label);
+	seq_printf(m, "address: %#x\n", dev->address);
+	seq_printf(m, "samples: %llu\n", dev->stats.samples);
+	seq_printf(m, "empty_polls: %llu\n", dev->stats.empty_polls);
+	seq_printf(m, "stale_reads: %llu\n", dev->stats.stale_reads);
+	seq_printf(m, "single_taps: %llu\n", dev->stats.single_taps);
+	seq_printf(m, "double_taps: %llu\n", dev->stats.double_taps);
+	seq_printf(m, "irqs: %llu\n", dev->stats.irqs);
+	seq_printf(m, "events: %llu\n", dev->stats.events);
+	seq_printf(m, "odr_estimated_mhz: %llu\n", div64_u64((u64) NSEC_PER_SEC * 1000 << 16, dev->ts.period));
+	seq_printf(m, "odr_error_ppm: %d\n", accel_ts_ppm(&dev->ts));
+	seq_printf(m, "timeline_resyncs: %u\n", dev->ts.resyncs);
+	seq_printf(m, "timeline_lost: %llu\n", dev->ts.lost);
+	seq_printf(m, "decimation_stages: %d\n", dev->decim_stages);
+	seq_printf(m, "rxflr_spins: %llu\n", dev->bus->stats.rxflr_spins);
+	seq_printf(m, "rxflr_ns: %llu\n", dev->bus->stats.rxflr_ns);
+	seq_printf(m, "i2c_irqs: %llu\n", dev->bus->stats.irqs);
+	seq_printf(m, "i2c_errors: %llu\n", dev->bus->stats.errors);
+	accel_hist_show(m, &dev->hist_reg_read);
+	accel_hist_show(m, &dev->hist_multi_read);
+	accel_hist_show(m, &dev->hist_read);
+	return 0;
+}
+
+static int accel_debugfs_open(struct inode * inode, struct file * file) {
+	return single_open(file, accel_debugfs_show, inode->i_private);
+}
+
+/* Any write to the reset file clears every counter and histogram of the
+ * sensor, and the counters of its controller */
+static ssize_t accel_debugfs_reset(struct file * filp, const char __user * buffer, size_t length, loff_t * offset) {
+	struct accel_dev * dev = filp->private_data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&stats_lock, flags);
+	memset(&dev->stats, 0, sizeof(dev->stats));
+	memset(&dev->bus->stats, 0, sizeof(dev->bus->stats));
+	accel_hist_clear(&dev->hist_reg_read);
+	accel_hist_clear(&dev->hist_multi_read);
+	accel_hist_clear(&dev->hist_read);
+	spin_unlock_irqrestore(&stats_lock, flags);
+	return length;
+}
+
+/* /sys/kernel/debug/accel/accelN/ */
+static int accel_debugfs_init(struct accel_dev * dev) {
+	char name[16];
+
+	if (accel_debugfs == NULL)
+		return -ENODEV;
+	sprintf(name, DEVICE_NAME "%d", dev->minor);
+	dev->debugfs = debugfs_create_dir(name, accel_debugfs);
+	if (IS_ERR_OR_NULL(dev->debugfs)) {
+		dev->debugfs = NULL;
+		return -ENODEV;
+	}
+	debugfs_create_file("stats", S_IRUGO, dev->debugfs, dev, &accel_debugfs_stats_fops);
+	debugfs_create_file("reset", S_IWUSR, dev->debugfs, dev, &accel_debugfs_reset_fops);
+	return 0;
+}
+
+/* One line per sensor, "accelN bus address state configured achieved
+ * samples" with the rates in mHz as "sampling" reports them, then the
+ * aggregate achieved rate of the running sensors */
+static int accel_throughput_show(struct seq_file * m, void * v) {
+	struct accel_dev * dev;
+	u64 achieved, total = 0;
+	int i;
+
+	for (i = 0; i < ACCEL_MAX_DEVICES; i++) {
+		if ((dev = accel_devs[i]) == NULL)
+			continue;
+		mutex_lock(&dev->lock);
+		achieved = accel_achieved(dev);
+		seq_printf(m, "accel%d %s %#x %s %llu %llu %llu\n", dev->minor, dev->bus->label, dev->address,
+			(dev->sampling && dev->acq_task) ? "running" : "stopped",
+			div64_u64((u64) NSEC_PER_SEC * 1000, ADXL345_Period(dev)), achieved, dev->acq_samples_count);
+		if (dev->sampling)
+			total += achieved;
+		mutex_unlock(&dev->lock);
+	}
+	seq_printf(m, "total %llu\n", total);
+	return 0;
+}
+
+static int accel_throughput_open(struct inode * inode, struct file * file) {
+	return single_open(file, accel_throughput_show, NULL);
+}
+
+/* Sample period of the current BW_RATE in ns */
+static u64 ADXL345_Period(struct accel_dev * dev) {
+	return adxl345_period_ns(dev->bw_rate);
+}
+
+/* Samples per 1000 s since the last start or rate change, i.e. mHz */
+static u64 accel_achieved(struct accel_dev * dev) {
+	u64 elapsed = ktime_get_ns() - dev->acq_start;
+
+	if (!elapsed)
+		return 0;
+	return div64_u64(dev->acq_samples_count * NSEC_PER_SEC * 1000, elapsed);
+}
+
+static void accel_stats_reset(struct accel_dev * dev) {
+	dev->acq_start = ktime_get_ns();
+	dev->acq_samples_count = 0;
+	accel_ts_restart(&dev->ts, ADXL345_Period(dev));
+	dev->decim_stages = 0;
+}
+
+/* Take up to max samples from this reader's ring, blocking until the
+ * acquisition thread publishes some. Returns the sample count, 0 when
+ * sampling is stopped and nothing is queued. */
+static int accel_collect(struct file * filp, struct accel_sample samples[], int max) {
+	struct accel_file * af = filp->private_data;
+	struct accel_dev * dev = af->dev;
+	int count;
+
+	if (kfifo_is_empty(&af->fifo) && dev->sampling && dev->acq_task) {
+		if (filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(dev->wait, !kfifo_is_empty(&af->fifo) || !dev->sampling))
+			return -ERESTARTSYS;
+		af->read_start = ktime_get_ns();
+	}
+
+	mutex_lock(&af->lock);
+	spin_lock(&dev->readers_lock);
+	count = kfifo_out(&af->fifo, samples, max);
+	if (count && af->overrun) {
+		samples[0].flags |= ACCEL_FLAG_OVERRUN;
+		af->overrun = 0;
+	}
+	spin_unlock(&dev->readers_lock);
+	mutex_unlock(&af->lock);
+	if (!count)
+		dev->stats.stale_reads++;
+	return count;
+}
+
+//Returns New XX YY ZZ SS, SS = Scaling Factor
+//Every queued sample is returned, one line each. *offset walks through the
+//lines of one batch and the read after the last line returns 0, so
+//"cat /dev/accel0" prints the current batch.
+//With the data ready interrupt, read blocks until a sample arrives
+static ssize_t accel_read (struct file * filp, char * buffer, size_t length, loff_t *offset) {
+	struct accel_file * af = filp->private_data;
+	int count;
+	size_t n;
+
+	af->read_start = ktime_get_ns();
+	if (af->events)
+		return accel_read_events(filp, buffer, length);
+	if (af->binary)
+		return accel_read_binary(filp, buffer, length);
+
+	//text and text_len also take the replies of accel_write, under af->lock.
+	//accel_collect takes the lock itself and may sleep, so it runs outside.
+	mutex_lock(&af->lock);
+	if (!af->text_len) {
+		mutex_unlock(&af->lock);
+		if ((count = accel_collect(filp, af->samples, ACCEL_BATCH)) < 0)
+			return count;
+		mutex_lock(&af->lock);
+		af->text_len = accel_format(af->dev, af->text, af->samples, count);
+		*offset = 0;
+	}
+
+	if (*offset >= af->text_len) {
+		af->text_len = 0;
+		*offset = 0;
+		mutex_unlock(&af->lock);
+		return 0;
+	}
+
+	n = min_t(size_t, length, af->text_len - *offset);
+	if (copy_to_user(buffer, af->text + *offset, n)) {
+		mutex_unlock(&af->lock);
+		return -EFAULT;
 	}
-	
-	if ((reg_write[ind_write] != '\0') && length) {
-		put_user(reg_write[ind_write++], buffer++);
-		length--;
+	*offset += n;
+	mutex_unlock(&af->lock);
+	accel_hist_add(&af->dev->hist_read, ktime_get_ns() - af->read_start);
+	return n;
+}
+
+/* Binary mode returns whole struct accel_sample records. When polling finds
+ * no new data the last sample is returned without ACCEL_FLAG_NEW. */
+static ssize_t accel_read_binary(struct file * filp, char * buffer, size_t length) {
+	struct accel_file * af = filp->private_data;
+	size_t records = length / sizeof(struct accel_sample);
+	int count;
+
+	if (!records)
+		return -EINVAL;
+
+	if ((count = accel_collect(filp, af->samples, min_t(size_t, records, ACCEL_BATCH))) < 0)
+		return count;
+	if (!count) {
+		af->samples[0] = af->dev->last_sample;
+		af->samples[0].flags &= ~ACCEL_FLAG_NEW;
+		count = 1;
+	}
+	if (copy_to_user(buffer, af->samples, count * sizeof(struct accel_sample)))
+		return -EFAULT;
+	accel_hist_add(&af->dev->hist_read, ktime_get_ns() - af->read_start);
+	return count * sizeof(struct accel_sample);
+}
+
+/* Event mode returns whole struct accel_event records, blocking until the
+ * acquisition thread queues one */
+static ssize_t accel_read_events(struct file * filp, char * buffer, size_t length) {
+	struct accel_file * af = filp->private_data;
+	struct accel_dev * dev = af->dev;
+	struct accel_event events[ACCEL_EVENT_BATCH];
+	size_t records = min_t(size_t, length / sizeof(struct accel_event), ACCEL_EVENT_BATCH);
+	int count;
+
+	if (!records)
+		return -EINVAL;
+
+	if (kfifo_is_empty(&af->event_fifo) && dev->sampling && dev->acq_task) {
+		if (filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(dev->wait, !kfifo_is_empty(&af->event_fifo) || !dev->sampling))
+			return -ERESTARTSYS;
+	}
+
+	mutex_lock(&af->lock);
+	spin_lock(&dev->readers_lock);
+	count = kfifo_out(&af->event_fifo, events, records);
+	spin_unlock(&dev->readers_lock);
+	mutex_unlock(&af->lock);
+	if (copy_to_user(buffer, events, count * sizeof(struct accel_event)))
+		return -EFAULT;
+	return count * sizeof(struct accel_event);
+}
+
+/* Queue a record per event source in INT_SOURCE on every event reader, the
+ * oldest dropped from a full queue. ACT_TAP_STATUS is read only then, so
+ * event readers cost nothing between events. Called from the acquisition
+ * thread with the device lock held. */
+static void accel_events(struct accel_dev * dev, u8 source, struct accel_sample samples[], int count) {
+	struct accel_event event = { 0 };
+	struct accel_file * af;
+	u8 bit;
+
+	ADXL345_REG_READ(dev, ADXL345_ACT_TAP_STATUS, &event.status);
+	//The event happened by the newest sample read with it
+	if (count) {
+		event.timestamp = samples[count - 1].timestamp;
+		event.seq = samples[count - 1].seq;
 	}
 	else {
-		write_Empty = 1;
-		ind_write = 0;
+		event.timestamp = ktime_get_ns();
+		event.seq = dev->sample_seq;
+	}
+
+	spin_lock(&dev->readers_lock);
+	for (bit = ADXL345_SINGLE; bit >= ADXL345_FREEFALL; bit >>= 1) {
+		if (!(source & bit))
+			continue;
+		event.type = bit;
+		dev->stats.events++;
+		list_for_each_entry(af, &dev->readers, list) {
+			if (!af->events)
+				continue;
+			if (kfifo_is_full(&af->event_fifo)) {
+				kfifo_skip(&af->event_fifo);
+				af->overruns++;
+			}
+			kfifo_put(&af->event_fifo, event);
+		}
+	}
+	spin_unlock(&dev->readers_lock);
+	wake_up_interruptible(&dev->wait);
+}
+
+/* Readable once a sample is queued, or always while sampling is stopped.
+ * A mapped file is readable while the consumer's tail is behind head, an
+ * event mode file once an event is queued. */
+static unsigned int accel_poll (struct file * filp, poll_table * wait) {
+	struct accel_file * af = filp->private_data;
+	struct accel_dev * dev = af->dev;
+	unsigned int mask = 0;
+
+	poll_wait(filp, &dev->wait, wait);
+	if (af->mapped) {
+		if (READ_ONCE(dev->ring_ctl->tail) != READ_ONCE(dev->ring_head))
+			mask |= POLLIN | POLLRDNORM;
 	}
-	return ind_write;
+	else if (af->events) {
+		if (!kfifo_is_empty(&af->event_fifo) || !dev->sampling)
+			mask |= POLLIN | POLLRDNORM;
+	}
+	else if (af->text_len || !kfifo_is_empty(&af->fifo) || !dev->sampling)
+		mask |= POLLIN | POLLRDNORM;
+	return mask;
+}
+
+/* Data ready / watermark interrupt on INT1. INT1 stays high until the sensor
+ * is read over I2C, so the line is disabled until the acquisition thread has
+ * done that. */
+static irqreturn_t accel_irq_handler(int irq, void * dev_id) {
+	struct accel_dev * dev = dev_id;
+
+	dev->stats.irqs++;
+	dev->irq_ns = ktime_get_ns();
+	disable_irq_nosync(irq);
+	dev->acq_irq = 1;
+	wake_up_interruptible(&dev->acq_wait);
+	return IRQ_HANDLED;
+}
+
+/* INT1 sources: the int_mask selection, plus data ready or the FIFO watermark
+ * when reads are interrupt driven */
+static u8 ADXL345_IntEnable(struct accel_dev * dev) {
+	u8 int_enable = dev->int_mask;
+
+	if (dev->use_irq)
+		int_enable |= (dev->fifo_ctl & ADXL345_FIFO_STREAM) ? ADXL345_WATERMARK : ADXL345_DATAREADY;
+	return int_enable;
+}
+
+/* Route the ADXL345 INT1 pin on HPS GPIO2 to the GIC, active high level */
+static int accel_irq_init(struct accel_dev * dev) {
+	int err;
+
+	if (irq <= 0)
+		return -ENODEV;
+
+	GPIO2_ptr = ioremap_nocache(HPS_BRIDGE_BASE + HPS_GPIO2_BASE, HPS_GPIO_SPAN);
+	if (GPIO2_ptr == NULL)
+		return -ENOMEM;
+
+	*(GPIO2_ptr + HPS_GPIO_INTEN) &= ~GSENSOR_INT;
+	*(GPIO2_ptr + HPS_GPIO_INTTYPE_LEVEL) &= ~GSENSOR_INT;
+	*(GPIO2_ptr + HPS_GPIO_INT_POLARITY) |= GSENSOR_INT;
+	*(GPIO2_ptr + HPS_GPIO_INTMASK) &= ~GSENSOR_INT;
+
+	err = request_irq(irq, accel_irq_handler, 0, DEVICE_NAME, dev);
+	if (err < 0) {
+		iounmap(GPIO2_ptr);
+		GPIO2_ptr = NULL;
+		return err;
+	}
+	*(GPIO2_ptr + HPS_GPIO_INTEN) |= GSENSOR_INT;
+	return 0;
+}
+
+static void accel_irq_exit(struct accel_dev * dev) {
+	if (!dev->use_irq)
+		return;
+	*(GPIO2_ptr + HPS_GPIO_INTEN) &= ~GSENSOR_INT;
+	free_irq(irq, dev);
+	iounmap(GPIO2_ptr);
+	GPIO2_ptr = NULL;
 }
 
 /* Check against commands[] */
@@ -165,26 +1417,32 @@ static int get_command(char * arr) {
 	int i = 0;
 	int command_ind = -1;
 	//Check for commands
-	for( i = 0; i < 5; i++) {
+	for( i = 0; i < NUM_COMMANDS; i++) {
 		if (!(strcmp(commands[i], arr))) {
 			command_ind = i;
-			i = 6;
+			i = NUM_COMMANDS + 1;
 		}
 	}
 	return command_ind;
 }
 
+/* Text commands, kept as a thin layer over the ioctl setters */
 static ssize_t accel_write (struct file * filp, const char * buffer, size_t length, loff_t *offset) {
+	struct accel_file * af = filp->private_data;
+	struct accel_dev * dev = af->dev;
 	int command = 10;
 	char commandStr[32];
+	char reg_read[256];
+	int ind_read;
 	int i = 0;
-	//Read buffer input
-	if (length < 256) {
-		for(ind_read = 0; ind_read < length-1; ind_read++) {
-			reg_read[ind_read] = buffer[ind_read];
-		}
-		reg_read[ind_read++] = '\0';
-	}
+	int wait_cal = 0;
+	//Read buffer input, dropping the trailing newline
+	ind_read = min_t(size_t, length, sizeof(reg_read) - 1);
+	if (copy_from_user(reg_read, buffer, ind_read))
+		return -EFAULT;
+	if (ind_read && reg_read[ind_read - 1] == '\n')
+		ind_read--;
+	reg_read[ind_read] = '\0';
 	//Seperate Command
 	for(i = 0; i < 32; i++) {
 		if ((reg_read[i] != ' ') && reg_read[i] != '\0') {
@@ -195,138 +1453,691 @@ static ssize_t accel_write (struct file * filp, const char * buffer, size_t leng
 			i = 33;
 		}
 	}
-	if (i == 32) 
+	if (i == 32)
 		commandStr[--i] = '\0';
 	//Get command
 	command = get_command(commandStr);
+	mutex_lock(&dev->lock);
+	//Replies go to af->text, which a read of this file may be copying out
+	mutex_lock(&af->lock);
 	switch (command) {
 
 		case 0 :
-				printk("device\n");
-				printk(KERN_INFO "%#x\n", devid);
-				sprintf(reg_write, "%#x\n", devid);
-				write_Empty = 0;
+				af->text_len = sprintf(af->text, "%#x\n", dev->devid);
+				*offset = 0;
+				break;
+		case 1 :
+				if (dev->cal.state == ACCEL_CAL_RUNNING)
+					pr_warn("Calibration running, try again when it is done\n");
+				else
+					ADXL345_Init(dev);
+				break;
+		case 2 :
+				wait_cal = accel_updateCalibrate(filp, reg_read + strlen(commandStr));
+				*offset = 0;
+				break;
+		case 3 :
+				ADXL345_updateFormat(dev, reg_read + strlen(commandStr));
+				break;
+		case 4 :
+				ADXL345_updateRate(dev, reg_read + strlen(commandStr));
+				break;
+		case 5 :
+				ADXL345_updateFifo(dev, reg_read, ind_read);
+				break;
+		case 6 :
+				accel_updateMode(filp, reg_read + strlen(commandStr));
+				break;
+		case 7 :
+				accel_updateDepth(filp, reg_read + strlen(commandStr));
 				break;
-		case 1 : 
-				printk("init\n");
-				ADXL345_Init();
+		case 8 :
+				af->text_len = sprintf(af->text, "%u\n", af->overruns);
+				*offset = 0;
 				break;
-		case 2 : 
-				printk("calibrate\n");
-				calibrate = 1;
-				ADXL345_Calibrate();
-				calibrate = 0;
+		case 9 :
+				accel_updateSampling(filp, reg_read + strlen(commandStr));
+				*offset = 0;
 				break;
-		case 3 : 
-				printk("format\n");
-				ADXL345_updateFormat(reg_read, ind_read);
+		case 10 :
+				accel_updateOutput(filp, reg_read + strlen(commandStr));
 				break;
-		case 4 : 
-				printk("rate\n");
-				ADXL345_updateRate(reg_read, ind_read);
+		case 11 :
+				accel_updateLowpass(filp, reg_read + strlen(commandStr));
 				break;
-		default : printk("Default: Not a valid command\n");
+		case 12 :
+				accel_updateThreshold(filp, reg_read + strlen(commandStr));
+				*offset = 0;
+				break;
+		default : pr_warn("Invalid command. Try device, init, calibrate, format, rate, fifo, mode, depth, overruns, "
+			"sampling, output, lowpass or threshold\n");
 	}
-	//printk("Command: %d, length: %zu, reg_write: %d\nreg_write: %s", command, length, ind_write, reg_write);
-	return ind_read;
+	mutex_unlock(&af->lock);
+	mutex_unlock(&dev->lock);
+
+	//"calibrate" returns once the offsets are applied, sampling goes on meanwhile.
+	//A signal only stops the wait, restarting would start a second calibration.
+	if (wait_cal && wait_event_interruptible(dev->cal_wait, dev->cal.state != ACCEL_CAL_RUNNING))
+		return -EINTR;
+	return length;
 }
 
-static void ADXL345_updateFormat(char command[], int len) {
-	int fvalue, gvalue;
-	u8 range = -1;
-	u8 format, oldFormat, newFormat;
-	char fstr[2];
-	char gstr[4];
-	int i = 0;
-	int k = 0;
-	//Get rid of 'format'
-	while (command[i++] != ' ') {
-		continue;
+static long accel_ioctl (struct file * filp, unsigned int cmd, unsigned long arg) {
+	struct accel_file * af = filp->private_data;
+	struct accel_dev * dev = af->dev;
+	void __user * argp = (void __user *) arg;
+	struct accel_config cfg;
+	struct accel_offsets ofs;
+	struct accel_calibration status;
+	struct accel_event_config events;
+	u32 value = 0;
+	long err = 0;
+
+	//Copy in the argument
+	switch (cmd) {
+		case ACCEL_IOC_SET_CONFIG :
+				if (copy_from_user(&cfg, argp, sizeof(cfg)))
+					return -EFAULT;
+				break;
+		case ACCEL_IOC_SET_OFFSETS :
+				if (copy_from_user(&ofs, argp, sizeof(ofs)))
+					return -EFAULT;
+				break;
+		case ACCEL_IOC_SET_EVENT_CONFIG :
+				if (copy_from_user(&events, argp, sizeof(events)))
+					return -EFAULT;
+				break;
+		case ACCEL_IOC_SET_RATE :
+		case ACCEL_IOC_SET_RANGE :
+		case ACCEL_IOC_SET_RESOLUTION :
+		case ACCEL_IOC_SET_FIFO :
+		case ACCEL_IOC_SET_INT_MASK :
+		case ACCEL_IOC_SET_BINARY :
+		case ACCEL_IOC_SET_DEPTH :
+		case ACCEL_IOC_SET_OUTPUT_RATE :
+		case ACCEL_IOC_SET_LOWPASS :
+		case ACCEL_IOC_SET_EVENTS :
+				if (get_user(value, (u32 __user *) argp))
+					return -EFAULT;
+				break;
+		case ACCEL_IOC_GET_DEVID :
+		case ACCEL_IOC_GET_RATE :
+		case ACCEL_IOC_GET_RANGE :
+		case ACCEL_IOC_GET_RESOLUTION :
+		case ACCEL_IOC_GET_OFFSETS :
+		case ACCEL_IOC_GET_FIFO :
+		case ACCEL_IOC_GET_INT_MASK :
+		case ACCEL_IOC_GET_CONFIG :
+		case ACCEL_IOC_CALIBRATE :
+		case ACCEL_IOC_GET_CALIBRATION :
+		case ACCEL_IOC_GET_EVENT_CONFIG :
+		case ACCEL_IOC_GET_OVERRUNS :
+				break;
+		default :
+				return -ENOTTY;
 	}
-	// Get resolution value
-	fstr[0] = command[i++];
-	fstr[1] = '\0';
-	i++; //get rid of space
-	kstrtouint(fstr, 10, &fvalue);
-	if (fvalue < 2) {
-		for (k = 0; k < 4; k++) {
-			if ((command[i] != ' ') && (command[i] != '\0')) {
-				gstr[k] = command[i++];
-			}
-			else {
-				gstr[k] = '\0';
-				k = 5;
-			}
-		}
-		if (k == 4) 
-			gstr[--k] = '\0';
-		kstrtoint(gstr, 10, &gvalue);
-		gvalue = gvalue * gvalue;
-		switch (gvalue) {
-			case (4) : range = 0x0;
-						break; 
-			case (16) : range = 0x1;
-						break;
-			case (64) : range = 0x2;
-						break;
-			case (256) : range = 0x3;
-						break;
-			default : printk("Invalid Resolution Value. Aborting command\n");
+
+	//Per open file requests don't touch the sensor
+	switch (cmd) {
+		case ACCEL_IOC_SET_BINARY :
+				af->binary = !!value;
+				return 0;
+		case ACCEL_IOC_SET_DEPTH :
+				mutex_lock(&af->lock);
+				err = accel_setDepth(af, value);
+				mutex_unlock(&af->lock);
+				return err;
+		case ACCEL_IOC_GET_OVERRUNS :
+				return put_user(af->overruns, (u32 __user *) argp);
+		case ACCEL_IOC_SET_OUTPUT_RATE :
+				return accel_setOutput(af, value);
+		case ACCEL_IOC_SET_LOWPASS :
+				return accel_setLowpass(af, value);
+		case ACCEL_IOC_SET_EVENTS :
+				accel_setEventMode(af, !!value);
+				return 0;
+	}
+
+	mutex_lock(&dev->lock);
+	switch (cmd) {
+		case ACCEL_IOC_GET_DEVID :
+				value = dev->devid;
+				break;
+		case ACCEL_IOC_SET_RATE :
+				err = ADXL345_setRate(dev, value);
+				break;
+		case ACCEL_IOC_GET_RATE :
+				value = dev->bw_rate & 0x0F;
+				break;
+		case ACCEL_IOC_SET_RANGE :
+				if ((err = ADXL345_rangeCode(value)) >= 0)
+					err = ADXL345_setFormat(dev, (dev->data_format & ~0x03) | err);
+				break;
+		case ACCEL_IOC_GET_RANGE :
+				value = 2 << (dev->data_format & 0x03);
+				break;
+		case ACCEL_IOC_SET_RESOLUTION :
+				if (value > 1)
+					err = -EINVAL;
+				else
+					err = ADXL345_setFormat(dev, (dev->data_format & ~0x08) | (value << 3));
+				break;
+		case ACCEL_IOC_GET_RESOLUTION :
+				value = (dev->data_format >> 3) & 0x1;
+				break;
+		case ACCEL_IOC_SET_OFFSETS :
+				if (dev->cal.state == ACCEL_CAL_RUNNING)
+					err = -EBUSY;
+				else
+					ADXL345_setOffsets(dev, &ofs);
+				break;
+		case ACCEL_IOC_GET_OFFSETS :
+				ADXL345_getOffsets(dev, &ofs);
+				break;
+		case ACCEL_IOC_SET_FIFO :
+				err = ADXL345_setFifo(dev, value);
+				break;
+		case ACCEL_IOC_GET_FIFO :
+				value = (dev->fifo_ctl & ADXL345_FIFO_STREAM) ? dev->fifo_ctl & ADXL345_FIFO_ENTRIES : 0;
+				break;
+		case ACCEL_IOC_SET_INT_MASK :
+				err = ADXL345_setIntMask(dev, value);
+				break;
+		case ACCEL_IOC_GET_INT_MASK :
+				value = dev->int_mask;
+				break;
+		case ACCEL_IOC_SET_CONFIG :
+				err = ADXL345_setConfig(dev, &cfg);
+				break;
+		case ACCEL_IOC_GET_CONFIG :
+				ADXL345_getConfig(dev, &cfg);
+				break;
+		case ACCEL_IOC_CALIBRATE :
+				err = accel_calStart(dev);
+				break;
+		case ACCEL_IOC_GET_CALIBRATION :
+				status = dev->cal;
+				break;
+		case ACCEL_IOC_SET_EVENT_CONFIG :
+				err = ADXL345_setEvents(dev, &events);
+				break;
+		case ACCEL_IOC_GET_EVENT_CONFIG :
+				events = dev->events;
+				break;
+		default :
+				err = -ENOTTY;
+	}
+	mutex_unlock(&dev->lock);
+	if (err < 0)
+		return err;
+
+	//Copy out the result
+	switch (cmd) {
+		case ACCEL_IOC_GET_OFFSETS :
+				return copy_to_user(argp, &ofs, sizeof(ofs)) ? -EFAULT : 0;
+		case ACCEL_IOC_GET_CONFIG :
+				return copy_to_user(argp, &cfg, sizeof(cfg)) ? -EFAULT : 0;
+		case ACCEL_IOC_GET_CALIBRATION :
+				return copy_to_user(argp, &status, sizeof(status)) ? -EFAULT : 0;
+		case ACCEL_IOC_GET_EVENT_CONFIG :
+				return copy_to_user(argp, &events, sizeof(events)) ? -EFAULT : 0;
+		default :
+				if (_IOC_DIR(cmd) & _IOC_READ)
+					return put_user(value, (u32 __user *) argp);
+	}
+	return 0;
+}
+
+/* Typed setters shared by accel_ioctl() and the text commands.
+ * Called with the device lock held. The configuration is fixed while a
+ * calibration runs. */
+static int ADXL345_setRate(struct accel_dev * dev, unsigned int rate) {
+	if (rate > 15)
+		return -EINVAL;
+	if (dev->cal.state == ACCEL_CAL_RUNNING)
+		return -EBUSY;
+	ADXL345_REG_WRITE(dev, ADXL345_BW_RATE, (u8) rate);
+	dev->bw_rate = rate;
+	accel_stats_reset(dev);
+	return 0;
+}
+
+/* Samples the sensor took before the change are in the old format and
+ * would be scaled with the new one, so they are dropped: with the FIFO in
+ * stream mode, or by reading the data registers in bypass. The timeline
+ * starts over as after a rate change. */
+static int ADXL345_setFormat(struct accel_dev * dev, u8 format) {
+	u8 szData8[6];
+
+	if (dev->cal.state == ACCEL_CAL_RUNNING)
+		return -EBUSY;
+	ADXL345_REG_WRITE(dev, ADXL345_DATA_FORMAT, format);
+	dev->data_format = format;
+	if (dev->fifo_ctl & ADXL345_FIFO_STREAM) {
+		ADXL345_REG_WRITE(dev, ADXL345_FIFO_CTL, ADXL345_FIFO_BYPASS);
+		ADXL345_REG_WRITE(dev, ADXL345_FIFO_CTL, dev->fifo_ctl);
+	}
+	else
+		ADXL345_REG_MULTI_READ(dev, ADXL345_DATAX0, szData8, sizeof(szData8));
+	accel_ts_restart(&dev->ts, ADXL345_Period(dev));
+	//The filters must not mix scales
+	dev->decim_stages = 0;
+	return 0;
+}
+
+/* DATA_FORMAT range bits of +-2/4/8/16 g */
+static int ADXL345_rangeCode(unsigned int g) {
+	switch (g) {
+		case 2 : return 0x0;
+		case 4 : return 0x1;
+		case 8 : return 0x2;
+		case 16 : return 0x3;
+	}
+	return -EINVAL;
+}
+
+/* Stream with a watermark of 1 to 31 samples, 0 bypasses the FIFO */
+static int ADXL345_setFifo(struct accel_dev * dev, unsigned int watermark) {
+	if (watermark >= ADXL345_FIFO_DEPTH)
+		return -EINVAL;
+	if (dev->cal.state == ACCEL_CAL_RUNNING)
+		return -EBUSY;
+	if (watermark)
+		dev->fifo_ctl = ADXL345_FIFO_STREAM | watermark;
+	else
+		dev->fifo_ctl = ADXL345_FIFO_BYPASS;
+
+	//Switching through bypass clears any stale entries
+	ADXL345_REG_WRITE(dev, ADXL345_FIFO_CTL, ADXL345_FIFO_BYPASS);
+	ADXL345_REG_WRITE(dev, ADXL345_FIFO_CTL, dev->fifo_ctl);
+	ADXL345_REG_WRITE(dev, ADXL345_INT_ENABLE, ADXL345_IntEnable(dev));
+	accel_ts_restart(&dev->ts, ADXL345_Period(dev));
+	return 0;
+}
+
+static int ADXL345_setIntMask(struct accel_dev * dev, unsigned int mask) {
+	if (mask & ~ACCEL_INT_MASK)
+		return -EINVAL;
+	dev->int_mask = mask;
+	ADXL345_REG_WRITE(dev, ADXL345_INT_ENABLE, ADXL345_IntEnable(dev));
+	return 0;
+}
+
+/* THRESH_TAP, then DUR to TAP_EN in one burst. Detection goes on while a
+ * calibration runs. */
+static int ADXL345_setEvents(struct accel_dev * dev, struct accel_event_config * cfg) {
+	if (cfg->tap_axes & ~0x0F)
+		return -EINVAL;
+	dev->events = *cfg;
+	dev->events.reserved = 0;
+	adxl345_write_events(dev, &dev->events);
+	return 0;
+}
+
+static void ADXL345_setOffsets(struct accel_dev * dev, struct accel_offsets * ofs) {
+	u8 values[3] = {ofs->x, ofs->y, ofs->z};
+
+	ADXL345_REG_MULTI_WRITE(dev, ADXL345_REG_OFSX, values, 3);
+}
+
+static void ADXL345_getOffsets(struct accel_dev * dev, struct accel_offsets * ofs) {
+	u8 values[3];
+
+	ADXL345_REG_MULTI_READ(dev, ADXL345_REG_OFSX, values, 3);
+	ofs->x = values[0];
+	ofs->y = values[1];
+	ofs->z = values[2];
+	ofs->reserved = 0;
+}
+
+/* Validate everything first, then write the configuration in standby with
+ * burst writes. BW_RATE, POWER_CTL and INT_ENABLE are adjacent, so the last
+ * burst also starts measuring. */
+static int ADXL345_setConfig(struct accel_dev * dev, struct accel_config * cfg) {
+	int range = ADXL345_rangeCode(cfg->range);
+	u8 values[3];
+
+	if (cfg->rate > 15 || range < 0 || cfg->full_res > 1 ||
+		cfg->fifo_watermark >= ADXL345_FIFO_DEPTH || (cfg->int_mask & ~ACCEL_INT_MASK))
+		return -EINVAL;
+	if (dev->cal.state == ACCEL_CAL_RUNNING)
+		return -EBUSY;
+
+	dev->data_format = (dev->data_format & ~0x0B) | (cfg->full_res << 3) | range;
+	dev->bw_rate = cfg->rate;
+	dev->int_mask = cfg->int_mask;
+	if (cfg->fifo_watermark)
+		dev->fifo_ctl = ADXL345_FIFO_STREAM | cfg->fifo_watermark;
+	else
+		dev->fifo_ctl = ADXL345_FIFO_BYPASS;
+
+	ADXL345_REG_WRITE(dev, ADXL345_POWER_CTL, 0x00); //standby
+	ADXL345_REG_WRITE(dev, ADXL345_DATA_FORMAT, dev->data_format);
+	ADXL345_setOffsets(dev, &cfg->offsets);
+	ADXL345_REG_WRITE(dev, ADXL345_FIFO_CTL, ADXL345_FIFO_BYPASS);
+	ADXL345_REG_WRITE(dev, ADXL345_FIFO_CTL, dev->fifo_ctl);
+
+	values[0] = dev->bw_rate;
+	values[1] = 0x08; //measure
+	values[2] = ADXL345_IntEnable(dev);
+	ADXL345_REG_MULTI_WRITE(dev, ADXL345_BW_RATE, values, 3);
+	accel_stats_reset(dev);
+	return 0;
+}
+
+static void ADXL345_getConfig(struct accel_dev * dev, struct accel_config * cfg) {
+	cfg->rate = dev->bw_rate & 0x0F;
+	cfg->range = 2 << (dev->data_format & 0x03);
+	cfg->full_res = (dev->data_format >> 3) & 0x1;
+	cfg->fifo_watermark = (dev->fifo_ctl & ADXL345_FIFO_STREAM) ? dev->fifo_ctl & ADXL345_FIFO_ENTRIES : 0;
+	cfg->int_mask = dev->int_mask;
+	ADXL345_getOffsets(dev, &cfg->offsets);
+}
+
+/* "format F G" sets full resolution F (0 for 10 bits, 1) and a range of G g
+ * (2, 4, 8 or 16, signed as +-G), through the validators of ACCEL_IOC_SET_RESOLUTION and
+ * ACCEL_IOC_SET_RANGE */
+static int ADXL345_updateFormat(struct accel_dev * dev, char * arg) {
+	unsigned int res;
+	int g, range, err;
+	char * gstr;
+	u8 oldFormat, newFormat;
+
+	if (arg[0] != ' ' || !(gstr = strchr(arg + 1, ' ')))
+		err = -EINVAL;
+	else {
+		*gstr++ = '\0';
+		if (kstrtouint(arg + 1, 10, &res) || kstrtoint(gstr, 10, &g) || res > 1)
+			err = -EINVAL;
+		else if ((err = range = ADXL345_rangeCode(abs(g))) >= 0) {
+			oldFormat = dev->data_format;
+			err = ADXL345_setFormat(dev, (dev->data_format & ~(ADXL345_FULL_RES | ADXL345_RANGE)) |
+				(res << 3) | range);
 		}
+	}
+	if (err == -EINVAL) {
+		pr_warn("Invalid format. Try a resolution of 0 (10 bits) or 1 (full) and a range of 2, 4, 8 or 16 g\n");
+		return err;
+	}
+	if (err < 0) {
+		pr_warn("Calibration running, try again when it is done\n");
+		return err;
+	}
+	ADXL345_REG_READ(dev, ADXL345_DATA_FORMAT, &newFormat);
+	pr_debug("oldFormat: %#x, newFormat: %#x\n", oldFormat, newFormat);
+	return 0;
+}
+
+/* "rate N" sets BW_RATE code N, 0 for 0.10 Hz to 15 for 3200 Hz, each step
+ * doubling the rate; the validator of ACCEL_IOC_SET_RATE checks it */
+static int ADXL345_updateRate(struct accel_dev * dev, char * arg) {
+	unsigned int rate;
+	u8 oldRate, newRate;
+	int err;
+
+	oldRate = dev->bw_rate;
+	if (arg[0] != ' ' || kstrtouint(arg + 1, 10, &rate))
+		err = -EINVAL;
+	else
+		err = ADXL345_setRate(dev, rate);
+	if (err == -EINVAL) {
+		pr_warn("Invalid rate. Try a code from 0 (0.10 Hz) to 15 (3200 Hz), each step doubling the rate\n");
+		return err;
+	}
+	if (err < 0) {
+		pr_warn("Calibration running, try again when it is done\n");
+		return err;
+	}
+	ADXL345_REG_READ(dev, ADXL345_BW_RATE, &newRate);
+	pr_debug("oldRate: %#x, newRate: %#x\n", oldRate, newRate);
+	return 0;
+}
+
+/* "mode binary" or "mode text" selects the read format of this open file */
+static void accel_updateMode(struct file * filp, char * arg) {
+	struct accel_file * af = filp->private_data;
 
-		if (range > -1) {
-			format = (fvalue << 3) | range;
-			printk("fstr: %s, gstr: %s, range: %d\n", fstr, gstr, range);
-			ADXL345_REG_READ(ADXL345_DATA_FORMAT, &oldFormat);
-			ADXL345_REG_WRITE(ADXL345_DATA_FORMAT, format);
-			ADXL345_REG_READ(ADXL345_DATA_FORMAT, &newFormat);
-			printk("oldFormat: %#x, newFormat: %#x\n", oldFormat, newFormat);
+	if (!strcmp(arg, " binary")) {
+		accel_setEventMode(af, 0);
+		af->binary = 1;
+	}
+	else if (!strcmp(arg, " text")) {
+		accel_setEventMode(af, 0);
+		af->binary = 0;
+	}
+	else if (!strcmp(arg, " events"))
+		accel_setEventMode(af, 1);
+	else
+		pr_warn("Invalid mode. Try binary, text or events\n");
+}
+
+/* Switch this reader between samples and events, dropping whatever the
+ * other queue holds */
+static void accel_setEventMode(struct accel_file * af, int on) {
+	struct accel_dev * dev = af->dev;
+
+	spin_lock(&dev->readers_lock);
+	if (on && !af->events)
+		kfifo_reset(&af->fifo);
+	else if (!on && af->events)
+		kfifo_reset(&af->event_fifo);
+	af->events = on;
+	spin_unlock(&dev->readers_lock);
+}
+
+/* "threshold NAME VALUE" sets one detection register, NAME from
+ * threshold_names[]. "threshold" alone makes the next read return them all
+ * as NAME=VALUE pairs. */
+static void accel_updateThreshold(struct file * filp, char * arg) {
+	struct accel_file * af = filp->private_data;
+	struct accel_dev * dev = af->dev;
+	struct accel_event_config cfg = dev->events;
+	char name[16];
+	unsigned int value, i;
+	size_t len = 0;
+
+	if (arg[0] == '\0') {
+		for (i = 0; i < ARRAY_SIZE(threshold_names); i++)
+			len += sprintf(af->text + len, "%s%s=%u", i ? " " : "", threshold_names[i], ((u8 *) &cfg)[i]);
+		af->text_len = len + sprintf(af->text + len, "\n");
+		return;
+	}
+	if (sscanf(arg, " %15s %u", name, &value) == 2 && value <= 0xFF) {
+		for (i = 0; i < ARRAY_SIZE(threshold_names); i++) {
+			if (!strcmp(name, threshold_names[i])) {
+				((u8 *) &cfg)[i] = value;
+				if (ADXL345_setEvents(dev, &cfg) == 0)
+					return;
+				break;
+			}
 		}
 	}
-	else 
-		printk("Invalid Resolution Value. Aborting command\n");
+	pr_warn("Invalid threshold. Try tap, dur, latent, window, act, inact, time_inact, act_inact_ctl, ff, "
+		"time_ff or tap_axes and a register value\n");
 }
 
+/* "depth N" resizes this reader's ring to N samples, rounded up to a power
+ * of 2. Queued samples are discarded. */
+static int accel_updateDepth(struct file * filp, char * arg) {
+	unsigned int n;
+	int err;
 
-static void ADXL345_updateRate(char command[], int len) {
-	int i = 0, k;
-	unsigned int rate;
-	u8 newRate, oldRate;
-	char rateStr[10];
+	if (kstrtouint(arg + 1, 10, &n))
+		err = -EINVAL;
+	else if ((err = accel_setDepth(filp->private_data, n)) == 0)
+		return 0;
+	if (err == -EINVAL)
+		pr_warn("Invalid depth. Try a value from 2 to 65536\n");
+	else
+		pr_warn("Depth not changed: no memory for %u samples\n", n);
+	return err;
+}
+
+/* Called with af->lock held, by accel_write() and ACCEL_IOC_SET_DEPTH, which
+ * serializes resizes of one reader with each other and with its reads. The
+ * new ring is allocated first and swapped in under readers_lock, which the
+ * acquisition thread holds to queue, so a failed allocation leaves the
+ * reader with the ring it had. */
+static int accel_setDepth(struct accel_file * af, unsigned int n) {
+	struct accel_dev * dev = af->dev;
+	DECLARE_KFIFO_PTR(fifo, struct accel_sample);
+	int err;
+
+	if (n < 2 || n > 65536)
+		return -EINVAL;
+	if ((err = kfifo_alloc(&fifo, n, GFP_KERNEL)) < 0)
+		return err;
+
+	spin_lock(&dev->readers_lock);
+	swap(af->fifo.kfifo, fifo.kfifo);
+	spin_unlock(&dev->readers_lock);
+
+	kfifo_free(&fifo);
+	return 0;
+}
+
+/* "output N" sets this reader's output rate to BW_RATE code N, decimating
+ * the sensor rate when it is higher; "output full" returns every sample */
+static void accel_updateOutput(struct file * filp, char * arg) {
+	unsigned int n;
+
+	if (!strcmp(arg, " full"))
+		accel_setOutput(filp->private_data, ACCEL_OUTPUT_FULL);
+	else if (kstrtouint(arg + 1, 10, &n) || accel_setOutput(filp->private_data, n) < 0)
+		pr_warn("Invalid output rate. Try a rate code from 0 to 15, or full\n");
+}
+
+static int accel_setOutput(struct accel_file * af, unsigned int rate) {
+	struct accel_dev * dev = af->dev;
+
+	if (rate > ACCEL_OUTPUT_FULL)
+		return -EINVAL;
+	spin_lock(&dev->readers_lock);
+	af->output = rate;
+	af->lp_primed = 0;
+	spin_unlock(&dev->readers_lock);
+	return 0;
+}
+
+/* "lowpass N" filters this reader's samples with y += (x - y) / 2^N,
+ * "lowpass 0" turns it off */
+static void accel_updateLowpass(struct file * filp, char * arg) {
+	unsigned int n;
 
-	//Get rid of 'rate'
+	if (kstrtouint(arg + 1, 10, &n) || accel_setLowpass(filp->private_data, n) < 0)
+		pr_warn("Invalid low-pass. Try a shift from 0 (off) to %d\n", ACCEL_LOWPASS_MAX);
+}
+
+static int accel_setLowpass(struct accel_file * af, unsigned int shift) {
+	struct accel_dev * dev = af->dev;
+
+	if (shift > ACCEL_LOWPASS_MAX)
+		return -EINVAL;
+	spin_lock(&dev->readers_lock);
+	af->lowpass = shift;
+	af->lp_primed = 0;
+	spin_unlock(&dev->readers_lock);
+	return 0;
+}
+
+/* "sampling start" and "sampling stop" control the acquisition thread.
+ * "sampling" alone makes the next read return its state, the configured
+ * and achieved rates in mHz and the samples read since the last start. */
+static void accel_updateSampling(struct file * filp, char * arg) {
+	struct accel_file * af = filp->private_data;
+	struct accel_dev * dev = af->dev;
+
+	if (!strcmp(arg, " start")) {
+		accel_stats_reset(dev);
+		dev->sampling = 1;
+		wake_up_interruptible(&dev->acq_wait);
+	}
+	else if (!strcmp(arg, " stop")) {
+		if (dev->cal.state == ACCEL_CAL_RUNNING)
+			accel_calEnd(dev, ACCEL_CAL_FAILED);
+		dev->sampling = 0;
+		wake_up_interruptible(&dev->acq_wait);
+		wake_up_interruptible(&dev->wait);
+	}
+	else if (arg[0] == '\0') {
+		af->text_len = sprintf(af->text, "%s %llu %llu %llu\n", (dev->sampling && dev->acq_task) ? "running" : "stopped",
+			div64_u64((u64) NSEC_PER_SEC * 1000, ADXL345_Period(dev)), accel_achieved(dev), dev->acq_samples_count);
+	}
+	else
+		pr_warn("Invalid sampling command. Try start, stop or nothing for the status\n");
+}
+
+/* "calibrate" runs a background calibration and returns when it is done,
+ * "calibrate async" returns at once. "calibrate status" makes the next read
+ * return "idle|running|done|failed collected used mean_x mean_y mean_z
+ * offset_x offset_y offset_z", the means in ug and the offsets in use.
+ * Returns 1 when the writer has to wait for the calibration. */
+static int accel_updateCalibrate(struct file * filp, char * arg) {
+	static const char * states[] = { "idle", "running", "done", "failed" };
+	struct accel_file * af = filp->private_data;
+	struct accel_calibration * cal = &af->dev->cal;
+	int err;
+
+	if (!strcmp(arg, " status")) {
+		af->text_len = sprintf(af->text, "%s %u %u %d %d %d %d %d %d\n", states[cal->state], cal->collected,
+			cal->used, cal->mean[0], cal->mean[1], cal->mean[2],
+			cal->state == ACCEL_CAL_DONE ? cal->after.x : cal->before.x,
+			cal->state == ACCEL_CAL_DONE ? cal->after.y : cal->before.y,
+			cal->state == ACCEL_CAL_DONE ? cal->after.z : cal->before.z);
+		return 0;
+	}
+	if (arg[0] != '\0' && strcmp(arg, " async")) {
+		pr_warn("Invalid calibrate command. Try async, status or nothing to wait for the result\n");
+		return 0;
+	}
+	if ((err = accel_calStart(af->dev)) < 0) {
+		pr_warn("Calibration not started: %s\n", err == -EBUSY ? "already running" : "sampling is stopped");
+		return 0;
+	}
+	return arg[0] == '\0';
+}
+
+/* ug per LSB of the current DATA_FORMAT */
+static u32 ADXL345_Scale(struct accel_dev * dev) {
+	return adxl345_scale_ug(dev->data_format);
+}
+
+/* "fifo N" streams with a watermark of N samples, "fifo 0" bypasses the FIFO */
+static void ADXL345_updateFifo(struct accel_dev * dev, char command[], int len) {
+	int i = 0, k, err;
+	unsigned int watermark;
+	char wmStr[4];
+
+	//Get rid of 'fifo'
 	while (command[i++] != ' ') {
 		continue;
 	}
-	for(k = 0; k < 10; k++) {
+	for(k = 0; k < 4; k++) {
 		if (command[i] != ' ' && command[i] != '\0') {
-			rateStr[k] = command[i++];
+			wmStr[k] = command[i++];
 		}
 		else {
-			rateStr[k] = '\0';
-			k = 11;
+			wmStr[k] = '\0';
+			k = 5;
 		}
 	}
-	if (k == 10) {
-		rateStr[--k] = '\0';
+	if (k == 4) {
+		wmStr[--k] = '\0';
 	}
-	kstrtouint(rateStr, 10, &rate);
-	if (rate >= 0 && rate <= 15) {
-		ADXL345_REG_READ(ADXL345_BW_RATE, &oldRate);
-		ADXL345_REG_WRITE(ADXL345_BW_RATE, (u8) rate);
-		ADXL345_REG_READ(ADXL345_BW_RATE, &newRate);
-		printk("oldRate: %#x, newRate: %#x\n", oldRate, newRate);
+	if (kstrtouint(wmStr, 10, &watermark) || (err = ADXL345_setFifo(dev, watermark)) == -EINVAL) {
+		pr_warn("Invalid watermark. Try a value from 1 to 31, or 0 to bypass the FIFO\n");
+		return;
 	}
-	else {
-		printk("Invalid rate. Try a value from 0 to 15 "
-			"for 0.098 Hz to 3600 Hz.\nEach decrement will halves the value\n"
-			"For Example:\n15 for 3600 Hz\n14 for 1600 Hz\n10 for 100Hz\n4 for 1.563 Hz\n");
+	if (err < 0) {
+		pr_warn("Calibration running, try again when it is done\n");
+		return;
 	}
-
+	pr_debug("fifo_ctl: %#x\n", dev->fifo_ctl);
 }
 
 
-
+/* I2C0 to the HPS pins of the on-board sensor. I2C1 to I2C3 are left as the
+ * boot loader muxed them. */
 static void mux_init(void) {
 	volatile unsigned int *gpio7_ptr, *gpio8_ptr, *i2c0fpga_ptr; //Mux pointer
 
@@ -340,81 +2151,137 @@ static void mux_init(void) {
 	printk("gio7: %#x\ngio8: %#x\ni2c0fpga: %#x\n", *gpio7_ptr, *gpio8_ptr, *i2c0fpga_ptr);
 }
 
-static int I2C0_Init(void) {
+/* Map and configure controller id when its first sensor is probed */
+static struct accel_bus * I2C_Get(unsigned int id) {
+	static const unsigned long bases[I2C_NUM_BUSES] = { I2C0_BASE, HPS_BRIDGE_BASE + I2C1_BASE,
+		HPS_BRIDGE_BASE + I2C2_BASE, HPS_BRIDGE_BASE + I2C3_BASE };
+	struct accel_bus * bus = &accel_buses[id];
+	int err;
+
+	if (bus->users++)
+		return bus;
+
+	bus->id = id;
+	sprintf(bus->label, "i2c%u", id);
+	sprintf(bus->name, DEVICE_NAME "_%s", bus->label);
+	mutex_init(&bus->lock);
+	init_completion(&bus->done);
+	bus->base = ioremap_nocache(bases[id], I2C0_SPAN);
+	if (bus->base == NULL) {
+		printk(KERN_ERR "Error: ioremap_nocache returned NULL\n");
+		bus->users = 0;
+		return NULL;
+	}
+	I2C_Init(bus);
+
+	if ((err = I2C_irq_init(bus)) < 0)
+		printk("No I2C%u interrupt (%d), polling I2C%u transfers\n", id, err, id);
+	return bus;
+}
+
+/* Map and configure SPIM0 when its first sensor is probed. Its pins are left
+ * as the boot loader muxed them. Transfers are polled: a FIFO entry is one
+ * 11 us frame at 5 MHz, less than an interrupt and wakeup would take. */
+static struct accel_bus * SPI_Get(void) {
+	struct accel_bus * bus = &accel_buses[SPI_BUS];
+
+	if (bus->users++)
+		return bus;
+
+	bus->id = SPI_BUS;
+	bus->spi = 1;
+	strcpy(bus->label, "spim0");
+	sprintf(bus->name, DEVICE_NAME "_%s", bus->label);
+	mutex_init(&bus->lock);
+	init_completion(&bus->done);
+	bus->base = ioremap_nocache(SPIM0_BASE, SPIM0_SPAN);
+	if (bus->base == NULL) {
+		printk(KERN_ERR "Error: ioremap_nocache returned NULL\n");
+		bus->users = 0;
+		return NULL;
+	}
+	SPI_Init(bus);
+	return bus;
+}
+
+static void accel_bus_put(struct accel_bus * bus) {
+	if (--bus->users)
+		return;
+	I2C_irq_exit(bus);
+	iounmap(bus->base);
+	bus->base = NULL;
+}
+
+static int I2C_Init(struct accel_bus * bus) {
 	//Abort tranmission and disable Controller for config
-	printk("%d\n%d\n", I2C0_TAR, I2C0_FS_SCL_HCNT * 1);
-	printk("%p\n%p\n", I2C0_ptr,  I2C0_ptr + (I2C0_FS_SCL_HCNT * 1));
-	*(I2C0_ptr + I2C0_ENABLE) = 0x2;
+	printk("I2C%d at %p\n", bus->id, bus->base);
+	*(bus->base + I2C0_ENABLE) = 0x2;
 	//Wait for disable status
 
-	if (!(I2C0_OnOff(2))) {
+	if (!(I2C_OnOff(bus, 2))) {
 		printk("Unable to disable\n");
 		return 0;
 	}
 	printk("Configuring\n");
 
 	// 7-Bit addressing, FastMode (400kb/s), Master Mode
-	*(I2C0_ptr + I2C0_CON) = 0x65;
+	*(bus->base + I2C0_CON) = 0x65;
 
-	//Set target address to be ADXL345 devid 0x53 and 7bit addressing
-	*(I2C0_ptr + I2C0_TAR) = 0x53;
+	//Target the ADXL345 at 0x53 and 7bit addressing, see I2C_SetTarget()
+	*(bus->base + I2C0_TAR) = ADXL345_I2C_ADDR;
+	bus->tar = ADXL345_I2C_ADDR;
 
 	//Minimum period is to be 2.5us but minimum high period is 0.6us
 	//and minimum low period is 1.3us so 0.3us is added to both.
-	*(I2C0_ptr + I2C0_FS_SCL_HCNT) = 60 + 30;
-	*(I2C0_ptr + I2C0_FS_SCL_LCNT) = 130 + 30;
+	*(bus->base + I2C0_FS_SCL_HCNT) = 60 + 30;
+	*(bus->base + I2C0_FS_SCL_LCNT) = 130 + 30;
 
 	//Enable the controller
 	printk("Renabling controller\n");
-	if (!(I2C0_OnOff(1))) {
+	if (!(I2C_OnOff(bus, 1))) {
 		printk("Unable to enable\n");
 		return 0;
 	}
-	printk("ic_tar: %#x\nic_con: %#x\n", *(I2C0_ptr + I2C0_TAR), *(I2C0_ptr + I2C0_CON));
+	printk("ic_tar: %#x\nic_con: %#x\n", *(bus->base + I2C0_TAR), *(bus->base + I2C0_CON));
 	return 1;
 }
 
-void ADXL345_Init(void) {
+/* Disabled while configured. No slave is selected between frames, see
+ * SPI_Frame() */
+static void SPI_Init(struct accel_bus * bus) {
+	printk("SPIM0 at %p\n", bus->base);
+	*(bus->base + SPIM0_REG(SPIM0_SSIENR)) = 0;
+	*(bus->base + SPIM0_REG(SPIM0_CTRLR0)) = SPIM0_CTRLR0_MODE3;
+	*(bus->base + SPIM0_REG(SPIM0_BAUDR)) = SPIM0_SCKDV;
+	*(bus->base + SPIM0_REG(SPIM0_SER)) = 0;
+	*(bus->base + SPIM0_REG(SPIM0_IMR)) = 0;
+	*(bus->base + SPIM0_REG(SPIM0_SSIENR)) = 1;
+}
 
-	u8 data_format = 0x03;
-	u8 bw_rate = 0x07;
+void ADXL345_Init(struct accel_dev * dev) {
 
 	//+-16 range, 10 bits
-	ADXL345_REG_WRITE(ADXL345_DATA_FORMAT, data_format);
-	ADXL345_REG_WRITE(ADXL345_BW_RATE, bw_rate);
-
-	//Set threshold for new data
-	ADXL345_REG_WRITE(ADXL345_THRESH_ACT, 0x04); //62.5 mg per LSB, 250 mg
-	ADXL345_REG_WRITE(ADXL345_THRESH_INACT, 0x02); //62.5 mg per LSB, 125 mg
-	ADXL345_REG_WRITE(ADXL345_TIME_INACT, 0x02); //1s per LSB, 2s
-	ADXL345_REG_WRITE(ADXL345_ACT_INACT_CTL, 0xFF); //
-
-	//Set single & double tap
-	ADXL345_REG_WRITE(ADXL345_THRESH_TAP, 0x10); // 65 mg per LSB, 1g
-	ADXL345_REG_WRITE(ADXL345_TAP_DUR, 0x20); // 62.5us per LSB, 20ms
-	ADXL345_REG_WRITE(ADXL345_TAP_LAT, 0x10); // 1.25ms per LSB, 20ms
-	ADXL345_REG_WRITE(ADXL345_DOUBLE_WIND, 0xF0); // 1.25ms per LSB, 300ms
-	ADXL345_REG_WRITE(ADXL345_TAP_EN, 0x2); // Only for Y
-	//Interrupt 0|Single_tap|Double_tap|Activity|Inactivity|0|0|0
-	ADXL345_REG_WRITE(ADXL345_INT_ENABLE, 0x78);
-
-	//Reset Measurement config
-	ADXL345_REG_WRITE(ADXL345_POWER_CTL, 0x00); //standby
-	ADXL345_REG_WRITE(ADXL345_POWER_CTL, 0x08);	
-}
-
-static int I2C0_OnOff(unsigned int onoff) {
+	dev->data_format = ADXL345_INIT_FORMAT;
+	dev->bw_rate = ADXL345_INIT_RATE;
+
+	//Tap, activity and free-fall thresholds and the FIFO mode selected with
+	//"fifo N" are kept across re-initialization
+	adxl345_init(dev, dev->data_format, dev->bw_rate, &dev->events, ADXL345_IntEnable(dev), dev->fifo_ctl);
+	accel_ts_restart(&dev->ts, ADXL345_Period(dev));
+}
+
+static int I2C_OnOff(struct accel_bus * bus, unsigned int onoff) {
 	int ti2c_poll = 1;
 	int MAX_T_POLL_COUNT = 100;
 	int poll_count = 0;
 
 	int good = 0;
-	*(I2C0_ptr + I2C0_ENABLE) = onoff;
+	*(bus->base + I2C0_ENABLE) = onoff;
 
-	while (((*(I2C0_ptr + I2C0_ENABLE_STATUS) & 0x1) == (onoff - 1)) & (poll_count < MAX_T_POLL_COUNT)) {
+	while (((*(bus->base + I2C0_ENABLE_STATUS) & 0x1) == (onoff - 1)) & (poll_count < MAX_T_POLL_COUNT)) {
 		poll_count++;
 		msleep(ti2c_poll);
-		*(I2C0_ptr + I2C0_ENABLE) = onoff;
+		*(bus->base + I2C0_ENABLE) = onoff;
 	}
 	if (poll_count < 10)
 		good = 1;
@@ -424,165 +2291,466 @@ static int I2C0_OnOff(unsigned int onoff) {
 	return good;
 }
 
-/* Single Byte Read */
-static void ADXL345_REG_READ(u8 address, u8 * value) {
+/* IC_TAR only changes while the controller is disabled. Posted writes are
+ * let out of the TX FIFO first; disabling then waits for the STOP of the
+ * transfer in progress instead of cutting it short. Called with the bus lock
+ * held, only when the bus carries sensors at both addresses. */
+static void I2C_SetTarget(struct accel_bus * bus, u8 target) {
+	int polls = 0;
+
+	if (bus->tar == target)
+		return;
+
+	while (*(bus->base + I2C0_TXFLR) > 0 && polls++ < 100)
+		udelay(10);
+	*(bus->base + I2C0_ENABLE) = 0;
+	polls = 0;
+	while ((*(bus->base + I2C0_ENABLE_STATUS) & 0x1) && polls++ < 100)
+		udelay(10);
+
+	*(bus->base + I2C0_TAR) = target;
+	*(bus->base + I2C0_ENABLE) = 1;
+	bus->tar = target;
+}
 
-	//Send address and start signal
-	*(I2C0_ptr + I2C0_DATA_CMD) = address + 0x400;
+/* Repeat a len byte read at address count times without waiting in between.
+ * Polling, the caller keeps count * (len + 1) within the I2C TX FIFO; the
+ * interrupt driven engine refills it, up to I2C0_MAX_CMDS commands. */
+static int I2C_Read(struct accel_bus * bus, u8 target, u8 address, u8 values[], u8 len, u8 count) {
+	int i, k, n = 0, err;
 
-	//send read signal
-	*(I2C0_ptr + I2C0_DATA_CMD) = 0x100;
+	mutex_lock(&bus->lock);
+	for (k = 0; k < count; k++) {
+		bus->cmds[n++] = address + 0x400;
 
-	//wait for response
+		//send read signal multiple times to prevent overwritten data at
+		//inconsistent times
 
-	while(*(I2C0_ptr + I2C0_RXFLR) == 0) {
-		continue;
+		for (i = 0; i < len; i++)
+			bus->cmds[n++] = 0x100;
 	}
-	*value = *(I2C0_ptr + I2C0_DATA_CMD) & 0xFF;
+	err = I2C_Transfer(bus, target, bus->cmds, n, values, len * count);
+	mutex_unlock(&bus->lock);
+	return err;
 }
 
-/* Single byte Write */
-static void ADXL345_REG_WRITE(u8 address, u8 value) {
+/* The ADXL345 increments the register address */
+static int I2C_Write(struct accel_bus * bus, u8 target, u8 address, u8 values[], u8 len) {
+	int i, err;
+
+	mutex_lock(&bus->lock);
+	bus->cmds[0] = address + 0x400;
+	for (i = 0; i < len; i++)
+		bus->cmds[i + 1] = values[i];
+	err = I2C_Transfer(bus, target, bus->cmds, len + 1, NULL, 0);
+	mutex_unlock(&bus->lock);
+	return err;
+}
 
-	*(I2C0_ptr + I2C0_DATA_CMD) = address + 0x400;
-	*(I2C0_ptr + I2C0_DATA_CMD) = value;
+/* Push cmds[] to the controller addressed to target and collect nrx received
+ * bytes into rx[]. Interrupt driven when the controller's interrupt is
+ * available, the caller then sleeps until STOP_DET; otherwise the RX FIFO is
+ * polled, and a transfer without reads returns as soon as it is queued.
+ * Called with the bus lock held, which lets the sensors of one bus take
+ * turns per transfer. */
+static int I2C_Transfer(struct accel_bus * bus, u8 target, u16 cmds[], int ncmds, u8 rx[], int nrx) {
+	I2C_SetTarget(bus, target);
+	if (bus->use_irq)
+		return I2C_Transfer_Irq(bus, cmds, ncmds, rx, nrx);
+	return I2C_Transfer_Poll(bus, cmds, ncmds, rx, nrx);
 }
 
-/* Multiple Byte Write */
-static void ADXL345_REG_MULTI_READ(u8 address, u8 values[], u8 len) {
+/* A sensor that does not acknowledge aborts the transfer, and the controller
+ * then holds its TX FIFO flushed until the abort is cleared. A read gives up
+ * on the abort instead of spinning for bytes that never come, and an abort
+ * left by a posted write is cleared before the next transfer. */
+static int I2C_Transfer_Poll(struct accel_bus * bus, u16 cmds[], int ncmds, u8 rx[], int nrx) {
+	int i, nth_byte = 0, err = 0;
+	u64 spin;
+	u32 spins = 0, clr;
+
+	if (*(bus->base + I2C0_RAW_INTR_STAT) & I2C0_INTR_TX_ABRT) {
+		clr = *(bus->base + I2C0_CLR_TX_ABRT);
+		bus->stats.errors++;
+	}
 
-	int i = 0;
-	int nth_byte = 0;
-	*(I2C0_ptr + I2C0_DATA_CMD) = address + 0x400;
+	for (i = 0; i < ncmds; i++)
+		*(bus->base + I2C0_DATA_CMD) = cmds[i];
+
+	spin = ktime_get_ns();
+	while (nth_byte < nrx) {
+		if (*(bus->base + I2C0_RXFLR) > 0)
+			rx[nth_byte++] = *(bus->base + I2C0_DATA_CMD) & 0xFF;
+		else if (*(bus->base + I2C0_RAW_INTR_STAT) & I2C0_INTR_TX_ABRT) {
+			clr = *(bus->base + I2C0_CLR_TX_ABRT);
+			bus->stats.errors++;
+			memset(rx + nth_byte, 0, nrx - nth_byte);
+			err = -EIO;
+			break;
+		}
+		else
+			spins++;
+	}
 
-	//send read signal multiple times to prevent overwritten data at 
-	//inconsistent times
+	bus->stats.rxflr_spins += spins;
+	bus->stats.rxflr_ns += ktime_get_ns() - spin;
+	return err;
+}
 
-	for(i = 0; i < len; i++)
-		*(I2C0_ptr + I2C0_DATA_CMD) = 0x100;
+/* The calling thread sleeps while I2C_irq_handler() refills the TX FIFO and
+ * drains the RX FIFO, see ADXL345_i2cxfer.h */
+static int I2C_Transfer_Irq(struct accel_bus * bus, u16 cmds[], int ncmds, u8 rx[], int nrx) {
+	reinit_completion(&bus->done);
+	i2c_xfer_start(&bus->xfer, bus->base, cmds, ncmds, rx, nrx);
 
-	while(len) {
-		if (*(I2C0_ptr + I2C0_RXFLR) > 0) {
-			values[nth_byte] = *(I2C0_ptr + I2C0_DATA_CMD) & 0xFF;
-			nth_byte++;
-			len--;
-		}
+	if (!wait_for_completion_timeout(&bus->done, msecs_to_jiffies(I2C0_TIMEOUT_MS))) {
+		*(bus->base + I2C0_INTR_MASK) = 0;
+		synchronize_irq(bus->irq);
+		i2c_xfer_abort(&bus->xfer, bus->base);
+	}
+	if (bus->xfer.err) {
+		bus->stats.errors++;
+		pr_debug("I2C%d transfer failed %d, %d of %d bytes\n", bus->id, bus->xfer.err, bus->xfer.rx_pos, nrx);
+		memset(rx + bus->xfer.rx_pos, 0, nrx - bus->xfer.rx_pos);
 	}
+	return bus->xfer.err;
 }
 
-static int ADXL345_IsDataReady(void) {
-	int bReady = 0;
-	u8 data8;
+static irqreturn_t I2C_irq_handler(int irq, void * dev_id) {
+	struct accel_bus * bus = dev_id;
+	u32 stat = *(bus->base + I2C0_INTR_STAT);
 
-	ADXL345_REG_READ(ADXL345_INT_SOURCE, &data8);
-	printk("%#x\n", data8);
-	if ((data8 & (ADXL345_DOUBLE | ADXL345_SINGLE)) | calibrate) {
-		if (data8 & ADXL345_DOUBLE) {
-			printk("Double Tap\n");
-			*LEDR_ptr ^= 0x2;
-		}
-		else if (data8 & ADXL345_SINGLE) {
-			*LEDR_ptr ^= 0x1;
-			printk("Single Tap\n");
-		}
-		else {
-			*LEDR_ptr = 0x3;
-			msleep(50);
-			*LEDR_ptr = 0;
+	if (!stat)
+		return IRQ_NONE;
+	bus->stats.irqs++;
+
+	if (stat & I2C0_INTR_TX_ABRT)
+		pr_debug("I2C%d abort source %#x\n", bus->id, *(bus->base + I2C0_TX_ABRT_SOURCE));
+	if (i2c_xfer_irq(&bus->xfer, bus->base, stat))
+		complete(&bus->done);
+	return IRQ_HANDLED;
+}
+
+/* FIFO thresholds of i2c_xfer_init(), then the handler */
+static int I2C_irq_init(struct accel_bus * bus) {
+	int err;
+
+	bus->irq = i2c_irq[bus->id];
+	if (bus->irq <= 0)
+		return -ENODEV;
+
+	i2c_xfer_init(bus->base);
+	err = request_irq(bus->irq, I2C_irq_handler, 0, bus->name, bus);
+	if (err < 0)
+		return err;
+	bus->use_irq = 1;
+	return 0;
+}
+
+static void I2C_irq_exit(struct accel_bus * bus) {
+	if (!bus->use_irq)
+		return;
+	*(bus->base + I2C0_INTR_MASK) = 0;
+	free_irq(bus->irq, bus);
+	bus->use_irq = 0;
+}
+
+/* SPI reads, count back to back frames of a command byte and len bytes.
+ * The data of a frame that read DATAZ1 is only popped from the FIFO when chip
+ * select rises, the next frame waits out the pop time. */
+static int SPI_Read(struct accel_bus * bus, u8 cs, u8 address, u8 values[], u8 len, u8 count) {
+	int k, err = 0;
+
+	mutex_lock(&bus->lock);
+	bus->spi_tx[0] = ADXL345_SPI_READ | (len > 1 ? ADXL345_SPI_MB : 0) | address;
+	memset(bus->spi_tx + 1, 0, len);
+	for (k = 0; k < count; k++) {
+		if ((err = SPI_Frame(bus, cs, len + 1)) < 0) {
+			memset(values + k * len, 0, (count - k) * len);
+			break;
 		}
-		ADXL345_REG_READ(ADXL345_INT_SOURCE, &data8);
-		if (data8 & ADXL345_DATAREADY) {
-			bReady = 1;
+		memcpy(values + k * len, bus->spi_rx + 1, len);
+		//The command byte of the next frame counts towards the pop time
+		if (address <= ADXL345_DATAZ1 && address + len > ADXL345_DATAZ1)
+			bus->spi_ready_ns = ktime_get_ns() + ADXL345_FIFO_POP_NS - SPIM0_BYTE_NS;
+	}
+	mutex_unlock(&bus->lock);
+	return err;
+}
+
+static int SPI_Write(struct accel_bus * bus, u8 cs, u8 address, u8 values[], u8 len) {
+	int err;
+
+	mutex_lock(&bus->lock);
+	bus->spi_tx[0] = (len > 1 ? ADXL345_SPI_MB : 0) | address;
+	memcpy(bus->spi_tx + 1, values, len);
+	err = SPI_Frame(bus, cs, len + 1);
+	mutex_unlock(&bus->lock);
+	return err;
+}
+
+/* Shift len bytes of spi_tx out to chip select cs and as many received
+ * into spi_rx. SPIM0 drops chip select whenever its TX FIFO runs empty, which
+ * would end the ADXL345 transaction, so the frame is queued with no slave
+ * selected and only SER starts it. Called with the bus lock held. */
+static int SPI_Frame(struct accel_bus * bus, u8 cs, int len) {
+	int i, n = 0, err = 0;
+	u64 spin;
+	u32 spins = 0;
+
+	while (ktime_get_ns() < bus->spi_ready_ns)
+		cpu_relax();
+
+	for (i = 0; i < len; i++)
+		*(bus->base + SPIM0_REG(SPIM0_DR)) = bus->spi_tx[i];
+	*(bus->base + SPIM0_REG(SPIM0_SER)) = 1 << cs;
+
+	spin = ktime_get_ns();
+	while (n < len) {
+		if (*(bus->base + SPIM0_REG(SPIM0_RXFLR)) > 0)
+			bus->spi_rx[n++] = *(bus->base + SPIM0_REG(SPIM0_DR)) & 0xFF;
+		else if (++spins % 64 == 0 && ktime_get_ns() - spin > SPIM0_TIMEOUT_NS) {
+			//Not clocked or not muxed, flush both FIFOs
+			*(bus->base + SPIM0_REG(SPIM0_SSIENR)) = 0;
+			*(bus->base + SPIM0_REG(SPIM0_SSIENR)) = 1;
+			bus->stats.errors++;
+			err = -ETIMEDOUT;
+			break;
 		}
 	}
-	return bReady;
+	*(bus->base + SPIM0_REG(SPIM0_SER)) = 0;
+
+	bus->stats.rxflr_spins += spins;
+	bus->stats.rxflr_ns += ktime_get_ns() - spin;
+	return err;
 }
 
-static void ADXL345_XYZ_Read(s16 szData16[3]) {
-	u8 szData8[6];
-	ADXL345_REG_MULTI_READ(0x32, (u8 *) &szData8, sizeof(szData8));
+/* Register access on the sensor's bus, traced per transfer. A read repeats a
+ * len byte read at address count times back to back. */
+static int accel_bus_read(struct accel_dev * dev, u8 address, u8 values[], u8 len, u8 count) {
+	int err;
 
-	szData16[0] = (szData8[1] << 8) | szData8[0];
-	szData16[1] = (szData8[3] << 8) | szData8[2];
-	szData16[2] = (szData8[5] << 8) | szData8[4];
-	printk("X:%d, Y:%d, Z:%d\n", szData16[0], szData16[1], szData16[2]);
+	if (dev->bus->spi) {
+		err = SPI_Read(dev->bus, dev->address, address, values, len, count);
+		trace_accel_spi(dev->address, address, len, count, true);
+	}
+	else {
+		err = I2C_Read(dev->bus, dev->address, address, values, len, count);
+		trace_accel_i2c(dev->bus->id, dev->address, address, len, count, true);
+	}
+	return err;
 }
 
+static int accel_bus_write(struct accel_dev * dev, u8 address, u8 values[], u8 len) {
+	int err;
 
-static void ADXL345_IdRead(u8 *pId) {
-	ADXL345_REG_READ(ADXL345_DEVID, pId);
+	if (dev->bus->spi) {
+		err = SPI_Write(dev->bus, dev->address, address, values, len);
+		trace_accel_spi(dev->address, address, len, 1, false);
+	}
+	else {
+		err = I2C_Write(dev->bus, dev->address, address, values, len);
+		trace_accel_i2c(dev->bus->id, dev->address, address, len, 1, false);
+	}
+	return err;
 }
 
-/* Courtesy Altera Open Source FPGA Driver */
-static void ADXL345_Calibrate(void) {
-	int average_x = 0;
-	int average_y = 0;
-	int average_z = 0;
-	int i = 0;
-	s16 XYZ_cal[3];
-	s8 offset_x, offset_y, offset_z; 
-	u8 saved_bw, saved_dataformat;
+/* Single Byte Read */
+static void ADXL345_REG_READ(struct accel_dev * dev, u8 address, u8 * value) {
+	u64 start = ktime_get_ns();
 
-	//stop measure
-	ADXL345_REG_WRITE(ADXL345_POWER_CTL, 0x00);
+	accel_bus_read(dev, address, value, 1, 1);
+	accel_hist_add(&dev->hist_reg_read, ktime_get_ns() - start);
+}
 
-	//get current offsets
-	ADXL345_REG_READ(ADXL345_REG_OFSX, (u8 *) &offset_x);
-	ADXL345_REG_READ(ADXL345_REG_OFSY, (u8 *) &offset_y);
-	ADXL345_REG_READ(ADXL345_REG_OFSZ, (u8 *) &offset_z);
+/* Single byte Write */
+static void ADXL345_REG_WRITE(struct accel_dev * dev, u8 address, u8 value) {
+	accel_bus_write(dev, address, &value, 1);
+}
 
-	//use 100Hz rate for calibrate. Save the current rate.
-	ADXL345_REG_READ(ADXL345_BW_RATE, &saved_bw);
-	ADXL345_REG_WRITE(ADXL345_BW_RATE, 0xA);
+/* Multiple Byte Write, the ADXL345 increments the register address */
+static void ADXL345_REG_MULTI_WRITE(struct accel_dev * dev, u8 address, u8 values[], u8 len) {
+	accel_bus_write(dev, address, values, len);
+}
 
-	//use 16g range, full resolution. Save the current format.
-	ADXL345_REG_READ(ADXL345_DATA_FORMAT, &saved_dataformat);
-	ADXL345_REG_WRITE(ADXL345_DATA_FORMAT, 0xB);
+/* Multiple Byte Read */
+static void ADXL345_REG_MULTI_READ(struct accel_dev * dev, u8 address, u8 values[], u8 len) {
+	ADXL345_REG_BURST_READ(dev, address, values, len, 1);
+}
 
-	// Start measure
-	ADXL345_REG_WRITE(ADXL345_POWER_CTL, 0x08);
+/* Repeat a len byte read at address count times without waiting in between,
+ * see I2C_Read() and SPI_Read() for the limits */
+static void ADXL345_REG_BURST_READ(struct accel_dev * dev, u8 address, u8 values[], u8 len, u8 count) {
+	u64 start = ktime_get_ns();
 
-	while (i < 32) {
-		//Note: use DATA_READY here, can't use acitivty because board is stationary.
-		if (ADXL345_IsDataReady()) {
-			ADXL345_XYZ_Read(XYZ_cal);
-			average_x += XYZ_cal[0];
-			average_y += XYZ_cal[1];
-			average_z += XYZ_cal[2];
-			i++;
-		}	
+	accel_bus_read(dev, address, values, len, count);
+	accel_hist_add(&dev->hist_multi_read, ktime_get_ns() - start);
+}
+
+/* Read up to max entries queued in the ADXL345 FIFO. Each 6 byte read at
+ * DATAX0 pops one entry, so entries are fetched FIFO_BURST_ENTRIES at a time
+ * when polling I2C, and all in one transfer when it is interrupt driven or
+ * on SPI, one frame per entry. status_ns is when FIFO_STATUS was read, by
+ * which every entry returned existed. */
+static int ADXL345_FIFO_Drain(struct accel_dev * dev, struct accel_sample samples[], int max, u64 * status_ns) {
+	u8 status, burst;
+	u8 szData8[ADXL345_FIFO_DEPTH * 6];
+	int entries, i, count = 0;
+	int max_burst = (dev->bus->use_irq || dev->bus->spi) ? ADXL345_FIFO_DEPTH : FIFO_BURST_ENTRIES;
+
+	ADXL345_REG_READ(dev, ADXL345_FIFO_STATUS, &status);
+	*status_ns = ktime_get_ns();
+	entries = status & ADXL345_FIFO_ENTRIES;
+	if (entries > max)
+		entries = max;
+
+	while (count < entries) {
+		burst = min(entries - count, max_burst);
+		ADXL345_REG_BURST_READ(dev, ADXL345_DATAX0, szData8, 6, burst);
+		for (i = 0; i < burst; i++, count++) {
+			samples[count].x = (szData8[i*6 + 1] << 8) | szData8[i*6];
+			samples[count].y = (szData8[i*6 + 3] << 8) | szData8[i*6 + 2];
+			samples[count].z = (szData8[i*6 + 5] << 8) | szData8[i*6 + 4];
+		}
 	}
+	return count;
+}
 
-	average_x = ROUNDED_DIVISION(average_x, 32);
-	average_y = ROUNDED_DIVISION(average_y, 32);
-	average_z = ROUNDED_DIVISION(average_z, 32);
+/* adxl345_snapshot(): INT_SOURCE through DATAZ1 in a single burst. Returns 1
+ * when the sample is new. */
+static int ADXL345_Snapshot(struct accel_dev * dev, u8 * source, s16 szData16[3]) {
+	int fresh = adxl345_snapshot(dev, source, szData16);
 
-	//stop measure
-	ADXL345_REG_WRITE(ADXL345_POWER_CTL, 0x00);
+	pr_debug("accel%d %#x X:%d, Y:%d, Z:%d\n", dev->minor, *source, szData16[0], szData16[1], szData16[2]);
+	return fresh;
+}
 
-	printk("Average X=%d, Y=%d, Z=%d\n", average_x, average_y, average_z);
+static void ADXL345_IdRead(struct accel_dev * dev, u8 *pId) {
+	ADXL345_REG_READ(dev, ADXL345_DEVID, pId);
+}
 
-	//Calculate the offsets (LSB 15.6mg)
+/* Start a background calibration: switch to CAL_RATE through the FIFO and
+ * let accel_acquire() feed the samples to accel_calFeed(). Readers keep
+ * receiving them, flagged ACCEL_FLAG_CALIBRATING. Called with the device
+ * lock held. */
+static int accel_calStart(struct accel_dev * dev) {
+	if (dev->cal.state == ACCEL_CAL_RUNNING)
+		return -EBUSY;
+	if (!dev->sampling || !dev->acq_task)
+		return -EAGAIN;
+
+	memset(&dev->cal, 0, sizeof(dev->cal));
+	ADXL345_getOffsets(dev, &dev->cal.before);
+	dev->cal.after = dev->cal.before;
+	dev->cal.state = ACCEL_CAL_RUNNING;
+	dev->cal_bw_rate = dev->bw_rate;
+	dev->cal_fifo_ctl = dev->fifo_ctl;
+	dev->cal_scale = ADXL345_Scale(dev);
+	dev->cal_skip = CAL_SKIP;
+	accel_calMode(dev, CAL_RATE, ADXL345_FIFO_STREAM | CAL_WATERMARK);
+	wake_up_interruptible(&dev->acq_wait);
+	return 0;
+}
 
-	offset_x += ROUNDED_DIVISION(0-average_x, 4);
-	offset_y += ROUNDED_DIVISION(0-average_y, 4);
-	offset_z += ROUNDED_DIVISION(256-average_z, 4);
+/* Collect stamped samples in ug until CAL_SAMPLES are in */
+static void accel_calFeed(struct accel_dev * dev, struct accel_sample samples[], int count) {
+	struct accel_calibration * cal = &dev->cal;
+	int i;
 
-	printk("Calibration: Offset_x: %d, offset_y: %d, offset_z: %d (LSB: 15.6 mg)\n", offset_x, offset_y, offset_z);
+	for (i = 0; i < count && cal->collected < CAL_SAMPLES; i++) {
+		if (dev->cal_skip) {
+			dev->cal_skip--;
+			continue;
+		}
+		dev->cal_ug[0][cal->collected] = samples[i].x * (s32) dev->cal_scale;
+		dev->cal_ug[1][cal->collected] = samples[i].y * (s32) dev->cal_scale;
+		dev->cal_ug[2][cal->collected] = samples[i].z * (s32) dev->cal_scale;
+		cal->collected++;
+	}
+	if (cal->collected == CAL_SAMPLES)
+		accel_calFinish(dev);
+}
 
-	//set the offset register
-	ADXL345_REG_WRITE(ADXL345_REG_OFSX, offset_x);
-	ADXL345_REG_WRITE(ADXL345_REG_OFSY, offset_y);
-	ADXL345_REG_WRITE(ADXL345_REG_OFSZ, offset_z);
+/* Drop every sample more than 3 standard deviations (4.5 median absolute
+ * deviations, at least 2 LSB) from the median on any axis, average the rest
+ * and correct the offsets from there as the Altera calibration does. A board
+ * that moved leaves fewer than half the samples and fails. */
+static void accel_calFinish(struct accel_dev * dev) {
+	struct accel_calibration * cal = &dev->cal;
+	s32 median[3], limit[3];
+	s64 sum[3] = { 0, 0, 0 };
+	int i, axis, n;
+
+	for (axis = 0; axis < 3; axis++) {
+		median[axis] = accel_calMedian(dev->cal_ug[axis], dev->cal_sorted, CAL_SAMPLES);
+		for (i = 0; i < CAL_SAMPLES; i++)
+			dev->cal_sorted[i] = abs(dev->cal_ug[axis][i] - median[axis]);
+		sort(dev->cal_sorted, CAL_SAMPLES, sizeof(s32), accel_calCompare, NULL);
+		limit[axis] = max_t(s32, dev->cal_sorted[CAL_SAMPLES / 2] * 9 / 2, 2 * dev->cal_scale);
+	}
 
-	//restore original bw rate
-	ADXL345_REG_WRITE(ADXL345_BW_RATE, saved_bw);
+	for (i = 0; i < CAL_SAMPLES; i++) {
+		for (axis = 0; axis < 3; axis++) {
+			if (abs(dev->cal_ug[axis][i] - median[axis]) > limit[axis])
+				break;
+		}
+		if (axis < 3)
+			continue;
+		for (axis = 0; axis < 3; axis++)
+			sum[axis] += dev->cal_ug[axis][i];
+		cal->used++;
+	}
+
+	if (cal->used < CAL_SAMPLES / 2) {
+		printk("Calibration of accel%d failed: %u of %u samples within the noise, keep the board still\n",
+			dev->minor, cal->used, CAL_SAMPLES);
+		accel_calEnd(dev, ACCEL_CAL_FAILED);
+		return;
+	}
+	for (axis = 0; axis < 3; axis++)
+		cal->mean[axis] = div_s64(sum[axis], cal->used);
+
+	n = cal->before.x + ROUNDED_DIVISION(0 - cal->mean[0], CAL_OFS_UG);
+	cal->after.x = clamp(n, -128, 127);
+	n = cal->before.y + ROUNDED_DIVISION(0 - cal->mean[1], CAL_OFS_UG);
+	cal->after.y = clamp(n, -128, 127);
+	n = cal->before.z + ROUNDED_DIVISION(CAL_1G_UG - cal->mean[2], CAL_OFS_UG);
+	cal->after.z = clamp(n, -128, 127);
+	ADXL345_setOffsets(dev, &cal->after);
+
+	printk("Calibration of accel%d: mean X=%d, Y=%d, Z=%d ug of %u samples, offsets %d %d %d (LSB: 15.6 mg)\n",
+		dev->minor, cal->mean[0], cal->mean[1], cal->mean[2], cal->used, cal->after.x, cal->after.y, cal->after.z);
+	accel_calEnd(dev, ACCEL_CAL_DONE);
+}
 
-	//restore original data format
-	ADXL345_REG_WRITE(ADXL345_DATA_FORMAT, saved_dataformat);
+/* Restore the rate and FIFO mode of before the calibration and wake the
+ * writers waiting for it */
+static void accel_calEnd(struct accel_dev * dev, u32 state) {
+	accel_calMode(dev, dev->cal_bw_rate, dev->cal_fifo_ctl);
+	dev->cal.state = state;
+	wake_up_interruptible(&dev->cal_wait);
+}
+
+static void accel_calMode(struct accel_dev * dev, u8 rate, u8 fifo) {
+	dev->bw_rate = rate;
+	dev->fifo_ctl = fifo;
+	ADXL345_REG_WRITE(dev, ADXL345_BW_RATE, dev->bw_rate);
+	ADXL345_REG_WRITE(dev, ADXL345_FIFO_CTL, ADXL345_FIFO_BYPASS);
+	ADXL345_REG_WRITE(dev, ADXL345_FIFO_CTL, dev->fifo_ctl);
+	ADXL345_REG_WRITE(dev, ADXL345_INT_ENABLE, ADXL345_IntEnable(dev));
+	accel_stats_reset(dev);
+}
+
+static int accel_calCompare(const void * a, const void * b) {
+	s32 x = *(const s32 *) a, y = *(const s32 *) b;
+
+	return (x > y) - (x < y);
+}
 
-	//Start Measure
-	ADXL345_REG_WRITE(ADXL345_POWER_CTL, 0x08);
+static s32 accel_calMedian(s32 values[], s32 sorted[], int n) {
+	memcpy(sorted, values, n * sizeof(s32));
+	sort(sorted, n, sizeof(s32), accel_calCompare, NULL);
+	return sorted[n / 2];
 }
 
 module_init (init_accel);
@@ -0,0 +1,343 @@
+#include <string.h>
+#include "../address_map_arm.h"
+#include "ADXL345_access.h"
+
+/* Timing model of the DesignWare I2C0 controller with the simulated ADXL345
+ * of ADXL345_sim.c on its bus, for the register offsets of address_map_arm.h.
+ * Time is virtual. The CPU clock advances by mmio_ns per register access (or
+ * by i2csim_idle_until() while the caller sleeps), and the bus processes the
+ * TX FIFO in the background at the SCL rate: 9 SCL periods per byte, one
+ * more for START, RESTART and STOP, and the fast mode bus free time between
+ * STOP and the next START. As on the real controller a STOP is sent as soon
+ * as the TX FIFO runs empty. The ADXL345 ends a read at RESTART as at STOP,
+ * so a transfer of several address write and read records pops a FIFO entry
+ * per record. A read of the data registers that does not run from DATAX0
+ * through DATAZ1 in one go, e.g. one cut by a STOP, is counted in
+ * split_reads: its sample is popped half read. */
+
+#define IC_CLK_NS					10		// 100 MHz ic_clk
+#define I2C_T_BUF_NS				1300	// fast mode bus free time
+#define I2C0_FIFO_DEPTH				64
+#define MMIO_NS						200		// default cost of one register access
+
+/* INTR_STAT / RAW_INTR_STAT bits */
+#define INTR_RX_UNDER				0x001
+#define INTR_RX_OVER				0x002
+#define INTR_RX_FULL				0x004
+#define INTR_TX_OVER				0x008
+#define INTR_TX_EMPTY				0x010
+#define INTR_TX_ABRT				0x040
+#define INTR_STOP_DET				0x200
+#define INTR_START_DET				0x400
+#define ABRT_7B_ADDR_NOACK			0x00001
+#define ABRT_USER_ABRT				0x10000
+
+static void i2csim_run(uint64_t until);
+static void i2csim_stop(void);
+static void i2csim_end_read(void);
+static void i2csim_flush(void);
+static uint64_t scl_ns(void);
+
+static struct {
+	uint32_t con, tar, hcnt, lcnt, enable, intr_mask, rx_tl, tx_tl;
+	uint32_t raw, abrt_source;
+	uint16_t tx[I2C0_FIFO_DEPTH];
+	uint64_t tx_t[I2C0_FIFO_DEPTH];		// CPU time each command was written
+	int tx_head, tx_count;
+	uint8_t rx[I2C0_FIFO_DEPTH];
+	int rx_head, rx_count;
+	uint64_t now;					// CPU time
+	uint64_t bus_t;					// bus time, end of the last bus event
+	int in_xfer;					// START sent, no STOP yet
+	int reading;					// direction since the last (RE)START
+	int pointer_byte;				// next written byte is the ADXL345 register address
+	uint8_t reg;					// ADXL345 register pointer
+	int data_first, data_last;		// data registers read since the last (RE)START, -1 for none
+	uint32_t mmio_ns;
+	struct bussim_stats stats;
+} ic;
+
+void i2csim_reset(void) {
+	uint32_t mmio_ns = ic.mmio_ns ? ic.mmio_ns : MMIO_NS;
+
+	memset(&ic, 0, sizeof(ic));
+	ic.mmio_ns = mmio_ns;
+	//Reset values: master, fast mode, 400 kHz
+	ic.con = 0x65;
+	ic.tar = 0x55;
+	ic.hcnt = 60 + 30;
+	ic.lcnt = 130 + 30;
+	ic.intr_mask = 0x8FF;
+	ic.raw = INTR_TX_EMPTY;
+	ic.data_first = -1;
+	ADXL345_sim_reset();
+	ADXL345_sim_set_clock(i2csim_now);
+}
+
+void i2csim_set_mmio_ns(uint32_t ns) {
+	ic.mmio_ns = ns;
+}
+
+uint64_t i2csim_now(void) {
+	return ic.now;
+}
+
+/* The caller sleeps until ns, the bus keeps running */
+void i2csim_idle_until(uint64_t ns) {
+	if (ns > ic.now)
+		ic.now = ns;
+	i2csim_run(ic.now);
+}
+
+/* The CPU runs ns of code that does not touch the controller, e.g. the
+ * entry and exit of an interrupt */
+void i2csim_cpu(uint64_t ns) {
+	ic.now += ns;
+	ic.stats.cpu_ns += ns;
+	i2csim_run(ic.now);
+}
+
+/* I2C0 interrupt line */
+int i2csim_irq(void) {
+	i2csim_run(ic.now);
+	return (ic.raw & ic.intr_mask) != 0;
+}
+
+void i2csim_get_stats(struct bussim_stats * stats) {
+	*stats = ic.stats;
+	stats->now_ns = ic.now;
+}
+
+static uint64_t scl_ns(void) {
+	return (uint64_t) (ic.hcnt + ic.lcnt) * IC_CLK_NS;
+}
+
+/* Process the TX FIFO up to CPU time until */
+static void i2csim_run(uint64_t until) {
+	uint16_t cmd;
+	uint64_t start, d, scl = scl_ns();
+	int restart, read;
+	uint8_t data;
+
+	while (ic.tx_count) {
+		//The FIFO ran empty before this command was written, STOP went out
+		if (ic.in_xfer && ic.tx_t[ic.tx_head] > ic.bus_t) {
+			i2csim_stop();
+			continue;
+		}
+
+		cmd = ic.tx[ic.tx_head];
+		read = (cmd & 0x100) != 0;
+		start = ic.tx_t[ic.tx_head] > ic.bus_t ? ic.tx_t[ic.tx_head] : ic.bus_t;
+		restart = ic.in_xfer && ((cmd & 0x400) || read != ic.reading);
+		d = 9 * scl;
+		if (!ic.in_xfer || restart)
+			d += scl + 9 * scl;		//(RE)START and the address byte
+		if (start + d > until)
+			break;
+
+		ic.tx_head = (ic.tx_head + 1) % I2C0_FIFO_DEPTH;
+		ic.tx_count--;
+		if (restart) {
+			i2csim_end_read();
+			ADXL345_sim_end();
+		}
+		if (!ic.in_xfer || restart) {
+			ic.raw |= ic.in_xfer ? 0 : INTR_START_DET;
+			ic.in_xfer = 1;
+			ic.reading = read;
+			ic.pointer_byte = !read;
+			ic.stats.bytes++;
+			if (ic.tar != ADXL345_I2C_ADDR) {
+				//Address NACK: the controller flushes the TX FIFO and stops
+				ic.stats.bus_busy_ns += 2 * scl + 9 * scl;
+				ic.bus_t = start + 2 * scl + 9 * scl;
+				ic.abrt_source |= ABRT_7B_ADDR_NOACK;
+				ic.raw |= INTR_TX_ABRT;
+				ic.tx_count = 0;
+				i2csim_stop();
+				break;
+			}
+		}
+
+		if (read) {
+			if (ic.reg >= ADXL345_DATAX0 && ic.reg <= ADXL345_DATAZ1) {
+				if (ic.data_first < 0)
+					ic.data_first = ic.reg;
+				ic.data_last = ic.reg;
+			}
+			data = ADXL345_sim_read(ic.reg++);
+			if (ic.rx_count < I2C0_FIFO_DEPTH) {
+				ic.rx[(ic.rx_head + ic.rx_count) % I2C0_FIFO_DEPTH] = data;
+				ic.rx_count++;
+			}
+			else
+				ic.raw |= INTR_RX_OVER;
+		}
+		else if (ic.pointer_byte) {
+			ic.reg = cmd & 0xFF;
+			ic.pointer_byte = 0;
+		}
+		else
+			ADXL345_sim_write(ic.reg++, cmd & 0xFF);
+
+		ic.stats.bytes++;
+		ic.stats.bus_busy_ns += d;
+		ic.bus_t = start + d;
+	}
+	if (!ic.tx_count && ic.in_xfer && ic.bus_t <= until)
+		i2csim_stop();
+
+	if (ic.tx_count <= (int) ic.tx_tl)
+		ic.raw |= INTR_TX_EMPTY;
+	else
+		ic.raw &= ~INTR_TX_EMPTY;
+	if (ic.rx_count > (int) ic.rx_tl)
+		ic.raw |= INTR_RX_FULL;
+	else
+		ic.raw &= ~INTR_RX_FULL;
+}
+
+static void i2csim_stop(void) {
+	uint64_t scl = scl_ns();
+
+	ic.bus_t += scl;
+	ic.stats.bus_busy_ns += scl;
+	ic.stats.transactions++;
+	i2csim_end_read();
+	ADXL345_sim_end();
+	ic.in_xfer = 0;
+	ic.raw |= INTR_STOP_DET;
+	//Bus free time before the next START
+	ic.bus_t += I2C_T_BUF_NS;
+}
+
+static void i2csim_end_read(void) {
+	if (ic.data_first >= 0 && (ic.data_first != ADXL345_DATAX0 || ic.data_last != ADXL345_DATAZ1))
+		ic.stats.split_reads++;
+	ic.data_first = -1;
+}
+
+static void i2csim_flush(void) {
+	ic.tx_count = ic.rx_count = 0;
+	ic.tx_head = ic.rx_head = 0;
+}
+
+uint32_t i2csim_read(int offset) {
+	uint32_t value = 0;
+
+	ic.now += ic.mmio_ns;
+	ic.stats.cpu_ns += ic.mmio_ns;
+	ic.stats.accesses++;
+	i2csim_run(ic.now);
+
+	switch (offset) {
+	case I2C0_CON :
+		return ic.con;
+	case I2C0_TAR :
+		return ic.tar;
+	case I2C0_DATA_CMD :
+		if (!ic.rx_count) {
+			ic.raw |= INTR_RX_UNDER;
+			return 0;
+		}
+		value = ic.rx[ic.rx_head];
+		ic.rx_head = (ic.rx_head + 1) % I2C0_FIFO_DEPTH;
+		ic.rx_count--;
+		if (ic.rx_count <= (int) ic.rx_tl)
+			ic.raw &= ~INTR_RX_FULL;
+		return value;
+	case I2C0_FS_SCL_HCNT :
+		return ic.hcnt;
+	case I2C0_FS_SCL_LCNT :
+		return ic.lcnt;
+	case I2C0_INTR_STAT :
+		return ic.raw & ic.intr_mask;
+	case I2C0_INTR_MASK :
+		return ic.intr_mask;
+	case I2C0_RAW_INTR_STAT :
+		return ic.raw;
+	case I2C0_RX_TL :
+		return ic.rx_tl;
+	case I2C0_TX_TL :
+		return ic.tx_tl;
+	case I2C0_CLR_INTR :
+		ic.raw &= (INTR_RX_FULL | INTR_TX_EMPTY);
+		ic.abrt_source = 0;
+		return 0;
+	case I2C0_CLR_TX_ABRT :
+		ic.raw &= ~INTR_TX_ABRT;
+		ic.abrt_source = 0;
+		return 0;
+	case I2C0_CLR_STOP_DET :
+		ic.raw &= ~INTR_STOP_DET;
+		return 0;
+	case I2C0_ENABLE :
+		return ic.enable;
+	case I2C0_TXFLR :
+		return ic.tx_count;
+	case I2C0_RXFLR :
+		return ic.rx_count;
+	case I2C0_TX_ABRT_SOURCE :
+		return ic.abrt_source;
+	case I2C0_ENABLE_STATUS :
+		return ic.enable & 0x1;
+	}
+	return 0;
+}
+
+void i2csim_write(int offset, uint32_t value) {
+	ic.now += ic.mmio_ns;
+	ic.stats.cpu_ns += ic.mmio_ns;
+	ic.stats.accesses++;
+	i2csim_run(ic.now);
+
+	switch (offset) {
+	case I2C0_CON :
+		ic.con = value;
+		break;
+	case I2C0_TAR :
+		ic.tar = value & 0x3FF;
+		break;
+	case I2C0_DATA_CMD :
+		if (!(ic.enable & 0x1))
+			break;
+		if (ic.tx_count == I2C0_FIFO_DEPTH) {
+			ic.raw |= INTR_TX_OVER;
+			break;
+		}
+		ic.tx[(ic.tx_head + ic.tx_count) % I2C0_FIFO_DEPTH] = value & 0x7FF;
+		ic.tx_t[(ic.tx_head + ic.tx_count) % I2C0_FIFO_DEPTH] = ic.now;
+		ic.tx_count++;
+		i2csim_run(ic.now);
+		break;
+	case I2C0_FS_SCL_HCNT :
+		ic.hcnt = value & 0xFFFF;
+		break;
+	case I2C0_FS_SCL_LCNT :
+		ic.lcnt = value & 0xFFFF;
+		break;
+	case I2C0_INTR_MASK :
+		ic.intr_mask = value;
+		break;
+	case I2C0_RX_TL :
+		ic.rx_tl = value & 0xFF;
+		break;
+	case I2C0_TX_TL :
+		ic.tx_tl = value & 0xFF;
+		break;
+	case I2C0_ENABLE :
+		if (value & 0x2) {
+			//ABORT: flush the TX FIFO, STOP and raise TX_ABRT
+			ic.tx_count = 0;
+			ic.abrt_source |= ABRT_USER_ABRT;
+			ic.raw |= INTR_TX_ABRT;
+			if (ic.in_xfer)
+				i2csim_stop();
+		}
+		if (!(value & 0x1))
+			i2csim_flush();
+		ic.enable = value & 0x1;
+		break;
+	}
+}
@@ -0,0 +1,151 @@
+/* Interrupt driven transfers on the HPS DesignWare I2C controller, shared by
+ * the driver and the "i2cirq" backend of ADXL345_access.c, which runs them on
+ * the timing model of ADXL345_i2csim.c.
+ *
+ * The caller builds the commands, starts the transfer with i2c_xfer_start()
+ * and sleeps; the controller interrupt passes INTR_STAT to i2c_xfer_irq(),
+ * which drains the RX FIFO, refills the TX FIFO and returns 1 once the
+ * transfer has ended, with err set if it was aborted. The includer provides
+ * the register offsets of address_map_arm.h and defines
+ * I2C_XFER_RD(base, offset) and I2C_XFER_WR(base, offset, value) first. */
+#ifndef ADXL345_I2CXFER_H
+#define ADXL345_I2CXFER_H
+
+#include <linux/types.h>
+
+#ifdef __KERNEL__
+#include <linux/errno.h>
+#else
+#include <errno.h>
+#endif
+
+#define I2C0_FIFO_DEPTH				64
+#define I2C0_INTR_RX_FULL			0x004
+#define I2C0_INTR_TX_EMPTY			0x010
+#define I2C0_INTR_TX_ABRT			0x040
+#define I2C0_INTR_STOP_DET			0x200
+
+struct i2c_xfer {
+	const __u16 * cmds;
+	__u8 * rx;
+	int tx_len, tx_pos;			// commands queued to DATA_CMD
+	int rx_len, rx_pos;			// bytes taken from the RX FIFO
+	int reads;					// read commands queued
+	int err;
+};
+
+/* RX_FULL above half the RX FIFO, TX_EMPTY at a quarter of the TX FIFO */
+static inline void i2c_xfer_init(volatile int * base) {
+	I2C_XFER_WR(base, I2C0_INTR_MASK, 0);
+	I2C_XFER_WR(base, I2C0_RX_TL, I2C0_FIFO_DEPTH / 2 - 1);
+	I2C_XFER_WR(base, I2C0_TX_TL, I2C0_FIFO_DEPTH / 4);
+}
+
+/* Clear a STOP_DET left by the previous transfer and unmask the interrupts,
+ * TX_EMPTY fires at once and queues the first commands */
+static inline void i2c_xfer_start(struct i2c_xfer * x, volatile int * base, const __u16 cmds[], int ncmds,
+	__u8 rx[], int nrx) {
+	x->cmds = cmds;
+	x->rx = rx;
+	x->tx_len = ncmds;
+	x->rx_len = nrx;
+	x->tx_pos = x->rx_pos = x->reads = 0;
+	x->err = 0;
+
+	(void) I2C_XFER_RD(base, I2C0_CLR_INTR);
+	I2C_XFER_WR(base, I2C0_INTR_MASK, I2C0_INTR_TX_EMPTY | I2C0_INTR_RX_FULL | I2C0_INTR_STOP_DET |
+		I2C0_INTR_TX_ABRT);
+}
+
+/* A transfer the handler did not end: abort whatever is still queued and
+ * drop stale RX bytes. The caller has masked the interrupts and made sure
+ * the handler is not running. */
+static inline void i2c_xfer_abort(struct i2c_xfer * x, volatile int * base) {
+	I2C_XFER_WR(base, I2C0_INTR_MASK, 0);
+	I2C_XFER_WR(base, I2C0_ENABLE, 0x3);
+	while (I2C_XFER_RD(base, I2C0_RXFLR) > 0)
+		(void) I2C_XFER_RD(base, I2C0_DATA_CMD);
+	(void) I2C_XFER_RD(base, I2C0_CLR_INTR);
+	x->err = -ETIMEDOUT;
+}
+
+/* Drain the RX FIFO into the transfer buffer */
+static inline void i2c_xfer_rx(struct i2c_xfer * x, volatile int * base) {
+	__u32 data;
+
+	while (I2C_XFER_RD(base, I2C0_RXFLR) > 0) {
+		data = I2C_XFER_RD(base, I2C0_DATA_CMD) & 0xFF;
+		if (x->rx_pos < x->rx_len)
+			x->rx[x->rx_pos++] = data;
+	}
+}
+
+/* Refill the TX FIFO a record at a time, a record being a command with
+ * 0x400 (the register address write, with RESTART) and what follows up to
+ * the next one. The controller sends STOP as soon as its TX FIFO runs empty,
+ * and a STOP inside a record would end the read there and read the rest of
+ * it as a new transaction, from the next ADXL345 FIFO entry. So a record is
+ * only queued whole, when the TX FIFO has room for all of it and the RX FIFO
+ * for all its bytes; a late refill then lets the bus STOP between records,
+ * which only costs bus time. Reads in flight are capped at the RX FIFO
+ * depth; while capped TX_EMPTY is masked and the next RX_FULL or STOP_DET
+ * resumes the refill. A record longer than the TX FIFO cannot go in whole
+ * and is queued as room allows; I2C_Read() of the driver never builds one. */
+static inline void i2c_xfer_tx(struct i2c_xfer * x, volatile int * base) {
+	int end, n, i, reads, room, capped = 0;
+
+	while (x->tx_pos < x->tx_len) {
+		end = x->tx_pos + 1;
+		while (end < x->tx_len && !(x->cmds[end] & 0x400))
+			end++;
+		n = end - x->tx_pos;
+		room = I2C0_FIFO_DEPTH - I2C_XFER_RD(base, I2C0_TXFLR);
+		if (n > I2C0_FIFO_DEPTH)
+			n = room;
+		if (!n || n > room)
+			break;
+		for (i = 0, reads = 0; i < n; i++) {
+			if (x->cmds[x->tx_pos + i] & 0x100)
+				reads++;
+		}
+		if (x->reads - x->rx_pos + reads > I2C0_FIFO_DEPTH) {
+			capped = 1;
+			break;
+		}
+		for (i = 0; i < n; i++)
+			I2C_XFER_WR(base, I2C0_DATA_CMD, x->cmds[x->tx_pos++]);
+		x->reads += reads;
+	}
+	if (capped || x->tx_pos == x->tx_len)
+		I2C_XFER_WR(base, I2C0_INTR_MASK, I2C_XFER_RD(base, I2C0_INTR_MASK) & ~I2C0_INTR_TX_EMPTY);
+	else
+		I2C_XFER_WR(base, I2C0_INTR_MASK, I2C_XFER_RD(base, I2C0_INTR_MASK) | I2C0_INTR_TX_EMPTY);
+}
+
+/* Controller interrupt with INTR_STAT stat, not 0. The controller issues
+ * STOP once its TX FIFO runs empty, so STOP_DET only ends the transfer when
+ * every command has been queued and every byte received. Returns 1 when the
+ * transfer has ended, with err set on an abort. */
+static inline int i2c_xfer_irq(struct i2c_xfer * x, volatile int * base, __u32 stat) {
+	if (stat & I2C0_INTR_TX_ABRT) {
+		(void) I2C_XFER_RD(base, I2C0_CLR_TX_ABRT);
+		I2C_XFER_WR(base, I2C0_INTR_MASK, 0);
+		x->err = -EIO;
+		return 1;
+	}
+
+	i2c_xfer_rx(x, base);
+	if (x->tx_pos < x->tx_len)
+		i2c_xfer_tx(x, base);
+
+	if (stat & I2C0_INTR_STOP_DET) {
+		(void) I2C_XFER_RD(base, I2C0_CLR_STOP_DET);
+		if (x->tx_pos == x->tx_len && x->rx_pos == x->rx_len) {
+			I2C_XFER_WR(base, I2C0_INTR_MASK, 0);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+#endif
@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include "ADXL345_access.h"
+
+/* Timestamp accuracy test: runs the sample timeline of ADXL345_timestamp.h
+ * the way the driver feeds it, against the simulated ADXL345 on the I2C0 or
+ * SPIM0 timing model in virtual time, with the sensor oscillator off by some
+ * ppm and jittered interrupt and wakeup latencies. The simulated part puts
+ * the sample number in X and Y, so every sample read is compared with the
+ * time it was really produced.
+ * Usage: ADXL345_jitter [-b bus] [-r rate] [-t ms] [-p ppm] [-l latency_us] [-j jitter_us]
+ *                       [-s stalls] [-e max_us]
+ *   -b   i2csim (default) or spisim
+ *   -r   BW_RATE code, default 13 (800 Hz)
+ *   -t   virtual time per configuration, default 10000 ms
+ *   -p   sensor output data rate error, default 2000 ppm (slow)
+ *   -l   interrupt to thread wakeup latency, default 20 us
+ *   -j   random extra latency, up to 50 us by default, on the interrupt
+ *        entry and the wakeup each, or on top of the polling period
+ *   -s   wakeups per 1000 delayed by a further 0 to 5 ms, default 1
+ *   -e   largest timestamp error allowed, default 1000 us, or half a period
+ *        when that is more as it still names the right sample
+ * Configurations are data ready and FIFO stream at a watermark of 16, each
+ * interrupt driven and polled. For each it reports the error of the
+ * reconstructed timestamps, and of stamping every sample with the read time
+ * as a reference, over the samples after the first JITTER_SETTLE_NS the
+ * estimator needs to measure the oscillator, along with the estimated ppm
+ * and the timeline restarts. Exits 1 when an interrupt driven configuration
+ * has an error beyond -e or a measured estimate off by more than
+ * JITTER_PPM_TOLERANCE. Polled observations are late by anything up to the
+ * polling interval, twice per sample in data ready mode as the driver polls,
+ * which bounds their accuracy instead; those rows are reported without a
+ * bound. */
+
+#define JITTER_BATCH				ADXL345_FIFO_DEPTH
+#define JITTER_SETTLE_NS			3000000000ULL
+#define JITTER_STALL_NS				5000000
+#define JITTER_PPM_TOLERANCE		200
+
+struct jitter_config {
+	const char * name;
+	unsigned int watermark;		// 0 for DATA_READY, else FIFO stream mode
+	int irq;					// else polled once per period or watermark
+};
+
+struct jitter_model {
+	struct adxl345_bus * bus;
+	uint64_t (*now)(void);
+	void (*idle_until)(uint64_t ns);
+};
+
+static struct jitter_model models[] = {
+	{ &i2csim_bus, i2csim_now, i2csim_idle_until },
+	{ &spisim_bus, spisim_now, spisim_idle_until },
+};
+
+static struct jitter_config configs[] = {
+	{ "dataready irq", 0, 1 },
+	{ "dataready poll", 0, 0 },
+	{ "fifo 16 irq", 16, 1 },
+	{ "fifo 16 poll", 16, 0 },
+};
+
+/* Timestamp errors in ns */
+struct jitter_error {
+	uint64_t samples;
+	double sum, sum_sq, max;
+};
+
+struct jitter_params {
+	int rate;
+	unsigned int ms;
+	int32_t ppm;
+	uint64_t latency_ns, jitter_ns;
+	int stalls;
+	double max_ns;
+};
+
+static int run_config(struct jitter_model * model, struct jitter_config * config, struct jitter_params * p);
+static void error_add(struct jitter_error * e, double ns);
+static uint64_t urand(uint64_t max);
+
+int main(int argc, char * argv[]) {
+
+	struct jitter_model * model = &models[0];
+	struct jitter_params p = { 13, 10000, 2000, 20000, 50000, 1, 1000000 };
+	int opt, failed = 0;
+	unsigned int i;
+
+	while ((opt = getopt(argc, argv, "b:r:t:p:l:j:s:e:")) != -1) {
+		switch (opt) {
+		case 'b' :
+			for (i = 0; i < sizeof(models) / sizeof(models[0]); i++) {
+				if (!strcmp(optarg, models[i].bus->name))
+					break;
+			}
+			if (i == sizeof(models) / sizeof(models[0])) {
+				printf("ERROR: buses are i2csim and spisim\n");
+				return(-1);
+			}
+			model = &models[i];
+			break;
+		case 'r' :
+			p.rate = atoi(optarg);
+			break;
+		case 't' :
+			p.ms = atoi(optarg);
+			break;
+		case 'p' :
+			p.ppm = atoi(optarg);
+			break;
+		case 'l' :
+			p.latency_ns = (uint64_t) atoi(optarg) * 1000;
+			break;
+		case 'j' :
+			p.jitter_ns = (uint64_t) atoi(optarg) * 1000;
+			break;
+		case 's' :
+			p.stalls = atoi(optarg);
+			break;
+		case 'e' :
+			p.max_ns = atof(optarg) * 1000;
+			break;
+		default :
+			printf("Usage: %s [-b bus] [-r rate] [-t ms] [-p ppm] [-l latency_us] [-j jitter_us] "
+				"[-s stalls] [-e max_us]\n", argv[0]);
+			return(-1);
+		}
+	}
+	if (p.rate < 0 || p.rate > 15 || p.ms <= JITTER_SETTLE_NS / 1000000 || p.ppm <= -50000 || p.ppm >= 50000) {
+		printf("ERROR: rates are 0 to 15, time > 3000 ms, |ppm| < 50000\n");
+		return(-1);
+	}
+
+	printf("bus %s, rate %d (%.3f Hz), odr error %d ppm\n\n", model->bus->name, p.rate,
+		3200.0 / (1 << (15 - p.rate)), p.ppm);
+	printf("%-15s %8s %9s %9s %9s %9s %9s %8s %7s\n", "config", "samples", "mean_us", "rms_us", "max_us",
+		"read_rms", "read_max", "est_ppm", "resync");
+	srand(1);
+	for (i = 0; i < sizeof(configs) / sizeof(configs[0]); i++)
+		failed |= run_config(model, &configs[i], &p);
+	printf("\n%s\n", failed ? "FAILED" : "passed");
+	return failed;
+}
+
+static uint64_t urand(uint64_t max) {
+	return max ? (uint64_t) rand() % max : 0;
+}
+
+static void error_add(struct jitter_error * e, double ns) {
+	e->samples++;
+	e->sum += ns;
+	e->sum_sq += ns * ns;
+	if (fabs(ns) > e->max)
+		e->max = fabs(ns);
+}
+
+/* One configuration, fed to the timeline as accel_acquire() does: the
+ * interrupt time for the sample that raised it, else the time the data was
+ * found */
+static int run_config(struct jitter_model * model, struct jitter_config * config, struct jitter_params * p) {
+	struct adxl345_bus * bus = model->bus;
+	struct accel_ts ts;
+	struct jitter_error stamped, read;
+	uint8_t records[JITTER_BATCH][ADXL345_RECORD_SIZE];
+	uint8_t source, status;
+	int16_t xyz[3];
+	uint64_t start, end, next, deadline, irq_ns = 0, obs_ns, read_ns, truth, period, now;
+	uint32_t n;
+	int count, obs, i, failed;
+
+	memset(&ts, 0, sizeof(ts));
+	memset(&stamped, 0, sizeof(stamped));
+	memset(&read, 0, sizeof(read));
+
+	if (bus->open(bus) < 0)
+		return 1;
+	ADXL345_sim_set_odr_error(p->ppm);
+	ADXL345_sim_set_counter(1);
+	ADXL345_Init(bus);
+	ADXL345_SetRate(bus, p->rate);
+	if (config->watermark) {
+		bus->reg_write(bus, ADXL345_FIFO_CTL, ADXL345_FIFO_STREAM | config->watermark);
+		bus->reg_write(bus, ADXL345_INT_ENABLE, ADXL345_WATERMARK);
+	}
+	else
+		bus->reg_write(bus, ADXL345_INT_ENABLE, ADXL345_DATAREADY);
+	bus->reg_read(bus, ADXL345_DEVID, &status);
+	accel_ts_restart(&ts, ADXL345_Period(p->rate));
+
+	start = model->now();
+	end = start + (uint64_t) p->ms * 1000000;
+	period = config->watermark ? ADXL345_Period(p->rate) * config->watermark : ADXL345_Period(p->rate) / 2;
+	deadline = start;
+
+	while (model->now() < end) {
+		if (config->irq) {
+			//Sleep until INT1, then pay the entry and wakeup latencies
+			if (!ADXL345_sim_int1()) {
+				next = ADXL345_sim_next();
+				if (next >= end)
+					break;
+				model->idle_until(next);
+				continue;
+			}
+			irq_ns = model->now() + urand(p->jitter_ns);
+			model->idle_until(irq_ns + p->latency_ns + urand(p->jitter_ns));
+		}
+		else {
+			//The driver's polling grid: deadlines a period apart, each wakeup
+			//up to an eighth of a period late
+			now = model->now();
+			deadline += period;
+			if (deadline + period < now)
+				deadline = now;
+			model->idle_until((deadline > now ? deadline : now) + urand(period / 8) + p->latency_ns +
+				urand(p->jitter_ns));
+		}
+		if ((int) urand(1000) < p->stalls)
+			model->idle_until(model->now() + urand(JITTER_STALL_NS));
+
+		count = 0;
+		obs = 0;
+		obs_ns = 0;
+		if (config->watermark) {
+			bus->reg_read(bus, ADXL345_INT_SOURCE, &source);
+			if (!config->irq || (source & ADXL345_WATERMARK)) {
+				bus->reg_read(bus, ADXL345_FIFO_STATUS, &status);
+				obs_ns = model->now();
+				count = ADXL345_FIFO_Drain(bus, records, status & ADXL345_FIFO_ENTRIES);
+			}
+			obs = count - 1;
+			if (config->irq && !(source & ADXL345_OVERRUN) && count >= (int) config->watermark) {
+				obs = config->watermark - 1;
+				obs_ns = irq_ns;
+			}
+		}
+		else if (ADXL345_Snapshot(bus, &source, xyz)) {
+			for (i = 0; i < 3; i++) {
+				records[0][2*i] = xyz[i] & 0xFF;
+				records[0][2*i + 1] = (xyz[i] >> 8) & 0xFF;
+			}
+			count = 1;
+			obs_ns = (config->irq && !(source & ADXL345_OVERRUN)) ? irq_ns : model->now();
+		}
+		read_ns = model->now();
+
+		accel_ts_batch(&ts, count, obs, obs_ns, source & ADXL345_OVERRUN);
+		for (i = 0; i < count; i++) {
+			n = records[i][0] | (records[i][1] << 8) | (records[i][2] << 16) | ((uint32_t) records[i][3] << 24);
+			truth = ADXL345_sim_sample_ns(n);
+			if (!truth || truth < start + JITTER_SETTLE_NS)
+				continue;
+			error_add(&stamped, (double) (int64_t) (accel_ts_stamp(&ts, i) - truth));
+			error_add(&read, (double) (int64_t) (read_ns - truth));
+		}
+	}
+	bus->close(bus);
+
+	failed = !stamped.samples || (config->irq && ((stamped.max > p->max_ns && stamped.max > ADXL345_Period(p->rate) / 2) ||
+		(ts.measured && abs(accel_ts_ppm(&ts) - p->ppm) > JITTER_PPM_TOLERANCE)));
+	printf("%-15s %8llu %9.1f %9.1f %9.1f %9.1f %9.1f %8d %7u%s\n", config->name,
+		(unsigned long long) stamped.samples,
+		stamped.samples ? stamped.sum / stamped.samples / 1000 : 0.0,
+		stamped.samples ? sqrt(stamped.sum_sq / stamped.samples) / 1000 : 0.0, stamped.max / 1000,
+		read.samples ? sqrt(read.sum_sq / read.samples) / 1000 : 0.0, read.max / 1000,
+		accel_ts_ppm(&ts), ts.resyncs, failed ? "  FAILED" : "");
+	return failed;
+}
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include "accel.h"
+
+/* Zero copy consumer of the /dev/accelN mmap() ring.
+ * Usage: ADXL345_mmap [-v] [device]    -v prints every sample, device
+ * defaults to /dev/accel0 */
+
+static double elapsed(struct timespec * start, struct timespec * end);
+
+volatile sig_atomic_t stop;
+void catchSIGINT (int signum) {
+	stop = 1;
+}
+
+int main(int argc, char * argv[]) {
+
+	int fd, verbose = 0, arg;
+	const char * device = "/dev/accel0";
+	void * ring;
+	size_t span;
+	struct accel_mmap_ctl * ctl;
+	struct accel_sample * samples, sample;
+	uint32_t head, tail, records, mask, lap;
+	unsigned long long consumed = 0, dropped = 0, torn = 0;
+	struct pollfd pfd;
+	struct timespec start, end;
+	struct rusage usage;
+	double seconds, cpu;
+
+	for (arg = 1; arg < argc; arg++) {
+		if (!strcmp(argv[arg], "-v"))
+			verbose = 1;
+		else
+			device = argv[arg];
+	}
+
+	stop = 0;
+	signal(SIGINT, catchSIGINT);
+
+	if ((fd = open(device, O_RDWR)) == -1) {
+		printf("ERROR: could not open \"%s\"...\n", device);
+		return(-1);
+	}
+
+	//Map the control page first to learn the ring size
+	ctl = mmap(NULL, getpagesize(), PROT_READ, MAP_SHARED, fd, 0);
+	if (ctl == MAP_FAILED) {
+		printf("ERROR: mmap() failed...\n");
+		close(fd);
+		return(-1);
+	}
+	records = ctl->records;
+	span = ctl->offset + (size_t) records * ctl->record_size;
+	if (ctl->record_size != sizeof(struct accel_sample)) {
+		printf("ERROR: record size %u, expected %zu\n", ctl->record_size, sizeof(struct accel_sample));
+		munmap(ctl, getpagesize());
+		close(fd);
+		return(-1);
+	}
+	munmap(ctl, getpagesize());
+	if (records <= ACCEL_MMAP_BATCH) {
+		printf("ERROR: ring of %u records, expected more than %d\n", records, ACCEL_MMAP_BATCH);
+		close(fd);
+		return(-1);
+	}
+
+	ring = mmap(NULL, span, (PROT_READ | PROT_WRITE), MAP_SHARED, fd, 0);
+	if (ring == MAP_FAILED) {
+		printf("ERROR: mmap() failed...\n");
+		close(fd);
+		return(-1);
+	}
+	ctl = (struct accel_mmap_ctl *) ring;
+	samples = (struct accel_sample *) ((char *) ring + ctl->offset);
+	mask = records - 1;
+	//The batch being written may already cover the oldest ACCEL_MMAP_BATCH slots
+	lap = records - ACCEL_MMAP_BATCH;
+
+	tail = __atomic_load_n(&ctl->head, __ATOMIC_ACQUIRE);
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (!stop) {
+		//Publish our position, poll() sleeps until head moves past it
+		__atomic_store_n(&ctl->tail, tail, __ATOMIC_RELEASE);
+		if (poll(&pfd, 1, 1000) < 0)
+			break;
+
+		head = __atomic_load_n(&ctl->head, __ATOMIC_ACQUIRE);
+		if (head - tail > lap) {
+			dropped += head - tail - lap;
+			tail = head - lap;
+		}
+		while (tail != head) {
+			sample = samples[tail & mask];
+			//The producer may have lapped this slot while it was copied
+			if (__atomic_load_n(&ctl->head, __ATOMIC_ACQUIRE) - tail > lap) {
+				torn++;
+				tail++;
+				continue;
+			}
+			if (verbose)
+				printf("%u %llu X=%d Y=%d Z=%d %#x\n", sample.seq, (unsigned long long) sample.timestamp,
+					sample.x, sample.y, sample.z, sample.flags);
+			tail++;
+			consumed++;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	getrusage(RUSAGE_SELF, &usage);
+	seconds = elapsed(&start, &end);
+	cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+		+ usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+
+	printf("%llu samples in %.3f s: %.1f samples/s\n", consumed, seconds, consumed / seconds);
+	printf("dropped: %llu, torn: %llu, cpu: %.3f s (%.2f%%)\n", dropped, torn, cpu, 100.0 * cpu / seconds);
+
+	//clean up
+	munmap(ring, span);
+	close(fd);
+	return 0;
+}
+
+static double elapsed(struct timespec * start, struct timespec * end) {
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
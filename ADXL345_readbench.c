@@ -0,0 +1,171 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include "ADXL345_access.h"
+#include "ADXL345_replay.h"
+
+/* Reader harness for the text lines of /dev/accel: read() calls and CPU
+ * time per sample.
+ * Usage: ADXL345_readbench [-l length] [-t seconds] [-p] [device]
+ *   -l   read() length, default 4096. 1 takes one byte per call, which is
+ *        what accel_read returned before it copied whole batches.
+ *   -t   seconds to read, default 5
+ *   -p   read a pipe instead, fed as fast as it is read by a thread that
+ *        writes the driver's lines of a synthetic signal (ADXL345_replay.h)
+ *        32 at a time, as a FIFO drain publishes them
+ *   device defaults to /dev/accel0
+ * Reports the read() calls, those that returned 0 (the end of a batch on
+ * /dev/accel), the samples (lines), and per sample the read() calls and the
+ * CPU time of the reading thread, user and system. */
+
+#define READBENCH_BATCH				ADXL345_FIFO_DEPTH
+#define READBENCH_LINE_MAX			40
+
+static void * feeder(void * arg);
+static double seconds(struct timeval * tv);
+
+volatile sig_atomic_t stop;
+void catchSIGINT (int signum) {
+	stop = 1;
+}
+
+int main(int argc, char * argv[]) {
+
+	int opt, fd, pipefd[2], use_pipe = 0;
+	size_t length = 4096;
+	unsigned int secs = 5;
+	const char * device = "/dev/accel0";
+	unsigned long long calls = 0, zeros = 0, lines = 0;
+	uint64_t start, end, now;
+	struct rusage usage;
+	struct accel_replay_config cfg = { NULL, ACCEL_REPLAY_SINE | ACCEL_REPLAY_NOISE, 50, 500, 0, 1 };
+	pthread_t thread;
+	char * buffer, * p;
+	ssize_t n;
+	double user, sys;
+
+	while ((opt = getopt(argc, argv, "l:t:p")) != -1) {
+		switch (opt) {
+		case 'l' :
+			length = strtoul(optarg, NULL, 0);
+			break;
+		case 't' :
+			secs = atoi(optarg);
+			break;
+		case 'p' :
+			use_pipe = 1;
+			break;
+		default :
+			printf("Usage: %s [-l length] [-t seconds] [-p] [device]\n", argv[0]);
+			return(-1);
+		}
+	}
+	if (optind < argc)
+		device = argv[optind];
+	if (length == 0 || secs == 0) {
+		printf("ERROR: length and time > 0\n");
+		return(-1);
+	}
+	if ((buffer = malloc(length)) == NULL) {
+		printf("ERROR: out of memory\n");
+		return(-1);
+	}
+
+	stop = 0;
+	signal(SIGINT, catchSIGINT);
+	signal(SIGPIPE, SIG_IGN);
+
+	if (use_pipe) {
+		if (pipe(pipefd) < 0) {
+			printf("ERROR: pipe() failed...\n");
+			return(-1);
+		}
+		ADXL345_Replay_Setup(&cfg);
+		if (replay_source.open(&replay_source) < 0)
+			return(-1);
+		if (pthread_create(&thread, NULL, feeder, &pipefd[1])) {
+			printf("ERROR: could not start the feeder thread\n");
+			return(-1);
+		}
+		fd = pipefd[0];
+		device = "pipe";
+	}
+	else if ((fd = open(device, O_RDONLY)) == -1) {
+		printf("ERROR: could not open \"%s\"...\n", device);
+		return(-1);
+	}
+
+	start = now = accel_now_ns();
+	end = start + (uint64_t) secs * 1000000000;
+	while (!stop && now < end) {
+		n = read(fd, buffer, length);
+		calls++;
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			printf("ERROR: read() failed...\n");
+			break;
+		}
+		if (n == 0) {
+			zeros++;
+			if (use_pipe)
+				break;
+		}
+		for (p = buffer; (p = memchr(p, '\n', buffer + n - p)) != NULL; p++)
+			lines++;
+		now = accel_now_ns();
+	}
+	getrusage(RUSAGE_THREAD, &usage);
+	user = seconds(&usage.ru_utime);
+	sys = seconds(&usage.ru_stime);
+
+	stop = 1;
+	close(fd);
+	if (use_pipe) {
+		pthread_join(thread, NULL);
+		replay_source.close(&replay_source);
+	}
+	free(buffer);
+
+	printf("%s, read() length %zu: %llu calls, %llu returned 0, %llu samples in %.3f s, %.1f samples/s\n",
+		device, length, calls, zeros, lines, (now - start) / 1e9, lines * 1e9 / (now - start));
+	if (lines)
+		printf("per sample: %.3f read() calls, %.3f us CPU (user %.3f, system %.3f)\n", (double) calls / lines,
+			(user + sys) * 1e6 / lines, user * 1e6 / lines, sys * 1e6 / lines);
+	return 0;
+}
+
+/* Writes batches of text lines to the pipe until the reader closes it */
+static void * feeder(void * arg) {
+	int fd = *(int *) arg;
+	struct accel_sample samples[READBENCH_BATCH];
+	char text[READBENCH_BATCH * READBENCH_LINE_MAX];
+	int32_t scale;
+	size_t len;
+	int n, i;
+
+	while (!stop) {
+		if ((n = replay_source.read(&replay_source, samples, READBENCH_BATCH, UINT64_MAX)) <= 0)
+			break;
+		for (i = 0, len = 0; i < n; i++) {
+			scale = samples[i].scale;
+			len += sprintf(text + len, "%d %d %d %d %d\n", 1, samples[i].x * scale / 1000,
+				samples[i].y * scale / 1000, samples[i].z * scale / 1000, (scale + 500) / 1000);
+		}
+		if (write(fd, text, len) < 0)
+			break;
+	}
+	close(fd);
+	return NULL;
+}
+
+static double seconds(struct timeval * tv) {
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
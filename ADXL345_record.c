@@ -0,0 +1,654 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ADXL345_record.h"
+
+/* Recording format, see ADXL345_record.h. A frame is
+ *   wx << 4 | wy, wz << 4 | wt, n - 1
+ *   varint e, then e times: index, varint seq gap, varint flags
+ *   when wt is 15, n varints of the zigzag change of the sample interval
+ *   n * (wx + wy + wz + wt) bits, per sample x, y, z then the interval
+ *   change unless it went in varints, LSB first
+ * Widths of 15 mean raw 16 bit values for an axis. */
+
+#define REC_FRAME_MAX				512		// 3 + 1 + 16 * (1 + 5 + 3) + 16 * 10 + 96
+#define REC_WIDTH_RAW				15
+#define REC_WIDTH_MAX				14
+
+struct adxl345_rec_writer {
+	int fd;
+	uint32_t block_size;
+	uint8_t data_format, bw_rate;
+	int config_changed;
+	uint8_t * block;
+	struct adxl345_rec_block * head;	// at block, count 0 while no block is open
+	uint32_t used;						// bytes of block filled, header included
+	int started;						// a sample was written before
+	struct accel_sample prev;			// last sample in the block
+	int64_t prev_delta;					// interval before it
+	struct accel_sample frame[ADXL345_REC_FRAME];
+	int pending;
+	struct adxl345_rec_index * index;
+	uint32_t index_entries, index_alloc;
+	uint32_t blocks;
+	uint64_t samples;
+	int error;
+};
+
+struct adxl345_rec_reader {
+	uint8_t * map;
+	size_t size;
+	uint32_t block_size, blocks, bad_blocks;
+	int indexed;
+	const struct adxl345_rec_index * index;
+	uint32_t index_entries;
+	uint32_t block;						// next block to decode
+	struct accel_sample * buf;			// the block decoded last
+	int count, pos;
+	uint8_t data_format, bw_rate;
+};
+
+static uint32_t crc_table[256];
+
+static uint32_t crc32(const void * data, size_t len);
+static void start_block(struct adxl345_rec_writer * w, const struct accel_sample * s);
+static void finish_block(struct adxl345_rec_writer * w);
+static void flush_frame(struct adxl345_rec_writer * w);
+static int encode_frame(struct adxl345_rec_writer * w, uint8_t * out);
+static int decode_block(struct adxl345_rec_reader * r, uint32_t b);
+static const struct adxl345_rec_block * block_at(struct adxl345_rec_reader * r, uint32_t b);
+static int write_all(int fd, const void * data, size_t len);
+
+/* IEEE 802.3 CRC-32, the table is built on first use */
+static uint32_t crc32(const void * data, size_t len) {
+	const uint8_t * p = data;
+	uint32_t crc = 0xFFFFFFFF, c;
+	int i, k;
+
+	if (!crc_table[1]) {
+		for (i = 0; i < 256; i++) {
+			c = i;
+			for (k = 0; k < 8; k++)
+				c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			crc_table[i] = c;
+		}
+	}
+	while (len--)
+		crc = crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+static inline uint32_t zigzag(int32_t v) {
+	return ((uint32_t) v << 1) ^ (uint32_t) (v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v) {
+	return (int32_t) (v >> 1) ^ -(int32_t) (v & 1);
+}
+
+static inline uint8_t * put_varint(uint8_t * p, uint64_t v) {
+	while (v >= 0x80) {
+		*p++ = (v & 0x7F) | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+/* NULL past end or on a varint longer than 64 bits */
+static inline const uint8_t * get_varint(const uint8_t * p, const uint8_t * end, uint64_t * v) {
+	int shift;
+
+	*v = 0;
+	for (shift = 0; p < end && shift < 64; shift += 7) {
+		*v |= (uint64_t) (*p & 0x7F) << shift;
+		if (!(*p++ & 0x80))
+			return p;
+	}
+	return NULL;
+}
+
+static int write_all(int fd, const void * data, size_t len) {
+	const uint8_t * p = data;
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* Writing */
+
+struct adxl345_rec_writer * ADXL345_Rec_Create(const char * path, uint32_t block_size) {
+	struct adxl345_rec_writer * w;
+	struct adxl345_rec_header * h;
+
+	if (block_size < ADXL345_REC_BLOCK_MIN || block_size > ADXL345_REC_BLOCK_MAX || (block_size & (block_size - 1))) {
+		errno = EINVAL;
+		return NULL;
+	}
+	w = calloc(1, sizeof(*w));
+	if (w == NULL)
+		return NULL;
+	w->block = calloc(1, block_size);
+	if (w->block == NULL) {
+		free(w);
+		return NULL;
+	}
+	w->head = (struct adxl345_rec_block *) w->block;
+	w->block_size = block_size;
+	w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (w->fd < 0) {
+		free(w->block);
+		free(w);
+		return NULL;
+	}
+
+	//An open recording: no index, the reader counts the blocks
+	h = (struct adxl345_rec_header *) w->block;
+	memcpy(h->magic, ADXL345_REC_MAGIC, sizeof(h->magic));
+	h->version = ADXL345_REC_VERSION;
+	h->block_size = block_size;
+	h->index_stride = ADXL345_REC_INDEX_STRIDE;
+	h->crc = crc32(h, offsetof(struct adxl345_rec_header, crc));
+	if (write_all(w->fd, w->block, block_size) < 0) {
+		close(w->fd);
+		free(w->block);
+		free(w);
+		return NULL;
+	}
+	memset(w->block, 0, block_size);
+	return w;
+}
+
+void ADXL345_Rec_Config(struct adxl345_rec_writer * w, uint8_t data_format, uint8_t bw_rate) {
+	if (w->head->count && (data_format != w->data_format || bw_rate != w->bw_rate))
+		w->config_changed = 1;
+	w->data_format = data_format;
+	w->bw_rate = bw_rate;
+}
+
+int ADXL345_Rec_Write(struct adxl345_rec_writer * w, const struct accel_sample samples[], int count) {
+	int i;
+
+	for (i = 0; i < count && !w->error; i++) {
+		if (!w->head->count)
+			start_block(w, &samples[i]);
+		else if (samples[i].scale != w->head->scale || w->config_changed) {
+			flush_frame(w);
+			finish_block(w);
+			start_block(w, &samples[i]);
+		}
+		else {
+			w->frame[w->pending++] = samples[i];
+			if (w->pending == ADXL345_REC_FRAME)
+				flush_frame(w);
+		}
+	}
+	w->samples += i;
+	return w->error;
+}
+
+int ADXL345_Rec_Close(struct adxl345_rec_writer * w, struct adxl345_rec_stats * stats) {
+	struct adxl345_rec_header * h;
+	int err;
+
+	flush_frame(w);
+	if (w->head->count)
+		finish_block(w);
+
+	if (!w->error && write_all(w->fd, w->index, w->index_entries * sizeof(*w->index)) < 0)
+		w->error = -1;
+	if (!w->error) {
+		memset(w->block, 0, w->block_size);
+		h = (struct adxl345_rec_header *) w->block;
+		memcpy(h->magic, ADXL345_REC_MAGIC, sizeof(h->magic));
+		h->version = ADXL345_REC_VERSION;
+		h->block_size = w->block_size;
+		h->index_offset = (uint64_t) (w->blocks + 1) * w->block_size;
+		h->index_entries = w->index_entries;
+		h->index_stride = ADXL345_REC_INDEX_STRIDE;
+		h->blocks = w->blocks;
+		h->index_crc = crc32(w->index, w->index_entries * sizeof(*w->index));
+		h->crc = crc32(h, offsetof(struct adxl345_rec_header, crc));
+		if (pwrite(w->fd, h, sizeof(*h), 0) != sizeof(*h))
+			w->error = -1;
+	}
+	if (stats) {
+		stats->samples = w->samples;
+		stats->blocks = w->blocks;
+		stats->bytes = (uint64_t) (w->blocks + 1) * w->block_size + w->index_entries * sizeof(*w->index);
+	}
+	err = w->error;
+	if (close(w->fd) < 0)
+		err = -1;
+	free(w->index);
+	free(w->block);
+	free(w);
+	return err;
+}
+
+/* s becomes the first sample of a new block, indexed every index stride */
+static void start_block(struct adxl345_rec_writer * w, const struct accel_sample * s) {
+	struct adxl345_rec_block * head = w->head;
+	struct adxl345_rec_index * index;
+	int64_t delta = w->started ? (int64_t) (s->timestamp - w->prev.timestamp) : 0;
+
+	if (w->blocks % ADXL345_REC_INDEX_STRIDE == 0) {
+		if (w->index_entries == w->index_alloc) {
+			index = realloc(w->index, (w->index_alloc + 256) * sizeof(*index));
+			if (index == NULL) {
+				w->error = -1;
+				return;
+			}
+			w->index = index;
+			w->index_alloc += 256;
+		}
+		w->index[w->index_entries].timestamp = s->timestamp;
+		w->index[w->index_entries].block = w->blocks;
+		w->index[w->index_entries].seq = s->seq;
+		w->index_entries++;
+	}
+
+	memset(w->block, 0, w->block_size);
+	head->magic = ADXL345_REC_BLOCK_MAGIC;
+	head->timestamp = s->timestamp;
+	head->seq = s->seq;
+	head->scale = s->scale;
+	head->delta_ns = delta < 0 ? 0 : delta > 0xFFFFFFFF ? 0xFFFFFFFF : delta;
+	head->count = 1;
+	head->x = s->x;
+	head->y = s->y;
+	head->z = s->z;
+	head->flags = s->flags;
+	head->data_format = w->data_format;
+	head->bw_rate = w->bw_rate;
+	w->used = sizeof(*head);
+	w->prev = *s;
+	w->prev_delta = head->delta_ns;
+	w->config_changed = 0;
+	w->started = 1;
+}
+
+static void finish_block(struct adxl345_rec_writer * w) {
+	struct adxl345_rec_block * head = w->head;
+
+	head->used = w->used - sizeof(*head);
+	head->last = w->prev.timestamp;
+	head->crc = crc32(w->block + 8, w->block_size - 8);
+	if (write_all(w->fd, w->block, w->block_size) < 0)
+		w->error = -1;
+	w->blocks++;
+	head->count = 0;
+}
+
+/* Encode the pending samples into the block, or start the next block with
+ * them when they do not fit */
+static void flush_frame(struct adxl345_rec_writer * w) {
+	uint8_t frame[REC_FRAME_MAX];
+	struct accel_sample first;
+	int len, n = w->pending;
+
+	if (!n || w->error)
+		return;
+	len = encode_frame(w, frame);
+	if (w->used + len > w->block_size || w->head->count + n > 0xFFFF) {
+		first = w->frame[0];
+		finish_block(w);
+		start_block(w, &first);
+		memmove(w->frame, w->frame + 1, --n * sizeof(w->frame[0]));
+		w->pending = n;
+		if (!n)
+			return;
+		len = encode_frame(w, frame);
+	}
+	memcpy(w->block + w->used, frame, len);
+	w->used += len;
+	w->head->count += n;
+	w->prev_delta = w->frame[n - 1].timestamp - (n > 1 ? w->frame[n - 2].timestamp : w->prev.timestamp);
+	w->prev = w->frame[n - 1];
+	w->pending = 0;
+}
+
+static int encode_frame(struct adxl345_rec_writer * w, uint8_t * out) {
+	const struct accel_sample * s = w->frame, * p = &w->prev;
+	uint64_t zz[4][ADXL345_REC_FRAME], any[4] = { 0, 0, 0, 0 };
+	int width[4], n = w->pending, i, axis, e = 0;
+	int64_t delta, prev_delta = w->prev_delta;
+	uint8_t * q = out + 3;
+	uint64_t bits = 0;
+	int nbits = 0;
+
+	for (i = 0; i < n; p = &s[i], i++) {
+		zz[0][i] = zigzag(s[i].x - p->x);
+		zz[1][i] = zigzag(s[i].y - p->y);
+		zz[2][i] = zigzag(s[i].z - p->z);
+		delta = s[i].timestamp - p->timestamp;
+		zz[3][i] = ((uint64_t) (delta - prev_delta) << 1) ^ (uint64_t) ((delta - prev_delta) >> 63);
+		prev_delta = delta;
+		for (axis = 0; axis < 4; axis++)
+			any[axis] |= zz[axis][i];
+		if (s[i].seq != p->seq + 1 || s[i].flags != p->flags)
+			e++;
+	}
+	for (axis = 0; axis < 4; axis++) {
+		for (width[axis] = 0; any[axis] >> width[axis]; width[axis]++)
+			;
+		if (width[axis] > REC_WIDTH_MAX)
+			width[axis] = REC_WIDTH_RAW;
+	}
+	out[0] = width[0] << 4 | width[1];
+	out[1] = width[2] << 4 | width[3];
+	out[2] = n - 1;
+
+	q = put_varint(q, e);
+	for (i = 0, p = &w->prev; i < n && e; p = &s[i], i++) {
+		if (s[i].seq != p->seq + 1 || s[i].flags != p->flags) {
+			*q++ = i;
+			q = put_varint(q, s[i].seq - p->seq - 1);
+			q = put_varint(q, s[i].flags);
+		}
+	}
+	for (i = 0; i < n && width[3] == REC_WIDTH_RAW; i++)
+		q = put_varint(q, zz[3][i]);
+	for (i = 0; i < n; i++) {
+		for (axis = 0; axis < 4; axis++) {
+			if (axis == 3 && width[axis] == REC_WIDTH_RAW)
+				break;
+			if (width[axis] == REC_WIDTH_RAW) {
+				bits |= (uint64_t) (uint16_t) (axis == 0 ? s[i].x : axis == 1 ? s[i].y : s[i].z) << nbits;
+				nbits += 16;
+			}
+			else {
+				bits |= (uint64_t) zz[axis][i] << nbits;
+				nbits += width[axis];
+			}
+			while (nbits >= 8) {
+				*q++ = bits;
+				bits >>= 8;
+				nbits -= 8;
+			}
+		}
+	}
+	if (nbits)
+		*q++ = bits;
+	return q - out;
+}
+
+/* Reading */
+
+struct adxl345_rec_reader * ADXL345_Rec_Open(const char * path) {
+	struct adxl345_rec_reader * r;
+	const struct adxl345_rec_header * h;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(*h)) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	r = calloc(1, sizeof(*r));
+	if (r == NULL) {
+		close(fd);
+		return NULL;
+	}
+	r->size = st.st_size;
+	r->map = mmap(NULL, r->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (r->map == MAP_FAILED) {
+		free(r);
+		return NULL;
+	}
+
+	h = (const struct adxl345_rec_header *) r->map;
+	if (memcmp(h->magic, ADXL345_REC_MAGIC, sizeof(h->magic)) || h->version != ADXL345_REC_VERSION ||
+		h->block_size < ADXL345_REC_BLOCK_MIN || h->block_size > ADXL345_REC_BLOCK_MAX ||
+		(h->block_size & (h->block_size - 1)) || r->size < h->block_size) {
+		ADXL345_Rec_Release(r);
+		errno = EINVAL;
+		return NULL;
+	}
+	r->block_size = h->block_size;
+	r->blocks = r->size / r->block_size - 1;
+	if (h->index_offset && h->crc == crc32(h, offsetof(struct adxl345_rec_header, crc)) &&
+		h->index_offset == (uint64_t) (h->blocks + 1) * h->block_size &&
+		h->index_offset + (uint64_t) h->index_entries * sizeof(struct adxl345_rec_index) <= r->size &&
+		h->index_crc == crc32(r->map + h->index_offset, h->index_entries * sizeof(struct adxl345_rec_index))) {
+		r->indexed = 1;
+		r->blocks = h->blocks;
+		r->index = (const struct adxl345_rec_index *) (r->map + h->index_offset);
+		r->index_entries = h->index_entries;
+	}
+
+	r->buf = malloc(r->block_size * sizeof(*r->buf));
+	if (r->buf == NULL) {
+		ADXL345_Rec_Release(r);
+		return NULL;
+	}
+	return r;
+}
+
+void ADXL345_Rec_Release(struct adxl345_rec_reader * r) {
+	munmap(r->map, r->size);
+	free(r->buf);
+	free(r);
+}
+
+static const struct adxl345_rec_block * block_at(struct adxl345_rec_reader * r, uint32_t b) {
+	return (const struct adxl345_rec_block *) (r->map + (size_t) (b + 1) * r->block_size);
+}
+
+/* Block b into buf, returns its sample count or -1 when it is corrupt */
+static int decode_block(struct adxl345_rec_reader * r, uint32_t b) {
+	const struct adxl345_rec_block * head = block_at(r, b);
+	const uint8_t * q = (const uint8_t *) (head + 1), * end = q + head->used;
+	struct accel_sample * s = r->buf, * p;
+	int16_t * xyz[3];
+	int width[4], count, n, i, axis, e, k;
+	int64_t delta, prev_delta = head->delta_ns;
+	uint64_t v, bits;
+	int nbits, w;
+
+	if (head->magic != ADXL345_REC_BLOCK_MAGIC || head->used > r->block_size - sizeof(*head) || !head->count ||
+		head->crc != crc32((const uint8_t *) head + 8, r->block_size - 8))
+		return -1;
+
+	s[0].timestamp = head->timestamp;
+	s[0].seq = head->seq;
+	s[0].x = head->x;
+	s[0].y = head->y;
+	s[0].z = head->z;
+	s[0].flags = head->flags;
+	s[0].scale = head->scale;
+	count = 1;
+
+	while (q < end) {
+		if (end - q < 3)
+			return -1;
+		width[0] = q[0] >> 4;
+		width[1] = q[0] & 0x0F;
+		width[2] = q[1] >> 4;
+		width[3] = q[1] & 0x0F;
+		n = q[2] + 1;
+		q += 3;
+		if (n > ADXL345_REC_FRAME || count + n > head->count)
+			return -1;
+
+		//Defaults, then the exceptions
+		for (i = 0; i < n; i++) {
+			p = &s[count + i - 1];
+			s[count + i].seq = p->seq + 1;
+			s[count + i].flags = p->flags;
+			s[count + i].scale = head->scale;
+		}
+		if ((q = get_varint(q, end, &v)) == NULL || v > (uint64_t) n)
+			return -1;
+		for (e = v; e > 0; e--) {
+			if (q >= end || *q >= n)
+				return -1;
+			k = count + *q++;
+			if ((q = get_varint(q, end, &v)) == NULL)
+				return -1;
+			s[k].seq = s[k - 1].seq + 1 + (uint32_t) v;
+			if ((q = get_varint(q, end, &v)) == NULL)
+				return -1;
+			s[k].flags = v;
+			//Later samples follow the one before them
+			for (i = k + 1; i < count + n; i++) {
+				s[i].seq = s[i - 1].seq + 1;
+				s[i].flags = s[i - 1].flags;
+			}
+		}
+		for (i = 0; i < n && width[3] == REC_WIDTH_RAW; i++) {
+			if ((q = get_varint(q, end, &v)) == NULL)
+				return -1;
+			delta = prev_delta + (int64_t) ((v >> 1) ^ -(v & 1));
+			s[count + i].timestamp = s[count + i - 1].timestamp + delta;
+			prev_delta = delta;
+		}
+
+		bits = 0;
+		nbits = 0;
+		for (i = 0; i < n; i++) {
+			p = &s[count + i - 1];
+			xyz[0] = &s[count + i].x;
+			xyz[1] = &s[count + i].y;
+			xyz[2] = &s[count + i].z;
+			for (axis = 0; axis < 4; axis++) {
+				if (axis == 3 && width[axis] == REC_WIDTH_RAW)
+					break;
+				w = width[axis] == REC_WIDTH_RAW ? 16 : width[axis];
+				while (nbits < w) {
+					if (q >= end)
+						return -1;
+					bits |= (uint64_t) *q++ << nbits;
+					nbits += 8;
+				}
+				v = bits & ((1U << w) - 1);
+				bits >>= w;
+				nbits -= w;
+				if (axis == 3) {
+					delta = prev_delta + (int64_t) ((v >> 1) ^ -(v & 1));
+					s[count + i].timestamp = p->timestamp + delta;
+					prev_delta = delta;
+				}
+				else if (width[axis] == REC_WIDTH_RAW)
+					*xyz[axis] = (int16_t) v;
+				else
+					*xyz[axis] = (axis == 0 ? p->x : axis == 1 ? p->y : p->z) + unzigzag(v);
+			}
+		}
+		count += n;
+	}
+	if (count != head->count)
+		return -1;
+	r->data_format = head->data_format;
+	r->bw_rate = head->bw_rate;
+	return count;
+}
+
+int ADXL345_Rec_Read(struct adxl345_rec_reader * r, struct accel_sample samples[], int max) {
+	int n;
+
+	while (r->pos == r->count) {
+		if (r->block >= r->blocks)
+			return 0;
+		n = decode_block(r, r->block++);
+		r->pos = 0;
+		r->count = n < 0 ? 0 : n;
+		if (n < 0)
+			r->bad_blocks++;
+	}
+	n = r->count - r->pos;
+	if (n > max)
+		n = max;
+	memcpy(samples, r->buf + r->pos, n * sizeof(*samples));
+	r->pos += n;
+	return n;
+}
+
+int ADXL345_Rec_Seek(struct adxl345_rec_reader * r, uint64_t timestamp) {
+	uint32_t lo = 0, hi = r->blocks, mid, k, lo_k, hi_k;
+	int n, first, last, i;
+
+	//The index narrows the search to one stride of blocks
+	if (r->index_entries) {
+		lo_k = 0;
+		hi_k = r->index_entries;
+		while (lo_k < hi_k) {
+			k = lo_k + (hi_k - lo_k) / 2;
+			if (r->index[k].timestamp <= timestamp)
+				lo_k = k + 1;
+			else
+				hi_k = k;
+		}
+		//lo_k entries start at or before timestamp
+		lo = lo_k ? r->index[lo_k - 1].block : 0;
+		if (lo_k < r->index_entries)
+			hi = r->index[lo_k].block + 1;
+	}
+	//First block whose last sample is at or after timestamp
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (block_at(r, mid)->last < timestamp)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (r->block = lo; r->block < r->blocks; ) {
+		n = decode_block(r, r->block++);
+		if (n < 0) {
+			r->bad_blocks++;
+			continue;
+		}
+		first = 0;
+		last = n;
+		while (first < last) {
+			i = first + (last - first) / 2;
+			if (r->buf[i].timestamp < timestamp)
+				first = i + 1;
+			else
+				last = i;
+		}
+		if (first < n) {
+			r->count = n;
+			r->pos = first;
+			return 0;
+		}
+	}
+	r->count = r->pos = 0;
+	return -1;
+}
+
+void ADXL345_Rec_Info(struct adxl345_rec_reader * r, struct adxl345_rec_info * info) {
+	memset(info, 0, sizeof(*info));
+	info->block_size = r->block_size;
+	info->blocks = r->blocks;
+	info->bad_blocks = r->bad_blocks;
+	info->indexed = r->indexed;
+	if (r->blocks) {
+		info->first = block_at(r, 0)->timestamp;
+		info->last = block_at(r, r->blocks - 1)->last;
+	}
+	info->data_format = r->data_format;
+	info->bw_rate = r->bw_rate;
+}
@@ -0,0 +1,115 @@
+/* Compressed recordings of struct accel_sample streams.
+ *
+ * A recording is a file of fixed size blocks. The first block holds the file
+ * header, every other one a run of samples that decodes on its own: a block
+ * header with the first sample in full, the configuration it was taken in
+ * and a CRC-32 of the block, then frames of up to ADXL345_REC_FRAME samples.
+ * A frame stores x, y and z as differences from the sample before, zigzag
+ * coded and bit packed at the width the largest of them needs in that frame
+ * (raw 16 bit when a difference does not fit 14 bits), the timestamps as
+ * the change of the sample interval packed the same way (varints when it
+ * does not fit), which is within 1 ns for the reconstructed timestamps of
+ * ADXL345_timestamp.h, and only the sequence gaps and flag changes as
+ * exceptions. Samples at rest take about 1.6 bytes against 24 for a struct
+ * accel_sample and 13 for a text line.
+ *
+ * Closing the recording appends a sparse index, one entry every
+ * index_stride blocks, and completes the header. Seeking by time searches
+ * the index, then the block headers of one stride, then the decoded block:
+ * O(log n) with a handful of pages touched. A recording that was never
+ * closed (power lost) still reads and seeks, by searching the block headers
+ * of the whole file; the block being filled at the time is lost. Blocks that
+ * fail their checksum are skipped and counted.
+ *
+ * Everything is little endian, as on the DE1-SoC and the build host. */
+#ifndef ADXL345_RECORD_H
+#define ADXL345_RECORD_H
+
+#include <stdint.h>
+#include "accel.h"
+
+#define ADXL345_REC_MAGIC			"ADXL345R"
+#define ADXL345_REC_VERSION			1
+#define ADXL345_REC_BLOCK_MAGIC		0x4b4c4241	// "ABLK"
+#define ADXL345_REC_BLOCK_MIN		1024
+#define ADXL345_REC_BLOCK_MAX		65536
+#define ADXL345_REC_BLOCK_DEFAULT	4096
+#define ADXL345_REC_INDEX_STRIDE	16
+#define ADXL345_REC_FRAME			16
+
+/* First block of the file, the rest of it zero */
+struct adxl345_rec_header {
+	char magic[8];				// ADXL345_REC_MAGIC, not terminated
+	uint32_t version;			// ADXL345_REC_VERSION
+	uint32_t block_size;		// bytes, a power of 2
+	uint64_t index_offset;		// 0 until the recording is closed
+	uint32_t index_entries;
+	uint32_t index_stride;		// blocks per index entry
+	uint32_t blocks;			// data blocks, once closed
+	uint32_t index_crc;			// CRC-32 of the index entries
+	uint32_t crc;				// CRC-32 of the header before this field
+	uint32_t reserved;
+};
+
+/* Start of every data block */
+struct adxl345_rec_block {
+	uint32_t magic;				// ADXL345_REC_BLOCK_MAGIC
+	uint32_t crc;				// CRC-32 of the rest of the block, padding included
+	uint64_t timestamp;			// first sample
+	uint64_t last;				// timestamp of the last sample
+	uint32_t seq;				// first sample
+	uint32_t scale;				// ug per LSB, the same for every sample of the block
+	uint32_t delta_ns;			// interval before the first sample, 0 at the start
+	uint16_t count;				// samples, the first one included
+	uint16_t used;				// bytes of frames after this header
+	int16_t x, y, z;			// first sample
+	uint16_t flags;
+	uint8_t data_format;		// DATA_FORMAT: range and resolution
+	uint8_t bw_rate;			// BW_RATE: output data rate
+	uint8_t reserved[6];
+};
+
+/* Index entry, for blocks 0, index_stride, 2 * index_stride... */
+struct adxl345_rec_index {
+	uint64_t timestamp;			// first sample of the block
+	uint32_t block;
+	uint32_t seq;
+};
+
+struct adxl345_rec_stats {
+	uint64_t samples;
+	uint32_t blocks;
+	uint64_t bytes;				// file size
+};
+
+struct adxl345_rec_info {
+	uint32_t block_size;
+	uint32_t blocks;
+	uint32_t bad_blocks;		// failed their checksum so far, skipped
+	int indexed;				// closed cleanly, else blocks counted from the file size
+	uint64_t first, last;		// timestamps
+	uint8_t data_format;		// of the block last read
+	uint8_t bw_rate;
+};
+
+struct adxl345_rec_writer;
+struct adxl345_rec_reader;
+
+/* Writing. A new block starts whenever the scale or the configuration
+ * changes; the configuration is recorded as given, set it before the first
+ * sample. Create returns NULL and Write and Close -1 with errno set. */
+struct adxl345_rec_writer * ADXL345_Rec_Create(const char * path, uint32_t block_size);
+void ADXL345_Rec_Config(struct adxl345_rec_writer * w, uint8_t data_format, uint8_t bw_rate);
+int ADXL345_Rec_Write(struct adxl345_rec_writer * w, const struct accel_sample samples[], int count);
+int ADXL345_Rec_Close(struct adxl345_rec_writer * w, struct adxl345_rec_stats * stats);
+
+/* Reading through mmap(). Read returns up to max samples, 0 at the end.
+ * Seek puts the next Read at the first sample at or after timestamp and
+ * returns 0, or -1 when there is none. */
+struct adxl345_rec_reader * ADXL345_Rec_Open(const char * path);
+void ADXL345_Rec_Release(struct adxl345_rec_reader * r);
+int ADXL345_Rec_Read(struct adxl345_rec_reader * r, struct accel_sample samples[], int max);
+int ADXL345_Rec_Seek(struct adxl345_rec_reader * r, uint64_t timestamp);
+void ADXL345_Rec_Info(struct adxl345_rec_reader * r, struct adxl345_rec_info * info);
+
+#endif
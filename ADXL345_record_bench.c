@@ -0,0 +1,377 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <math.h>
+#include "ADXL345.h"
+#include "ADXL345_record.h"
+
+/* Compression ratio and throughput of the recording format.
+ * Usage: ADXL345_record_bench [-n samples] [-b block_size] [-f file] [-v]
+ *   -n   samples per synthetic data set, default 1000000
+ *   -b   block size, default 4096
+ *   -f   also a recording made by ADXL345_recorder: decoded, then encoded
+ *        again as the other data sets
+ *   -v   verify instead: every data set must read back bit exact, seeks to
+ *        random times must land on the first sample at or after them, a
+ *        corrupted block must be skipped and counted, and a recording cut
+ *        short without its index must still read and seek. Exits 1 on the
+ *        first failure.
+ * Synthetic data sets, at 800 Hz: the board at rest at full resolution with
+ * timestamps as the driver reconstructs them, a 97 Hz vibration in 10 bit
+ * mode, and taps and overruns with samples stamped at read time. For each
+ * it reports bytes per sample, the ratio to struct accel_sample records and
+ * to the text lines of /dev/accel, encode and decode throughput, and the
+ * time of a seek. The recording goes to a file under /tmp. */
+
+#define BENCH_RATE					13		// BW_RATE, 800 Hz
+#define BENCH_SEEKS					1000
+#define BENCH_BATCH					256
+
+struct data_set {
+	const char * name;
+	uint8_t data_format;
+	void (*make)(struct accel_sample * s, unsigned long i);
+};
+
+static void make_rest(struct accel_sample * s, unsigned long i);
+static void make_vibration(struct accel_sample * s, unsigned long i);
+static void make_taps(struct accel_sample * s, unsigned long i);
+
+static struct data_set sets[] = {
+	{ "rest 13 bit", ADXL345_FULL_RES | 0x03, make_rest },
+	{ "vibration 10 bit", 0x00, make_vibration },
+	{ "taps, read time", ADXL345_FULL_RES | 0x03, make_taps },
+};
+
+#define NUM_SETS					(sizeof(sets) / sizeof(sets[0]))
+
+static int run(const char * name, struct accel_sample * samples, unsigned long count, uint8_t data_format,
+	uint32_t block_size, const char * path, int check);
+static int check_cut(struct accel_sample * samples, unsigned long count, uint8_t data_format, uint32_t block_size,
+	const char * path);
+static int compare(const struct accel_sample * a, const struct accel_sample * b);
+static size_t text_size(const struct accel_sample * s);
+static uint64_t now_ns(void);
+
+int main(int argc, char * argv[]) {
+
+	int opt, check = 0, failed = 0, n;
+	unsigned long count = 1000000, i, alloc;
+	uint32_t block_size = ADXL345_REC_BLOCK_DEFAULT;
+	const char * file = NULL;
+	char path[64];
+	struct accel_sample * samples;
+	struct adxl345_rec_reader * r;
+	struct adxl345_rec_info info;
+	unsigned int k;
+
+	while ((opt = getopt(argc, argv, "n:b:f:v")) != -1) {
+		switch (opt) {
+		case 'n' :
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 'b' :
+			block_size = atoi(optarg);
+			break;
+		case 'f' :
+			file = optarg;
+			break;
+		case 'v' :
+			check = 1;
+			break;
+		default :
+			printf("Usage: %s [-n samples] [-b block_size] [-f file] [-v]\n", argv[0]);
+			return(-1);
+		}
+	}
+	if (count < 2 || block_size < ADXL345_REC_BLOCK_MIN || block_size > ADXL345_REC_BLOCK_MAX ||
+		(block_size & (block_size - 1))) {
+		printf("ERROR: at least 2 samples, blocks a power of 2 from %d to %d\n", ADXL345_REC_BLOCK_MIN,
+			ADXL345_REC_BLOCK_MAX);
+		return(-1);
+	}
+	snprintf(path, sizeof(path), "/tmp/ADXL345_record_bench.%d", (int) getpid());
+
+	samples = malloc(count * sizeof(*samples));
+	if (samples == NULL) {
+		printf("ERROR: out of memory\n");
+		return(-1);
+	}
+	printf("%-18s %9s %7s %7s %7s %10s %10s %8s\n", "data", "samples", "B/smp", "x_bin", "x_text",
+		"enc_Ms/s", "dec_Ms/s", "seek_us");
+	srand(1);
+	for (k = 0; k < NUM_SETS && !failed; k++) {
+		for (i = 0; i < count; i++)
+			sets[k].make(&samples[i], i);
+		failed |= run(sets[k].name, samples, count, sets[k].data_format, block_size, path, check);
+		if (check && !failed)
+			failed |= check_cut(samples, count, sets[k].data_format, block_size, path);
+	}
+
+	if (file && !failed) {
+		if ((r = ADXL345_Rec_Open(file)) == NULL) {
+			printf("ERROR: could not open \"%s\"...\n", file);
+			free(samples);
+			return(-1);
+		}
+		ADXL345_Rec_Info(r, &info);
+		alloc = (unsigned long) info.blocks * info.block_size;
+		free(samples);
+		samples = malloc((alloc ? alloc : 1) * sizeof(*samples));
+		if (samples == NULL) {
+			printf("ERROR: out of memory\n");
+			return(-1);
+		}
+		for (i = 0; (n = ADXL345_Rec_Read(r, samples + i, BENCH_BATCH)) > 0; i += n)
+			;
+		ADXL345_Rec_Info(r, &info);
+		ADXL345_Rec_Release(r);
+		if (info.bad_blocks)
+			printf("%s: %u bad blocks skipped\n", file, info.bad_blocks);
+		if (i > 1)
+			failed |= run(file, samples, i, info.data_format, block_size, path, check);
+	}
+	unlink(path);
+	free(samples);
+	if (check)
+		printf("%s\n", failed ? "FAILED" : "passed");
+	return failed;
+}
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int noise(void) {
+	return rand() % 5 - 2;
+}
+
+/* Stamps as accel_ts_stamp() makes them: a period in ns << 16, 800 Hz off by
+ * 2000 ppm */
+static uint64_t stamp(unsigned long i) {
+	const uint64_t period = (uint64_t) (1250000 * 1.002 * 65536);
+
+	return 1000000000ULL + ((i * period) >> 16);
+}
+
+static void make_rest(struct accel_sample * s, unsigned long i) {
+	s->timestamp = stamp(i);
+	s->seq = i;
+	s->x = noise();
+	s->y = noise();
+	s->z = 256 + noise();
+	s->flags = ACCEL_FLAG_NEW | ACCEL_FLAG_FULL_RES;
+	s->scale = 3900;
+}
+
+/* 500 mg at 97.3 Hz on X and Y, 1 g on Z, 3.9 mg per LSB at +-2 g */
+static void make_vibration(struct accel_sample * s, unsigned long i) {
+	double t = i / 800.0;
+
+	s->timestamp = stamp(i);
+	s->seq = i;
+	s->x = lrint(128 * sin(2 * M_PI * 97.3 * t)) + noise();
+	s->y = lrint(128 * cos(2 * M_PI * 97.3 * t)) + noise();
+	s->z = 256 + noise();
+	s->flags = ACCEL_FLAG_NEW;
+	s->scale = 3900;
+}
+
+/* At rest with a decaying 2 g tap about every 2 s, flagged, an overrun
+ * losing a few samples every 10 s, and read time stamps late by 20 to
+ * 120 us */
+static void make_taps(struct accel_sample * s, unsigned long i) {
+	static unsigned long lost;
+	unsigned long since;
+	int tap;
+
+	if (!i)
+		lost = 0;
+	if (i && i % 8000 == 0)
+		lost += 1 + rand() % 4;
+	since = (i + lost) % 1600;
+	tap = since < 40 ? lrint(512 * exp(-(double) since / 8) * cos(since * 1.3)) : 0;
+	s->timestamp = stamp(i + lost) + 20000 + rand() % 100000;
+	s->seq = i + lost;
+	s->x = noise() + tap;
+	s->y = noise() - tap / 2;
+	s->z = 256 + noise() + tap / 4;
+	s->flags = ACCEL_FLAG_NEW | ACCEL_FLAG_FULL_RES | (since == 2 ? ACCEL_FLAG_SINGLE_TAP : 0) |
+		(i % 8000 == 0 && i ? ACCEL_FLAG_OVERRUN : 0);
+	s->scale = 3900;
+}
+
+/* The driver's text line, "R X Y Z SS" in mg */
+static size_t text_size(const struct accel_sample * s) {
+	char line[64];
+	int32_t scale = s->scale;
+
+	return sprintf(line, "%d %d %d %d %d\n", 1, s->x * scale / 1000, s->y * scale / 1000, s->z * scale / 1000,
+		(scale + 500) / 1000);
+}
+
+static int compare(const struct accel_sample * a, const struct accel_sample * b) {
+	return a->timestamp != b->timestamp || a->seq != b->seq || a->x != b->x || a->y != b->y || a->z != b->z ||
+		a->flags != b->flags || a->scale != b->scale;
+}
+
+/* Encode, decode and seek one data set */
+static int run(const char * name, struct accel_sample * samples, unsigned long count, uint8_t data_format,
+	uint32_t block_size, const char * path, int check) {
+	struct adxl345_rec_writer * w;
+	struct adxl345_rec_reader * r;
+	struct adxl345_rec_stats stats;
+	struct adxl345_rec_info info;
+	struct accel_sample batch[BENCH_BATCH];
+	uint64_t start, enc_ns, dec_ns, seek_ns, t, span;
+	unsigned long i, j, got = 0, text = 0;
+	int n, k;
+
+	for (i = 0; i < count; i++)
+		text += text_size(&samples[i]);
+
+	start = now_ns();
+	if ((w = ADXL345_Rec_Create(path, block_size)) == NULL) {
+		printf("ERROR: could not create \"%s\"...\n", path);
+		return 1;
+	}
+	ADXL345_Rec_Config(w, data_format, BENCH_RATE);
+	for (i = 0; i < count; i += BENCH_BATCH)
+		ADXL345_Rec_Write(w, samples + i, count - i < BENCH_BATCH ? count - i : BENCH_BATCH);
+	if (ADXL345_Rec_Close(w, &stats) < 0) {
+		printf("ERROR: writing \"%s\" failed...\n", path);
+		return 1;
+	}
+	enc_ns = now_ns() - start;
+
+	start = now_ns();
+	if ((r = ADXL345_Rec_Open(path)) == NULL) {
+		printf("ERROR: could not open \"%s\"...\n", path);
+		return 1;
+	}
+	while ((n = ADXL345_Rec_Read(r, batch, BENCH_BATCH)) > 0) {
+		for (k = 0; k < n && check; k++) {
+			if (got + k >= count || compare(&batch[k], &samples[got + k])) {
+				printf("%s: sample %lu differs\n", name, got + k);
+				ADXL345_Rec_Release(r);
+				return 1;
+			}
+		}
+		got += n;
+	}
+	dec_ns = now_ns() - start;
+	ADXL345_Rec_Info(r, &info);
+	if (got != count || !info.indexed || info.bad_blocks || info.data_format != data_format ||
+		info.bw_rate != BENCH_RATE) {
+		printf("%s: read %lu of %lu samples, indexed %d, %u bad blocks, config %#x %u\n", name, got, count,
+			info.indexed, info.bad_blocks, info.data_format, info.bw_rate);
+		ADXL345_Rec_Release(r);
+		return 1;
+	}
+
+	//Random times within the recording, the found sample checked against a
+	//search of the samples
+	span = samples[count - 1].timestamp - samples[0].timestamp + 1;
+	seek_ns = 0;
+	for (k = 0; k < BENCH_SEEKS; k++) {
+		t = samples[0].timestamp - 1000 + ((uint64_t) rand() * RAND_MAX + rand()) % (span + 2000);
+		start = now_ns();
+		n = ADXL345_Rec_Seek(r, t) == 0 ? ADXL345_Rec_Read(r, batch, 1) : 0;
+		seek_ns += now_ns() - start;
+		if (!check)
+			continue;
+		for (i = 0, j = count; i < j; ) {
+			if (samples[i + (j - i) / 2].timestamp < t)
+				i += (j - i) / 2 + 1;
+			else
+				j = i + (j - i) / 2;
+		}
+		if (n != (i < count) || (n && compare(&batch[0], &samples[i]))) {
+			printf("%s: seek to %llu found %s, expected sample %lu\n", name, (unsigned long long) t,
+				n ? "a sample" : "nothing", i);
+			ADXL345_Rec_Release(r);
+			return 1;
+		}
+	}
+
+	//A block with a flipped byte is skipped and counted
+	if (check && info.blocks > 2) {
+		ADXL345_Rec_Release(r);
+		n = open(path, O_RDWR);
+		if (n < 0 || pwrite(n, "\xFF", 1, (off_t) 2 * block_size + block_size / 2) != 1) {
+			printf("ERROR: could not corrupt \"%s\"...\n", path);
+			return 1;
+		}
+		close(n);
+		r = ADXL345_Rec_Open(path);
+		for (got = 0; r && (n = ADXL345_Rec_Read(r, batch, BENCH_BATCH)) > 0; got += n)
+			;
+		if (r)
+			ADXL345_Rec_Info(r, &info);
+		if (r == NULL || info.bad_blocks != 1 || got >= count) {
+			printf("%s: corrupted block not detected\n", name);
+			if (r)
+				ADXL345_Rec_Release(r);
+			return 1;
+		}
+	}
+	ADXL345_Rec_Release(r);
+
+	printf("%-18.18s %9lu %7.2f %7.1f %7.1f %10.2f %10.2f %8.2f\n", name, count, (double) stats.bytes / count,
+		(double) count * sizeof(struct accel_sample) / stats.bytes, (double) text / stats.bytes,
+		count * 1e3 / enc_ns, count * 1e3 / dec_ns, seek_ns / 1e3 / BENCH_SEEKS);
+	return 0;
+}
+
+/* A recording that lost power: the blocks written so far, no index and the
+ * header as created */
+static int check_cut(struct accel_sample * samples, unsigned long count, uint8_t data_format, uint32_t block_size,
+	const char * path) {
+	struct adxl345_rec_writer * w;
+	struct adxl345_rec_reader * r;
+	struct adxl345_rec_stats stats;
+	struct adxl345_rec_info info;
+	struct accel_sample s;
+	unsigned long got = 0;
+	uint64_t t;
+	int fd, n, failed;
+
+	if ((w = ADXL345_Rec_Create(path, block_size)) == NULL)
+		return 1;
+	ADXL345_Rec_Config(w, data_format, BENCH_RATE);
+	ADXL345_Rec_Write(w, samples, count);
+	if (ADXL345_Rec_Close(w, &stats) < 0 || stats.blocks < 2)
+		return stats.blocks < 2 ? 0 : 1;
+
+	//Drop the last block, the index and the header's knowledge of them
+	fd = open(path, O_RDWR);
+	if (fd < 0 || ftruncate(fd, (off_t) stats.blocks * block_size) < 0 ||
+		pwrite(fd, "\0\0\0\0\0\0\0\0", 8, offsetof(struct adxl345_rec_header, index_offset)) != 8) {
+		printf("ERROR: could not cut \"%s\"...\n", path);
+		return 1;
+	}
+	close(fd);
+
+	if ((r = ADXL345_Rec_Open(path)) == NULL)
+		return 1;
+	while ((n = ADXL345_Rec_Read(r, &s, 1)) > 0) {
+		if (compare(&s, &samples[got++]))
+			break;
+	}
+	ADXL345_Rec_Info(r, &info);
+	t = samples[got / 2].timestamp;
+	failed = n > 0 || info.indexed || info.blocks != stats.blocks - 1 || !got || got >= count ||
+		ADXL345_Rec_Seek(r, t) < 0 || ADXL345_Rec_Read(r, &s, 1) != 1 || s.timestamp < t ||
+		compare(&s, &samples[got / 2]);
+	ADXL345_Rec_Release(r);
+	if (failed)
+		printf("cut recording: %lu samples read, %u blocks, indexed %d\n", got, info.blocks, info.indexed);
+	return failed;
+}
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include "ADXL345_access.h"
+#include "ADXL345_record.h"
+
+/* Compressed recording of a sample source, and playback of recordings.
+ * Usage: ADXL345_recorder [-b backend] [-r rate] [-t seconds] [-k block_size] file
+ *        ADXL345_recorder -p [-f from_ms] [-n samples] file
+ *   -b   sample source: devmem, spimem, dev (/dev/accel0, default) or sim
+ *   -r   BW_RATE code, default 13 (800 Hz)
+ *   -t   seconds to record, default until Ctrl+C
+ *   -k   block size, a power of 2 from 1024 to 65536, default 4096. Smaller
+ *        blocks lose less on a power cut at low rates.
+ *   -p   print the recording instead: its blocks, time span and
+ *        configuration, then "seq timestamp X=x Y=y Z=z flags" per sample
+ *   -f   start at this many ms after the first sample, found by the index
+ *   -n   samples to print, default all
+ * Recording prints the samples, the file size, and the size the samples
+ * would have taken as struct accel_sample records and as text lines. */
+
+#define RECORD_BATCH				64
+
+static int record(const char * path, struct accel_source * src, int rate, unsigned int seconds, uint32_t block_size);
+static int play(const char * path, uint64_t from_ms, unsigned long limit);
+static uint8_t source_format(struct accel_source * src);
+
+volatile sig_atomic_t stop;
+void catchSIGINT (int signum) {
+	stop = 1;
+}
+
+int main(int argc, char * argv[]) {
+
+	int opt, rate = 13, playback = 0;
+	unsigned int seconds = 0;
+	uint32_t block_size = ADXL345_REC_BLOCK_DEFAULT;
+	uint64_t from_ms = 0;
+	unsigned long limit = 0;
+	struct accel_source * src = accel_source_find("dev");
+
+	while ((opt = getopt(argc, argv, "b:r:t:k:pf:n:")) != -1) {
+		switch (opt) {
+		case 'b' :
+			if ((src = accel_source_find(optarg)) == NULL) {
+				printf("ERROR: no backend \"%s\"\n", optarg);
+				return(-1);
+			}
+			break;
+		case 'r' :
+			rate = atoi(optarg);
+			break;
+		case 't' :
+			seconds = atoi(optarg);
+			break;
+		case 'k' :
+			block_size = atoi(optarg);
+			break;
+		case 'p' :
+			playback = 1;
+			break;
+		case 'f' :
+			from_ms = strtoull(optarg, NULL, 0);
+			break;
+		case 'n' :
+			limit = strtoul(optarg, NULL, 0);
+			break;
+		default :
+			printf("Usage: %s [-b backend] [-r rate] [-t seconds] [-k block_size] file\n", argv[0]);
+			printf("       %s -p [-f from_ms] [-n samples] file\n", argv[0]);
+			return(-1);
+		}
+	}
+	if (optind != argc - 1) {
+		printf("ERROR: no recording file given\n");
+		return(-1);
+	}
+	if (rate < 0 || rate > 15) {
+		printf("ERROR: rates are 0 to 15\n");
+		return(-1);
+	}
+
+	stop = 0;
+	signal(SIGINT, catchSIGINT);
+
+	if (playback)
+		return play(argv[optind], from_ms, limit);
+	return record(argv[optind], src, rate, seconds, block_size);
+}
+
+/* DATA_FORMAT of the running source: read back from the sensor, or rebuilt
+ * from the /dev/accel0 configuration */
+static uint8_t source_format(struct accel_source * src) {
+	struct accel_config config;
+	uint8_t data_format = 0;
+	int range;
+
+	if (src->bus) {
+		src->bus->reg_read(src->bus, ADXL345_DATA_FORMAT, &data_format);
+		return data_format;
+	}
+	if (ioctl(*(int *) src->priv, ACCEL_IOC_GET_CONFIG, &config) < 0)
+		return 0;
+	for (range = 0; range < 3 && (2U << range) < config.range; range++)
+		;
+	return range | (config.full_res ? ADXL345_FULL_RES : 0);
+}
+
+static int record(const char * path, struct accel_source * src, int rate, unsigned int seconds, uint32_t block_size) {
+	struct adxl345_rec_writer * w;
+	struct adxl345_rec_stats stats;
+	struct accel_sample samples[RECORD_BATCH];
+	uint64_t end, text = 0;
+	char line[64];
+	int n, i, kept, err = 0;
+
+	if (src->open(src) < 0)
+		return(-1);
+	if (src->set_rate(src, rate) < 0) {
+		printf("ERROR: %s: unable to set rate %d\n", src->name, rate);
+		src->close(src);
+		return(-1);
+	}
+	if ((w = ADXL345_Rec_Create(path, block_size)) == NULL) {
+		printf("ERROR: could not create \"%s\"...\n", path);
+		src->close(src);
+		return(-1);
+	}
+	ADXL345_Rec_Config(w, source_format(src), rate);
+
+	printf("Recording %s at %.3f Hz to %s, Ctrl+C to stop\n", src->name, 3200.0 / (1 << (15 - rate)), path);
+	end = seconds ? accel_now_ns() + (uint64_t) seconds * 1000000000 : UINT64_MAX;
+	while (!stop && accel_now_ns() < end) {
+		if ((n = src->read(src, samples, RECORD_BATCH, end)) < 0)
+			break;
+		//Only fresh samples, the rest repeat the last one
+		for (i = kept = 0; i < n; i++) {
+			if (!(samples[i].flags & ACCEL_FLAG_NEW))
+				continue;
+			samples[kept++] = samples[i];
+			text += sprintf(line, "%d %d %d %d %d\n", 1, samples[i].x * (int32_t) samples[i].scale / 1000,
+				samples[i].y * (int32_t) samples[i].scale / 1000, samples[i].z * (int32_t) samples[i].scale / 1000,
+				(samples[i].scale + 500) / 1000);
+		}
+		if (ADXL345_Rec_Write(w, samples, kept) < 0) {
+			printf("ERROR: writing \"%s\" failed...\n", path);
+			err = -1;
+			break;
+		}
+	}
+	src->close(src);
+	if (ADXL345_Rec_Close(w, &stats) < 0) {
+		printf("ERROR: closing \"%s\" failed...\n", path);
+		err = -1;
+	}
+
+	printf("%llu samples, %u blocks, %llu bytes", (unsigned long long) stats.samples, stats.blocks,
+		(unsigned long long) stats.bytes);
+	if (stats.samples)
+		printf(", %.2f bytes per sample", (double) stats.bytes / stats.samples);
+	printf("\nas struct accel_sample: %llu bytes (x%.1f), as text: %llu bytes (x%.1f)\n",
+		(unsigned long long) (stats.samples * sizeof(struct accel_sample)),
+		(double) stats.samples * sizeof(struct accel_sample) / stats.bytes, (unsigned long long) text,
+		(double) text / stats.bytes);
+	return err;
+}
+
+static int play(const char * path, uint64_t from_ms, unsigned long limit) {
+	struct adxl345_rec_reader * r;
+	struct adxl345_rec_info info;
+	struct accel_sample samples[RECORD_BATCH];
+	unsigned long printed = 0;
+	int n, i;
+
+	if ((r = ADXL345_Rec_Open(path)) == NULL) {
+		printf("ERROR: could not open \"%s\" as a recording...\n", path);
+		return(-1);
+	}
+	ADXL345_Rec_Info(r, &info);
+	printf("%u blocks of %u bytes, %s, %.3f s from %llu\n", info.blocks, info.block_size,
+		info.indexed ? "indexed" : "not closed, no index", (info.last - info.first) / 1e9,
+		(unsigned long long) info.first);
+
+	if (from_ms && ADXL345_Rec_Seek(r, info.first + from_ms * 1000000) < 0) {
+		printf("ERROR: the recording ends before %llu ms\n", (unsigned long long) from_ms);
+		ADXL345_Rec_Release(r);
+		return(-1);
+	}
+	while (!stop && (!limit || printed < limit) && (n = ADXL345_Rec_Read(r, samples, RECORD_BATCH)) > 0) {
+		if (!printed) {
+			ADXL345_Rec_Info(r, &info);
+			printf("DATA_FORMAT %#x, BW_RATE %u (%.3f Hz), %.1f mg per LSB\n", info.data_format, info.bw_rate,
+				3200.0 / (1 << (15 - (info.bw_rate & 0x0F))), samples[0].scale / 1000.0);
+		}
+		for (i = 0; i < n && (!limit || printed < limit); i++, printed++)
+			printf("%u %llu X=%d Y=%d Z=%d %#x\n", samples[i].seq, (unsigned long long) samples[i].timestamp,
+				samples[i].x, samples[i].y, samples[i].z, samples[i].flags);
+	}
+	ADXL345_Rec_Info(r, &info);
+	if (info.bad_blocks)
+		printf("%u blocks failed their checksum and were skipped\n", info.bad_blocks);
+	ADXL345_Rec_Release(r);
+	return 0;
+}
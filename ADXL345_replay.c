@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include "ADXL345_replay.h"
+#include "ADXL345_record.h"
+
+/* Replay source, see ADXL345_replay.h */
+
+#define REPLAY_BATCH				256
+#define REPLAY_TAP_NS				2000000000ULL	// between taps
+#define REPLAY_TAP_LSB				512				// 2 g
+#define REPLAY_TAP_HZ				250
+#define REPLAY_TAP_DECAY_NS			5000000			// time constant of the ringing
+#define REPLAY_TAP_LENGTH_NS		40000000		// ringing cut off after
+
+struct replay_state {
+	struct accel_replay_config cfg;
+	struct adxl345_rec_reader * rec;
+	uint8_t data_format, bw_rate;
+	uint64_t period_ns;					// synthetic signal
+	unsigned int seed;
+
+	//Look ahead into the recording
+	struct accel_sample buf[REPLAY_BATCH];
+	int count, pos;
+	uint64_t rec_first;					// timestamp of the first sample of the recording
+	uint32_t rec_seq;					// and its sequence number
+	uint64_t loop_ns;					// added to timestamps and sequence numbers on each loop
+	uint32_t loop_seq;
+	uint64_t last_ts, last_delta;
+	uint32_t last_seq;
+
+	uint64_t index;						// samples produced
+	struct accel_sample next;			// next sample out, in recording time
+	int have_next;
+
+	//Pacing: next is due at start_ns + (next.timestamp - first_ts) / speed
+	uint64_t start_ns, first_ts;
+};
+
+static struct replay_state replay_state;
+
+static int replay_open(struct accel_source * src);
+static void replay_close(struct accel_source * src);
+static int replay_set_rate(struct accel_source * src, unsigned int rate);
+static int replay_read(struct accel_source * src, struct accel_sample samples[], int max, uint64_t deadline);
+static int replay_next(struct replay_state * st);
+static void synth(struct replay_state * st, struct accel_sample * s);
+
+struct accel_source replay_source = {
+	.name = "replay",
+	.open = replay_open,
+	.close = replay_close,
+	.set_rate = replay_set_rate,
+	.read = replay_read,
+	.priv = &replay_state
+};
+
+void ADXL345_Replay_Setup(const struct accel_replay_config * cfg) {
+	replay_state.cfg = *cfg;
+}
+
+void ADXL345_Replay_Parse(const char * spec, struct accel_replay_config * cfg) {
+	static const char * names[] = { "sine", "noise", "taps" };
+	unsigned int signals = 0, i;
+	const char * p = spec;
+	size_t len;
+
+	while (*p) {
+		len = strcspn(p, ",");
+		for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+			if (len == strlen(names[i]) && !strncmp(p, names[i], len))
+				break;
+		}
+		if (i == sizeof(names) / sizeof(names[0])) {
+			signals = 0;
+			break;
+		}
+		signals |= 1 << i;
+		p += len;
+		if (*p)
+			p++;
+	}
+	if (signals) {
+		cfg->file = NULL;
+		cfg->signals = signals;
+	}
+	else
+		cfg->file = spec;
+}
+
+void ADXL345_Replay_Speed(double speed) {
+	replay_state.cfg.speed = speed;
+	replay_state.start_ns = 0;
+}
+
+void ADXL345_Replay_Format(uint8_t * data_format, uint8_t * bw_rate) {
+	*data_format = replay_state.data_format;
+	*bw_rate = replay_state.bw_rate;
+}
+
+static int replay_open(struct accel_source * src) {
+	struct replay_state * st = src->priv;
+	struct adxl345_rec_info info;
+
+	st->rec = NULL;
+	st->count = st->pos = 0;
+	st->index = 0;
+	st->loop_ns = st->loop_seq = 0;
+	st->have_next = 0;
+	st->start_ns = 0;
+	st->seed = 1;
+
+	if (st->cfg.file == NULL) {
+		st->data_format = ADXL345_FULL_RES | ADXL345_RANGE;
+		st->bw_rate = 13;
+		st->period_ns = ADXL345_Period(st->bw_rate);
+		return 0;
+	}
+
+	if ((st->rec = ADXL345_Rec_Open(st->cfg.file)) == NULL) {
+		printf("ERROR: could not open \"%s\" as a recording...\n", st->cfg.file);
+		return -1;
+	}
+	//The configuration comes with the first block
+	st->count = ADXL345_Rec_Read(st->rec, st->buf, REPLAY_BATCH);
+	if (st->count <= 0) {
+		printf("ERROR: \"%s\" holds no samples\n", st->cfg.file);
+		ADXL345_Rec_Release(st->rec);
+		st->rec = NULL;
+		return -1;
+	}
+	ADXL345_Rec_Info(st->rec, &info);
+	st->data_format = info.data_format;
+	st->bw_rate = info.bw_rate;
+	st->rec_first = st->buf[0].timestamp;
+	st->rec_seq = st->buf[0].seq;
+	st->last_delta = ADXL345_Period(st->bw_rate);
+	return 0;
+}
+
+static void replay_close(struct accel_source * src) {
+	struct replay_state * st = src->priv;
+
+	if (st->rec)
+		ADXL345_Rec_Release(st->rec);
+	st->rec = NULL;
+}
+
+static int replay_set_rate(struct accel_source * src, unsigned int rate) {
+	struct replay_state * st = src->priv;
+
+	if (rate > 15)
+		return -1;
+	if (st->rec)
+		return 0;
+	st->bw_rate = rate;
+	st->period_ns = ADXL345_Period(rate);
+	st->start_ns = 0;
+	return 0;
+}
+
+/* Put the sample after next in next, returns 0 at the end of a recording
+ * that does not loop */
+static int replay_next(struct replay_state * st) {
+	struct accel_sample * s = &st->next;
+
+	if (st->rec == NULL) {
+		synth(st, s);
+		st->index++;
+		return 1;
+	}
+
+	if (st->pos == st->count) {
+		st->pos = 0;
+		st->count = ADXL345_Rec_Read(st->rec, st->buf, REPLAY_BATCH);
+		if (!st->count && st->cfg.loop && st->index) {
+			//Play on one sample interval after the last sample
+			st->loop_ns = st->last_ts + st->last_delta - st->rec_first;
+			st->loop_seq = st->last_seq + 1 - st->rec_seq;
+			ADXL345_Rec_Seek(st->rec, 0);
+			st->count = ADXL345_Rec_Read(st->rec, st->buf, REPLAY_BATCH);
+		}
+		if (!st->count)
+			return 0;
+	}
+	*s = st->buf[st->pos++];
+	s->timestamp += st->loop_ns;
+	s->seq += st->loop_seq;
+	if (st->index && s->timestamp > st->last_ts)
+		st->last_delta = s->timestamp - st->last_ts;
+	st->last_ts = s->timestamp;
+	st->last_seq = s->seq;
+	st->index++;
+	return 1;
+}
+
+static int noise(struct replay_state * st) {
+	return rand_r(&st->seed) % 5 - 2;
+}
+
+static void synth(struct replay_state * st, struct accel_sample * s) {
+	uint64_t t = st->index * st->period_ns, since = t % REPLAY_TAP_NS;
+	double w = 2 * M_PI * st->cfg.sine_hz * t / 1e9, tap = 0;
+
+	s->timestamp = t;
+	s->seq = st->index;
+	s->x = s->y = 0;
+	s->z = 1000000 / 3900;
+	s->flags = ACCEL_FLAG_NEW | ACCEL_FLAG_FULL_RES;
+	s->scale = 3900;
+	if (st->cfg.signals & ACCEL_REPLAY_SINE) {
+		s->x += lrint(st->cfg.sine_mg / 3.9 * sin(w));
+		s->y += lrint(st->cfg.sine_mg / 3.9 * cos(w));
+	}
+	if (st->cfg.signals & ACCEL_REPLAY_NOISE) {
+		s->x += noise(st);
+		s->y += noise(st);
+		s->z += noise(st);
+	}
+	//The tap flag goes with the first sample of the ringing
+	if ((st->cfg.signals & ACCEL_REPLAY_TAPS) && t >= REPLAY_TAP_NS && since < REPLAY_TAP_LENGTH_NS) {
+		tap = REPLAY_TAP_LSB * exp(-(double) since / REPLAY_TAP_DECAY_NS) * cos(2 * M_PI * REPLAY_TAP_HZ * since / 1e9);
+		if (since < st->period_ns)
+			s->flags |= ACCEL_FLAG_SINGLE_TAP;
+		s->x += lrint(tap / 2);
+		s->y += lrint(tap / 4);
+		s->z += lrint(tap);
+	}
+}
+
+static int replay_read(struct accel_source * src, struct accel_sample samples[], int max, uint64_t deadline) {
+	struct replay_state * st = src->priv;
+	struct timespec until;
+	uint64_t now, due = 0;
+	int n = 0;
+
+	if (!st->have_next && !(st->have_next = replay_next(st)))
+		return -1;
+
+	now = accel_now_ns();
+	if (st->cfg.speed <= 0) {
+		while (n < max && st->have_next) {
+			samples[n] = st->next;
+			samples[n++].timestamp = now;
+			st->have_next = replay_next(st);
+		}
+		return n;
+	}
+
+	if (!st->start_ns) {
+		st->start_ns = now;
+		st->first_ts = st->next.timestamp;
+	}
+	due = st->start_ns + (uint64_t) ((st->next.timestamp - st->first_ts) / st->cfg.speed);
+	if (due > now) {
+		until.tv_sec = (due < deadline ? due : deadline) / 1000000000;
+		until.tv_nsec = (due < deadline ? due : deadline) % 1000000000;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL);
+		now = accel_now_ns();
+	}
+	//Everything due by now, which after a late wakeup is more than one
+	while (n < max && st->have_next && due <= now) {
+		samples[n] = st->next;
+		samples[n++].timestamp = due;
+		if ((st->have_next = replay_next(st)))
+			due = st->start_ns + (uint64_t) ((st->next.timestamp - st->first_ts) / st->cfg.speed);
+	}
+	return n;
+}
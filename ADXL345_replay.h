@@ -0,0 +1,50 @@
+/* Replay sample source: a recording of ADXL345_record.h, or a synthetic
+ * signal, handed out through struct accel_source like the sensor backends,
+ * so consumers can be loaded without a board.
+ *
+ * Samples are paced by their own timestamps: in real time, speed times
+ * faster, or as fast as read() is called when speed is 0. Replayed samples
+ * carry the time they were due on CLOCK_MONOTONIC (the read time when
+ * unpaced), so latencies measured from them stay meaningful; sequence
+ * numbers and flags are kept, and continue across loops of a recording.
+ *
+ * The synthetic signal is 1 g on Z at full resolution, 3.9 mg per LSB, at
+ * the BW_RATE code set_rate() selects (13, 800 Hz, at first), plus any of:
+ * a sine on X (and its cosine on Y), +-2 LSB of noise on every axis, and a
+ * 2 g tap every 2 s ringing at 250 Hz, flagged ACCEL_FLAG_SINGLE_TAP. A
+ * recording plays at the rate it was taken at, whatever set_rate() asks. */
+#ifndef ADXL345_REPLAY_H
+#define ADXL345_REPLAY_H
+
+#include <stdint.h>
+#include "ADXL345_access.h"
+
+#define ACCEL_REPLAY_SINE			0x01
+#define ACCEL_REPLAY_NOISE			0x02
+#define ACCEL_REPLAY_TAPS			0x04
+
+struct accel_replay_config {
+	const char * file;			// recording to play, NULL for the synthetic signal
+	unsigned int signals;		// ACCEL_REPLAY_*, synthetic signal only
+	double sine_hz, sine_mg;
+	double speed;				// 1 in real time, N times faster, 0 as fast as possible
+	int loop;					// start the recording over at its end, else read() returns -1 there
+};
+
+extern struct accel_source replay_source;
+
+/* Takes effect at the next open(); file must stay valid until close() */
+void ADXL345_Replay_Setup(const struct accel_replay_config * cfg);
+
+/* "sine", "noise", "taps" or several joined by ',' select the synthetic
+ * signal, anything else names a recording. Fills in cfg->file or
+ * cfg->signals. */
+void ADXL345_Replay_Parse(const char * spec, struct accel_replay_config * cfg);
+
+/* New pacing from the next sample on, while open */
+void ADXL345_Replay_Speed(double speed);
+
+/* DATA_FORMAT and BW_RATE of what is being replayed, while open */
+void ADXL345_Replay_Format(uint8_t * data_format, uint8_t * bw_rate);
+
+#endif
@@ -0,0 +1,309 @@
+#include <string.h>
+#include "ADXL345_access.h"
+
+/* In-process ADXL345 register file for running the userspace tools and the
+ * benchmark without a board. While POWER_CTL measure is set a new sample
+ * appears every BW_RATE output data period: in bypass mode it replaces the
+ * data registers and raises DATA_READY, in stream mode it is queued in the
+ * 32 entry FIFO. Reading INT_SOURCE clears the event bits and reading the
+ * data clears DATA_READY or pops one FIFO entry, as on the real part; both
+ * take effect when the bus transaction ends. New samples only land between
+ * transactions, so a burst never returns a DATA_READY bit and data from
+ * different samples. Time comes from CLOCK_MONOTONIC,
+ * or from the I2C0 and SPIM0 timing models of ADXL345_i2csim.c and
+ * ADXL345_spisim.c. For timestamp tests the output data rate can be off by
+ * some ppm as the part's oscillator is, the data can carry the sample number,
+ * and the time each recent sample was produced is kept. */
+
+static int sim_open(struct adxl345_bus * bus);
+static void sim_close(struct adxl345_bus * bus);
+static void sim_REG_READ(struct adxl345_bus * bus, uint8_t address, uint8_t * value);
+static void sim_REG_WRITE(struct adxl345_bus * bus, uint8_t address, uint8_t value);
+static void sim_REG_MULTI_READ(struct adxl345_bus * bus, uint8_t address, uint8_t values[], uint8_t len);
+static void sim_update(void);
+static void sim_sample(uint64_t t);
+static uint8_t sim_source(void);
+static uint64_t sim_period(void);
+
+#define SIM_TIMES					1024
+
+struct adxl345_bus sim_bus = {
+	.name = "sim",
+	.open = sim_open,
+	.close = sim_close,
+	.reg_read = sim_REG_READ,
+	.reg_write = sim_REG_WRITE,
+	.multi_read = sim_REG_MULTI_READ
+};
+
+static uint8_t sim_regs[ADXL345_NUM_REGS];
+static uint64_t (*sim_clock)(void) = accel_now_ns;
+static uint64_t sim_next;				// ns the next sample is due
+static uint8_t sim_events;				// latched INT_SOURCE tap/activity bits
+static int sim_ready, sim_overrun;		// bypass DATA_READY, lost sample since the last data read
+static int16_t sim_fifo[ADXL345_FIFO_DEPTH][3];
+static int sim_fifo_head, sim_fifo_count;
+static int sim_source_read, sim_data_read;	// side effects due at the end of the transaction
+static int sim_in_xfer;					// a byte was transferred since the last end
+static struct adxl345_sim_stats sim_stats;
+static int32_t sim_odr_ppm;				// output data rate error, positive runs slow
+static int sim_counter;					// X and Y carry the sample number
+static uint64_t sim_times[SIM_TIMES];	// production time by sample number
+
+void ADXL345_sim_reset(void) {
+	memset(sim_regs, 0, sizeof(sim_regs));
+	//Reset values
+	sim_regs[ADXL345_DEVID] = ADXL345_ID;
+	sim_regs[ADXL345_BW_RATE] = 0x0A;
+	sim_events = 0;
+	sim_ready = sim_overrun = 0;
+	sim_fifo_head = sim_fifo_count = 0;
+	sim_source_read = sim_data_read = 0;
+	sim_in_xfer = 0;
+	memset(&sim_stats, 0, sizeof(sim_stats));
+	sim_odr_ppm = 0;
+	sim_counter = 0;
+}
+
+void ADXL345_sim_set_clock(uint64_t (*clock)(void)) {
+	sim_clock = clock ? clock : accel_now_ns;
+}
+
+void ADXL345_sim_get_stats(struct adxl345_sim_stats * stats) {
+	*stats = sim_stats;
+}
+
+/* Takes effect with the next BW_RATE write or measurement start */
+void ADXL345_sim_set_odr_error(int32_t ppm) {
+	sim_odr_ppm = ppm;
+}
+
+/* Sample n has X = n & 0xFFFF and Y = n >> 16 instead of the triangle */
+void ADXL345_sim_set_counter(int on) {
+	sim_counter = on;
+}
+
+/* Time sample n was produced, 0 once SIM_TIMES newer ones were */
+uint64_t ADXL345_sim_sample_ns(uint32_t n) {
+	if (n >= sim_stats.generated || sim_stats.generated - n > SIM_TIMES)
+		return 0;
+	return sim_times[n % SIM_TIMES];
+}
+
+/* Output data period of BW_RATE in ns, 3200 Hz halving per step, off by
+ * the oscillator error */
+static uint64_t sim_period(void) {
+	uint64_t period = (uint64_t) 312500 << (15 - (sim_regs[ADXL345_BW_RATE] & 0x0F));
+
+	return period + (int64_t) period * sim_odr_ppm / 1000000;
+}
+
+/* ns the next sample is due, or ~0 in standby */
+uint64_t ADXL345_sim_next(void) {
+	if (!(sim_regs[ADXL345_POWER_CTL] & ADXL345_MEASURE))
+		return ~0ULL;
+	return sim_next;
+}
+
+/* One new sample, due at t. Board lying flat: 1 g on Z, plus a slow triangle
+ * on X and Y */
+static void sim_sample(uint64_t t) {
+	int16_t XYZ[3];
+	int32_t lsb_per_g;
+	uint32_t n = sim_stats.generated++;
+	int i, slot;
+
+	lsb_per_g = 1000000 / ADXL345_Scale(sim_regs[ADXL345_DATA_FORMAT]);
+	XYZ[0] = (int) (n % 64) - 32;
+	XYZ[1] = 32 - (int) (n % 64);
+	XYZ[2] = lsb_per_g;
+	if (sim_counter) {
+		XYZ[0] = n & 0xFFFF;
+		XYZ[1] = n >> 16;
+	}
+	sim_times[n % SIM_TIMES] = t;
+
+	if (sim_regs[ADXL345_FIFO_CTL] & ADXL345_FIFO_STREAM) {
+		//Stream mode keeps the newest 32, dropping the oldest
+		if (sim_fifo_count == ADXL345_FIFO_DEPTH) {
+			sim_fifo_head = (sim_fifo_head + 1) % ADXL345_FIFO_DEPTH;
+			sim_fifo_count--;
+			sim_overrun = 1;
+			sim_stats.overruns++;
+		}
+		slot = (sim_fifo_head + sim_fifo_count) % ADXL345_FIFO_DEPTH;
+		memcpy(sim_fifo[slot], XYZ, sizeof(XYZ));
+		sim_fifo_count++;
+	}
+	else {
+		if (sim_ready) {
+			sim_overrun = 1;
+			sim_stats.overruns++;
+		}
+		for (i = 0; i < 3; i++) {
+			sim_regs[ADXL345_DATAX0 + 2*i] = XYZ[i] & 0xFF;
+			sim_regs[ADXL345_DATAX0 + 2*i + 1] = (XYZ[i] >> 8) & 0xFF;
+		}
+		sim_ready = 1;
+	}
+}
+
+/* Generate every sample due by now. A long gap on the real clock is
+ * counted as lost samples rather than generated one by one. */
+static void sim_update(void) {
+	uint64_t now, period, missed;
+
+	if (!(sim_regs[ADXL345_POWER_CTL] & ADXL345_MEASURE))
+		return;
+	now = sim_clock();
+	if (now < sim_next)
+		return;
+	period = sim_period();
+	missed = (now - sim_next) / period + 1;
+	if (missed > 2 * ADXL345_FIFO_DEPTH) {
+		sim_stats.generated += missed - 2 * ADXL345_FIFO_DEPTH;
+		sim_stats.overruns += missed - 2 * ADXL345_FIFO_DEPTH;
+		sim_next += period * (missed - 2 * ADXL345_FIFO_DEPTH);
+	}
+	while (sim_next <= now) {
+		sim_sample(sim_next);
+		sim_next += period;
+	}
+}
+
+/* INT_SOURCE as the part computes it */
+static uint8_t sim_source(void) {
+	uint8_t source = sim_events;
+	unsigned int watermark = sim_regs[ADXL345_FIFO_CTL] & 0x1F;
+
+	if (sim_regs[ADXL345_FIFO_CTL] & ADXL345_FIFO_STREAM) {
+		if (sim_fifo_count)
+			source |= ADXL345_DATAREADY;
+		if (sim_fifo_count >= watermark)
+			source |= ADXL345_WATERMARK;
+	}
+	else if (sim_ready)
+		source |= ADXL345_DATAREADY;
+	if (sim_overrun)
+		source |= ADXL345_OVERRUN;
+	return source;
+}
+
+/* INT1 level: enabled sources not mapped to INT2 */
+int ADXL345_sim_int1(void) {
+	sim_update();
+	return (sim_source() & sim_regs[ADXL345_INT_ENABLE] & ~sim_regs[ADXL345_INT_MAP]) != 0;
+}
+
+/* One byte of a bus read */
+uint8_t ADXL345_sim_read(uint8_t address) {
+	int slot;
+
+	if (!sim_in_xfer)
+		sim_update();
+	sim_in_xfer = 1;
+	if (address >= ADXL345_NUM_REGS)
+		return 0;
+	switch (address) {
+	case ADXL345_INT_SOURCE :
+		sim_source_read = 1;
+		return sim_source();
+	case ADXL345_FIFO_STATUS :
+		return sim_fifo_count;
+	}
+	if (address >= ADXL345_DATAX0 && address < ADXL345_DATAX0 + 6) {
+		sim_data_read = 1;
+		if (sim_regs[ADXL345_FIFO_CTL] & ADXL345_FIFO_STREAM) {
+			if (!sim_fifo_count)
+				return 0;
+			slot = sim_fifo_head;
+			if ((address - ADXL345_DATAX0) & 1)
+				return (sim_fifo[slot][(address - ADXL345_DATAX0) / 2] >> 8) & 0xFF;
+			return sim_fifo[slot][(address - ADXL345_DATAX0) / 2] & 0xFF;
+		}
+	}
+	return sim_regs[address];
+}
+
+/* One byte of a bus write */
+void ADXL345_sim_write(uint8_t address, uint8_t value) {
+	if (!sim_in_xfer)
+		sim_update();
+	sim_in_xfer = 1;
+	if (address >= ADXL345_NUM_REGS)
+		return;
+
+	switch (address) {
+	case ADXL345_DEVID :
+	case ADXL345_ACT_TAP_STATUS :
+	case ADXL345_INT_SOURCE :
+	case ADXL345_FIFO_STATUS :
+		//read only
+		return;
+	case ADXL345_POWER_CTL :
+		if ((value & ADXL345_MEASURE) && !(sim_regs[address] & ADXL345_MEASURE))
+			sim_next = sim_clock() + sim_period();
+		break;
+	case ADXL345_BW_RATE :
+		sim_regs[address] = value;
+		sim_next = sim_clock() + sim_period();
+		return;
+	case ADXL345_FIFO_CTL :
+		//Changing mode empties the FIFO
+		if ((value ^ sim_regs[address]) & 0xC0)
+			sim_fifo_head = sim_fifo_count = 0;
+		break;
+	}
+	sim_regs[address] = value;
+}
+
+/* STOP: apply the read side effects of the transaction */
+void ADXL345_sim_end(void) {
+	if (sim_source_read)
+		sim_events = 0;
+	if (sim_data_read) {
+		if (sim_regs[ADXL345_FIFO_CTL] & ADXL345_FIFO_STREAM) {
+			if (sim_fifo_count) {
+				sim_fifo_head = (sim_fifo_head + 1) % ADXL345_FIFO_DEPTH;
+				sim_fifo_count--;
+				sim_stats.read++;
+			}
+		}
+		else if (sim_ready) {
+			sim_ready = 0;
+			sim_stats.read++;
+		}
+		sim_overrun = 0;
+	}
+	sim_source_read = sim_data_read = 0;
+	sim_in_xfer = 0;
+}
+
+/* Register backend, every call is one whole transaction */
+
+static int sim_open(struct adxl345_bus * bus) {
+	ADXL345_sim_reset();
+	ADXL345_sim_set_clock(NULL);
+	return 0;
+}
+
+static void sim_close(struct adxl345_bus * bus) {
+}
+
+static void sim_REG_READ(struct adxl345_bus * bus, uint8_t address, uint8_t * value) {
+	sim_REG_MULTI_READ(bus, address, value, 1);
+}
+
+static void sim_REG_WRITE(struct adxl345_bus * bus, uint8_t address, uint8_t value) {
+	ADXL345_sim_write(address, value);
+	ADXL345_sim_end();
+}
+
+/* Burst read with address auto-increment */
+static void sim_REG_MULTI_READ(struct adxl345_bus * bus, uint8_t address, uint8_t values[], uint8_t len) {
+	int i;
+
+	for (i = 0; i < len; i++)
+		values[i] = ADXL345_sim_read(address + i);
+	ADXL345_sim_end();
+}
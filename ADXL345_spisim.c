@@ -0,0 +1,241 @@
+#include <string.h>
+#include "../address_map_arm.h"
+#include "ADXL345_access.h"
+
+/* Timing model of the DesignWare SSI master SPIM0 with the simulated ADXL345
+ * of ADXL345_sim.c on chip select 0, for the byte offsets of
+ * address_map_arm.h. Time is virtual as in ADXL345_i2csim.c: the CPU clock
+ * advances by mmio_ns per register access, and the master shifts the TX FIFO
+ * out in the background, 8 SCLK periods of BAUDR spi_m_clk cycles per byte,
+ * receiving one byte for every byte sent. A frame starts once a slave is
+ * selected in SER and the TX FIFO holds data, and as on the real master chip
+ * select rises as soon as the TX FIFO runs empty; the ADXL345 then ends the
+ * transaction. */
+
+#define SPI_M_CLK_NS				5		// 200 MHz spi_m_clk
+#define SPI_T_CS_DIS_NS				150		// ADXL345 chip select deassertion time
+#define SPIM0_FIFO_DEPTH			256
+#define MMIO_NS						200		// default cost of one register access
+
+/* SR bits */
+#define SR_BUSY						0x01
+#define SR_TFNF						0x02
+#define SR_TFE						0x04
+#define SR_RFNE						0x08
+#define SR_RFF						0x10
+
+static void spisim_run(uint64_t until);
+static void spisim_end(void);
+static void spisim_flush(void);
+
+static struct {
+	uint32_t ctrlr0, ssienr, ser, baudr, imr;
+	uint8_t tx[SPIM0_FIFO_DEPTH];
+	uint64_t tx_t[SPIM0_FIFO_DEPTH];	// CPU time each byte was written
+	int tx_head, tx_count;
+	uint8_t rx[SPIM0_FIFO_DEPTH];
+	int rx_head, rx_count;
+	uint64_t now;					// CPU time
+	uint64_t bus_t;					// bus time, end of the last bus event
+	uint64_t ser_t;					// CPU time a slave was last selected
+	int in_frame;					// chip select low
+	int selected;					// the frame reaches the ADXL345
+	int command;					// next byte is the ADXL345 command byte
+	int reading, multi;				// R/W and MB of the command byte
+	uint8_t reg;					// ADXL345 register pointer
+	uint32_t mmio_ns;
+	struct bussim_stats stats;
+} ssi;
+
+void spisim_reset(void) {
+	uint32_t mmio_ns = ssi.mmio_ns ? ssi.mmio_ns : MMIO_NS;
+
+	memset(&ssi, 0, sizeof(ssi));
+	ssi.mmio_ns = mmio_ns;
+	//Reset values: 8 bit frames, mode 0, no clock until BAUDR is set
+	ssi.ctrlr0 = 0x7;
+	ssi.imr = 0x3F;
+	ADXL345_sim_reset();
+	ADXL345_sim_set_clock(spisim_now);
+}
+
+void spisim_set_mmio_ns(uint32_t ns) {
+	ssi.mmio_ns = ns;
+}
+
+uint64_t spisim_now(void) {
+	return ssi.now;
+}
+
+/* The caller sleeps until ns, the master keeps shifting */
+void spisim_idle_until(uint64_t ns) {
+	if (ns > ssi.now)
+		ssi.now = ns;
+	spisim_run(ssi.now);
+}
+
+void spisim_get_stats(struct bussim_stats * stats) {
+	*stats = ssi.stats;
+	stats->now_ns = ssi.now;
+}
+
+/* Shift the TX FIFO out up to CPU time until. Only a frame on chip select 0
+ * with 8 bit frames in SPI mode 3 reaches the ADXL345, any other one reads
+ * back 0xFF from the idle MISO line. */
+static void spisim_run(uint64_t until) {
+	uint64_t start, t, d = 8 * (uint64_t) ssi.baudr * SPI_M_CLK_NS;
+	uint8_t byte, data = 0;
+
+	while (ssi.tx_count && ssi.ser && (ssi.ssienr & 0x1) && ssi.baudr >= 2) {
+		t = ssi.tx_t[ssi.tx_head] > ssi.ser_t ? ssi.tx_t[ssi.tx_head] : ssi.ser_t;
+		//The FIFO ran empty before this byte was written, chip select rose
+		if (ssi.in_frame && t > ssi.bus_t) {
+			spisim_end();
+			continue;
+		}
+
+		start = t > ssi.bus_t ? t : ssi.bus_t;
+		if (start + d > until)
+			break;
+
+		byte = ssi.tx[ssi.tx_head];
+		ssi.tx_head = (ssi.tx_head + 1) % SPIM0_FIFO_DEPTH;
+		ssi.tx_count--;
+		if (!ssi.in_frame) {
+			ssi.in_frame = 1;
+			ssi.command = 1;
+			ssi.selected = (ssi.ser & 0x1) && (ssi.ctrlr0 & 0xCF) == 0xC7;
+		}
+
+		if (!ssi.selected)
+			data = 0xFF;
+		else if (ssi.command) {
+			ssi.reading = (byte & ADXL345_SPI_READ) != 0;
+			ssi.multi = (byte & ADXL345_SPI_MB) != 0;
+			ssi.reg = byte & 0x3F;
+			ssi.command = 0;
+			data = 0xFF;
+		}
+		else if (ssi.reading) {
+			data = ADXL345_sim_read(ssi.reg);
+			ssi.reg += ssi.multi;
+		}
+		else {
+			ADXL345_sim_write(ssi.reg, byte);
+			ssi.reg += ssi.multi;
+			data = 0xFF;
+		}
+		if (ssi.rx_count < SPIM0_FIFO_DEPTH) {
+			ssi.rx[(ssi.rx_head + ssi.rx_count) % SPIM0_FIFO_DEPTH] = data;
+			ssi.rx_count++;
+		}
+
+		ssi.stats.bytes++;
+		ssi.stats.bus_busy_ns += d;
+		ssi.bus_t = start + d;
+	}
+	if (!ssi.tx_count && ssi.in_frame && ssi.bus_t <= until)
+		spisim_end();
+}
+
+static void spisim_end(void) {
+	ssi.stats.transactions++;
+	if (ssi.selected)
+		ADXL345_sim_end();
+	ssi.in_frame = 0;
+	ssi.bus_t += SPI_T_CS_DIS_NS;
+}
+
+static void spisim_flush(void) {
+	ssi.tx_count = ssi.rx_count = 0;
+	ssi.tx_head = ssi.rx_head = 0;
+	if (ssi.in_frame)
+		spisim_end();
+}
+
+uint32_t spisim_read(int offset) {
+	uint32_t value = 0;
+
+	ssi.now += ssi.mmio_ns;
+	ssi.stats.cpu_ns += ssi.mmio_ns;
+	ssi.stats.accesses++;
+	spisim_run(ssi.now);
+
+	switch (offset) {
+	case SPIM0_CTRLR0 :
+		return ssi.ctrlr0;
+	case SPIM0_SSIENR :
+		return ssi.ssienr;
+	case SPIM0_SER :
+		return ssi.ser;
+	case SPIM0_BAUDR :
+		return ssi.baudr;
+	case SPIM0_TXFLR :
+		return ssi.tx_count;
+	case SPIM0_RXFLR :
+		return ssi.rx_count;
+	case SPIM0_SR :
+		if (ssi.in_frame || (ssi.tx_count && ssi.ser))
+			value |= SR_BUSY;
+		if (ssi.tx_count < SPIM0_FIFO_DEPTH)
+			value |= SR_TFNF;
+		if (!ssi.tx_count)
+			value |= SR_TFE;
+		if (ssi.rx_count)
+			value |= SR_RFNE;
+		if (ssi.rx_count == SPIM0_FIFO_DEPTH)
+			value |= SR_RFF;
+		return value;
+	case SPIM0_IMR :
+		return ssi.imr;
+	case SPIM0_DR :
+		if (!ssi.rx_count)
+			return 0;
+		value = ssi.rx[ssi.rx_head];
+		ssi.rx_head = (ssi.rx_head + 1) % SPIM0_FIFO_DEPTH;
+		ssi.rx_count--;
+		return value;
+	}
+	return 0;
+}
+
+void spisim_write(int offset, uint32_t value) {
+	ssi.now += ssi.mmio_ns;
+	ssi.stats.cpu_ns += ssi.mmio_ns;
+	ssi.stats.accesses++;
+	spisim_run(ssi.now);
+
+	switch (offset) {
+	case SPIM0_CTRLR0 :
+		if (!(ssi.ssienr & 0x1))
+			ssi.ctrlr0 = value & 0xFFFF;
+		break;
+	case SPIM0_SSIENR :
+		//Disabling flushes both FIFOs
+		if (!(value & 0x1))
+			spisim_flush();
+		ssi.ssienr = value & 0x1;
+		break;
+	case SPIM0_SER :
+		if (value && !ssi.ser)
+			ssi.ser_t = ssi.now;
+		ssi.ser = value & 0xF;
+		spisim_run(ssi.now);
+		break;
+	case SPIM0_BAUDR :
+		if (!(ssi.ssienr & 0x1))
+			ssi.baudr = value & 0xFFFE;
+		break;
+	case SPIM0_IMR :
+		ssi.imr = value & 0x3F;
+		break;
+	case SPIM0_DR :
+		if (!(ssi.ssienr & 0x1) || ssi.tx_count == SPIM0_FIFO_DEPTH)
+			break;
+		ssi.tx[(ssi.tx_head + ssi.tx_count) % SPIM0_FIFO_DEPTH] = value & 0xFF;
+		ssi.tx_t[(ssi.tx_head + ssi.tx_count) % SPIM0_FIFO_DEPTH] = ssi.now;
+		ssi.tx_count++;
+		spisim_run(ssi.now);
+		break;
+	}
+}
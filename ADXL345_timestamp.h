@@ -0,0 +1,212 @@
+/* Per sample timestamps reconstructed from the output data rate, shared by
+ * the driver and the userspace timing tools.
+ *
+ * The ADXL345 produces sample n at t0 + n * T, with T the BW_RATE period
+ * off by the tolerance of its oscillator. Each batch read comes with one
+ * observation, a CLOCK_MONOTONIC time by which a given sample of the batch
+ * certainly existed: the data ready or watermark interrupt that sample
+ * raised or, failing that, the end of the read that found it. Observations
+ * are late by the interrupt or polling latency but never early, so the
+ * timeline follows their lower envelope: an observation earlier than
+ * predicted moves it at once, a later one by 1 / ACCEL_TS_SLEW of the
+ * difference. T is measured between the least late observations of
+ * successive windows of at least ACCEL_TS_WINDOW_NS, and kept as a ratio to
+ * the nominal period, which survives rate changes since the oscillator stays
+ * the same. After an overrun the newest sample read is taken as the last one
+ * due by its observation, which counts the samples lost; a later
+ * observation too early for that count takes back the excess, and as the
+ * count is not certain the drift window starts over. An observation too far
+ * off to be latency restarts the timeline. Stamping costs one multiply and
+ * shift per sample. */
+#ifndef ADXL345_TIMESTAMP_H
+#define ADXL345_TIMESTAMP_H
+
+#include <linux/types.h>
+
+#ifdef __KERNEL__
+#include <linux/math64.h>
+#define ACCEL_TS_DIV(n, d)			div64_u64(n, d)
+#else
+#define ACCEL_TS_DIV(n, d)			((n) / (d))
+#endif
+
+#define ACCEL_TS_ONE				(1 << 24)		// period ratio 1.0
+#define ACCEL_TS_TOLERANCE			(ACCEL_TS_ONE / 20)	// 5%, beyond any ADXL345 oscillator
+#define ACCEL_TS_SLEW				64
+#define ACCEL_TS_WINDOW_NS			1000000000ULL
+#define ACCEL_TS_WINDOW_MIN			16				// samples per window at the lowest rates
+#define ACCEL_TS_LATE_NS			1000000			// latency allowed on top of 2 periods
+#define ACCEL_TS_GAP_NS				(1ULL << 40)	// 18 minutes, longest overrun bridged
+
+struct accel_ts {
+	__u64 nominal_ns;			// BW_RATE period
+	__u32 ratio;				// estimated / nominal period, ACCEL_TS_ONE is 1
+	__u32 measured;				// ratio estimated at least once
+	__u64 period;				// estimated period, ns << 16
+	__u64 base_ns, base_idx;	// time of sample base_idx
+	__u64 next_idx;				// index of the next sample read
+	__u64 first_ns;				// time of the first sample of the last batch
+	int synced;
+
+	/* Drift windows: the current one starts at sample win_idx, its least
+	 * late observation so far is min_*, that of the previous one env_* */
+	__u64 win_ns, win_idx;
+	__u64 min_ns, min_idx;
+	__s64 min_late;
+	__u64 env_ns, env_idx;
+
+	__u32 resyncs;				// timeline restarts
+	__u64 lost;					// samples counted lost on overruns
+	__u64 bridge_idx, bridge_lost;	// the last overrun counted bridge_lost samples before bridge_idx
+};
+
+/* New period, or the sensor restarted: the next observation starts a new
+ * timeline. A zeroed struct accel_ts is ready for this. */
+static inline void accel_ts_restart(struct accel_ts * ts, __u64 nominal_ns) {
+	if (!ts->ratio)
+		ts->ratio = ACCEL_TS_ONE;
+	ts->nominal_ns = nominal_ns;
+	ts->period = (nominal_ns * ts->ratio) >> 8;
+	ts->synced = 0;
+}
+
+/* Sample idx existed by obs_ns: track the least late observation of the
+ * window, and at its end measure the period against the previous window's
+ * and put the timeline on the line through it with the new period, which
+ * undoes the lag the slew built up while the period was off. restart when
+ * the sample count since the last observation is not certain; that
+ * observation may be as late as the stall behind it, so the first window
+ * after it only provides the point for the next. */
+static inline void accel_ts_drift(struct accel_ts * ts, __u64 idx, __u64 obs_ns, int restart) {
+	__s64 late;
+	__u64 ratio, anchor;
+
+	if (restart) {
+		ts->env_ns = 0;
+		goto window;
+	}
+	late = (__s64) (obs_ns - ts->win_ns - (((idx - ts->win_idx) * ts->period) >> 16));
+	if (late < ts->min_late) {
+		ts->min_late = late;
+		ts->min_ns = obs_ns;
+		ts->min_idx = idx;
+	}
+	if (obs_ns - ts->win_ns < ACCEL_TS_WINDOW_NS || idx - ts->win_idx < ACCEL_TS_WINDOW_MIN)
+		return;
+
+	//Least late points close together measure nothing but their latencies
+	if (ts->env_ns && ts->min_idx > ts->env_idx && ts->min_ns > ts->env_ns &&
+		ts->min_ns - ts->env_ns >= ACCEL_TS_WINDOW_NS / 2) {
+		ratio = ACCEL_TS_DIV((ts->min_ns - ts->env_ns) << 24, (ts->min_idx - ts->env_idx) * ts->nominal_ns);
+		if (ratio > ACCEL_TS_ONE - ACCEL_TS_TOLERANCE && ratio < ACCEL_TS_ONE + ACCEL_TS_TOLERANCE) {
+			//Average the windows once the first one has measured the oscillator
+			if (ts->measured)
+				ts->ratio = (__u32) ((__s64) ts->ratio + ((__s64) ratio - (__s64) ts->ratio) / 4);
+			else
+				ts->ratio = (__u32) ratio;
+			ts->measured = 1;
+			ts->period = (ts->nominal_ns * ts->ratio) >> 8;
+			anchor = ts->min_ns + (((idx - ts->min_idx) * ts->period) >> 16);
+			ts->base_ns = anchor < obs_ns ? anchor : obs_ns;
+		}
+	}
+	ts->env_ns = ts->min_ns;
+	ts->env_idx = ts->min_idx;
+window:
+	ts->win_ns = ts->min_ns = obs_ns;
+	ts->win_idx = ts->min_idx = idx;
+	ts->min_late = 0;
+}
+
+/* Samples from bridge_idx on were numbered d too high: the last overrun lost
+ * fewer than it counted */
+static inline void accel_ts_relabel(struct accel_ts * ts, __u64 d) {
+	if (ts->base_idx >= ts->bridge_idx)
+		ts->base_idx -= d;
+	if (ts->win_idx >= ts->bridge_idx)
+		ts->win_idx -= d;
+	if (ts->min_idx >= ts->bridge_idx)
+		ts->min_idx -= d;
+	if (ts->env_idx >= ts->bridge_idx)
+		ts->env_idx -= d;
+	ts->next_idx -= d;
+	ts->bridge_idx -= d;
+	ts->bridge_lost -= d;
+	ts->lost -= d;
+}
+
+/* count new samples were read, sample obs of them (0 the oldest) existed by
+ * obs_ns; overrun when the sensor lost samples before them, in which case
+ * obs must be the newest */
+static inline void accel_ts_batch(struct accel_ts * ts, int count, int obs, __u64 obs_ns, int overrun) {
+	__u64 idx, due, pred, d, period_ns = ts->period >> 16;
+	__s64 err, limit = (__s64) (2 * period_ns + ACCEL_TS_LATE_NS);
+	int bridged = 0;
+
+	if (count <= 0)
+		return;
+	idx = ts->next_idx + obs;
+	if (ts->synced && overrun) {
+		if (obs_ns <= ts->base_ns || obs_ns - ts->base_ns >= ACCEL_TS_GAP_NS)
+			ts->synced = 0;
+		else {
+			//At least one was lost, maybe more by the time elapsed
+			due = ts->base_idx + ACCEL_TS_DIV((obs_ns - ts->base_ns) << 16, ts->period);
+			if (due <= idx)
+				due = idx + 1;
+			ts->lost += due - idx;
+			ts->next_idx += due - idx;
+			ts->bridge_idx = due;
+			ts->bridge_lost = due - idx;
+			idx = due;
+			bridged = 1;
+		}
+	}
+
+	if (ts->synced) {
+		pred = ts->base_ns + (((idx - ts->base_idx) * ts->period) >> 16);
+		err = (__s64) (obs_ns - pred);
+		//An observation can only be that early if the overrun counted too many
+		if (err < -(__s64) (period_ns / 2) && ts->bridge_lost && idx >= ts->bridge_idx) {
+			d = ACCEL_TS_DIV((__u64) -err + period_ns / 2, period_ns);
+			if (d > ts->bridge_lost)
+				d = ts->bridge_lost;
+			accel_ts_relabel(ts, d);
+			idx -= d;
+			pred = ts->base_ns + (((idx - ts->base_idx) * ts->period) >> 16);
+			err = (__s64) (obs_ns - pred);
+		}
+		if (err > limit || err < -limit)
+			ts->synced = 0;
+		else if (err < 0)
+			ts->base_ns = obs_ns;
+		else
+			ts->base_ns = pred + err / ACCEL_TS_SLEW;
+	}
+
+	if (ts->synced)
+		accel_ts_drift(ts, idx, obs_ns, bridged);
+	else {
+		if (ts->next_idx)
+			ts->resyncs++;
+		ts->bridge_lost = 0;
+		ts->base_ns = obs_ns;
+		ts->synced = 1;
+		accel_ts_drift(ts, idx, obs_ns, 1);
+	}
+	ts->base_idx = idx;
+	ts->first_ns = ts->base_ns - (((__u64) obs * ts->period) >> 16);
+	ts->next_idx += count;
+}
+
+/* Time of sample i of the last batch */
+static inline __u64 accel_ts_stamp(const struct accel_ts * ts, int i) {
+	return ts->first_ns + (((__u64) i * ts->period) >> 16);
+}
+
+/* Oscillator error in ppm, positive when the sensor runs slow */
+static inline __s32 accel_ts_ppm(const struct accel_ts * ts) {
+	return (__s32) (((__s64) ts->ratio - ACCEL_TS_ONE) * 1000000 / ACCEL_TS_ONE);
+}
+
+#endif
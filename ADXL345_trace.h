@@ -0,0 +1,122 @@
+/* Tracepoints of the /dev/accelN ADXL345 driver, enabled through
+ * /sys/kernel/debug/tracing/events/accel/. The directory holding this header
+ * has to be on the module include path, which Kbuild adds. */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM accel
+
+#if !defined(_ADXL345_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _ADXL345_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* One sample as it is handed to the readers, dev is the N of /dev/accelN */
+TRACE_EVENT(accel_sample,
+	TP_PROTO(int dev, u32 seq, s16 x, s16 y, s16 z, u16 flags),
+	TP_ARGS(dev, seq, x, y, z, flags),
+	TP_STRUCT__entry(
+		__field(int, dev)
+		__field(u32, seq)
+		__field(s16, x)
+		__field(s16, y)
+		__field(s16, z)
+		__field(u16, flags)
+	),
+	TP_fast_assign(
+		__entry->dev = dev;
+		__entry->seq = seq;
+		__entry->x = x;
+		__entry->y = y;
+		__entry->z = z;
+		__entry->flags = flags;
+	),
+	TP_printk("dev=%d seq=%u x=%d y=%d z=%d flags=%#x", __entry->dev,
+		__entry->seq, __entry->x, __entry->y, __entry->z, __entry->flags)
+);
+
+/* INT_SOURCE read while checking for new data, ready is the sample count */
+TRACE_EVENT(accel_data_ready,
+	TP_PROTO(int dev, u8 source, int ready),
+	TP_ARGS(dev, source, ready),
+	TP_STRUCT__entry(
+		__field(int, dev)
+		__field(u8, source)
+		__field(int, ready)
+	),
+	TP_fast_assign(
+		__entry->dev = dev;
+		__entry->source = source;
+		__entry->ready = ready;
+	),
+	TP_printk("dev=%d int_source=%#x ready=%d", __entry->dev, __entry->source, __entry->ready)
+);
+
+TRACE_EVENT(accel_tap,
+	TP_PROTO(int dev, u8 source),
+	TP_ARGS(dev, source),
+	TP_STRUCT__entry(
+		__field(int, dev)
+		__field(u8, source)
+	),
+	TP_fast_assign(
+		__entry->dev = dev;
+		__entry->source = source;
+	),
+	TP_printk("dev=%d %s int_source=%#x", __entry->dev, (__entry->source & 0x20) ? "double" : "single",
+		__entry->source)
+);
+
+/* One I2C transaction on controller bus to sensor target, count back to
+ * back reads of len bytes at register address */
+TRACE_EVENT(accel_i2c,
+	TP_PROTO(u8 bus, u8 target, u8 address, u8 len, u8 count, bool read),
+	TP_ARGS(bus, target, address, len, count, read),
+	TP_STRUCT__entry(
+		__field(u8, bus)
+		__field(u8, target)
+		__field(u8, address)
+		__field(u8, len)
+		__field(u8, count)
+		__field(bool, read)
+	),
+	TP_fast_assign(
+		__entry->bus = bus;
+		__entry->target = target;
+		__entry->address = address;
+		__entry->len = len;
+		__entry->count = count;
+		__entry->read = read;
+	),
+	TP_printk("i2c%u target=%#x %s address=%#x len=%u count=%u", __entry->bus, __entry->target,
+		__entry->read ? "read" : "write", __entry->address, __entry->len, __entry->count)
+);
+
+/* count SPIM0 frames to the sensor on chip select cs, each a command byte
+ * and len bytes at register address */
+TRACE_EVENT(accel_spi,
+	TP_PROTO(u8 cs, u8 address, u8 len, u8 count, bool read),
+	TP_ARGS(cs, address, len, count, read),
+	TP_STRUCT__entry(
+		__field(u8, cs)
+		__field(u8, address)
+		__field(u8, len)
+		__field(u8, count)
+		__field(bool, read)
+	),
+	TP_fast_assign(
+		__entry->cs = cs;
+		__entry->address = address;
+		__entry->len = len;
+		__entry->count = count;
+		__entry->read = read;
+	),
+	TP_printk("spim0 cs=%u %s address=%#x len=%u count=%u", __entry->cs,
+		__entry->read ? "read" : "write", __entry->address, __entry->len, __entry->count)
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ADXL345_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,213 @@
+#include <string.h>
+#include "ADXL345.h"
+#include "ADXL345_unpack.h"
+
+/* Record unpacking kernels. Every DATA_FORMAT maps to one of four scales,
+ * 3900 ug per LSB at full resolution and 3900 << range at 10 bits, and each
+ * implementation is instantiated once per scale so the multiply is by a
+ * constant. The vector paths take 8 records (48 bytes) per step and finish
+ * the remainder with the scalar reference, and they all produce exactly its
+ * result: the scales fit in 16 bits and every product in 32. */
+
+/* The vector paths load the 16 bit fields in place */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UNPACK_X86
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define UNPACK_NEON
+#endif
+#endif
+
+#define ALWAYS_INLINE				inline __attribute__((always_inline))
+
+typedef void (*unpack_fn)(const uint8_t raw[], int count, struct adxl345_soa * out);
+
+struct unpack_impl {
+	const char * name;
+	int (*supported)(void);
+	const unpack_fn * kernels;		// by scale index, see unpack_scale_index()
+};
+
+/* Scalar reference, records start to count */
+static ALWAYS_INLINE void unpack_records(const uint8_t raw[], int start, int count, struct adxl345_soa * out, int32_t scale) {
+	int i, axis;
+	int16_t value;
+
+	for (i = start; i < count; i++) {
+		for (axis = 0; axis < 3; axis++) {
+			value = (raw[i*6 + 2*axis + 1] << 8) | raw[i*6 + 2*axis];
+			out->lsb[axis][i] = value;
+			out->ug[axis][i] = value * scale;
+		}
+	}
+}
+
+static ALWAYS_INLINE void unpack_scalar(const uint8_t raw[], int count, struct adxl345_soa * out, int16_t scale) {
+	unpack_records(raw, 0, count, out, scale);
+}
+
+#ifdef UNPACK_X86
+/* pshufb masks moving the x, y and z words of three 16 byte loads a, b, c
+ * (x0 y0 z0 x1 y1 z1 x2 y2 | z2 x3 y3 z3 x4 y4 z4 x5 | y5 z5 x6 y6 z6 x7 y7 z7)
+ * to their lane of the axis vector, zeroing the rest */
+#define W(n)						2*(n), 2*(n) + 1
+#define Z							-1, -1
+static const int8_t deinterleave_masks[3][3][16] = {
+	{ { W(0), W(3), W(6), Z, Z, Z, Z, Z }, { Z, Z, Z, W(1), W(4), W(7), Z, Z }, { Z, Z, Z, Z, Z, Z, W(2), W(5) } },
+	{ { W(1), W(4), W(7), Z, Z, Z, Z, Z }, { Z, Z, Z, W(2), W(5), Z, Z, Z }, { Z, Z, Z, Z, Z, W(0), W(3), W(6) } },
+	{ { W(2), W(5), Z, Z, Z, Z, Z, Z }, { Z, Z, W(0), W(3), W(6), Z, Z, Z }, { Z, Z, Z, Z, Z, W(1), W(4), W(7) } }
+};
+#undef W
+#undef Z
+
+/* 8 records into x, y and z vectors of 8 int16 */
+static ALWAYS_INLINE __attribute__((target("ssse3"))) void deinterleave8(const uint8_t raw[], __m128i xyz[3]) {
+	__m128i a = _mm_loadu_si128((const __m128i *) raw);
+	__m128i b = _mm_loadu_si128((const __m128i *) (raw + 16));
+	__m128i c = _mm_loadu_si128((const __m128i *) (raw + 32));
+	int axis;
+
+	for (axis = 0; axis < 3; axis++) {
+		xyz[axis] = _mm_or_si128(
+			_mm_or_si128(_mm_shuffle_epi8(a, _mm_loadu_si128((const __m128i *) deinterleave_masks[axis][0])),
+				_mm_shuffle_epi8(b, _mm_loadu_si128((const __m128i *) deinterleave_masks[axis][1]))),
+			_mm_shuffle_epi8(c, _mm_loadu_si128((const __m128i *) deinterleave_masks[axis][2])));
+	}
+}
+
+/* 16x16 bit products widened by interleaving the low and high halves */
+static ALWAYS_INLINE __attribute__((target("ssse3"))) void unpack_ssse3(const uint8_t raw[], int count, struct adxl345_soa * out, int16_t scale) {
+	__m128i xyz[3], lo, hi, s = _mm_set1_epi16(scale);
+	int i, axis;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		deinterleave8(raw + i*6, xyz);
+		for (axis = 0; axis < 3; axis++) {
+			_mm_storeu_si128((__m128i *) (out->lsb[axis] + i), xyz[axis]);
+			lo = _mm_mullo_epi16(xyz[axis], s);
+			hi = _mm_mulhi_epi16(xyz[axis], s);
+			_mm_storeu_si128((__m128i *) (out->ug[axis] + i), _mm_unpacklo_epi16(lo, hi));
+			_mm_storeu_si128((__m128i *) (out->ug[axis] + i + 4), _mm_unpackhi_epi16(lo, hi));
+		}
+	}
+	unpack_records(raw, i, count, out, scale);
+}
+
+/* Sign extension and the multiply on all 8 records in one 256 bit register */
+static ALWAYS_INLINE __attribute__((target("avx2"))) void unpack_avx2(const uint8_t raw[], int count, struct adxl345_soa * out, int16_t scale) {
+	__m128i xyz[3];
+	__m256i s = _mm256_set1_epi32(scale);
+	int i, axis;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		deinterleave8(raw + i*6, xyz);
+		for (axis = 0; axis < 3; axis++) {
+			_mm_storeu_si128((__m128i *) (out->lsb[axis] + i), xyz[axis]);
+			_mm256_storeu_si256((__m256i *) (out->ug[axis] + i),
+				_mm256_mullo_epi32(_mm256_cvtepi16_epi32(xyz[axis]), s));
+		}
+	}
+	unpack_records(raw, i, count, out, scale);
+}
+
+static int ssse3_supported(void) {
+	return __builtin_cpu_supports("ssse3");
+}
+
+static int avx2_supported(void) {
+	return __builtin_cpu_supports("avx2");
+}
+#endif
+
+#ifdef UNPACK_NEON
+/* vld3 deinterleaves the 8 records by itself */
+static ALWAYS_INLINE void unpack_neon(const uint8_t raw[], int count, struct adxl345_soa * out, int16_t scale) {
+	int16x8x3_t xyz;
+	int i, axis;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		xyz = vld3q_s16((const int16_t *) (raw + i*6));
+		for (axis = 0; axis < 3; axis++) {
+			vst1q_s16(out->lsb[axis] + i, xyz.val[axis]);
+			vst1q_s32(out->ug[axis] + i, vmull_n_s16(vget_low_s16(xyz.val[axis]), scale));
+			vst1q_s32(out->ug[axis] + i + 4, vmull_n_s16(vget_high_s16(xyz.val[axis]), scale));
+		}
+	}
+	unpack_records(raw, i, count, out, scale);
+}
+#endif
+
+static int always_supported(void) {
+	return 1;
+}
+
+/* One kernel per scale with the scale folded in */
+#define UNPACK_KERNEL(impl, attr, scale) \
+	static attr void impl##_##scale(const uint8_t raw[], int count, struct adxl345_soa * out) { \
+		unpack_##impl(raw, count, out, scale); \
+	}
+#define UNPACK_KERNELS(impl, attr) \
+	UNPACK_KERNEL(impl, attr, 3900) \
+	UNPACK_KERNEL(impl, attr, 7800) \
+	UNPACK_KERNEL(impl, attr, 15600) \
+	UNPACK_KERNEL(impl, attr, 31200) \
+	static const unpack_fn impl##_kernels[4] = { impl##_3900, impl##_7800, impl##_15600, impl##_31200 };
+
+UNPACK_KERNELS(scalar, )
+#ifdef UNPACK_X86
+UNPACK_KERNELS(ssse3, __attribute__((target("ssse3"))))
+UNPACK_KERNELS(avx2, __attribute__((target("avx2"))))
+#endif
+#ifdef UNPACK_NEON
+UNPACK_KERNELS(neon, )
+#endif
+
+/* Best first */
+static const struct unpack_impl unpack_impls[] = {
+#ifdef UNPACK_NEON
+	{ "neon", always_supported, neon_kernels },
+#endif
+#ifdef UNPACK_X86
+	{ "avx2", avx2_supported, avx2_kernels },
+	{ "ssse3", ssse3_supported, ssse3_kernels },
+#endif
+	{ "scalar", always_supported, scalar_kernels },
+};
+
+static const struct unpack_impl * unpack_impl;
+
+/* 3900 << index ug per LSB, as ADXL345_Scale() */
+static int unpack_scale_index(uint8_t data_format) {
+	if (data_format & ADXL345_FULL_RES)
+		return 0;
+	return data_format & ADXL345_RANGE;
+}
+
+int ADXL345_Unpack_Select(const char * name) {
+	unsigned int i;
+
+	for (i = 0; i < sizeof(unpack_impls) / sizeof(unpack_impls[0]); i++) {
+		if (name && strcmp(name, unpack_impls[i].name))
+			continue;
+		if (unpack_impls[i].supported()) {
+			unpack_impl = &unpack_impls[i];
+			return 0;
+		}
+	}
+	return -1;
+}
+
+const char * ADXL345_Unpack_Name(void) {
+	if (!unpack_impl)
+		ADXL345_Unpack_Select(NULL);
+	return unpack_impl->name;
+}
+
+void ADXL345_Unpack(const uint8_t raw[], int count, uint8_t data_format, struct adxl345_soa * out) {
+	if (!unpack_impl)
+		ADXL345_Unpack_Select(NULL);
+	unpack_impl->kernels[unpack_scale_index(data_format)](raw, count, out);
+}
@@ -0,0 +1,29 @@
+/* Batch conversion of raw ADXL345 data records. A record is the six bytes
+ * DATAX0 through DATAZ1, little endian and already sign extended by the part
+ * in every DATA_FORMAT, as FIFO drains and snapshots read them back to back.
+ * One pass splits count records into per axis arrays of raw LSB and of
+ * acceleration in ug, i.e. mg in fixed point with three decimals, exact for
+ * every range and resolution (3.9 mg per LSB is 3900 ug, not 3 or 4 mg). */
+#ifndef ADXL345_UNPACK_H
+#define ADXL345_UNPACK_H
+
+#include <stdint.h>
+
+#define ADXL345_RECORD_SIZE			6
+
+/* Structure of arrays output, each array holds count entries */
+struct adxl345_soa {
+	int16_t * lsb[3];		// x, y, z raw LSB
+	int32_t * ug[3];		// x, y, z in ug
+};
+
+void ADXL345_Unpack(const uint8_t raw[], int count, uint8_t data_format, struct adxl345_soa * out);
+
+/* Implementations: "scalar" always, "ssse3" and "avx2" on x86, "neon" on ARM
+ * (built with -mfpu=neon). The best one the CPU supports is used unless
+ * another is selected; select returns -1 when the named one is not built in
+ * or not supported, NULL picks the best again. */
+int ADXL345_Unpack_Select(const char * name);
+const char * ADXL345_Unpack_Name(void);
+
+#endif
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "ADXL345.h"
+#include "ADXL345_unpack.h"
+
+/* Microbenchmark and bit-exact check of the record unpacking kernels.
+ * Usage: ADXL345_unpack_bench [-n records] [-i iterations] [-v]
+ *   -n   records per batch, default 32 (a full FIFO)
+ *   -i   batches per measurement, default 1000000
+ *   -v   verify instead: every kernel against the scalar reference on random
+ *        records, all batch sizes 0 to 64 and both buffer alignments, for
+ *        every DATA_FORMAT. Exits 1 on the first difference.
+ * The benchmark prints ns per record for every kernel the CPU supports and
+ * every scale. */
+
+#define VERIFY_MAX_RECORDS			64
+#define VERIFY_ROUNDS				200
+
+static const char * impl_names[] = { "scalar", "ssse3", "avx2", "neon" };
+static const uint8_t data_formats[] = { 0x00, 0x01, 0x02, 0x03, ADXL345_FULL_RES, ADXL345_FULL_RES | 0x03 };
+
+#define NUM_IMPLS					(sizeof(impl_names) / sizeof(impl_names[0]))
+#define NUM_FORMATS					(sizeof(data_formats) / sizeof(data_formats[0]))
+
+static int verify(void);
+static void bench(int records, unsigned long iterations);
+static void soa_init(struct adxl345_soa * soa, int16_t * lsb, int32_t * ug, int stride);
+static uint64_t now_ns(void);
+
+int main(int argc, char * argv[]) {
+
+	int opt, records = 32, check = 0;
+	unsigned long iterations = 1000000;
+
+	while ((opt = getopt(argc, argv, "n:i:v")) != -1) {
+		switch (opt) {
+		case 'n' :
+			records = atoi(optarg);
+			break;
+		case 'i' :
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'v' :
+			check = 1;
+			break;
+		default :
+			printf("Usage: %s [-n records] [-i iterations] [-v]\n", argv[0]);
+			return(-1);
+		}
+	}
+	if (records < 1 || iterations == 0) {
+		printf("ERROR: records and iterations > 0\n");
+		return(-1);
+	}
+
+	if (check)
+		return verify();
+	bench(records, iterations);
+	return 0;
+}
+
+/* Point the output at per axis arrays of stride entries */
+static void soa_init(struct adxl345_soa * soa, int16_t * lsb, int32_t * ug, int stride) {
+	int axis;
+
+	for (axis = 0; axis < 3; axis++) {
+		soa->lsb[axis] = lsb + axis * stride;
+		soa->ug[axis] = ug + axis * stride;
+	}
+}
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int verify(void) {
+	static uint8_t raw[VERIFY_MAX_RECORDS * ADXL345_RECORD_SIZE + 1];
+	static int16_t ref_lsb[3][VERIFY_MAX_RECORDS], out_lsb[3][VERIFY_MAX_RECORDS];
+	static int32_t ref_ug[3][VERIFY_MAX_RECORDS], out_ug[3][VERIFY_MAX_RECORDS];
+	struct adxl345_soa ref, out;
+	unsigned int impl, f, round, offset, checked;
+	int count, axis, i;
+
+	soa_init(&ref, ref_lsb[0], ref_ug[0], VERIFY_MAX_RECORDS);
+	soa_init(&out, out_lsb[0], out_ug[0], VERIFY_MAX_RECORDS);
+	srand(1);
+
+	for (impl = 0; impl < NUM_IMPLS; impl++) {
+		if (ADXL345_Unpack_Select(impl_names[impl]) < 0) {
+			printf("%-7s not supported\n", impl_names[impl]);
+			continue;
+		}
+		checked = 0;
+		for (round = 0; round < VERIFY_ROUNDS; round++) {
+			for (i = 0; i < (int) sizeof(raw); i++)
+				raw[i] = rand();
+			//Extremes of every field in the first records
+			if (round == 0) {
+				memset(raw, 0x80, 24);
+				memset(raw + 24, 0x7F, 24);
+			}
+			for (offset = 0; offset < 2; offset++) {
+				for (f = 0; f < NUM_FORMATS; f++) {
+					for (count = 0; count <= VERIFY_MAX_RECORDS; count++) {
+						ADXL345_Unpack_Select("scalar");
+						ADXL345_Unpack(raw + offset, count, data_formats[f], &ref);
+						ADXL345_Unpack_Select(impl_names[impl]);
+						memset(out_lsb, 0x55, sizeof(out_lsb));
+						memset(out_ug, 0x55, sizeof(out_ug));
+						ADXL345_Unpack(raw + offset, count, data_formats[f], &out);
+						for (axis = 0; axis < 3; axis++) {
+							for (i = 0; i < count; i++) {
+								if (out_lsb[axis][i] != ref_lsb[axis][i] || out_ug[axis][i] != ref_ug[axis][i]) {
+									printf("%-7s MISMATCH format %#x count %d offset %u axis %c record %d: %d %d, expected %d %d\n",
+										impl_names[impl], data_formats[f], count, offset, 'x' + axis, i,
+										out_lsb[axis][i], out_ug[axis][i], ref_lsb[axis][i], ref_ug[axis][i]);
+									return 1;
+								}
+							}
+						}
+						checked++;
+					}
+				}
+			}
+		}
+		printf("%-7s %u batches bit-exact\n", impl_names[impl], checked);
+	}
+	ADXL345_Unpack_Select(NULL);
+	return 0;
+}
+
+static void bench(int records, unsigned long iterations) {
+	uint8_t * raw;
+	int16_t * lsb;
+	int32_t * ug;
+	struct adxl345_soa out;
+	unsigned int impl, f;
+	unsigned long n;
+	uint64_t start, elapsed;
+	volatile int32_t sink = 0;
+	int i;
+
+	raw = malloc(records * ADXL345_RECORD_SIZE);
+	lsb = malloc(3 * records * sizeof(int16_t));
+	ug = malloc(3 * records * sizeof(int32_t));
+	if (!raw || !lsb || !ug) {
+		printf("ERROR: out of memory\n");
+		goto out;
+	}
+	for (i = 0; i < records * ADXL345_RECORD_SIZE; i++)
+		raw[i] = rand();
+	soa_init(&out, lsb, ug, records);
+
+	printf("%-7s %7s %7s %10s %12s\n", "kernel", "format", "records", "ns/record", "Mrecords/s");
+	for (impl = 0; impl < NUM_IMPLS; impl++) {
+		if (ADXL345_Unpack_Select(impl_names[impl]) < 0)
+			continue;
+		//One format per scale
+		for (f = 0; f < 4; f++) {
+			start = now_ns();
+			for (n = 0; n < iterations; n++) {
+				ADXL345_Unpack(raw, records, data_formats[f], &out);
+				sink += ug[n % (3 * records)];
+			}
+			elapsed = now_ns() - start;
+			printf("%-7s %#7x %7d %10.3f %12.1f\n", impl_names[impl], data_formats[f], records,
+				(double) elapsed / ((double) iterations * records),
+				(double) iterations * records * 1e3 / elapsed);
+		}
+	}
+	ADXL345_Unpack_Select(NULL);
+
+out:
+	free(raw);
+	free(lsb);
+	free(ug);
+}
@@ -1,43 +1,59 @@
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
-#include <fcntl.h>
-#include <sys/mman.h>
-#include "../address_map_arm.h"
 #include <stdint.h>
 #include <signal.h>
-
-
-#define ADXL345_DEVID				0x00
-#define ADXL345_BW_RATE				0x2C
-#define ADXL345_POWER_CTL			0x2D
-#define ADXL345_THRESH_ACT			0x24
-#define ADXL345_THRESH_INACT		0x25
-#define ADXL345_TIME_INACT			0x26
-#define ADXL345_ACT_INACT_CTL		0x27
-#define ADXL345_INT_ENABLE			0x2E
-#define ADXL345_INT_SOURCE			0x30
-#define ADXL345_DATA_FORMAT			0x31
-#define ADXL345_ACTIVITY			0x10
-#define ADXL345_DATAREADY 			0x80
-
-static unsigned int * i2c0_base_ptr, * sysmgr_base_ptr;
-static void * i2c0base_virtual, * sysmgrbase_virtual;
-static int fd_i2c0base = -1, fd_sysmgr = -1;
-
-int open_physical(int);
-void * map_physical (int, unsigned int, unsigned int);
-void close_physical(int);
-int unmap_physical(void *, unsigned int);
-void mux_init();
-int I2C0_Init();
-void ADXL345_REG_READ(uint8_t, uint8_t *);
-void ADXL345_REG_WRITE(uint8_t, uint8_t );
-void ADXL345_REG_MULTI_READ(uint8_t address, uint8_t values[], uint8_t len);
-void ADXL345_init();
-int ADXL345_IsDataReady();
-void ADXL345_XYZ_Read(int16_t *);
-void ADXL345_IdRead(uint8_t *pId);
-int I2C0_onoff(unsigned int onoff);
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "ADXL345_access.h"
+#include "ADXL345_analytics.h"
+#include "ADXL345_replay.h"
+
+
+/* Producer to consumer ring, one per consumer thread. Only the producer
+ * stores head and only the consumer stores tail. */
+#define RING_SIZE					4096	// power of 2
+#define NUM_CONSUMERS				3
+#define REPLAY_BATCH				64
+#define LOADTEST_STEP_NS			2000000000ULL
+#define LOADTEST_SPEED_MAX			4096	// then as fast as possible
+
+struct sample {
+	uint64_t timestamp;		// CLOCK_MONOTONIC, ns
+	uint32_t seq;
+	int16_t xyz[3];
+};
+
+struct spsc_ring {
+	uint32_t head __attribute__((aligned(64)));
+	uint32_t tail __attribute__((aligned(64)));
+	unsigned long long pushed, dropped;		// producer side
+	struct sample samples[RING_SIZE];
+};
+
+static struct adxl345_bus * bus = &devmem_bus;
+static struct spsc_ring rings[NUM_CONSUMERS];
+static uint32_t scale;		// ug per LSB of DATA_FORMAT
+static int quiet = 0;
+static struct adxl345_analytics_config vibration_cfg = { 64, 0, 0, 0 };
+static struct accel_source * replay = NULL;
+static struct accel_replay_config replay_cfg = { NULL, 0, 50, 500, 1, 1 };
+static int loadtest = 0;
+static FILE * out;			// sample lines and window summaries
+static const char * consumer_names[NUM_CONSUMERS] = { "printer", "analyzer", "vibration" };
+
+int ring_push(struct spsc_ring * ring, struct sample * sample);
+int ring_pop(struct spsc_ring * ring, struct sample * sample);
+void * producer(void * arg);
+void * replay_producer(void * arg);
+void * loadtest_producer(void * arg);
+void run(uint8_t data_format, uint8_t bw_rate, int producer_cpu, int consumer_cpu, int fifo_prio);
+void * printer(void * arg);
+void * analyzer(void * arg);
+void * vibration(void * arg);
+int start_thread(pthread_t * thread, void * (*fn)(void *), void * arg, int cpu, int fifo_prio);
 
 volatile sig_atomic_t stop;
 void catchSIGINT (int signum) {
@@ -45,266 +61,412 @@ void catchSIGINT (int signum) {
 	stop = 1;
 }
 
-int main(void) {
-
-	uint8_t devid = 0;
-	float mg_per_lsb = 3.2;
-	int16_t XYZ[3];
+/* Usage: ADXL345_user [-p cpu] [-c cpu] [-f prio] [-q] [-s] [-w size] [-o hop]
+ *                     [-r file|sine,noise,taps] [-x speed] [-n rate] [-m]
+ *   -p cpu   pin the producer to cpu
+ *   -c cpu   pin the consumers to cpu
+ *   -f prio  run the producer SCHED_FIFO at prio (1 to 99)
+ *   -q       do not print samples, only the window summaries and the
+ *            counters on Ctrl+C
+ *   -s       read the simulated register file instead of I2C0
+ *   -w size  vibration analytics window, a power of 2, default 64
+ *   -o hop   samples between windows, default half the window
+ *   -r       replay a recording of ADXL345_recorder, over and over, or a
+ *            synthetic signal (ADXL345_replay.h) instead of reading I2C0
+ *   -x speed replay speed, 1 (real time) by default, 0 as fast as possible
+ *   -n rate  BW_RATE code of the synthetic signal, default 13 (800 Hz)
+ *   -m       load test the consumers on the replay: the speed doubles
+ *            from real time every 2 s, then goes as fast as possible, and
+ *            each consumer's drops are reported along with the highest rate
+ *            it took without any. Output the consumers would print goes to
+ *            /dev/null. */
+int main(int argc, char * argv[]) {
+
+	uint8_t devid = 0, data_format, bw_rate;
+	int opt, rate = 13;
+	int producer_cpu = -1, consumer_cpu = -1, fifo_prio = 0;
 	stop = 0;
-
-	signal(SIGINT, catchSIGINT);
-	//Configure MUX to connect I2C0 controller to ADXL345
-	if ((fd_sysmgr = open_physical(fd_sysmgr)) == -1) {
-		return(-1);
+	out = stdout;
+
+	while ((opt = getopt(argc, argv, "p:c:f:qsw:o:r:x:n:m")) != -1) {
+		switch (opt) {
+		case 'p' :
+			producer_cpu = atoi(optarg);
+			break;
+		case 'c' :
+			consumer_cpu = atoi(optarg);
+			break;
+		case 'f' :
+			fifo_prio = atoi(optarg);
+			break;
+		case 'q' :
+			quiet = 1;
+			break;
+		case 's' :
+			bus = &sim_bus;
+			break;
+		case 'w' :
+			vibration_cfg.fft_size = atoi(optarg);
+			break;
+		case 'o' :
+			vibration_cfg.hop = atoi(optarg);
+			break;
+		case 'r' :
+			replay = &replay_source;
+			ADXL345_Replay_Parse(optarg, &replay_cfg);
+			break;
+		case 'x' :
+			replay_cfg.speed = atof(optarg);
+			break;
+		case 'n' :
+			rate = atoi(optarg);
+			break;
+		case 'm' :
+			loadtest = 1;
+			break;
+		default :
+			printf("Usage: %s [-p cpu] [-c cpu] [-f prio] [-q] [-s] [-w size] [-o hop]\n"
+				"       [-r file|sine,noise,taps] [-x speed] [-n rate] [-m]\n", argv[0]);
+			return(-1);
+		}
 	}
-
-	if ((sysmgrbase_virtual = map_physical(fd_sysmgr, SYSMGR_BASE, SYSMGR_SPAN)) == NULL) {
+	if (loadtest && replay == NULL) {
+		printf("ERROR: the load test needs a replay, -r\n");
 		return(-1);
 	}
 
-	sysmgr_base_ptr = (unsigned int *) sysmgrbase_virtual;
-
-	printf("%p\n", sysmgr_base_ptr);
-	printf("Starting mux_init()\n");
-	mux_init();
-	printf("Finished mux_init()\n");
-
-	if ((fd_i2c0base = open_physical(fd_i2c0base)) == -1) {
-		return(-1);
+	signal(SIGINT, catchSIGINT);
+	if (replay != NULL) {
+		ADXL345_Replay_Setup(&replay_cfg);
+		if (replay->open(replay) < 0)
+			return(-1);
+		if (replay->set_rate(replay, rate) < 0) {
+			printf("ERROR: rates are 0 to 15\n");
+			replay->close(replay);
+			return(-1);
+		}
+		if (loadtest && (out = fopen("/dev/null", "w")) == NULL) {
+			replay->close(replay);
+			return(-1);
+		}
+		ADXL345_Replay_Format(&data_format, &bw_rate);
+		run(data_format, bw_rate, producer_cpu, consumer_cpu, fifo_prio);
+		replay->close(replay);
+		if (out != stdout)
+			fclose(out);
+		return 0;
 	}
 
-	if ((i2c0base_virtual = map_physical(fd_i2c0base, I2C0_BASE, I2C0_SPAN)) == NULL) {
+	if (bus->open(bus) < 0) {
 		return(-1);
 	}
-
-	i2c0_base_ptr = (unsigned int *) i2c0base_virtual;
-	printf("Starting I2C0_Init()\n");
-	I2C0_Init();
 	printf("Getting ID\n");
-	ADXL345_IdRead(&devid);
+	ADXL345_IdRead(bus, &devid);
 	printf("%#x\n", devid);
-	if (devid == 0xE5) {
+	if (devid == ADXL345_ID) {
 		printf("Found ADXL345\n");
-		ADXL345_init();
-		while(!stop) {
-			if(ADXL345_IsDataReady()) {
-				ADXL345_XYZ_Read(XYZ);
-				printf("X=%d mg, Y=%d mg, Z=%d mg\n", XYZ[0]*mg_per_lsb,
-					XYZ[1]*mg_per_lsb, XYZ[2]*mg_per_lsb);
-			}
-		}
+		ADXL345_Init(bus);
+		bus->reg_read(bus, ADXL345_DATA_FORMAT, &data_format);
+		bus->reg_read(bus, ADXL345_BW_RATE, &bw_rate);
+		run(data_format, bw_rate, producer_cpu, consumer_cpu, fifo_prio);
 	}
 
 	//clean up
-	unmap_physical(i2c0base_virtual, I2C0_SPAN);
-	close_physical(fd_i2c0base);
-	unmap_physical(sysmgrbase_virtual, SYSMGR_SPAN);
-	close_physical(fd_sysmgr);
+	bus->close(bus);
 
 	return 0;
 }
 
-int open_physical(int fd) {
-	if (fd == -1) {
-		if ((fd = open("/dev/mem", (O_RDWR | O_SYNC))) == -1) {
-			printf("ERROR: could not open \"/dev/mem\"...\n");
-			return(-1);
-		}
-	}
+/* Consumers, then the producer of the sensor or of the replay, until Ctrl+C
+ * or the end of the replay */
+void run(uint8_t data_format, uint8_t bw_rate, int producer_cpu, int consumer_cpu, int fifo_prio) {
+	pthread_t producer_thread, consumer_threads[NUM_CONSUMERS];
+	void * (*consumers[NUM_CONSUMERS])(void *) = { printer, analyzer, vibration };
+	void * (*produce)(void *) = replay == NULL ? producer : loadtest ? loadtest_producer : replay_producer;
+	int i;
+
+	scale = ADXL345_Scale(data_format);
+	vibration_cfg.rate_hz = 3200.0 / (1 << (15 - (bw_rate & 0x0F)));
+	vibration_cfg.scale = scale;
+	if (!vibration_cfg.hop)
+		vibration_cfg.hop = vibration_cfg.fft_size / 2;
+
+	//Consumers first so the rings are drained from the first sample
+	for (i = 0; i < NUM_CONSUMERS; i++)
+		start_thread(&consumer_threads[i], consumers[i], &rings[i], consumer_cpu, 0);
+	if (start_thread(&producer_thread, produce, NULL, producer_cpu, fifo_prio) == 0)
+		pthread_join(producer_thread, NULL);
+	stop = 1;
+	for (i = 0; i < NUM_CONSUMERS; i++)
+		pthread_join(consumer_threads[i], NULL);
 
-	return fd;
+	for (i = 0; i < NUM_CONSUMERS; i++)
+		printf("consumer %d: %llu samples, %llu dropped\n", i, rings[i].pushed, rings[i].dropped);
 }
 
-void * map_physical(int fd, unsigned int base, unsigned int span) {
-	void * virtual_base;
-
-	// Get a mapping from physical addresses to virtual addresses
-	virtual_base = mmap(NULL, span, (PROT_READ | PROT_WRITE), MAP_SHARED, fd, base);
-	if (virtual_base == NULL) {
-		printf("ERROR: mmap() failed...\n");
-		close(fd);
-		return(NULL);
+/* Start fn on its own thread, pinned to cpu unless it is -1, and SCHED_FIFO
+ * at fifo_prio unless it is 0. Returns 0 or the pthread error. */
+int start_thread(pthread_t * thread, void * (*fn)(void *), void * arg, int cpu, int fifo_prio) {
+	pthread_attr_t attr;
+	struct sched_param param;
+	cpu_set_t cpus;
+	int err;
+
+	pthread_attr_init(&attr);
+	if (cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
 	}
-
-	return virtual_base;
-}
-
-int unmap_physical(void * virtual_base, unsigned int span)
-{
-   if (munmap (virtual_base, span) != 0)
-   {
-      printf ("ERROR: munmap() failed...\n");
-      return (-1);
-   }
-   return 0;
-}
-
-void close_physical (int fd) {
-	close(fd);
-}
-
-/* Set mux to connect ADXL345 to I2C0 Controller */
-void mux_init() {
-
-	volatile unsigned int *gpio7_ptr, *gpio8_ptr, *i2c0fpga_ptr; //Mux pointer
-
-	gpio7_ptr = sysmgr_base_ptr + SYSMGR_GENERALIO7;
-	gpio8_ptr = sysmgr_base_ptr + SYSMGR_GENERALIO8;
-	i2c0fpga_ptr =  sysmgr_base_ptr + SYSMGR_I2C0USEFPGA;
-
-	*i2c0fpga_ptr = 0;
-	*gpio7_ptr = 1;
-	*gpio8_ptr = 1;
-	printf("gio7: %#x\ngio8: %#x\ni2c0fpga: %#x\n", *gpio7_ptr, *gpio8_ptr, *i2c0fpga_ptr);
-}
-
-/* Enabling I2C0 with polling */
-int I2C0_onoff(unsigned int onoff) {
-	int ti2c_poll = 2500;
-	int MAX_T_POLL_COUNT = 100;
-	int poll_count = 0;
-
-	int good = 0;
-	*(i2c0_base_ptr + I2C0_ENABLE) = onoff;
-
-	while (((*(i2c0_base_ptr + I2C0_ENABLE_STATUS) & 0x1) == (onoff - 1)) & (poll_count < MAX_T_POLL_COUNT)) {
-		poll_count++;
-		usleep(ti2c_poll);
-		*(i2c0_base_ptr + I2C0_ENABLE) = onoff;
+	if (fifo_prio > 0) {
+		param.sched_priority = fifo_prio;
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		pthread_attr_setschedparam(&attr, &param);
 	}
-	if (poll_count < 10)
-		good = 1;
 
-	return good;
+	err = pthread_create(thread, &attr, fn, arg);
+	pthread_attr_destroy(&attr);
+	if (err)
+		printf("ERROR: pthread_create() failed %d, SCHED_FIFO needs root\n", err);
+	return err;
 }
 
-int I2C0_Init() {
-
-	//Abort tranmission and disable Controller for config
-	printf("%d\n%d\n", I2C0_TAR, I2C0_FS_SCL_HCNT * 1);
-	printf("%p\n%p\n", i2c0_base_ptr,  i2c0_base_ptr + (I2C0_FS_SCL_HCNT * 1));
-	*(i2c0_base_ptr + I2C0_ENABLE) = 0x2;
-	//Wait for disable status
+/* Producer side, never blocks: a full ring drops the new sample */
+int ring_push(struct spsc_ring * ring, struct sample * sample) {
+	uint32_t head = ring->head;
 
-	if (!(I2C0_onoff(2))) {
-		printf("Unable to disable\n");
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == RING_SIZE) {
+		ring->dropped++;
 		return 0;
 	}
-	printf("Configuring\n");
-
-	// 7-Bit addressing, FastMode (400kb/s), Master Mode
-	*(i2c0_base_ptr + I2C0_CON) = 0x65;
-
-	//Set target address to be ADXL345 devid 0x53 and 7bit addressing
-	*(i2c0_base_ptr + I2C0_TAR) = 0x53;
+	ring->samples[head & (RING_SIZE - 1)] = *sample;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	ring->pushed++;
+	return 1;
+}
 
-	//Minimum period is to be 2.5us but minimum high period is 0.6us
-	//and minimum low period is 1.3us so 0.3us is added to both.
-	*(i2c0_base_ptr + I2C0_FS_SCL_HCNT) = 60 + 30;
-	*(i2c0_base_ptr + I2C0_FS_SCL_LCNT) = 130 + 30;
+/* Consumer side, returns 0 when the ring is empty */
+int ring_pop(struct spsc_ring * ring, struct sample * sample) {
+	uint32_t tail = ring->tail;
 
-	//Enable the controller
-	printf("Renabling controller\n");
-	if (!(I2C0_onoff(1))) {
-		printf("Unable to enable\n");
+	if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
 		return 0;
-	}
-	printf("ic_tar: %#x\nic_con: %#x\n", *(i2c0_base_ptr + I2C0_TAR), *(i2c0_base_ptr + I2C0_CON));
+	*sample = ring->samples[tail & (RING_SIZE - 1)];
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
 	return 1;
 }
 
-/* Single Byte Read */
-void ADXL345_REG_READ(uint8_t address, uint8_t * value) {
-
-	//Send address and start signal
-	*(i2c0_base_ptr + I2C0_DATA_CMD) = address + 0x400;
-
-	//send read signal
-	*(i2c0_base_ptr + I2C0_DATA_CMD) = 0x100;
-
-	//wait for response
-
-	while(*(i2c0_base_ptr + I2C0_RXFLR) == 0) {
-		continue;
+/* Register I/O only: poll the sensor and hand every sample to each ring */
+void * producer(void * arg) {
+	struct sample sample;
+	uint8_t source;
+	int i;
+
+	sample.seq = 0;
+	while (!stop) {
+		if (ADXL345_Snapshot(bus, &source, sample.xyz)) {
+			sample.timestamp = accel_now_ns();
+			for (i = 0; i < NUM_CONSUMERS; i++)
+				ring_push(&rings[i], &sample);
+			sample.seq++;
+		}
 	}
-	*value = *(i2c0_base_ptr + I2C0_DATA_CMD) & 0xFF;
-}
-
-/* Single byte Write */
-void ADXL345_REG_WRITE(uint8_t address, uint8_t value) {
-
-	*(i2c0_base_ptr + I2C0_DATA_CMD) = address + 0x400;
-	*(i2c0_base_ptr + I2C0_DATA_CMD) = value;
+	return NULL;
 }
 
-/* Multiple Byte Write */
-void ADXL345_REG_MULTI_READ(uint8_t address, uint8_t values[], uint8_t len) {
-
-	int i = 0;
-	int nth_byte = 0;
-	*(i2c0_base_ptr + I2C0_DATA_CMD) = address + 0x400;
-
-	//send read signal multiple times to prevent overwritten data at 
-	//inconsistent times
-
-	for(i = 0; i < len; i++)
-		*(i2c0_base_ptr + I2C0_DATA_CMD) = 0x100;
-
-	while(len) {
-		if (*(i2c0_base_ptr + I2C0_RXFLR) > 0) {
-			values[nth_byte] = *(i2c0_base_ptr + I2C0_DATA_CMD) & 0xFF;
-			nth_byte++;
-			len--;
+/* Replayed samples to every ring, at the pace of the replay */
+void * replay_producer(void * arg) {
+	struct accel_sample samples[REPLAY_BATCH];
+	struct sample sample;
+	int n, i, k;
+
+	while (!stop) {
+		if ((n = replay->read(replay, samples, REPLAY_BATCH, accel_now_ns() + 100000000)) < 0)
+			break;
+		for (k = 0; k < n; k++) {
+			sample.timestamp = samples[k].timestamp;
+			sample.seq = samples[k].seq;
+			sample.xyz[0] = samples[k].x;
+			sample.xyz[1] = samples[k].y;
+			sample.xyz[2] = samples[k].z;
+			for (i = 0; i < NUM_CONSUMERS; i++)
+				ring_push(&rings[i], &sample);
 		}
 	}
+	return NULL;
 }
 
-void ADXL345_init() {
-
-	uint8_t data_format = 0x03;
-	uint8_t bw_rate = 0x07;
-
-	//+-16 range, 10 bits
-	ADXL345_REG_WRITE(ADXL345_DATA_FORMAT, data_format);
-	ADXL345_REG_WRITE(ADXL345_BW_RATE, bw_rate);
-
-	//Using threshold for new data
-	ADXL345_REG_WRITE(ADXL345_THRESH_ACT, 0x04);
-	ADXL345_REG_WRITE(ADXL345_THRESH_INACT, 0x02);
-	ADXL345_REG_WRITE(ADXL345_TIME_INACT, 0x02);
-	ADXL345_REG_WRITE(ADXL345_ACT_INACT_CTL, 0xFF);
-	ADXL345_REG_WRITE(ADXL345_INT_ENABLE, 0x18);
+/* Replay at doubling speeds, LOADTEST_STEP_NS each, and report the drops of
+ * every consumer per step. A consumer sustains the highest rate of a step
+ * it went through without a drop. */
+void * loadtest_producer(void * arg) {
+	struct accel_sample samples[REPLAY_BATCH];
+	struct sample sample;
+	unsigned long long before[NUM_CONSUMERS], offered;
+	double speed, rate, sustained[NUM_CONSUMERS] = { 0 }, limit = 0;
+	int dropping[NUM_CONSUMERS] = { 0 }, all, n, i, k;
+	uint64_t start, end;
+	struct timespec idle = { 0, 1000000 };
+
+	printf("%10s %12s", "speed", "samples/s");
+	for (i = 0; i < NUM_CONSUMERS; i++)
+		printf(" %10s", consumer_names[i]);
+	printf("\n");
+
+	for (speed = 1; !stop; speed *= 2) {
+		ADXL345_Replay_Speed(speed > LOADTEST_SPEED_MAX ? 0 : speed);
+		for (i = 0; i < NUM_CONSUMERS; i++)
+			before[i] = rings[i].dropped;
+		offered = 0;
+		start = accel_now_ns();
+		end = start + LOADTEST_STEP_NS;
+		while (!stop && accel_now_ns() < end) {
+			if ((n = replay->read(replay, samples, REPLAY_BATCH, end)) < 0) {
+				stop = 1;
+				break;
+			}
+			for (k = 0; k < n; k++) {
+				sample.timestamp = samples[k].timestamp;
+				sample.seq = samples[k].seq;
+				sample.xyz[0] = samples[k].x;
+				sample.xyz[1] = samples[k].y;
+				sample.xyz[2] = samples[k].z;
+				for (i = 0; i < NUM_CONSUMERS; i++)
+					ring_push(&rings[i], &sample);
+			}
+			offered += n;
+		}
+		rate = offered * 1e9 / (accel_now_ns() - start);
+
+		if (speed > LOADTEST_SPEED_MAX)
+			printf("%10s %12.0f", "max", rate);
+		else
+			printf("%10.0f %12.0f", speed, rate);
+		all = 1;
+		for (i = 0; i < NUM_CONSUMERS; i++) {
+			printf(" %10llu", rings[i].dropped - before[i]);
+			if (rings[i].dropped != before[i])
+				dropping[i] = 1;
+			else if (!dropping[i] && rate > sustained[i])
+				sustained[i] = rate;
+			all &= dropping[i];
+		}
+		printf("\n");
+		if (rate > limit)
+			limit = rate;
+
+		//Let the consumers catch up before the next step
+		for (i = 0; i < NUM_CONSUMERS && !stop; ) {
+			if (__atomic_load_n(&rings[i].tail, __ATOMIC_ACQUIRE) == rings[i].head)
+				i++;
+			else
+				nanosleep(&idle, NULL);
+		}
+		if (all || speed > LOADTEST_SPEED_MAX)
+			break;
+	}
 
-	//Reset Measurement config
-	ADXL345_REG_WRITE(ADXL345_POWER_CTL, 0x00); //standby
-	ADXL345_REG_WRITE(ADXL345_POWER_CTL, 0x08);	
+	for (i = 0; i < NUM_CONSUMERS; i++) {
+		if (!dropping[i])
+			printf("%s: no drops up to %.0f samples/s, the most the replay offered\n", consumer_names[i], limit);
+		else if (sustained[i] > 0)
+			printf("%s: sustains %.0f samples/s, drops above\n", consumer_names[i], sustained[i]);
+		else
+			printf("%s: drops even in real time\n", consumer_names[i]);
+	}
+	return NULL;
 }
 
-int ADXL345_IsDataReady() {
-	int bReady = 0;
-	uint8_t data8;
+/* Formatting and logging, as the single loop used to do */
+void * printer(void * arg) {
+	struct spsc_ring * ring = arg;
+	struct sample sample;
+	struct timespec idle = { 0, 1000000 };
 
-	ADXL345_REG_READ(ADXL345_INT_SOURCE, &data8);
-	if (data8 & ADXL345_ACTIVITY) {
-		ADXL345_REG_READ(ADXL345_INT_SOURCE, &data8);
-		if (data8 & ADXL345_DATAREADY) {
-			bReady = 1;
+	while (!stop) {
+		if (!ring_pop(ring, &sample)) {
+			nanosleep(&idle, NULL);
+			continue;
 		}
+		if (!quiet)
+			fprintf(out, "X=%.1f mg, Y=%.1f mg, Z=%.1f mg\n", sample.xyz[0] * (int32_t) scale / 1000.0,
+				sample.xyz[1] * (int32_t) scale / 1000.0, sample.xyz[2] * (int32_t) scale / 1000.0);
 	}
-	return bReady;
+	return NULL;
 }
 
-//Read acceleration data of all three axes
-
-void ADXL345_XYZ_Read(int16_t szData16[3]) {
-	uint8_t szData8[6];
-	ADXL345_REG_MULTI_READ(0x32, (uint8_t *) &szData8, sizeof(szData8));
+/* Running per axis mean and extremes, and samples lost between producer
+ * reads, printed on exit */
+void * analyzer(void * arg) {
+	struct spsc_ring * ring = arg;
+	struct sample sample;
+	struct timespec idle = { 0, 1000000 };
+	long long sum[3] = { 0, 0, 0 };
+	int min[3] = { 32767, 32767, 32767 }, max[3] = { -32768, -32768, -32768 };
+	unsigned long long count = 0, gaps = 0;
+	uint32_t next = 0;
+	int i;
+
+	while (!stop) {
+		if (!ring_pop(ring, &sample)) {
+			nanosleep(&idle, NULL);
+			continue;
+		}
+		if (count && sample.seq != next)
+			gaps += sample.seq - next;
+		next = sample.seq + 1;
+		for (i = 0; i < 3; i++) {
+			sum[i] += sample.xyz[i];
+			if (sample.xyz[i] < min[i])
+				min[i] = sample.xyz[i];
+			if (sample.xyz[i] > max[i])
+				max[i] = sample.xyz[i];
+		}
+		count++;
+	}
 
-	szData16[0] = (szData8[1] << 8) | szData8[0];
-	szData16[1] = (szData8[3] << 8) | szData8[2];
-	szData16[2] = (szData8[5] << 8) | szData8[4];
+	if (count) {
+		for (i = 0; i < 3; i++)
+			printf("%c: mean %.1f mg, min %.1f mg, max %.1f mg\n", 'X' + i, sum[i] * (int32_t) scale / 1000.0 / count,
+				min[i] * (int32_t) scale / 1000.0, max[i] * (int32_t) scale / 1000.0);
+	}
+	printf("analyzer: %llu samples, %llu missed\n", count, gaps);
+	return NULL;
 }
 
-void ADXL345_IdRead(uint8_t *pId) {
-	ADXL345_REG_READ(ADXL345_DEVID, pId);
+/* Vibration analytics, one summary line per window: RMS, peak, crest factor
+ * and the strongest line with its amplitude, per axis */
+void * vibration(void * arg) {
+	struct spsc_ring * ring = arg;
+	struct sample sample;
+	struct timespec idle = { 0, 1000000 };
+	struct adxl345_analytics * analytics = ADXL345_Analytics_Create(&vibration_cfg);
+	struct adxl345_window window;
+	char line[256];
+
+	if (analytics == NULL) {
+		printf("ERROR: analytics window %d, hop %d: the window is a power of 2 from %d to %d, the hop at most the window\n",
+			vibration_cfg.fft_size, vibration_cfg.hop, ANALYTICS_FFT_MIN, ANALYTICS_FFT_MAX);
+		//Keep draining so the producer's counters stay meaningful
+		while (!stop) {
+			if (!ring_pop(ring, &sample))
+				nanosleep(&idle, NULL);
+		}
+		return NULL;
+	}
+
+	fprintf(out, "window seq t_ms | axis rms_mg peak_mg crest freq_hz amplitude_mg\n");
+	while (!stop) {
+		if (!ring_pop(ring, &sample)) {
+			nanosleep(&idle, NULL);
+			continue;
+		}
+		if (ADXL345_Analytics_Push(analytics, sample.timestamp, sample.xyz, &window)) {
+			ADXL345_Analytics_Format(&window, line, sizeof(line));
+			fputs(line, out);
+		}
+	}
+	ADXL345_Analytics_Destroy(analytics);
+	return NULL;
 }
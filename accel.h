@@ -0,0 +1,162 @@
+/* Userspace interface of the /dev/accel ADXL345 driver */
+#ifndef ACCEL_H
+#define ACCEL_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* Binary read mode, selected per open file by writing "mode binary".
+ * read() returns as many whole records as fit in the user buffer. */
+struct accel_sample {
+	__u64 timestamp;		// CLOCK_MONOTONIC, ns
+	__u32 seq;				// increments once per sample read from the sensor
+	__s16 x, y, z;			// raw LSB
+	__u16 flags;			// ACCEL_FLAG_*
+	__u32 scale;			// ug per LSB
+};
+
+#define ACCEL_FLAG_NEW			0x0001	// sample not returned to this reader before
+#define ACCEL_FLAG_FULL_RES		0x0002	// 13 bit full resolution, else 10 bit
+#define ACCEL_FLAG_SINGLE_TAP	0x0004
+#define ACCEL_FLAG_DOUBLE_TAP	0x0008
+#define ACCEL_FLAG_ACTIVITY		0x0010
+#define ACCEL_FLAG_INACTIVITY	0x0020
+#define ACCEL_FLAG_OVERRUN		0x0040	// this reader dropped samples before this one
+#define ACCEL_FLAG_CALIBRATING	0x0080	// taken during a calibration, before its offsets were applied
+#define ACCEL_FLAG_FILTERED		0x0100	// decimated or low-pass filtered for this reader
+#define ACCEL_FLAG_FREE_FALL	0x0200
+
+/* Event mode, selected per open file by writing "mode events": read() returns
+ * whole struct accel_event records and blocks until one is queued, and the
+ * file receives no samples. One record per interrupt source seen, so a
+ * double tap comes with the single tap the ADXL345 also reports. */
+struct accel_event {
+	__u64 timestamp;		// CLOCK_MONOTONIC ns of the newest sample read with the event
+	__u32 seq;				// that sample's sequence number
+	__u16 type;				// one ACCEL_INT_* source
+	__u8 status;			// ACT_TAP_STATUS, ACCEL_EVENT_*
+	__u8 reserved;
+};
+
+/* ACT_TAP_STATUS: the axes that triggered activity and the first tap */
+#define ACCEL_EVENT_ACT_X		0x40
+#define ACCEL_EVENT_ACT_Y		0x20
+#define ACCEL_EVENT_ACT_Z		0x10
+#define ACCEL_EVENT_ASLEEP		0x08
+#define ACCEL_EVENT_TAP_X		0x04
+#define ACCEL_EVENT_TAP_Y		0x02
+#define ACCEL_EVENT_TAP_Z		0x01
+
+/* mmap() of /dev/accel maps a control page followed by a ring of
+ * struct accel_sample records written by the driver. The driver only ever
+ * writes head; tail is stored by the consumer so poll() on the mapping file
+ * descriptor can report POLLIN while tail != head. With a single tail the
+ * ring has one consumer: one open file maps it at a time, mmap() of another
+ * returns EBUSY until every mapping of the first is gone.
+ * The driver writes up to ACCEL_MMAP_BATCH records before it moves head, so
+ * a record may be overwritten as soon as head - tail > records -
+ * ACCEL_MMAP_BATCH, not only once the ring is lapped. */
+#define ACCEL_MMAP_BATCH		32
+struct accel_mmap_ctl {
+	__u32 head;				// records written since load, index is head & (records - 1)
+	__u32 tail;				// consumer position
+	__u32 records;			// ring size, a power of 2
+	__u32 record_size;		// sizeof(struct accel_sample)
+	__u32 offset;			// byte offset of the first record from the mapping
+};
+
+/* ADXL345 offset registers, 15.6 mg per LSB */
+struct accel_offsets {
+	__s8 x, y, z;
+	__u8 reserved;
+};
+
+/* Whole sensor configuration, written in one go by ACCEL_IOC_SET_CONFIG */
+struct accel_config {
+	__u32 rate;				// BW_RATE code, 0 (0.098 Hz) to 15 (3200 Hz)
+	__u32 range;			// 2, 4, 8 or 16 g
+	__u32 full_res;			// 1 for 13 bit full resolution, 0 for 10 bit
+	__u32 fifo_watermark;	// 1 to 31 streams through the FIFO, 0 bypasses it
+	__u32 int_mask;			// ACCEL_INT_* sources routed to INT1
+	struct accel_offsets offsets;
+};
+
+/* Background calibration with the board flat, Z up: samples are collected
+ * from FIFO bursts at 800 Hz while reads go on, outliers are rejected and
+ * the offset registers are corrected so the mean reads 0, 0, +1 g. */
+struct accel_calibration {
+	__u32 state;			// ACCEL_CAL_*
+	__u32 collected;		// samples collected so far
+	__u32 used;				// samples averaged after outlier rejection
+	__s32 mean[3];			// x, y, z mean of those samples in ug
+	struct accel_offsets before, after;
+};
+
+#define ACCEL_CAL_IDLE			0
+#define ACCEL_CAL_RUNNING		1
+#define ACCEL_CAL_DONE			2
+#define ACCEL_CAL_FAILED		3	// too many outliers, or sampling stopped
+
+/* Tap, activity and free-fall detection, the raw ADXL345 registers written
+ * in one go by ACCEL_IOC_SET_EVENT_CONFIG */
+struct accel_event_config {
+	__u8 thresh_tap;		// 62.5 mg per LSB
+	__u8 dur;				// 625 us per LSB, longest tap
+	__u8 latent;			// 1.25 ms per LSB, from a tap to the double tap window
+	__u8 window;			// 1.25 ms per LSB, double tap window, 0 disables double taps
+	__u8 thresh_act;		// 62.5 mg per LSB
+	__u8 thresh_inact;		// 62.5 mg per LSB
+	__u8 time_inact;		// 1 s per LSB
+	__u8 act_inact_ctl;		// ac/dc coupling and axes of activity and inactivity
+	__u8 thresh_ff;			// 62.5 mg per LSB, every axis below it is free-fall
+	__u8 time_ff;			// 5 ms per LSB
+	__u8 tap_axes;			// TAP_EN: suppress and x/y/z
+	__u8 reserved;
+};
+
+/* Interrupt sources selectable with ACCEL_IOC_SET_INT_MASK. Data ready or the
+ * FIFO watermark is added by the driver as the sampling path needs it. */
+#define ACCEL_INT_SINGLE_TAP	0x40
+#define ACCEL_INT_DOUBLE_TAP	0x20
+#define ACCEL_INT_ACTIVITY		0x10
+#define ACCEL_INT_INACTIVITY	0x08
+#define ACCEL_INT_FREE_FALL		0x04
+#define ACCEL_INT_MASK			0x7C
+
+#define ACCEL_IOC_MAGIC			'x'
+#define ACCEL_IOC_GET_DEVID			_IOR(ACCEL_IOC_MAGIC, 0, __u32)
+#define ACCEL_IOC_SET_RATE			_IOW(ACCEL_IOC_MAGIC, 1, __u32)
+#define ACCEL_IOC_GET_RATE			_IOR(ACCEL_IOC_MAGIC, 2, __u32)
+#define ACCEL_IOC_SET_RANGE			_IOW(ACCEL_IOC_MAGIC, 3, __u32)
+#define ACCEL_IOC_GET_RANGE			_IOR(ACCEL_IOC_MAGIC, 4, __u32)
+#define ACCEL_IOC_SET_RESOLUTION	_IOW(ACCEL_IOC_MAGIC, 5, __u32)
+#define ACCEL_IOC_GET_RESOLUTION	_IOR(ACCEL_IOC_MAGIC, 6, __u32)
+#define ACCEL_IOC_SET_OFFSETS		_IOW(ACCEL_IOC_MAGIC, 7, struct accel_offsets)
+#define ACCEL_IOC_GET_OFFSETS		_IOR(ACCEL_IOC_MAGIC, 8, struct accel_offsets)
+#define ACCEL_IOC_SET_FIFO			_IOW(ACCEL_IOC_MAGIC, 9, __u32)
+#define ACCEL_IOC_GET_FIFO			_IOR(ACCEL_IOC_MAGIC, 10, __u32)
+#define ACCEL_IOC_SET_INT_MASK		_IOW(ACCEL_IOC_MAGIC, 11, __u32)
+#define ACCEL_IOC_GET_INT_MASK		_IOR(ACCEL_IOC_MAGIC, 12, __u32)
+#define ACCEL_IOC_SET_CONFIG		_IOW(ACCEL_IOC_MAGIC, 13, struct accel_config)
+#define ACCEL_IOC_GET_CONFIG		_IOR(ACCEL_IOC_MAGIC, 14, struct accel_config)
+#define ACCEL_IOC_CALIBRATE			_IO(ACCEL_IOC_MAGIC, 18)
+#define ACCEL_IOC_GET_CALIBRATION	_IOR(ACCEL_IOC_MAGIC, 19, struct accel_calibration)
+#define ACCEL_IOC_SET_EVENT_CONFIG	_IOW(ACCEL_IOC_MAGIC, 23, struct accel_event_config)
+#define ACCEL_IOC_GET_EVENT_CONFIG	_IOR(ACCEL_IOC_MAGIC, 24, struct accel_event_config)
+/* Per open file */
+#define ACCEL_IOC_SET_BINARY		_IOW(ACCEL_IOC_MAGIC, 15, __u32)
+#define ACCEL_IOC_SET_DEPTH			_IOW(ACCEL_IOC_MAGIC, 16, __u32)
+#define ACCEL_IOC_GET_OVERRUNS		_IOR(ACCEL_IOC_MAGIC, 17, __u32)
+#define ACCEL_IOC_SET_OUTPUT_RATE	_IOW(ACCEL_IOC_MAGIC, 20, __u32)
+#define ACCEL_IOC_SET_LOWPASS		_IOW(ACCEL_IOC_MAGIC, 21, __u32)
+#define ACCEL_IOC_SET_EVENTS		_IOW(ACCEL_IOC_MAGIC, 22, __u32)
+
+/* ACCEL_IOC_SET_OUTPUT_RATE takes a BW_RATE code: the reader gets the sensor
+ * rate decimated by 2 for every step it is below the sensor's, and every
+ * sample at or above it. ACCEL_IOC_SET_LOWPASS takes a shift N of 0 (off)
+ * to ACCEL_LOWPASS_MAX for a single pole low-pass on the reader's samples,
+ * y += (x - y) / 2^N, a cutoff of about output rate / (2 pi 2^N). */
+#define ACCEL_OUTPUT_FULL		16
+#define ACCEL_LOWPASS_MAX		8
+
+#endif
@@ -46,10 +46,18 @@
 #define I2C0_DATA_CMD          0x00000004      // word offset
 #define I2C0_FS_SCL_HCNT       0x00000007      // word offset
 #define I2C0_FS_SCL_LCNT       0x00000008      // word offset
+#define I2C0_INTR_STAT         0x0000000B      // word offset
+#define I2C0_INTR_MASK         0x0000000C      // word offset
+#define I2C0_RAW_INTR_STAT     0x0000000D      // word offset
+#define I2C0_RX_TL             0x0000000E      // word offset
+#define I2C0_TX_TL             0x0000000F      // word offset
 #define I2C0_CLR_INTR          0x00000010      // word offset
+#define I2C0_CLR_TX_ABRT       0x00000015      // word offset
+#define I2C0_CLR_STOP_DET      0x00000018      // word offset
 #define I2C0_ENABLE            0x0000001B      // word offset
 #define I2C0_TXFLR             0x0000001D      // word offset
 #define I2C0_RXFLR             0x0000001E      // word offset
+#define I2C0_TX_ABRT_SOURCE    0x00000020      // word offset
 #define I2C0_ENABLE_STATUS     0x00000027      // word offset
 #define I2C0_SPAN              0x00000100      // span
 
@@ -58,6 +66,13 @@
 #define HPS_GPIO0_BASE         0x00008000   // word offset
 #define HPS_GPIO1_BASE         0x00009000
 #define HPS_GPIO2_BASE         0x0000A000
+#define HPS_GPIO_INTEN         0x0000000C   // word offset
+#define HPS_GPIO_INTMASK       0x0000000D   // word offset
+#define HPS_GPIO_INTTYPE_LEVEL 0x0000000E   // word offset
+#define HPS_GPIO_INT_POLARITY  0x0000000F   // word offset
+#define HPS_GPIO_INTSTATUS     0x00000010   // word offset
+#define HPS_GPIO_PORTA_EOI     0x00000013   // word offset
+#define HPS_GPIO_SPAN          0x00000080   // span
 #define I2C1_BASE              0x00505000
 #define I2C2_BASE              0x00506000
 #define I2C3_BASE              0x00507000
@@ -75,8 +90,15 @@
 #define CLK_MGR                0xFFD04000
 
 #define SPIM0_BASE             0xFFF00000   // base
-#define SPIM0_SR               0x00000028   // word offset
-#define SPIM0_DR               0x00000060
+#define SPIM0_CTRLR0           0x00000000   // byte offset
+#define SPIM0_SSIENR           0x00000008   // byte offset
+#define SPIM0_SER              0x00000010   // byte offset
+#define SPIM0_BAUDR            0x00000014   // byte offset
+#define SPIM0_TXFLR            0x00000020   // byte offset
+#define SPIM0_RXFLR            0x00000024   // byte offset
+#define SPIM0_SR               0x00000028   // byte offset
+#define SPIM0_IMR              0x0000002C   // byte offset
+#define SPIM0_DR               0x00000060   // byte offset
 #define SPIM0_SPAN             0x00000100   // span
 
 